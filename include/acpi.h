@@ -0,0 +1,20 @@
+#ifndef _MYOS_ACPI_H
+#define _MYOS_ACPI_H
+
+#include <stdint.h>
+
+typedef struct acpi_header {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_header_t;
+
+const acpi_header_t *acpi_find_table(const char *signature);
+
+#endif /* _MYOS_ACPI_H */
@@ -0,0 +1,39 @@
+#ifndef _MYOS_AHCI_H
+#define _MYOS_AHCI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define AHCI_MAX_PORTS 4
+#define AHCI_MAX_SLOTS 32
+
+/* Commands completed (and of those, NCQ ones), failed commands with the
+ * port restarts they caused, and the most commands seen in flight. */
+typedef struct ahci_stats {
+    uint64_t commands;
+    uint64_t ncq_commands;
+    uint64_t errors;
+    uint64_t restarts;
+    uint32_t max_active;
+} ahci_stats_t;
+
+typedef struct ahci_port_info {
+    const char *name;
+    const char *model;
+    uint64_t sectors;
+    uint32_t queue_depth; /* 1 without NCQ */
+    int lba48;
+    int fua;
+} ahci_port_info_t;
+
+void ahci_init(void);
+int ahci_is_available(void);
+size_t ahci_port_count(void);
+int ahci_get_port_info(size_t index, ahci_port_info_t *info);
+int ahci_ncq_enabled(void);
+int ahci_set_ncq(int enabled);
+uint32_t ahci_queue_limit(void);
+void ahci_set_queue_limit(uint32_t depth);
+void ahci_get_stats(ahci_stats_t *stats);
+
+#endif /* _MYOS_AHCI_H */
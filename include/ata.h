@@ -4,10 +4,52 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/* Commands completed in each mode, PIO data blocks (one DRQ handshake
+ * each), interrupts and timed-out requests, and TSC cycles spent in
+ * transfers and, of those, waiting on the drive. */
+typedef struct ata_stats {
+    uint64_t pio_commands;
+    uint64_t pio_blocks;
+    uint64_t dma_commands;
+    uint64_t dma_errors;
+    uint64_t ext_commands;
+    uint64_t irqs;
+    uint64_t timeouts;
+    uint64_t cycles;
+    uint64_t wait_cycles;
+} ata_stats_t;
+
+#define ATA_MAX_DRIVES 4
+
+typedef struct ata_drive_info {
+    const char *name;
+    const char *model;
+    const char *serial;
+    const char *firmware;
+    uint64_t sectors;
+    uint8_t channel; /* 0 primary, 1 secondary */
+    int slave;
+    int lba48;
+    int dma;
+} ata_drive_info_t;
+
 void ata_init(void);
 int ata_is_available(void);
-int ata_read_sectors(uint32_t lba, uint16_t sector_count, void *buffer);
-int ata_write_sectors(uint32_t lba, uint16_t sector_count, const void *buffer);
+size_t ata_drive_count(void);
+int ata_get_drive_info(size_t index, ata_drive_info_t *info);
+int ata_read_sectors(uint64_t lba, uint32_t sector_count, void *buffer);
+int ata_write_sectors(uint64_t lba, uint32_t sector_count, const void *buffer);
+int ata_flush(void);
+int ata_dma_available(void);
+int ata_dma_enabled(void);
+int ata_set_dma(int enabled);
+uint16_t ata_multiple_sectors(void);
+int ata_set_multiple(int enabled);
+int ata_irq_enabled(void);
+void ata_set_irq(int enabled);
+void ata_handle_irq(uint8_t channel);
+void ata_get_stats(ata_stats_t *stats);
+int ata_lba48_supported(void);
 uint64_t ata_get_total_sectors(void);
 const char *ata_get_model(void);
 const char *ata_get_serial(void);
@@ -0,0 +1,32 @@
+#ifndef _MYOS_BCACHE_H
+#define _MYOS_BCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <blockdev.h>
+
+typedef struct bcache_stats {
+    size_t blocks;
+    size_t cached;
+    size_t dirty;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t bypassed;
+    uint64_t writebacks;
+    uint64_t evictions;
+    uint64_t ra_requests;  /* read-ahead requests issued */
+    uint64_t ra_sectors;   /* sectors they covered */
+    uint64_t ra_hits;      /* read-ahead sectors later read */
+    uint64_t ra_wasted;    /* read-ahead sectors dropped unread */
+    uint64_t ra_waits;     /* reads that waited for read-ahead in flight */
+} bcache_stats_t;
+
+int bcache_read(blockdev_t *dev, uint64_t lba, uint32_t count, void *buffer);
+int bcache_write(blockdev_t *dev, uint64_t lba, uint32_t count, const void *buffer);
+int bcache_write_fua(blockdev_t *dev, uint64_t lba, uint32_t count, const void *buffer);
+int bcache_sync(blockdev_t *dev);
+void bcache_invalidate(blockdev_t *dev);
+int bcache_poll(void);
+void bcache_get_stats(bcache_stats_t *stats);
+
+#endif /* _MYOS_BCACHE_H */
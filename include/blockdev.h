@@ -0,0 +1,122 @@
+#ifndef _MYOS_BLOCKDEV_H
+#define _MYOS_BLOCKDEV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BLOCKDEV_MAX_DEVICES 8
+#define BLOCKDEV_NAME_LEN    16
+#define BLOCKDEV_QUEUE_DEPTH 64
+
+/* Request flag: the data must be on stable media when the write
+ * completes (forced unit access). */
+#define BLOCKDEV_REQ_FUA     0x01
+
+/* Device feature: the driver carries out BLOCKDEV_REQ_FUA itself rather
+ * than the layer following the write with a flush. */
+#define BLOCKDEV_FEATURE_FUA 0x01
+
+/* Device feature: the device keeps several commands in flight, so the
+ * queue issues separate requests rather than merging them through the
+ * bounce buffer. */
+#define BLOCKDEV_FEATURE_QUEUED 0x02
+
+typedef enum blockdev_op {
+    BLOCKDEV_READ = 0,
+    BLOCKDEV_WRITE,
+    BLOCKDEV_FLUSH
+} blockdev_op_t;
+
+/* One transfer handed to a driver. The range has already been checked
+ * against the device and split to at most max_transfer sectors. */
+typedef struct blockdev_request {
+    blockdev_op_t op;
+    uint64_t lba;
+    uint32_t count;
+    void *buffer;
+    uint32_t flags;
+} blockdev_request_t;
+
+typedef struct blockdev blockdev_t;
+typedef int (*blockdev_submit_t)(blockdev_t *dev, const blockdev_request_t *request);
+
+/* Optional asynchronous path for devices that keep several commands in
+ * flight. start() issues a request without waiting and returns 0, 1 if
+ * every command slot is busy, or -1; the driver later hands `tag` to
+ * blockdev_complete(). poll() reaps whatever has finished. */
+typedef int (*blockdev_start_t)(blockdev_t *dev, const blockdev_request_t *request, void *tag);
+typedef void (*blockdev_poll_t)(blockdev_t *dev);
+
+/* A queued transfer. The owner keeps it alive until the callback, which
+ * runs from blockdev_unplug with status 0 or -1. */
+typedef struct blockdev_io blockdev_io_t;
+typedef void (*blockdev_io_callback_t)(blockdev_io_t *io, void *user_data);
+
+struct blockdev_io {
+    blockdev_op_t op;
+    uint64_t lba;
+    uint32_t count;
+    void *buffer;
+    int status;
+    blockdev_io_callback_t callback;
+    void *user_data;
+    blockdev_io_t *next;
+};
+
+typedef struct blockdev_queue_stats {
+    uint64_t queued;
+    uint64_t merged;
+    uint64_t dispatched;
+    uint64_t dispatched_sectors;
+    size_t max_depth;
+    size_t max_inflight;
+} blockdev_queue_stats_t;
+
+typedef struct blockdev_stats {
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t flushes;
+    uint64_t flushes_skipped;
+    uint64_t flush_cycles;
+    uint64_t flush_max_cycles;
+    uint64_t fua_writes;
+    uint64_t sectors_read;
+    uint64_t sectors_written;
+    uint64_t errors;
+} blockdev_stats_t;
+
+struct blockdev {
+    char name[BLOCKDEV_NAME_LEN];
+    const char *driver;
+    uint32_t sector_size;
+    uint64_t sector_count;
+    uint32_t max_transfer;
+    uint32_t features;
+    blockdev_submit_t submit;
+    blockdev_start_t start;
+    blockdev_poll_t poll;
+    void *driver_data;
+    blockdev_stats_t stats;
+    uint64_t unflushed_writes;
+    blockdev_io_t *queue;
+    size_t queue_depth;
+    uint64_t queue_position;
+    size_t inflight;
+    blockdev_queue_stats_t queue_stats;
+};
+
+int blockdev_register(blockdev_t *dev);
+blockdev_t *blockdev_find(const char *name);
+blockdev_t *blockdev_get(size_t index);
+size_t blockdev_count(void);
+int blockdev_read(blockdev_t *dev, uint64_t lba, uint32_t count, void *buffer);
+int blockdev_write(blockdev_t *dev, uint64_t lba, uint32_t count, const void *buffer);
+int blockdev_write_fua(blockdev_t *dev, uint64_t lba, uint32_t count, const void *buffer);
+int blockdev_flush(blockdev_t *dev);
+int blockdev_queue(blockdev_t *dev, blockdev_io_t *io);
+int blockdev_unplug(blockdev_t *dev);
+int blockdev_start(blockdev_t *dev, blockdev_io_t *io);
+void blockdev_poll(blockdev_t *dev);
+void blockdev_complete(blockdev_t *dev, void *tag, int status);
+
+#endif /* _MYOS_BLOCKDEV_H */
@@ -0,0 +1,12 @@
+#ifndef _MYOS_CHECKSUM_H
+#define _MYOS_CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+void checksum_init(void);
+int checksum_hw_accelerated(void);
+uint32_t checksum_crc32c_update(uint32_t crc, const void *data, size_t length);
+uint32_t checksum_crc32c(const void *data, size_t length);
+
+#endif /* _MYOS_CHECKSUM_H */
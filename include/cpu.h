@@ -0,0 +1,45 @@
+#ifndef _MYOS_CPU_H
+#define _MYOS_CPU_H
+
+#include <stdint.h>
+
+#define CPUID_LEAF_FEATURES    0x00000001u
+#define CPUID_FEAT_ECX_SSE42   (1u << 20)
+#define CPUID_FEAT_EDX_APIC    (1u << 9)
+#define MSR_APIC_BASE          0x0000001Bu
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf,
+                         uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+    uint32_t a, b, c, d;
+    __asm__ volatile("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(leaf), "c"(subleaf));
+    if (eax) *eax = a;
+    if (ebx) *ebx = b;
+    if (ecx) *ecx = c;
+    if (edx) *edx = d;
+}
+
+static inline int cpu_has_sse42(void) {
+    uint32_t ecx = 0;
+    cpuid(CPUID_LEAF_FEATURES, 0, NULL, NULL, &ecx, NULL);
+    return (ecx & CPUID_FEAT_ECX_SSE42) != 0;
+}
+
+static inline int cpu_has_apic(void) {
+    uint32_t edx = 0;
+    cpuid(CPUID_LEAF_FEATURES, 0, NULL, NULL, NULL, &edx);
+    return (edx & CPUID_FEAT_EDX_APIC) != 0;
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+#endif /* _MYOS_CPU_H */
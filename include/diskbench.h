@@ -0,0 +1,57 @@
+#ifndef _MYOS_DISKBENCH_H
+#define _MYOS_DISKBENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <blockdev.h>
+
+#define DISKBENCH_MAX_OPS   4096u
+#define DISKBENCH_MAX_DEPTH 32u
+#define DISKBENCH_MAX_BYTES (512u * 1024u) /* all buffers of one run */
+
+/* Bucket k counts latencies below 2^k microseconds (and at least
+ * 2^(k-1)); the last one takes everything slower. */
+#define DISKBENCH_BUCKETS   18u
+
+typedef enum diskbench_pattern {
+    DISKBENCH_SEQ_READ = 0,
+    DISKBENCH_SEQ_WRITE,
+    DISKBENCH_RAND_READ,
+    DISKBENCH_RAND_WRITE,
+    DISKBENCH_PATTERN_COUNT
+} diskbench_pattern_t;
+
+/* block_sectors of 0 picks the pattern's default size. */
+typedef struct diskbench_config {
+    blockdev_t *dev;
+    diskbench_pattern_t pattern;
+    uint32_t block_sectors;
+    uint32_t depth;
+    uint32_t ops;
+} diskbench_config_t;
+
+/* Latencies run from a request's start to its completion, in nanoseconds
+ * derived from the TSC; with a queue depth above one they include the
+ * time spent waiting behind other requests. */
+typedef struct diskbench_result {
+    int status;
+    uint32_t ops;
+    uint32_t block_sectors;
+    uint64_t bytes;
+    uint64_t total_ns;
+    uint64_t iops;
+    uint64_t kb_per_sec;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t max_ns;
+    uint32_t histogram[DISKBENCH_BUCKETS];
+} diskbench_result_t;
+
+const char *diskbench_pattern_name(diskbench_pattern_t pattern);
+int diskbench_find_pattern(const char *name);
+uint32_t diskbench_default_ops(diskbench_pattern_t pattern);
+uint32_t diskbench_default_block(diskbench_pattern_t pattern);
+int diskbench_scratch_range(const blockdev_t *dev, uint64_t *first, uint64_t *count);
+void diskbench_run(const diskbench_config_t *config, diskbench_result_t *result);
+
+#endif /* _MYOS_DISKBENCH_H */
@@ -18,6 +18,13 @@ typedef struct fs_dir_entry {
     int is_directory;
 } fs_dir_entry_t;
 
+typedef enum fs_dir_order {
+    FS_DIR_ORDER_NAME = 0,
+    FS_DIR_ORDER_NAME_DESC = 1
+} fs_dir_order_t;
+
+typedef struct fs_dir fs_dir_t;
+
 typedef enum fs_status {
     FS_OK = 0,
     FS_ERR_NOENT = -1,
@@ -26,11 +33,87 @@ typedef enum fs_status {
     FS_ERR_ISDIR = -4,
     FS_ERR_NOMEM = -5,
     FS_ERR_INVALID = -6,
-    FS_ERR_NOTEMPTY = -7
+    FS_ERR_NOTEMPTY = -7,
+    FS_ERR_CORRUPT = -8,
+    FS_ERR_BUSY = -9
 } fs_status_t;
 
+typedef struct fs_usage {
+    size_t bytes;
+    size_t files;
+    size_t directories;
+} fs_usage_t;
+
+/* Live chunks may also be held by a snapshot or by removed nodes that an
+ * in-progress save still references, so physical_bytes can exceed what the
+ * current tree alone would need. */
+typedef struct fs_dedup_stats {
+    size_t logical_bytes;
+    size_t physical_bytes;
+    size_t chunk_count;
+    size_t chunk_refs;
+} fs_dedup_stats_t;
+
+typedef struct fs_search_result {
+    size_t candidates;
+    size_t matches;
+} fs_search_result_t;
+
+typedef struct fs_search_stats {
+    size_t indexed_files;
+    size_t incomplete_files;
+    size_t trigrams;
+    size_t postings;
+    size_t memory_bytes;
+} fs_search_stats_t;
+
+typedef void (*fs_search_callback_t)(const char *path, void *user_data);
+
+/* Chunks stored in the current on-disk image may be evicted from memory;
+ * a miss reads the chunk back from the disk. */
+typedef struct fs_cache_stats {
+    size_t resident_bytes;
+    size_t evicted_bytes;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} fs_cache_stats_t;
+
 typedef void (*fs_list_callback_t)(const fs_dir_entry_t *entry, void *user_data);
 
+typedef enum fs_request_op {
+    FS_REQUEST_SAVE = 0,
+    FS_REQUEST_LOAD,
+    FS_REQUEST_READ,
+    FS_REQUEST_WRITE,
+    FS_REQUEST_APPEND
+} fs_request_op_t;
+
+typedef struct fs_request fs_request_t;
+typedef void (*fs_request_callback_t)(fs_request_t *request, void *user_data);
+
+/* An asynchronous request. The caller zeroes the structure before its first
+ * use and owns it and everything it points to (path, buffer) until the
+ * callback has run; it may then be submitted again. When the callback runs,
+ * `status` holds the result; reads also set `size` to the file size and
+ * `transferred` to the number of bytes copied into the buffer. */
+struct fs_request {
+    fs_request_op_t op;
+    const char *path;
+    void *buffer;
+    size_t length;
+    size_t size;
+    size_t transferred;
+    fs_status_t status;
+    fs_request_callback_t callback;
+    void *user_data;
+    /* Private to the filesystem while the request is queued. */
+    struct fs_request *next;
+    void *data;
+    int queued;
+    int started;
+};
+
 void fs_init(void);
 fs_status_t fs_mkdir(const char *path);
 fs_status_t fs_create_file(const char *path);
@@ -39,14 +122,49 @@ fs_status_t fs_append_file(const char *path, const void *data, size_t size);
 fs_status_t fs_read_file(const char *path, void *buffer, size_t buffer_size, size_t *out_size);
 const uint8_t *fs_get_file_data(const char *path, size_t *out_size);
 fs_status_t fs_list_dir(const char *path, fs_list_callback_t callback, void *user_data);
+fs_status_t fs_opendir(const char *path, fs_dir_order_t order, fs_dir_t **out);
+int fs_readdir(fs_dir_t *dir, fs_dir_entry_t *entry);
+fs_status_t fs_seekdir(fs_dir_t *dir, size_t offset);
+size_t fs_dir_entry_count(fs_dir_t *dir);
+void fs_closedir(fs_dir_t *dir);
 fs_status_t fs_change_dir(const char *path);
 void fs_get_cwd(char *buffer, size_t buffer_size);
 int fs_exists(const char *path);
 int fs_is_dir(const char *path);
 fs_status_t fs_remove(const char *path, int recursive);
+fs_status_t fs_rename(const char *old_path, const char *new_path);
+fs_status_t fs_copy(const char *src_path, const char *dst_path, int recursive);
+fs_status_t fs_get_usage(const char *path, fs_usage_t *usage);
 fs_status_t fs_save(void);
+fs_status_t fs_save_begin(void);
+int fs_save_poll(void);
+int fs_save_in_progress(void);
+fs_status_t fs_save_last_status(void);
+uint64_t fs_save_last_duration_ms(void);
 fs_status_t fs_load(void);
+fs_status_t fs_save_async(fs_request_t *request, fs_request_callback_t callback, void *user_data);
+fs_status_t fs_load_async(fs_request_t *request, fs_request_callback_t callback, void *user_data);
+fs_status_t fs_read_async(fs_request_t *request, const char *path, void *buffer, size_t buffer_size,
+                          fs_request_callback_t callback, void *user_data);
+fs_status_t fs_write_async(fs_request_t *request, const char *path, const void *data, size_t size,
+                           fs_request_callback_t callback, void *user_data);
+fs_status_t fs_append_async(fs_request_t *request, const char *path, const void *data, size_t size,
+                            fs_request_callback_t callback, void *user_data);
+int fs_async_pending(void);
+int fs_async_poll(void);
 int fs_persistence_available(void);
+fs_status_t fs_mount(const char *device);
+const char *fs_mounted_device(void);
+uint64_t fs_image_end(uint64_t sector_count);
+void fs_get_dedup_stats(fs_dedup_stats_t *stats);
+fs_status_t fs_set_search_indexing(const char *path, int enabled);
+int fs_search_indexing_enabled(const char *path);
+fs_status_t fs_search(const char *text, fs_search_callback_t callback, void *user_data,
+                      fs_search_result_t *result);
+void fs_get_search_stats(fs_search_stats_t *stats);
+void fs_get_cache_stats(fs_cache_stats_t *stats);
+size_t fs_cache_drop(void);
+int fs_cache_writeback_wanted(void);
 
 #endif /* _MYOS_FILESYSTEM_H */
 
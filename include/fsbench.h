@@ -0,0 +1,42 @@
+#ifndef _MYOS_FSBENCH_H
+#define _MYOS_FSBENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <filesystem.h>
+
+#define FSBENCH_MAX_OPS 4096u
+
+typedef enum fsbench_workload {
+    FSBENCH_CREATE = 0,
+    FSBENCH_LOOKUP,
+    FSBENCH_REMOVE,
+    FSBENCH_DEEP_LOOKUP,
+    FSBENCH_APPEND,
+    FSBENCH_SEQ_WRITE,
+    FSBENCH_ROUNDTRIP,
+    FSBENCH_WORKLOAD_COUNT
+} fsbench_workload_t;
+
+/* Latencies are per operation, in nanoseconds derived from the TSC. */
+typedef struct fsbench_result {
+    fs_status_t status;
+    uint32_t ops;
+    uint64_t bytes;
+    uint64_t total_ns;
+    uint64_t ops_per_sec;
+    uint64_t p50_ns;
+    uint64_t p90_ns;
+    uint64_t p99_ns;
+    uint64_t max_ns;
+} fsbench_result_t;
+
+const char *fsbench_workload_name(fsbench_workload_t workload);
+int fsbench_find_workload(const char *name);
+uint32_t fsbench_default_ops(fsbench_workload_t workload);
+uint64_t fsbench_tsc_hz(void);
+void fsbench_sort(uint64_t *values, uint32_t count);
+uint64_t fsbench_cycles_to_ns(uint64_t cycles, uint64_t hz);
+void fsbench_run(fsbench_workload_t workload, uint32_t ops, fsbench_result_t *result);
+
+#endif /* _MYOS_FSBENCH_H */
@@ -15,9 +15,15 @@ struct interrupt_frame {
     uint32_t _pad3;
 };
 
+typedef void (*irq_handler_t)(void *context);
+
 void interrupts_init(void);
+int interrupts_register_irq(uint8_t irq, irq_handler_t handler, void *context);
+int interrupts_alloc_vector(irq_handler_t handler, void *context);
+uint32_t interrupts_msi_address(void);
 void interrupts_enable(void);
 void interrupts_disable(void);
+int interrupts_enabled(void);
 
 #endif /* _MYOS_INTERRUPTS_H */
 
@@ -28,6 +28,16 @@ static inline uint16_t inw(uint16_t port) {
     return value;
 }
 
+static inline void outl(uint16_t port, uint32_t value) {
+    __asm__ volatile("outl %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint32_t inl(uint16_t port) {
+    uint32_t value;
+    __asm__ volatile("inl %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
 static inline void insw(uint16_t port, void *addr, size_t count) {
     __asm__ volatile("rep insw" : "+D"(addr), "+c"(count) : "d"(port) : "memory");
 }
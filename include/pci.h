@@ -0,0 +1,103 @@
+#ifndef _MYOS_PCI_H
+#define _MYOS_PCI_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <interrupts.h>
+
+#define PCI_REG_VENDOR_ID  0x00
+#define PCI_REG_COMMAND    0x04
+#define PCI_REG_STATUS     0x06
+#define PCI_REG_CLASS      0x08
+#define PCI_REG_HEADER     0x0E
+#define PCI_REG_BAR0       0x10
+#define PCI_REG_CAPABILITY 0x34
+#define PCI_REG_INTERRUPT  0x3C
+
+#define PCI_COMMAND_IO     0x0001
+#define PCI_COMMAND_MEMORY 0x0002
+#define PCI_COMMAND_MASTER 0x0004
+#define PCI_COMMAND_INTX_DISABLE 0x0400
+
+#define PCI_CAP_MSI        0x05
+#define PCI_CAP_MSIX       0x11
+
+#define PCI_ANY_ID         0xFFFFu
+#define PCI_MAX_DEVICES    64
+#define PCI_MAX_BARS       6
+#define PCI_MAX_VECTORS    4
+#define PCI_MAX_DRIVERS    8
+
+typedef struct pci_device {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t function;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t prog_if;
+} pci_device_t;
+
+typedef enum pci_irq_mode {
+    PCI_IRQ_INTX = 0,
+    PCI_IRQ_MSI,
+    PCI_IRQ_MSIX
+} pci_irq_mode_t;
+
+/* A BAR as sized at scan time; a size of 0 means it is not implemented.
+ * The upper half of a 64-bit BAR shows up as an empty BAR. */
+typedef struct pci_bar_info {
+    uint64_t base;
+    uint64_t size;
+    uint8_t io;
+    uint8_t is64;
+    uint8_t prefetchable;
+} pci_bar_info_t;
+
+typedef struct pci_device_info {
+    pci_device_t device;
+    uint8_t header_type;
+    uint8_t interrupt_pin;   /* 0: none, 1-4: INTA#-INTD# */
+    uint8_t interrupt_line;
+    uint8_t has_msi;
+    uint8_t has_msix;
+    pci_irq_mode_t irq_mode;
+    uint8_t vector_count;
+    uint8_t vectors[PCI_MAX_VECTORS];
+    const char *driver;      /* NULL while no driver has claimed it */
+    pci_bar_info_t bars[PCI_MAX_BARS];
+} pci_device_info_t;
+
+/* Matches on any combination of IDs and class; PCI_ANY_ID matches
+ * anything. probe returns 0 to claim the device. */
+typedef struct pci_driver {
+    const char *name;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint16_t class_code;
+    uint16_t subclass;
+    int (*probe)(const pci_device_t *device);
+} pci_driver_t;
+
+void pci_init(void);
+int pci_get_ecam(uint64_t *base, uint8_t *start_bus, uint8_t *end_bus);
+size_t pci_device_count(void);
+int pci_get_device_info(size_t index, pci_device_info_t *info);
+int pci_register_driver(const pci_driver_t *driver);
+
+uint32_t pci_config_read32(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset);
+uint16_t pci_config_read16(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset);
+void pci_config_write32(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset, uint32_t value);
+void pci_config_write16(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset, uint16_t value);
+int pci_find_class(uint8_t class_code, uint8_t subclass, pci_device_t *device);
+int pci_find_device(uint16_t vendor_id, uint16_t device_id, pci_device_t *device);
+uint8_t pci_interrupt_line(const pci_device_t *device);
+uint32_t pci_bar(const pci_device_t *device, int index);
+volatile void *pci_map_bar(const pci_device_t *device, int index, uint64_t *size);
+void pci_enable(const pci_device_t *device, uint16_t command_bits);
+uint8_t pci_find_capability(const pci_device_t *device, uint8_t id);
+int pci_enable_msi(const pci_device_t *device, irq_handler_t handler, void *context);
+int pci_enable_msix(const pci_device_t *device, uint16_t entry, irq_handler_t handler, void *context);
+
+#endif /* _MYOS_PCI_H */
@@ -0,0 +1,26 @@
+#ifndef _MYOS_RAID0_H
+#define _MYOS_RAID0_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <blockdev.h>
+
+#define RAID0_MAX_MEMBERS    4
+#define RAID0_DEFAULT_CHUNK  64u /* sectors: 32 KiB */
+
+typedef struct raid0_info {
+    const char *name;
+    size_t members;
+    const char *member_names[RAID0_MAX_MEMBERS];
+    uint32_t chunk_sectors;
+    uint64_t sectors;
+    uint64_t pieces;       /* member transfers completed */
+    uint64_t overlapped;   /* of those, started while another member was busy */
+} raid0_info_t;
+
+int raid0_create(const char *const *members, size_t count, uint32_t chunk_sectors);
+int raid0_is_active(void);
+int raid0_is_member(const blockdev_t *dev);
+int raid0_get_info(raid0_info_t *info);
+
+#endif /* _MYOS_RAID0_H */
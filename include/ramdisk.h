@@ -0,0 +1,11 @@
+#ifndef _MYOS_RAMDISK_H
+#define _MYOS_RAMDISK_H
+
+#include <stdint.h>
+#include <blockdev.h>
+
+#define RAMDISK_SECTOR_SIZE 512u
+
+blockdev_t *ramdisk_create(uint32_t sector_count);
+
+#endif /* _MYOS_RAMDISK_H */
@@ -8,5 +8,7 @@ typedef __PTRDIFF_TYPE__ ptrdiff_t;
 #define NULL ((void *)0)
 #endif
 
+#define offsetof(type, member) __builtin_offsetof(type, member)
+
 #endif /* _MYOS_STDDEF_H */
 
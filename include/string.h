@@ -10,6 +10,7 @@ const char *strstr(const char *haystack, const char *needle);
 void *memset(void *dest, int value, size_t count);
 void *memcpy(void *dest, const void *src, size_t count);
 void *memmove(void *dest, const void *src, size_t count);
+int memcmp(const void *a, const void *b, size_t count);
 
 #endif /* _MYOS_STRING_H */
 
@@ -0,0 +1,26 @@
+#ifndef _MYOS_TRIGRAM_H
+#define _MYOS_TRIGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRIGRAM_NO_DOC 0xFFFFFFFFu
+
+typedef struct trigram_stats {
+    size_t trigrams;
+    size_t postings;
+    size_t documents;
+    size_t incomplete;
+    size_t memory_bytes;
+} trigram_stats_t;
+
+/* Called once per candidate document, in increasing id order. */
+typedef void (*trigram_candidate_callback_t)(uint32_t doc, void *owner, void *user_data);
+
+uint32_t trigram_doc_create(void *owner);
+void trigram_doc_add(uint32_t doc, const uint8_t *bytes, size_t length);
+void trigram_doc_destroy(uint32_t doc);
+void trigram_query(const uint8_t *text, size_t length, trigram_candidate_callback_t callback, void *user_data);
+void trigram_get_stats(trigram_stats_t *stats);
+
+#endif /* _MYOS_TRIGRAM_H */
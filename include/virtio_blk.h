@@ -0,0 +1,29 @@
+#ifndef _MYOS_VIRTIO_BLK_H
+#define _MYOS_VIRTIO_BLK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Requests completed, queue notifications (one per batch of requests),
+ * interrupts, requests described through an indirect table, failed and
+ * timed-out requests, and the most requests seen in flight. */
+typedef struct virtio_blk_stats {
+    uint64_t requests;
+    uint64_t notifies;
+    uint64_t irqs;
+    uint64_t indirect;
+    uint64_t errors;
+    uint64_t timeouts;
+    uint32_t max_inflight;
+} virtio_blk_stats_t;
+
+void virtio_blk_init(void);
+int virtio_blk_is_available(void);
+uint16_t virtio_blk_queue_size(void);
+int virtio_blk_indirect_enabled(void);
+int virtio_blk_irq_usable(void);
+int virtio_blk_irq_enabled(void);
+void virtio_blk_set_irq(int enabled);
+void virtio_blk_get_stats(virtio_blk_stats_t *stats);
+
+#endif /* _MYOS_VIRTIO_BLK_H */
@@ -0,0 +1,105 @@
+#include <acpi.h>
+#include <stddef.h>
+#include <string.h>
+
+#define ACPI_EBDA_POINTER  0x40E
+#define ACPI_BIOS_START    0xE0000u
+#define ACPI_BIOS_END      0x100000u
+#define ACPI_MAPPED_LIMIT  0x100000000ull /* identity mapped by boot.asm */
+
+typedef struct acpi_rsdp {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+static const acpi_rsdp_t *acpi_rsdp = NULL;
+static int acpi_searched = 0;
+
+static int acpi_checksum_ok(const void *data, uint32_t length) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; ++i) {
+        sum = (uint8_t)(sum + bytes[i]);
+    }
+    return sum == 0;
+}
+
+static const acpi_rsdp_t *acpi_scan_rsdp(uintptr_t start, uintptr_t end) {
+    for (uintptr_t address = start; address + sizeof(acpi_rsdp_t) <= end; address += 16) {
+        const acpi_rsdp_t *rsdp = (const acpi_rsdp_t *)address;
+        if (memcmp(rsdp->signature, "RSD PTR ", 8) == 0 && acpi_checksum_ok(rsdp, 20)) {
+            return rsdp;
+        }
+    }
+    return NULL;
+}
+
+/* The RSDP sits on a 16-byte boundary in the first KiB of the EBDA or
+ * in the BIOS area below 1 MiB. */
+static const acpi_rsdp_t *acpi_find_rsdp(void) {
+    uintptr_t ebda = (uintptr_t)(*(const volatile uint16_t *)ACPI_EBDA_POINTER) << 4;
+    const acpi_rsdp_t *rsdp = NULL;
+    if (ebda >= 0x80000 && ebda < 0xA0000) {
+        rsdp = acpi_scan_rsdp(ebda, ebda + 1024);
+    }
+    return rsdp ? rsdp : acpi_scan_rsdp(ACPI_BIOS_START, ACPI_BIOS_END);
+}
+
+static const acpi_header_t *acpi_table_at(uint64_t address) {
+    if (address == 0 || address >= ACPI_MAPPED_LIMIT) {
+        return NULL;
+    }
+    const acpi_header_t *table = (const acpi_header_t *)(uintptr_t)address;
+    if (table->length < sizeof(acpi_header_t) || address + table->length > ACPI_MAPPED_LIMIT ||
+        !acpi_checksum_ok(table, table->length)) {
+        return NULL;
+    }
+    return table;
+}
+
+/* Looks `signature` up in the XSDT (ACPI 2.0+) or the RSDT. Tables
+ * outside the identity mapped first 4 GiB or with a bad checksum are
+ * skipped. Returns NULL if there is no such table. */
+const acpi_header_t *acpi_find_table(const char *signature) {
+    if (!acpi_searched) {
+        acpi_rsdp = acpi_find_rsdp();
+        acpi_searched = 1;
+    }
+    const acpi_rsdp_t *rsdp = acpi_rsdp;
+    if (!rsdp || !signature) {
+        return NULL;
+    }
+
+    const acpi_header_t *root = NULL;
+    uint32_t entry_size = 4;
+    if (rsdp->revision >= 2 && acpi_checksum_ok(rsdp, rsdp->length)) {
+        root = acpi_table_at(rsdp->xsdt_address);
+        entry_size = 8;
+    }
+    if (!root) {
+        root = acpi_table_at(rsdp->rsdt_address);
+        entry_size = 4;
+    }
+    if (!root) {
+        return NULL;
+    }
+
+    const uint8_t *entries = (const uint8_t *)root + sizeof(acpi_header_t);
+    uint32_t count = (root->length - (uint32_t)sizeof(acpi_header_t)) / entry_size;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint64_t address = 0;
+        memcpy(&address, entries + (size_t)i * entry_size, entry_size);
+        const acpi_header_t *table = acpi_table_at(address);
+        if (table && memcmp(table->signature, signature, 4) == 0) {
+            return table;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,611 @@
+#include <ahci.h>
+#include <blockdev.h>
+#include <pci.h>
+#include <pit.h>
+#include <string.h>
+
+/* HBA registers, as offsets into the ABAR (BAR5) window. */
+#define AHCI_REG_CAP           0x00
+#define AHCI_REG_GHC           0x04
+#define AHCI_REG_PI            0x0C
+#define AHCI_CAP_SNCQ          (1u << 30)
+#define AHCI_GHC_IE            (1u << 1)
+#define AHCI_GHC_AE            (1u << 31)
+
+/* Port registers, relative to the port's 0x80-byte block. */
+#define AHCI_PORT_BASE         0x100
+#define AHCI_PORT_SIZE         0x80
+#define AHCI_PxCLB             0x00
+#define AHCI_PxCLBU            0x04
+#define AHCI_PxFB              0x08
+#define AHCI_PxFBU             0x0C
+#define AHCI_PxIS              0x10
+#define AHCI_PxIE              0x14
+#define AHCI_PxCMD             0x18
+#define AHCI_PxTFD             0x20
+#define AHCI_PxSIG             0x24
+#define AHCI_PxSSTS            0x28
+#define AHCI_PxSERR            0x30
+#define AHCI_PxSACT            0x34
+#define AHCI_PxCI              0x38
+
+#define AHCI_PxCMD_ST          0x0001
+#define AHCI_PxCMD_FRE         0x0010
+#define AHCI_PxCMD_FR          0x4000
+#define AHCI_PxCMD_CR          0x8000
+#define AHCI_PxIS_ERRORS       0x78000000u /* task file, host bus data/fatal, interface */
+#define AHCI_PxTFD_BUSY        0x88        /* BSY or DRQ */
+#define AHCI_SSTS_DET_PRESENT  3
+#define AHCI_SIG_ATA           0x00000101u
+
+#define AHCI_FIS_H2D           0x27
+#define AHCI_FIS_COMMAND       0x80
+#define AHCI_HEADER_WRITE      0x0040
+#define AHCI_DEVICE_LBA        0x40
+#define AHCI_DEVICE_FUA        0x80
+
+#define ATA_CMD_READ_DMA       0xC8
+#define ATA_CMD_WRITE_DMA      0xCA
+#define ATA_CMD_READ_DMA_EXT   0x25
+#define ATA_CMD_WRITE_DMA_EXT  0x35
+#define ATA_CMD_WRITE_DMA_FUA_EXT 0x3D
+#define ATA_CMD_READ_FPDMA     0x60
+#define ATA_CMD_WRITE_FPDMA    0x61
+#define ATA_CMD_CACHE_FLUSH    0xE7
+#define ATA_CMD_CACHE_FLUSH_EXT 0xEA
+#define ATA_CMD_IDENTIFY       0xEC
+
+#define AHCI_SECTOR_SIZE       512u
+#define AHCI_PRD_ENTRIES       8
+#define AHCI_PRD_MAX_BYTES     (4u << 20)
+#define AHCI_MAX_TRANSFER      256u
+#define AHCI_MAX_TRANSFER_EXT  65536u
+#define AHCI_TIMEOUT_MS        5000
+
+typedef struct ahci_command_header {
+    uint16_t flags;          /* FIS length in dwords, direction */
+    uint16_t prdt_length;
+    volatile uint32_t bytes_transferred;
+    uint32_t table;
+    uint32_t table_high;
+    uint32_t reserved[4];
+} __attribute__((packed)) ahci_command_header_t;
+
+/* One piece of a data buffer: at most 4 MiB, with an even address and
+ * length. The byte count is stored minus one. */
+typedef struct ahci_prd {
+    uint32_t address;
+    uint32_t address_high;
+    uint32_t reserved;
+    uint32_t byte_count;
+} __attribute__((packed)) ahci_prd_t;
+
+typedef struct ahci_command_table {
+    uint8_t fis[64];
+    uint8_t atapi[16];
+    uint8_t reserved[48];
+    ahci_prd_t prdt[AHCI_PRD_ENTRIES];
+} __attribute__((packed)) ahci_command_table_t;
+
+/* Everything the HBA reads or writes for one port: the command list
+ * (1 KiB aligned), a table per slot (128-byte aligned) and the receive
+ * area for FISes from the device (256-byte aligned). */
+typedef struct ahci_port_memory {
+    ahci_command_header_t headers[AHCI_MAX_SLOTS];
+    ahci_command_table_t tables[AHCI_MAX_SLOTS];
+    uint8_t received_fis[256];
+} __attribute__((aligned(1024))) ahci_port_memory_t;
+
+/* `active` has a bit per slot with a command in flight, `queued` the NCQ
+ * ones among them. Each slot remembers the block-layer tag to complete. */
+typedef struct ahci_port {
+    blockdev_t dev;
+    volatile uint32_t *regs;
+    ahci_port_memory_t *memory;
+    uint32_t depth;
+    uint32_t active;
+    uint32_t queued;
+    void *tags[AHCI_MAX_SLOTS];
+    uint64_t progress_ms;
+    int sync_status;
+    int lba48;
+    int ncq;
+    int fua;
+    char model[41];
+} ahci_port_t;
+
+static ahci_port_memory_t ahci_memory[AHCI_MAX_PORTS];
+static ahci_port_t ahci_ports[AHCI_MAX_PORTS];
+static uint16_t ahci_identify_data[256];
+static size_t ahci_port_total = 0;
+static volatile uint32_t *ahci_hba = NULL;
+static uint32_t ahci_slots = 1;
+static int ahci_ncq_on = 1;
+static uint32_t ahci_limit = AHCI_MAX_SLOTS;
+static ahci_stats_t ahci_stats;
+
+/* Marks slots issued by ahci_execute, which waits for them itself. */
+static char ahci_sync_tag;
+
+static uint64_t ahci_get_time_ms(void) {
+    uint32_t freq = pit_current_frequency();
+    if (freq == 0) {
+        return 0;
+    }
+    return pit_ticks() * 1000 / freq;
+}
+
+static uint32_t ahci_read(const ahci_port_t *port, uint32_t reg) {
+    return port->regs[reg / 4];
+}
+
+static void ahci_write(ahci_port_t *port, uint32_t reg, uint32_t value) {
+    port->regs[reg / 4] = value;
+}
+
+static int ahci_wait_clear(ahci_port_t *port, uint32_t reg, uint32_t bits) {
+    uint64_t start_time = ahci_get_time_ms();
+    while (ahci_read(port, reg) & bits) {
+        if (ahci_get_time_ms() - start_time > AHCI_TIMEOUT_MS) {
+            return -1;
+        }
+        __asm__ volatile("pause");
+    }
+    return 0;
+}
+
+/* The command list and FIS area may only be moved while the port's DMA
+ * engines are stopped. */
+static int ahci_port_stop(ahci_port_t *port) {
+    ahci_write(port, AHCI_PxCMD, ahci_read(port, AHCI_PxCMD) & ~AHCI_PxCMD_ST);
+    if (ahci_wait_clear(port, AHCI_PxCMD, AHCI_PxCMD_CR) != 0) {
+        return -1;
+    }
+    ahci_write(port, AHCI_PxCMD, ahci_read(port, AHCI_PxCMD) & ~AHCI_PxCMD_FRE);
+    return ahci_wait_clear(port, AHCI_PxCMD, AHCI_PxCMD_FR);
+}
+
+static int ahci_port_start(ahci_port_t *port) {
+    ahci_write(port, AHCI_PxSERR, 0xFFFFFFFFu);
+    ahci_write(port, AHCI_PxIS, 0xFFFFFFFFu);
+    ahci_write(port, AHCI_PxCMD, ahci_read(port, AHCI_PxCMD) | AHCI_PxCMD_FRE);
+    if (ahci_wait_clear(port, AHCI_PxTFD, AHCI_PxTFD_BUSY) != 0) {
+        return -1;
+    }
+    ahci_write(port, AHCI_PxCMD, ahci_read(port, AHCI_PxCMD) | AHCI_PxCMD_ST);
+    return 0;
+}
+
+static int ahci_build_prdt(ahci_command_table_t *table, void *buffer, size_t bytes) {
+    uintptr_t address = (uintptr_t)buffer;
+    if ((address & 1) || (bytes & 1) || address + bytes > 0x100000000ull) {
+        return -1;
+    }
+    int entry = 0;
+    while (bytes > 0) {
+        if (entry == AHCI_PRD_ENTRIES) {
+            return -1;
+        }
+        uint32_t piece = (bytes > AHCI_PRD_MAX_BYTES) ? AHCI_PRD_MAX_BYTES : (uint32_t)bytes;
+        table->prdt[entry].address = (uint32_t)address;
+        table->prdt[entry].address_high = 0;
+        table->prdt[entry].reserved = 0;
+        table->prdt[entry].byte_count = piece - 1;
+        address += piece;
+        bytes -= piece;
+        ++entry;
+    }
+    return entry;
+}
+
+/* Fills slot `slot` with a register H2D FIS. FPDMA QUEUED commands carry
+ * the sector count in the feature field and the tag in the count field. */
+static int ahci_prepare(ahci_port_t *port, uint32_t slot, uint8_t command, uint64_t lba, uint32_t count,
+                        void *buffer, size_t bytes, int write, int fua) {
+    ahci_command_table_t *table = &port->memory->tables[slot];
+    int prds = 0;
+    if (bytes > 0) {
+        prds = ahci_build_prdt(table, buffer, bytes);
+        if (prds < 0) {
+            return -1;
+        }
+    }
+
+    uint8_t *fis = table->fis;
+    memset(fis, 0, 20);
+    fis[0] = AHCI_FIS_H2D;
+    fis[1] = AHCI_FIS_COMMAND;
+    fis[2] = command;
+    fis[4] = (uint8_t)lba;
+    fis[5] = (uint8_t)(lba >> 8);
+    fis[6] = (uint8_t)(lba >> 16);
+    fis[7] = AHCI_DEVICE_LBA;
+    fis[8] = (uint8_t)(lba >> 24);
+    fis[9] = (uint8_t)(lba >> 32);
+    fis[10] = (uint8_t)(lba >> 40);
+    if (command == ATA_CMD_READ_FPDMA || command == ATA_CMD_WRITE_FPDMA) {
+        fis[3] = (uint8_t)count;
+        fis[11] = (uint8_t)(count >> 8);
+        fis[12] = (uint8_t)(slot << 3);
+        if (fua) {
+            fis[7] |= AHCI_DEVICE_FUA;
+        }
+    } else {
+        fis[12] = (uint8_t)count;
+        fis[13] = (uint8_t)(count >> 8);
+        if (!port->lba48) {
+            fis[7] |= (uint8_t)((lba >> 24) & 0x0F);
+        }
+    }
+
+    ahci_command_header_t *header = &port->memory->headers[slot];
+    header->flags = (uint16_t)(5 | (write ? AHCI_HEADER_WRITE : 0));
+    header->prdt_length = (uint16_t)prds;
+    header->bytes_transferred = 0;
+    return 0;
+}
+
+static void ahci_issue(ahci_port_t *port, uint32_t slot, void *tag, int ncq) {
+    uint32_t bit = 1u << slot;
+    if (port->active == 0) {
+        port->progress_ms = ahci_get_time_ms();
+    }
+    port->tags[slot] = tag;
+    port->active |= bit;
+    if (ncq) {
+        port->queued |= bit;
+    }
+
+    uint32_t in_flight = 0;
+    for (uint32_t mask = port->active; mask; mask &= mask - 1) {
+        ++in_flight;
+    }
+    if (in_flight > ahci_stats.max_active) {
+        ahci_stats.max_active = in_flight;
+    }
+
+    /* The command table must be in memory before the HBA is told. */
+    __asm__ volatile("" ::: "memory");
+    if (ncq) {
+        ahci_write(port, AHCI_PxSACT, bit);
+    }
+    ahci_write(port, AHCI_PxCI, bit);
+}
+
+static void ahci_finish(ahci_port_t *port, uint32_t slot, int status) {
+    uint32_t bit = 1u << slot;
+    void *tag = port->tags[slot];
+    ahci_stats.commands++;
+    if (port->queued & bit) {
+        ahci_stats.ncq_commands++;
+    }
+    if (status != 0) {
+        ahci_stats.errors++;
+    }
+    port->tags[slot] = NULL;
+    port->active &= ~bit;
+    port->queued &= ~bit;
+    port->progress_ms = ahci_get_time_ms();
+
+    if (tag == &ahci_sync_tag) {
+        port->sync_status = status;
+    } else {
+        blockdev_complete(&port->dev, tag, status);
+    }
+}
+
+/* Reaps finished commands. An error stops the port's command processing,
+ * and after an NCQ error the drive drops every outstanding command, so
+ * all of them fail and the port is restarted; so is a port that made no
+ * progress within the timeout. */
+static void ahci_port_poll(ahci_port_t *port) {
+    if (port->active == 0) {
+        return;
+    }
+    uint32_t status = ahci_read(port, AHCI_PxIS);
+    if (status) {
+        ahci_write(port, AHCI_PxIS, status);
+    }
+
+    uint32_t failed = 0;
+    uint32_t done = 0;
+    if ((status & AHCI_PxIS_ERRORS) || ahci_get_time_ms() - port->progress_ms > AHCI_TIMEOUT_MS) {
+        failed = port->active;
+        ahci_port_stop(port);
+        ahci_port_start(port);
+        ahci_stats.restarts++;
+    } else {
+        uint32_t busy = ahci_read(port, AHCI_PxCI) | ahci_read(port, AHCI_PxSACT);
+        done = port->active & ~busy;
+    }
+    __asm__ volatile("" ::: "memory");
+
+    for (uint32_t slot = 0; slot < AHCI_MAX_SLOTS; ++slot) {
+        uint32_t bit = 1u << slot;
+        if (failed & bit) {
+            ahci_finish(port, slot, -1);
+        } else if (done & bit) {
+            ahci_finish(port, slot, 0);
+        }
+    }
+}
+
+static void ahci_port_drain(ahci_port_t *port) {
+    while (port->active) {
+        ahci_port_poll(port);
+        __asm__ volatile("pause");
+    }
+}
+
+/* Runs one non-queued command in slot 0 and waits for it. Non-queued
+ * commands may not overlap NCQ ones, so the port is drained first. */
+static int ahci_execute(ahci_port_t *port, uint8_t command, uint64_t lba, uint32_t count,
+                        void *buffer, int write) {
+    ahci_port_drain(port);
+    size_t bytes = (size_t)count * AHCI_SECTOR_SIZE;
+    if (command == ATA_CMD_IDENTIFY) {
+        bytes = sizeof(ahci_identify_data);
+        count = 0;
+    }
+    if (ahci_prepare(port, 0, command, lba, count, buffer, buffer ? bytes : 0, write, 0) != 0) {
+        return -1;
+    }
+    port->sync_status = -1;
+    ahci_issue(port, 0, &ahci_sync_tag, 0);
+    ahci_port_drain(port);
+    return port->sync_status;
+}
+
+static uint8_t ahci_dma_command(const ahci_port_t *port, int write, int fua) {
+    if (!port->lba48) {
+        return write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA;
+    }
+    if (write) {
+        return fua ? ATA_CMD_WRITE_DMA_FUA_EXT : ATA_CMD_WRITE_DMA_EXT;
+    }
+    return ATA_CMD_READ_DMA_EXT;
+}
+
+static int ahci_blockdev_submit(blockdev_t *dev, const blockdev_request_t *request) {
+    ahci_port_t *port = (ahci_port_t *)dev->driver_data;
+    switch (request->op) {
+    case BLOCKDEV_READ:
+    case BLOCKDEV_WRITE: {
+        int write = request->op == BLOCKDEV_WRITE;
+        int fua = write && port->fua && (request->flags & BLOCKDEV_REQ_FUA);
+        return ahci_execute(port, ahci_dma_command(port, write, fua), request->lba, request->count,
+                            request->buffer, write);
+    }
+    case BLOCKDEV_FLUSH:
+        return ahci_execute(port, port->lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH, 0, 0, NULL, 0);
+    }
+    return -1;
+}
+
+/* Asynchronous path used by blockdev_unplug: with NCQ, up to the queue
+ * depth of FPDMA QUEUED commands are in flight at once and the drive
+ * picks their order; without it, one DMA command at a time. */
+static int ahci_blockdev_start(blockdev_t *dev, const blockdev_request_t *request, void *tag) {
+    ahci_port_t *port = (ahci_port_t *)dev->driver_data;
+    if (request->op == BLOCKDEV_FLUSH) {
+        return -1;
+    }
+    int ncq = port->ncq && ahci_ncq_on;
+    uint32_t depth = ncq ? port->depth : 1;
+    if (depth > ahci_limit) {
+        depth = ahci_limit;
+    }
+    if (port->active & ~port->queued) {
+        return 1;
+    }
+
+    uint32_t slot = 0;
+    while (slot < depth && (port->active & (1u << slot))) {
+        ++slot;
+    }
+    if (slot == depth) {
+        return 1;
+    }
+
+    int write = request->op == BLOCKDEV_WRITE;
+    int fua = write && port->fua && (request->flags & BLOCKDEV_REQ_FUA);
+    uint8_t command = ncq ? (write ? ATA_CMD_WRITE_FPDMA : ATA_CMD_READ_FPDMA) : ahci_dma_command(port, write, fua);
+    if (ahci_prepare(port, slot, command, request->lba, request->count, request->buffer,
+                     (size_t)request->count * AHCI_SECTOR_SIZE, write, fua) != 0) {
+        return -1;
+    }
+    ahci_issue(port, slot, tag, ncq);
+    return 0;
+}
+
+static void ahci_blockdev_poll(blockdev_t *dev) {
+    ahci_port_poll((ahci_port_t *)dev->driver_data);
+}
+
+static void ahci_copy_string(char *dest, const uint16_t *words, size_t word_count) {
+    for (size_t i = 0; i < word_count; ++i) {
+        dest[i * 2] = (char)(words[i] >> 8);
+        dest[i * 2 + 1] = (char)words[i];
+    }
+    size_t length = word_count * 2;
+    dest[length] = '\0';
+    while (length > 0 && dest[length - 1] == ' ') {
+        dest[--length] = '\0';
+    }
+}
+
+/* Sets up one port with an ATA drive behind it and registers it as
+ * "sataN". Ports without a device, or with ATAPI ones, are skipped. */
+static void ahci_port_init(uint32_t index) {
+    ahci_port_t *port = &ahci_ports[ahci_port_total];
+    ahci_port_memory_t *memory = &ahci_memory[ahci_port_total];
+    memset(port, 0, sizeof(*port));
+    port->regs = ahci_hba + (AHCI_PORT_BASE + index * AHCI_PORT_SIZE) / 4;
+    port->memory = memory;
+
+    if ((ahci_read(port, AHCI_PxSSTS) & 0x0F) != AHCI_SSTS_DET_PRESENT ||
+        ahci_read(port, AHCI_PxSIG) != AHCI_SIG_ATA) {
+        return;
+    }
+    if (ahci_port_stop(port) != 0) {
+        return;
+    }
+
+    memset(memory, 0, sizeof(*memory));
+    for (uint32_t slot = 0; slot < AHCI_MAX_SLOTS; ++slot) {
+        memory->headers[slot].table = (uint32_t)(uintptr_t)&memory->tables[slot];
+    }
+    ahci_write(port, AHCI_PxCLB, (uint32_t)(uintptr_t)memory->headers);
+    ahci_write(port, AHCI_PxCLBU, 0);
+    ahci_write(port, AHCI_PxFB, (uint32_t)(uintptr_t)memory->received_fis);
+    ahci_write(port, AHCI_PxFBU, 0);
+    ahci_write(port, AHCI_PxIE, 0);
+    if (ahci_port_start(port) != 0) {
+        return;
+    }
+
+    /* A port that is not used must not keep pointing at memory the next
+     * port will take. */
+    if (ahci_execute(port, ATA_CMD_IDENTIFY, 0, 0, ahci_identify_data, 0) != 0) {
+        ahci_port_stop(port);
+        return;
+    }
+    const uint16_t *id = ahci_identify_data;
+    port->lba48 = (id[83] & 0x400) != 0;
+    uint64_t sectors = port->lba48
+        ? ((uint64_t)id[100] | ((uint64_t)id[101] << 16) | ((uint64_t)id[102] << 32) | ((uint64_t)id[103] << 48))
+        : ((uint64_t)id[60] | ((uint64_t)id[61] << 16));
+    if (sectors == 0) {
+        ahci_port_stop(port);
+        return;
+    }
+    /* Word 76 bit 8: NCQ; word 75: queue depth minus one. */
+    port->ncq = port->lba48 && (id[76] & 0x100) != 0 && (ahci_hba[AHCI_REG_CAP / 4] & AHCI_CAP_SNCQ) != 0;
+    port->depth = port->ncq ? (uint32_t)(id[75] & 0x1F) + 1 : 1;
+    if (port->depth > ahci_slots) {
+        port->depth = ahci_slots;
+    }
+    port->fua = port->lba48 && (id[84] & 0x40) != 0;
+    ahci_copy_string(port->model, id + 27, 20);
+
+    blockdev_t *dev = &port->dev;
+    memcpy(dev->name, "sata", 4);
+    dev->name[4] = (char)('0' + ahci_port_total);
+    dev->name[5] = '\0';
+    dev->driver = port->ncq ? "ahci-ncq" : "ahci";
+    dev->sector_size = AHCI_SECTOR_SIZE;
+    dev->sector_count = sectors;
+    dev->max_transfer = port->lba48 ? AHCI_MAX_TRANSFER_EXT : AHCI_MAX_TRANSFER;
+    dev->features = BLOCKDEV_FEATURE_QUEUED | (port->fua ? BLOCKDEV_FEATURE_FUA : 0);
+    dev->submit = ahci_blockdev_submit;
+    dev->start = ahci_blockdev_start;
+    dev->poll = ahci_blockdev_poll;
+    dev->driver_data = port;
+    if (blockdev_register(dev) < 0) {
+        ahci_port_stop(port);
+        return;
+    }
+    ahci_port_total++;
+}
+
+/* Takes the first AHCI controller (class 01h, subclass 06h), switches it
+ * to AHCI mode with its interrupt off (completions are polled) and sets
+ * up every implemented port that has a drive. */
+static int ahci_probe(const pci_device_t *hba) {
+    if (ahci_hba) {
+        return -1;
+    }
+    volatile uint32_t *abar = (volatile uint32_t *)pci_map_bar(hba, 5, NULL);
+    if (!abar) {
+        return -1;
+    }
+    pci_enable(hba, PCI_COMMAND_MASTER);
+    ahci_hba = abar;
+
+    ahci_hba[AHCI_REG_GHC / 4] |= AHCI_GHC_AE;
+    ahci_hba[AHCI_REG_GHC / 4] &= ~AHCI_GHC_IE;
+    ahci_slots = ((ahci_hba[AHCI_REG_CAP / 4] >> 8) & 0x1F) + 1;
+
+    uint32_t implemented = ahci_hba[AHCI_REG_PI / 4];
+    for (uint32_t index = 0; index < 32 && ahci_port_total < AHCI_MAX_PORTS; ++index) {
+        if (implemented & (1u << index)) {
+            ahci_port_init(index);
+        }
+    }
+    return 0;
+}
+
+static const pci_driver_t ahci_driver = {
+    .name = "ahci",
+    .vendor_id = PCI_ANY_ID,
+    .device_id = PCI_ANY_ID,
+    .class_code = 0x01,
+    .subclass = 0x06,
+    .probe = ahci_probe
+};
+
+void ahci_init(void) {
+    if (!ahci_hba) {
+        pci_register_driver(&ahci_driver);
+    }
+}
+
+int ahci_is_available(void) {
+    return ahci_port_total > 0;
+}
+
+size_t ahci_port_count(void) {
+    return ahci_port_total;
+}
+
+int ahci_get_port_info(size_t index, ahci_port_info_t *info) {
+    if (index >= ahci_port_total || !info) {
+        return -1;
+    }
+    const ahci_port_t *port = &ahci_ports[index];
+    info->name = port->dev.name;
+    info->model = port->model;
+    info->sectors = port->dev.sector_count;
+    info->queue_depth = port->depth;
+    info->lba48 = port->lba48;
+    info->fua = port->fua;
+    return 0;
+}
+
+int ahci_ncq_enabled(void) {
+    return ahci_ncq_on;
+}
+
+int ahci_set_ncq(int enabled) {
+    int supported = 0;
+    for (size_t i = 0; i < ahci_port_total; ++i) {
+        supported |= ahci_ports[i].ncq;
+    }
+    if (enabled && !supported) {
+        return -1;
+    }
+    ahci_ncq_on = enabled ? 1 : 0;
+    for (size_t i = 0; i < ahci_port_total; ++i) {
+        ahci_ports[i].dev.driver = (ahci_ports[i].ncq && ahci_ncq_on) ? "ahci-ncq" : "ahci";
+    }
+    return 0;
+}
+
+uint32_t ahci_queue_limit(void) {
+    return ahci_limit;
+}
+
+/* Caps the commands in flight per port, for measuring how throughput
+ * scales with queue depth. */
+void ahci_set_queue_limit(uint32_t depth) {
+    if (depth == 0) {
+        depth = 1;
+    }
+    ahci_limit = (depth > AHCI_MAX_SLOTS) ? AHCI_MAX_SLOTS : depth;
+}
+
+void ahci_get_stats(ahci_stats_t *stats) {
+    if (stats) {
+        *stats = ahci_stats;
+    }
+}
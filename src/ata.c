@@ -1,26 +1,51 @@
 #include <ata.h>
+#include <blockdev.h>
+#include <cpu.h>
+#include <interrupts.h>
 #include <io.h>
+#include <pci.h>
 #include <pit.h>
 #include <string.h>
 
 #define ATA_PRIMARY_IO         0x1F0
 #define ATA_PRIMARY_CTRL       0x3F6
+#define ATA_SECONDARY_IO       0x170
+#define ATA_SECONDARY_CTRL     0x376
 
-#define ATA_REG_DATA           (ATA_PRIMARY_IO + 0)
-#define ATA_REG_ERROR          (ATA_PRIMARY_IO + 1)
-#define ATA_REG_SECCOUNT0      (ATA_PRIMARY_IO + 2)
-#define ATA_REG_LBA0           (ATA_PRIMARY_IO + 3)
-#define ATA_REG_LBA1           (ATA_PRIMARY_IO + 4)
-#define ATA_REG_LBA2           (ATA_PRIMARY_IO + 5)
-#define ATA_REG_HDDEVSEL       (ATA_PRIMARY_IO + 6)
-#define ATA_REG_COMMAND        (ATA_PRIMARY_IO + 7)
-#define ATA_REG_STATUS         (ATA_PRIMARY_IO + 7)
+/* Task-file registers, relative to the channel's I/O base. */
+#define ATA_REG_DATA           0
+#define ATA_REG_ERROR          1
+#define ATA_REG_SECCOUNT0      2
+#define ATA_REG_LBA0           3
+#define ATA_REG_LBA1           4
+#define ATA_REG_LBA2           5
+#define ATA_REG_HDDEVSEL       6
+#define ATA_REG_COMMAND        7
+#define ATA_REG_STATUS         7
 
-#define ATA_REG_CONTROL        (ATA_PRIMARY_CTRL)
+#define ATA_CTRL_SRST          0x04
+
+/* Device register: LBA addressing, and the second drive on the cable. */
+#define ATA_DEV_LBA            0x40
+#define ATA_DEV_SLAVE          0x10
 
 #define ATA_CMD_READ_PIO       0x20
 #define ATA_CMD_WRITE_PIO      0x30
+#define ATA_CMD_READ_MULTIPLE  0xC4
+#define ATA_CMD_WRITE_MULTIPLE 0xC5
+#define ATA_CMD_SET_MULTIPLE   0xC6
+#define ATA_CMD_READ_DMA       0xC8
+#define ATA_CMD_WRITE_DMA      0xCA
+#define ATA_CMD_READ_PIO_EXT   0x24
+#define ATA_CMD_READ_DMA_EXT   0x25
+#define ATA_CMD_READ_MULT_EXT  0x29
+#define ATA_CMD_WRITE_PIO_EXT  0x34
+#define ATA_CMD_WRITE_DMA_EXT  0x35
+#define ATA_CMD_WRITE_MULT_EXT 0x39
 #define ATA_CMD_CACHE_FLUSH    0xE7
+#define ATA_CMD_CACHE_FLUSH_EXT 0xEA
+#define ATA_CMD_WRITE_MULT_FUA_EXT 0xCE
+#define ATA_CMD_WRITE_DMA_FUA_EXT  0x3D
 #define ATA_CMD_IDENTIFY       0xEC
 
 #define ATA_SR_ERR             0x01
@@ -32,11 +57,107 @@
 #define ATA_TIMEOUT_MS         5000
 #define ATA_POLL_INTERVAL_MS   10
 
-static int ata_present = 0;
-static uint64_t ata_total_sectors = 0;
-static char ata_model[41] = {0};
-static char ata_serial[21] = {0};
-static char ata_firmware[9] = {0};
+/* PCI IDE bus-master registers, relative to BAR4 (BMIDE) plus 8 for the
+ * secondary channel. */
+#define ATA_BM_COMMAND         0
+#define ATA_BM_STATUS          2
+#define ATA_BM_PRDT            4
+#define ATA_BM_CHANNEL_STRIDE  8
+#define ATA_BM_CMD_START       0x01
+#define ATA_BM_CMD_READ        0x08
+#define ATA_BM_SR_ACTIVE       0x01
+#define ATA_BM_SR_ERROR        0x02
+#define ATA_BM_SR_IRQ          0x04
+
+#define ATA_PRD_ENTRIES        513
+#define ATA_PRD_STRIDE         1024
+#define ATA_PRD_EOT            0x8000
+#define ATA_PRD_BOUNDARY       0x10000u
+
+#define ATA_CHANNELS           2
+#define ATA_SECTOR_SIZE        512u
+#define ATA_MULTIPLE_MAX       16u
+#define ATA_MAX_TRANSFER       256u
+#define ATA_MAX_TRANSFER_EXT   65536u
+#define ATA_LBA28_LIMIT        (1u << 28)
+
+/* Physical region descriptor: one piece of the DMA buffer, which must
+ * not cross a 64 KiB boundary. A byte count of 0 means 64 KiB. A table
+ * covers a 65536-sector transfer at any alignment; each channel's table
+ * starts on an 8 KiB boundary, which keeps it from crossing 64 KiB. */
+typedef struct ata_prd {
+    uint32_t address;
+    uint16_t byte_count;
+    uint16_t flags;
+} __attribute__((packed)) ata_prd_t;
+
+typedef struct ata_drive ata_drive_t;
+
+/* One IDE channel. Its two drives share the task file, the interrupt
+ * line and the bus-master engine, so it runs one command at a time.
+ * `active` is the drive whose DMA command was started without waiting;
+ * the request is kept to redo it by PIO if the DMA fails. */
+typedef struct ata_channel {
+    uint16_t io;
+    uint16_t ctrl;
+    uint16_t bmide;
+    ata_prd_t *prdt;
+    int selected;
+    volatile int irq_pending;
+    volatile uint8_t irq_status;
+    uint8_t direction;
+    ata_drive_t *active;
+    void *active_tag;
+    blockdev_request_t active_request;
+    int active_ext;
+    int active_fua;
+    uint64_t active_begin;
+    uint64_t active_start_ms;
+} ata_channel_t;
+
+struct ata_drive {
+    ata_channel_t *channel;
+    uint8_t slave;
+    int present;
+    int lba48;
+    int fua;
+    int dma_capable;
+    uint16_t multiple;
+    int multiple_on;
+    uint64_t total_sectors;
+    char model[41];
+    char serial[21];
+    char firmware[9];
+    blockdev_t blockdev;
+};
+
+static ata_prd_t ata_prdt[ATA_CHANNELS][ATA_PRD_STRIDE] __attribute__((aligned(8192)));
+
+static ata_channel_t ata_channels[ATA_CHANNELS] = {
+    { .io = ATA_PRIMARY_IO, .ctrl = ATA_PRIMARY_CTRL, .prdt = ata_prdt[0], .selected = -1 },
+    { .io = ATA_SECONDARY_IO, .ctrl = ATA_SECONDARY_CTRL, .prdt = ata_prdt[1], .selected = -1 }
+};
+
+/* Named by position: ata0/ata1 are the primary master and slave,
+ * ata2/ata3 the secondary ones. */
+static ata_drive_t ata_drives[ATA_MAX_DRIVES] = {
+    { .channel = &ata_channels[0], .slave = 0, .blockdev = { .name = "ata0" } },
+    { .channel = &ata_channels[0], .slave = 1, .blockdev = { .name = "ata1" } },
+    { .channel = &ata_channels[1], .slave = 0, .blockdev = { .name = "ata2" } },
+    { .channel = &ata_channels[1], .slave = 1, .blockdev = { .name = "ata3" } }
+};
+
+/* The drive behind the single-disk calls (ata_read_sectors and the
+ * like): the first one found. */
+static ata_drive_t *ata_default = NULL;
+static int ata_dma_on = 0;
+static ata_stats_t ata_stats;
+static int ata_irq_mode = 1;
+
+static int ata_blockdev_submit(blockdev_t *dev, const blockdev_request_t *request);
+static int ata_blockdev_start(blockdev_t *dev, const blockdev_request_t *request, void *tag);
+static void ata_blockdev_poll(blockdev_t *dev);
+static void ata_channel_poll(ata_channel_t *channel);
 
 static uint64_t ata_get_time_ms(void) {
     uint32_t freq = pit_current_frequency();
@@ -46,40 +167,151 @@ static uint64_t ata_get_time_ms(void) {
     return pit_ticks() * 1000 / freq;
 }
 
-static int ata_wait_busy_clear(void) {
+/* Time spent in the wait loops is counted apart: the CPU only polls
+ * there, so it is time that could be given to other work. */
+static int ata_wait_busy_clear(ata_channel_t *channel) {
+    uint64_t begin = rdtsc();
     uint64_t start_time = ata_get_time_ms();
     uint8_t status;
-    
+    int result = 0;
+
     do {
-        status = inb(ATA_REG_STATUS);
+        status = inb(channel->io + ATA_REG_STATUS);
         uint64_t elapsed = ata_get_time_ms() - start_time;
         if (elapsed > ATA_TIMEOUT_MS) {
-            return -2; /* Timeout */
+            result = -2; /* Timeout */
+            break;
         }
     } while (status & ATA_SR_BSY);
-    
-    if (status & (ATA_SR_ERR | ATA_SR_DF)) {
-        return -1; /* Error */
+
+    if (result == 0 && (status & (ATA_SR_ERR | ATA_SR_DF))) {
+        result = -1; /* Error */
     }
-    return 0;
+    ata_stats.wait_cycles += rdtsc() - begin;
+    return result;
 }
 
-static int ata_wait_drq(void) {
+static int ata_wait_drq(ata_channel_t *channel) {
+    uint64_t begin = rdtsc();
     uint64_t start_time = ata_get_time_ms();
     uint8_t status;
-    
+    int result = 0;
+
     do {
-        status = inb(ATA_REG_STATUS);
+        status = inb(channel->io + ATA_REG_STATUS);
         if (status & (ATA_SR_ERR | ATA_SR_DF)) {
-            return -1; /* Error */
+            result = -1; /* Error */
+            break;
         }
         uint64_t elapsed = ata_get_time_ms() - start_time;
         if (elapsed > ATA_TIMEOUT_MS) {
-            return -2; /* Timeout */
+            result = -2; /* Timeout */
+            break;
         }
     } while (!(status & ATA_SR_DRQ));
-    
-    return 0;
+
+    ata_stats.wait_cycles += rdtsc() - begin;
+    return result;
+}
+
+/* Called from the IRQ14/IRQ15 handlers. Reading the status register
+ * acknowledges the drive's interrupt. */
+void ata_handle_irq(uint8_t channel) {
+    if (channel >= ATA_CHANNELS) {
+        return;
+    }
+    ata_channels[channel].irq_status = inb(ata_channels[channel].io + ATA_REG_STATUS);
+    ata_channels[channel].irq_pending = 1;
+    ata_stats.irqs++;
+}
+
+/* Interrupt completion needs the handler to be able to run; with
+ * interrupts off (or switched off by the user) the driver polls. */
+static int ata_irq_usable(void) {
+    return ata_irq_mode && interrupts_enabled();
+}
+
+/* Software reset of the channel, used to recover from a request that
+ * never completed. */
+static void ata_reset(ata_channel_t *channel) {
+    outb(channel->ctrl, ATA_CTRL_SRST);
+    for (int i = 0; i < 4; ++i) {
+        io_wait();
+    }
+    outb(channel->ctrl, 0x00);
+    uint64_t start_time = ata_get_time_ms();
+    while ((inb(channel->io + ATA_REG_STATUS) & ATA_SR_BSY) && ata_get_time_ms() - start_time < ATA_TIMEOUT_MS) {
+    }
+    channel->selected = -1;
+    channel->irq_pending = 0;
+}
+
+/* Sleeps until the drive raises its interrupt for the current step. The
+ * flag is tested with interrupts off and `sti; hlt` is atomic, so an
+ * interrupt cannot slip in between the test and the halt. */
+static int ata_wait_irq(ata_channel_t *channel) {
+    uint64_t begin = rdtsc();
+    uint64_t start_time = ata_get_time_ms();
+    int result = 0;
+
+    for (;;) {
+        __asm__ volatile("cli");
+        if (channel->irq_pending) {
+            channel->irq_pending = 0;
+            __asm__ volatile("sti");
+            break;
+        }
+        if (ata_get_time_ms() - start_time > ATA_TIMEOUT_MS) {
+            __asm__ volatile("sti");
+            result = -2;
+            break;
+        }
+        __asm__ volatile("sti; hlt");
+    }
+
+    ata_stats.wait_cycles += rdtsc() - begin;
+    if (result != 0) {
+        ata_stats.timeouts++;
+        ata_reset(channel);
+        return result;
+    }
+    return (channel->irq_status & (ATA_SR_ERR | ATA_SR_DF)) ? -1 : 0;
+}
+
+/* Waits for the bus master to finish: the engine goes inactive, or the
+ * drive raises its interrupt line, or either reports an error. */
+static int ata_wait_dma(ata_channel_t *channel) {
+    uint64_t begin = rdtsc();
+    uint64_t start_time = ata_get_time_ms();
+    int result = 0;
+
+    for (;;) {
+        uint8_t bm_status = inb(channel->bmide + ATA_BM_STATUS);
+        if (bm_status & ATA_BM_SR_ERROR) {
+            result = -1;
+            break;
+        }
+        if (!(bm_status & ATA_BM_SR_ACTIVE) || (bm_status & ATA_BM_SR_IRQ)) {
+            break;
+        }
+        if (ata_get_time_ms() - start_time > ATA_TIMEOUT_MS) {
+            result = -2;
+            break;
+        }
+        __asm__ volatile("pause");
+    }
+
+    ata_stats.wait_cycles += rdtsc() - begin;
+    return result;
+}
+
+/* A command for one drive must wait for the channel's background DMA,
+ * whichever drive it belongs to. */
+static void ata_channel_drain(ata_channel_t *channel) {
+    while (channel->active) {
+        ata_channel_poll(channel);
+        __asm__ volatile("pause");
+    }
 }
 
 static void ata_swap_string(char *str, size_t len) {
@@ -97,169 +329,704 @@ static void ata_swap_string(char *str, size_t len) {
     }
 }
 
-static void ata_select_drive(uint32_t lba) {
-    outb(ATA_REG_HDDEVSEL, 0xE0 | ((lba >> 24) & 0x0F));
+/* Writes the device register. After switching to the other drive the
+ * status register is valid only 400 ns later; four reads of the
+ * alternate status register take that long. */
+static void ata_select(ata_drive_t *drive, uint8_t value) {
+    ata_channel_t *channel = drive->channel;
+    outb(channel->io + ATA_REG_HDDEVSEL, value | (drive->slave ? ATA_DEV_SLAVE : 0));
+    if (channel->selected != drive->slave) {
+        for (int i = 0; i < 4; ++i) {
+            (void)inb(channel->ctrl);
+        }
+        channel->selected = drive->slave;
+    }
 }
 
-void ata_init(void) {
-    ata_present = 0;
-    ata_total_sectors = 0;
-    memset(ata_model, 0, sizeof(ata_model));
-    memset(ata_serial, 0, sizeof(ata_serial));
-    memset(ata_firmware, 0, sizeof(ata_firmware));
-    
-    outb(ATA_REG_CONTROL, 0x00);
-    ata_select_drive(0);
-    outb(ATA_REG_SECCOUNT0, 0);
-    outb(ATA_REG_LBA0, 0);
-    outb(ATA_REG_LBA1, 0);
-    outb(ATA_REG_LBA2, 0);
-    outb(ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
-
-    uint8_t status = inb(ATA_REG_STATUS);
-    if (status == 0) {
+static void ata_select_drive(ata_drive_t *drive, uint32_t lba) {
+    ata_select(drive, 0xE0 | ((lba >> 24) & 0x0F));
+}
+
+/* Switches the drive to multiple mode with the largest power of two up to
+ * ATA_MULTIPLE_MAX sectors per DRQ block that it supports. */
+static void ata_multiple_init(ata_drive_t *drive, uint16_t max_sectors) {
+    drive->multiple = 1;
+    drive->multiple_on = 0;
+    uint16_t block = 1;
+    while (block * 2 <= max_sectors && block * 2 <= ATA_MULTIPLE_MAX) {
+        block *= 2;
+    }
+    if (block < 2) {
         return;
     }
 
+    ata_select_drive(drive, 0);
+    outb(drive->channel->io + ATA_REG_SECCOUNT0, (uint8_t)block);
+    outb(drive->channel->io + ATA_REG_COMMAND, ATA_CMD_SET_MULTIPLE);
+    if (ata_wait_busy_clear(drive->channel) != 0) {
+        return;
+    }
+    drive->multiple = block;
+    drive->multiple_on = 1;
+}
+
+static int ata_drive_dma(const ata_drive_t *drive) {
+    return ata_dma_on && drive->dma_capable && drive->channel->bmide != 0;
+}
+
+/* Takes the first PCI IDE controller for its bus-master register block:
+ * eight ports of BAR4 per channel. */
+static int ata_ide_probe(const pci_device_t *ide) {
+    uint32_t bar4 = pci_bar(ide, 4);
+    if (ata_channels[0].bmide != 0 || !(bar4 & 1) || (bar4 & 0xFFFC) == 0) {
+        return -1;
+    }
+    pci_enable(ide, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+    for (size_t i = 0; i < ATA_CHANNELS; ++i) {
+        ata_channels[i].bmide = (uint16_t)((bar4 & 0xFFFC) + i * ATA_BM_CHANNEL_STRIDE);
+    }
+    ata_dma_on = 1;
+    return 0;
+}
+
+static const pci_driver_t ata_ide_driver = {
+    .name = "ata",
+    .vendor_id = PCI_ANY_ID,
+    .device_id = PCI_ANY_ID,
+    .class_code = 0x01,
+    .subclass = 0x01,
+    .probe = ata_ide_probe
+};
+
+static void ata_dma_init(void) {
+    int capable = 0;
+    for (size_t i = 0; i < ATA_MAX_DRIVES; ++i) {
+        capable |= ata_drives[i].present && ata_drives[i].dma_capable;
+    }
+    ata_dma_on = 0;
+    if (capable) {
+        pci_register_driver(&ata_ide_driver);
+    }
+}
+
+/* Reads IDENTIFY DEVICE into `buffer`. Fails for an empty position and
+ * for ATAPI or SATA signatures, which leave LBA1/LBA2 non-zero. */
+static int ata_identify(ata_drive_t *drive, uint16_t *buffer) {
+    ata_channel_t *channel = drive->channel;
+    ata_select(drive, 0xA0);
+    outb(channel->io + ATA_REG_SECCOUNT0, 0);
+    outb(channel->io + ATA_REG_LBA0, 0);
+    outb(channel->io + ATA_REG_LBA1, 0);
+    outb(channel->io + ATA_REG_LBA2, 0);
+    outb(channel->io + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+
+    uint8_t status = inb(channel->io + ATA_REG_STATUS);
+    if (status == 0) {
+        return -1;
+    }
+
     uint64_t start_time = ata_get_time_ms();
     while (status & ATA_SR_BSY) {
-        status = inb(ATA_REG_STATUS);
+        status = inb(channel->io + ATA_REG_STATUS);
         uint64_t elapsed = ata_get_time_ms() - start_time;
         if (elapsed > ATA_TIMEOUT_MS) {
-            return; /* Timeout */
+            return -1; /* Timeout */
         }
     }
 
-    uint8_t lba1 = inb(ATA_REG_LBA1);
-    uint8_t lba2 = inb(ATA_REG_LBA2);
+    uint8_t lba1 = inb(channel->io + ATA_REG_LBA1);
+    uint8_t lba2 = inb(channel->io + ATA_REG_LBA2);
     if (lba1 != 0 || lba2 != 0) {
-        return; /* Not ATA */
+        return -1; /* Not ATA */
     }
 
     start_time = ata_get_time_ms();
     while (!(status & ATA_SR_DRQ) && !(status & ATA_SR_ERR)) {
-        status = inb(ATA_REG_STATUS);
+        status = inb(channel->io + ATA_REG_STATUS);
         uint64_t elapsed = ata_get_time_ms() - start_time;
         if (elapsed > ATA_TIMEOUT_MS) {
-            return; /* Timeout */
+            return -1; /* Timeout */
         }
     }
 
     if (status & ATA_SR_ERR) {
-        return;
+        return -1;
     }
 
+    insw(channel->io + ATA_REG_DATA, buffer, 256);
+    return 0;
+}
+
+static void ata_probe(ata_drive_t *drive) {
     uint16_t buffer[256];
-    insw(ATA_REG_DATA, buffer, 256);
-    
+    drive->present = 0;
+    drive->total_sectors = 0;
+    memset(drive->model, 0, sizeof(drive->model));
+    memset(drive->serial, 0, sizeof(drive->serial));
+    memset(drive->firmware, 0, sizeof(drive->firmware));
+    if (ata_identify(drive, buffer) != 0) {
+        return;
+    }
+
     /* Extract disk information from IDENTIFY data */
     /* Model name (words 27-46) */
-    memcpy(ata_model, &buffer[27], 40);
-    ata_swap_string(ata_model, 40);
-    
+    memcpy(drive->model, &buffer[27], 40);
+    ata_swap_string(drive->model, 40);
+
     /* Serial number (words 10-19) */
-    memcpy(ata_serial, &buffer[10], 20);
-    ata_swap_string(ata_serial, 20);
-    
+    memcpy(drive->serial, &buffer[10], 20);
+    ata_swap_string(drive->serial, 20);
+
     /* Firmware revision (words 23-26) */
-    memcpy(ata_firmware, &buffer[23], 8);
-    ata_swap_string(ata_firmware, 8);
-    
+    memcpy(drive->firmware, &buffer[23], 8);
+    ata_swap_string(drive->firmware, 8);
+
     /* Total sectors (words 60-61 for LBA28, or 100-103 for LBA48) */
-    if (buffer[83] & 0x400) {
+    drive->lba48 = (buffer[83] & 0x400) != 0;
+    if (drive->lba48) {
         /* LBA48 supported */
-        ata_total_sectors = ((uint64_t)buffer[103] << 48) |
-                           ((uint64_t)buffer[102] << 32) |
-                           ((uint64_t)buffer[101] << 16) |
-                           (uint64_t)buffer[100];
+        drive->total_sectors = ((uint64_t)buffer[103] << 48) |
+                               ((uint64_t)buffer[102] << 32) |
+                               ((uint64_t)buffer[101] << 16) |
+                               (uint64_t)buffer[100];
     } else {
         /* LBA28 */
-        ata_total_sectors = ((uint32_t)buffer[61] << 16) | (uint32_t)buffer[60];
+        drive->total_sectors = ((uint32_t)buffer[61] << 16) | (uint32_t)buffer[60];
+    }
+
+    drive->present = 1;
+
+    /* Word 47, low byte: the most sectors the drive moves per DRQ block. */
+    ata_multiple_init(drive, buffer[47] & 0xFF);
+
+    /* Word 49 bit 8: the drive supports DMA transfers. */
+    drive->dma_capable = (buffer[49] & 0x100) != 0;
+
+    /* Word 84 bit 6: WRITE DMA FUA EXT and WRITE MULTIPLE FUA EXT. */
+    drive->fua = drive->lba48 && (buffer[84] & 0x40) != 0;
+}
+
+/* Only one command runs per channel, so start() reports busy while the
+ * channel has one in flight; drives on different channels overlap. */
+static void ata_register(ata_drive_t *drive) {
+    blockdev_t *dev = &drive->blockdev;
+    dev->driver = ata_drive_dma(drive) ? "ata-dma" : "ata-pio";
+    dev->sector_size = ATA_SECTOR_SIZE;
+    dev->features = drive->fua ? BLOCKDEV_FEATURE_FUA : 0;
+    dev->submit = ata_blockdev_submit;
+    dev->start = ata_blockdev_start;
+    dev->poll = ata_blockdev_poll;
+    dev->driver_data = drive;
+
+    /* Without LBA48 commands, sectors past 2^28 are unreachable. */
+    if (drive->lba48) {
+        dev->sector_count = drive->total_sectors;
+        dev->max_transfer = ATA_MAX_TRANSFER_EXT;
+    } else {
+        dev->sector_count = (drive->total_sectors < ATA_LBA28_LIMIT) ? drive->total_sectors : ATA_LBA28_LIMIT;
+        dev->max_transfer = ATA_MAX_TRANSFER;
+    }
+    if (!blockdev_find(dev->name)) {
+        blockdev_register(dev);
+    }
+}
+
+/* Probes master and slave on both channels. A channel whose status reads
+ * 0xFF has nothing attached (the bus floats high). */
+void ata_init(void) {
+    ata_default = NULL;
+    for (size_t i = 0; i < ATA_CHANNELS; ++i) {
+        ata_channels[i].bmide = 0;
+        ata_channels[i].active = NULL;
+        ata_channels[i].selected = -1;
+        outb(ata_channels[i].ctrl, 0x00);
+    }
+    for (size_t i = 0; i < ATA_MAX_DRIVES; ++i) {
+        ata_drive_t *drive = &ata_drives[i];
+        drive->present = 0;
+        if (inb(drive->channel->io + ATA_REG_STATUS) == 0xFF) {
+            continue;
+        }
+        ata_probe(drive);
+        if (drive->present && !ata_default) {
+            ata_default = drive;
+        }
+    }
+
+    ata_dma_init();
+    for (size_t i = 0; i < ATA_MAX_DRIVES; ++i) {
+        if (ata_drives[i].present) {
+            ata_register(&ata_drives[i]);
+        }
     }
-    
-    ata_present = 1;
 }
 
 int ata_is_available(void) {
-    return ata_present;
+    return ata_default != NULL;
 }
 
-static int ata_transfer(uint32_t lba, uint16_t sector_count, void *buffer, int write) {
-    if (!ata_present || sector_count == 0 || buffer == NULL) {
+/* Programs the task file. EXT commands take a 48-bit LBA and a 16-bit
+ * count through the same registers, high-order bytes written first; a
+ * count of 0 means 256 sectors, or 65536 for EXT commands. */
+static void ata_issue(ata_drive_t *drive, uint8_t command, uint64_t lba, uint32_t chunk, int ext) {
+    uint16_t io = drive->channel->io;
+    if (ext) {
+        ata_select(drive, ATA_DEV_LBA);
+        outb(io + ATA_REG_SECCOUNT0, (uint8_t)(chunk >> 8));
+        outb(io + ATA_REG_LBA0, (uint8_t)(lba >> 24));
+        outb(io + ATA_REG_LBA1, (uint8_t)(lba >> 32));
+        outb(io + ATA_REG_LBA2, (uint8_t)(lba >> 40));
+        ata_stats.ext_commands++;
+    } else {
+        ata_select_drive(drive, (uint32_t)lba);
+    }
+    outb(io + ATA_REG_SECCOUNT0, (uint8_t)chunk);
+    outb(io + ATA_REG_LBA0, (uint8_t)(lba & 0xFF));
+    outb(io + ATA_REG_LBA1, (uint8_t)((lba >> 8) & 0xFF));
+    outb(io + ATA_REG_LBA2, (uint8_t)((lba >> 16) & 0xFF));
+    outb(io + ATA_REG_COMMAND, command);
+}
+
+/* In interrupt mode the drive interrupts once per DRQ block: when a read
+ * block is ready, and when a written block has been taken (the first
+ * write block is sent on DRQ alone). The status checks that follow an
+ * interrupt then return at once. In multiple mode a block is up to
+ * drive->multiple sectors instead of one. */
+static int ata_transfer_pio(ata_drive_t *drive, uint64_t lba, uint32_t chunk, uint8_t *buffer, int write, int ext,
+                            int fua) {
+    ata_channel_t *channel = drive->channel;
+    int irq = ata_irq_usable();
+    uint32_t block = drive->multiple_on ? drive->multiple : 1;
+    uint8_t command;
+    if (fua && block > 1) {
+        command = ATA_CMD_WRITE_MULT_FUA_EXT;
+    } else if (block > 1) {
+        command = write ? (ext ? ATA_CMD_WRITE_MULT_EXT : ATA_CMD_WRITE_MULTIPLE)
+                        : (ext ? ATA_CMD_READ_MULT_EXT : ATA_CMD_READ_MULTIPLE);
+    } else {
+        command = write ? (ext ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_WRITE_PIO)
+                        : (ext ? ATA_CMD_READ_PIO_EXT : ATA_CMD_READ_PIO);
+    }
+
+    channel->irq_pending = 0;
+    ata_issue(drive, command, lba, chunk, ext);
+    for (uint32_t done = 0; done < chunk;) {
+        uint32_t sectors = (chunk - done > block) ? block : chunk - done;
+        if (irq && (!write || done > 0) && ata_wait_irq(channel) != 0) {
+            return -1;
+        }
+        if (ata_wait_busy_clear(channel) != 0 || ata_wait_drq(channel) != 0) {
+            return -1;
+        }
+        if (write) {
+            outsw(channel->io + ATA_REG_DATA, buffer, (size_t)sectors * 256);
+        } else {
+            insw(channel->io + ATA_REG_DATA, buffer, (size_t)sectors * 256);
+        }
+        buffer += (size_t)sectors * ATA_SECTOR_SIZE;
+        done += sectors;
+        ata_stats.pio_blocks++;
+    }
+    if (write && irq && ata_wait_irq(channel) != 0) {
+        return -1;
+    }
+    ata_stats.pio_commands++;
+    return 0;
+}
+
+static int ata_flush_cache(ata_drive_t *drive) {
+    ata_channel_drain(drive->channel);
+    int irq = ata_irq_usable();
+    drive->channel->irq_pending = 0;
+    ata_select(drive, 0xE0);
+    outb(drive->channel->io + ATA_REG_COMMAND, drive->lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+    if (irq && ata_wait_irq(drive->channel) != 0) {
+        return -1;
+    }
+    return ata_wait_busy_clear(drive->channel);
+}
+
+/* Describes `buffer` in the channel's PRD table. The kernel's memory is
+ * identity mapped, so addresses are physical; they must be below 4 GiB
+ * and even. */
+static int ata_build_prdt(ata_prd_t *prdt, uint8_t *buffer, uint32_t bytes) {
+    uintptr_t address = (uintptr_t)buffer;
+    if ((address & 1) || address + bytes > 0x100000000ull) {
+        return -1;
+    }
+    size_t entry = 0;
+    while (bytes > 0) {
+        if (entry == ATA_PRD_ENTRIES) {
+            return -1;
+        }
+        uint32_t piece = ATA_PRD_BOUNDARY - (uint32_t)(address & (ATA_PRD_BOUNDARY - 1));
+        if (piece > bytes) {
+            piece = bytes;
+        }
+        prdt[entry].address = (uint32_t)address;
+        prdt[entry].byte_count = (uint16_t)piece;
+        prdt[entry].flags = 0;
+        address += piece;
+        bytes -= piece;
+        ++entry;
+    }
+    prdt[entry - 1].flags = ATA_PRD_EOT;
+    return 0;
+}
+
+/* Programs the bus master and issues the command, leaving the transfer
+ * running. Returns 0 once started, -1 on failure, or 1 if the buffer
+ * cannot be used for DMA and the caller should fall back to PIO. */
+static int ata_dma_start(ata_drive_t *drive, uint64_t lba, uint32_t chunk, uint8_t *buffer, int write, int ext,
+                         int fua) {
+    ata_channel_t *channel = drive->channel;
+    if (ata_build_prdt(channel->prdt, buffer, chunk * ATA_SECTOR_SIZE) != 0) {
+        return 1;
+    }
+    channel->direction = write ? 0 : ATA_BM_CMD_READ;
+    outb(channel->bmide + ATA_BM_COMMAND, 0);
+    outl(channel->bmide + ATA_BM_PRDT, (uint32_t)(uintptr_t)channel->prdt);
+    /* Error and interrupt bits are cleared by writing ones. */
+    outb(channel->bmide + ATA_BM_STATUS, inb(channel->bmide + ATA_BM_STATUS) | ATA_BM_SR_ERROR | ATA_BM_SR_IRQ);
+    outb(channel->bmide + ATA_BM_COMMAND, channel->direction);
+    if (ata_wait_busy_clear(channel) != 0) {
+        return -1;
+    }
+
+    channel->irq_pending = 0;
+    uint8_t command;
+    if (fua) {
+        command = ATA_CMD_WRITE_DMA_FUA_EXT;
+    } else if (write) {
+        command = ext ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA;
+    } else {
+        command = ext ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA;
+    }
+    ata_issue(drive, command, lba, chunk, ext);
+    __asm__ volatile("" : : : "memory");
+    outb(channel->bmide + ATA_BM_COMMAND, channel->direction | ATA_BM_CMD_START);
+    return 0;
+}
+
+/* Stops the engine once the transfer is over, with `result` from the
+ * wait, and reports the final drive status. */
+static int ata_dma_finish(ata_channel_t *channel, int result) {
+    outb(channel->bmide + ATA_BM_COMMAND, channel->direction);
+    __asm__ volatile("" : : : "memory");
+
+    if (result == 0 && ata_wait_busy_clear(channel) != 0) {
+        result = -1;
+    }
+    outb(channel->bmide + ATA_BM_STATUS, inb(channel->bmide + ATA_BM_STATUS) | ATA_BM_SR_ERROR | ATA_BM_SR_IRQ);
+    if (result == 0) {
+        ata_stats.dma_commands++;
+    }
+    return result;
+}
+
+static int ata_transfer_dma(ata_drive_t *drive, uint64_t lba, uint32_t chunk, uint8_t *buffer, int write, int ext,
+                            int fua) {
+    int irq = ata_irq_usable();
+    int result = ata_dma_start(drive, lba, chunk, buffer, write, ext, fua);
+    if (result != 0) {
+        return result;
+    }
+    result = irq ? ata_wait_irq(drive->channel) : 0;
+    if (result == 0) {
+        /* Once the drive has interrupted this only confirms the engine
+         * stopped and reports bus-master errors. */
+        result = ata_wait_dma(drive->channel);
+    }
+    return ata_dma_finish(drive->channel, result);
+}
+
+/* Each command takes as much as the addressing allows. EXT commands are
+ * used only where needed: for ranges past 2^28 or longer than 256
+ * sectors, or for FUA writes, which exist only in EXT form.
+ *
+ * Writes stay in the drive's cache; durability comes from explicit
+ * flushes (BLOCKDEV_FLUSH) or FUA. A FUA write that cannot use a FUA
+ * command (single-sector PIO) is followed by one flush at the end. */
+static int ata_transfer(ata_drive_t *drive, uint64_t lba, uint32_t sector_count, void *buffer, int write, int fua) {
+    if (!drive || !drive->present || sector_count == 0 || buffer == NULL) {
         return -1;
     }
 
+    ata_channel_drain(drive->channel);
+    uint64_t begin = rdtsc();
     uint32_t remaining = sector_count;
     uint8_t *byte_buffer = (uint8_t *)buffer;
+    uint32_t limit = drive->lba48 ? ATA_MAX_TRANSFER_EXT : ATA_MAX_TRANSFER;
+    int result = 0;
+    int flush_after = 0;
+    fua = fua && write && drive->fua;
+
+    while (remaining > 0 && result == 0) {
+        uint32_t chunk = (remaining > limit) ? limit : remaining;
+        int ext = fua || chunk > ATA_MAX_TRANSFER || lba + chunk > ATA_LBA28_LIMIT;
+        if (ext && !drive->lba48) {
+            result = -1;
+            break;
+        }
+
+        int dma_result = ata_drive_dma(drive) ? ata_transfer_dma(drive, lba, chunk, byte_buffer, write, ext, fua) : 1;
+        if (dma_result < 0) {
+            /* Keep the data safe: drop to PIO for good and redo the chunk. */
+            ata_stats.dma_errors++;
+            ata_set_dma(0);
+        }
+        if (dma_result != 0) {
+            result = ata_transfer_pio(drive, lba, chunk, byte_buffer, write, ext, fua);
+            flush_after |= fua && !drive->multiple_on;
+        }
+
+        byte_buffer += (size_t)chunk * ATA_SECTOR_SIZE;
+        lba += chunk;
+        remaining -= chunk;
+    }
+
+    if (result == 0 && flush_after) {
+        result = ata_flush_cache(drive);
+    }
+    ata_stats.cycles += rdtsc() - begin;
+    return result;
+}
+
+int ata_read_sectors(uint64_t lba, uint32_t sector_count, void *buffer) {
+    return ata_transfer(ata_default, lba, sector_count, buffer, 0, 0);
+}
+
+int ata_write_sectors(uint64_t lba, uint32_t sector_count, const void *buffer) {
+    return ata_transfer(ata_default, lba, sector_count, (void *)buffer, 1, 0);
+}
+
+static int ata_drive_flush(ata_drive_t *drive) {
+    if (!drive || !drive->present) {
+        return -1;
+    }
+    uint64_t begin = rdtsc();
+    int result = ata_flush_cache(drive);
+    ata_stats.cycles += rdtsc() - begin;
+    return result;
+}
+
+int ata_flush(void) {
+    return ata_drive_flush(ata_default);
+}
+
+static int ata_blockdev_submit(blockdev_t *dev, const blockdev_request_t *request) {
+    ata_drive_t *drive = (ata_drive_t *)dev->driver_data;
+    switch (request->op) {
+    case BLOCKDEV_READ:
+        return ata_transfer(drive, request->lba, request->count, request->buffer, 0, 0);
+    case BLOCKDEV_WRITE:
+        return ata_transfer(drive, request->lba, request->count, request->buffer, 1,
+                            (request->flags & BLOCKDEV_REQ_FUA) != 0);
+    case BLOCKDEV_FLUSH:
+        return ata_drive_flush(drive);
+    default:
+        return -1;
+    }
+}
+
+/* Starts a DMA command and returns without waiting, so that the other
+ * channel can work at the same time. Requests that cannot go by DMA are
+ * carried out at once through submit. */
+static int ata_blockdev_start(blockdev_t *dev, const blockdev_request_t *request, void *tag) {
+    ata_drive_t *drive = (ata_drive_t *)dev->driver_data;
+    ata_channel_t *channel = drive->channel;
+    if (channel->active) {
+        return 1;
+    }
+
+    int write = request->op == BLOCKDEV_WRITE;
+    int fua = write && (request->flags & BLOCKDEV_REQ_FUA) && drive->fua;
+    int ext = fua || request->count > ATA_MAX_TRANSFER || request->lba + request->count > ATA_LBA28_LIMIT;
+    int result = 1;
+    uint64_t begin = rdtsc();
+    if (ata_drive_dma(drive) && request->op != BLOCKDEV_FLUSH && (!ext || drive->lba48)) {
+        result = ata_dma_start(drive, request->lba, request->count, (uint8_t *)request->buffer, write, ext, fua);
+    }
+    if (result < 0) {
+        ata_stats.dma_errors++;
+        ata_set_dma(0);
+    }
+    if (result != 0) {
+        blockdev_complete(dev, tag, ata_blockdev_submit(dev, request));
+        return 0;
+    }
 
-    while (remaining > 0) {
-        uint16_t chunk = (remaining > 256) ? 256 : (uint16_t)remaining;
-        uint8_t sector_value = (chunk == 256) ? 0 : (uint8_t)chunk;
-
-        ata_select_drive(lba);
-        outb(ATA_REG_SECCOUNT0, sector_value);
-        outb(ATA_REG_LBA0, (uint8_t)(lba & 0xFF));
-        outb(ATA_REG_LBA1, (uint8_t)((lba >> 8) & 0xFF));
-        outb(ATA_REG_LBA2, (uint8_t)((lba >> 16) & 0xFF));
-        outb(ATA_REG_COMMAND, write ? ATA_CMD_WRITE_PIO : ATA_CMD_READ_PIO);
-
-        uint16_t sectors_to_process = (chunk == 256) ? 256 : chunk;
-        for (uint16_t i = 0; i < sectors_to_process; ++i) {
-            if (write) {
-                if (ata_wait_busy_clear() != 0 || ata_wait_drq() != 0) {
-                    return -1;
-                }
-                outsw(ATA_REG_DATA, byte_buffer, 256);
-            } else {
-                if (ata_wait_busy_clear() != 0 || ata_wait_drq() != 0) {
-                    return -1;
-                }
-                insw(ATA_REG_DATA, byte_buffer, 256);
+    channel->active = drive;
+    channel->active_tag = tag;
+    channel->active_request = *request;
+    channel->active_ext = ext;
+    channel->active_fua = fua;
+    channel->active_begin = begin;
+    channel->active_start_ms = ata_get_time_ms();
+    return 0;
+}
+
+/* Completes the channel's background command if the bus master is done
+ * with it or it has run out of time. A failed DMA drops the driver to
+ * PIO, as in ata_transfer, and the request is redone that way. */
+static void ata_channel_poll(ata_channel_t *channel) {
+    ata_drive_t *drive = channel->active;
+    if (!drive) {
+        return;
+    }
+    int result;
+    uint8_t bm_status = inb(channel->bmide + ATA_BM_STATUS);
+    if ((bm_status & (ATA_BM_SR_ERROR | ATA_BM_SR_IRQ)) || !(bm_status & ATA_BM_SR_ACTIVE)) {
+        result = (bm_status & ATA_BM_SR_ERROR) ? -1 : 0;
+        if (channel->irq_pending) {
+            channel->irq_pending = 0;
+            if (channel->irq_status & (ATA_SR_ERR | ATA_SR_DF)) {
+                result = -1;
             }
-            byte_buffer += 512;
         }
+    } else if (ata_get_time_ms() - channel->active_start_ms > ATA_TIMEOUT_MS) {
+        result = -2;
+        ata_stats.timeouts++;
+        ata_reset(channel);
+    } else {
+        return;
+    }
 
-        if (write) {
-            outb(ATA_REG_COMMAND, ATA_CMD_CACHE_FLUSH);
-            ata_wait_busy_clear();
+    result = ata_dma_finish(channel, result);
+    channel->active = NULL;
+    const blockdev_request_t *request = &channel->active_request;
+    if (result != 0) {
+        ata_stats.dma_errors++;
+        ata_set_dma(0);
+        result = ata_transfer_pio(drive, request->lba, request->count, (uint8_t *)request->buffer,
+                                  request->op == BLOCKDEV_WRITE, channel->active_ext, channel->active_fua);
+        if (result == 0 && channel->active_fua && !drive->multiple_on) {
+            result = ata_flush_cache(drive);
+        }
+    }
+    ata_stats.cycles += rdtsc() - channel->active_begin;
+    blockdev_complete(&drive->blockdev, channel->active_tag, result);
+}
+
+/* With interrupt completion the CPU sleeps until the next interrupt
+ * rather than spinning on the bus-master status. */
+static void ata_blockdev_poll(blockdev_t *dev) {
+    ata_channel_t *channel = ((ata_drive_t *)dev->driver_data)->channel;
+    if (channel->active && ata_irq_usable()) {
+        __asm__ volatile("cli");
+        if (channel->irq_pending) {
+            __asm__ volatile("sti");
+        } else {
+            __asm__ volatile("sti; hlt");
+        }
+    }
+    ata_channel_poll(channel);
+}
+
+size_t ata_drive_count(void) {
+    size_t count = 0;
+    for (size_t i = 0; i < ATA_MAX_DRIVES; ++i) {
+        count += ata_drives[i].present ? 1 : 0;
+    }
+    return count;
+}
+
+int ata_get_drive_info(size_t index, ata_drive_info_t *info) {
+    for (size_t i = 0; i < ATA_MAX_DRIVES && info; ++i) {
+        const ata_drive_t *drive = &ata_drives[i];
+        if (!drive->present || index-- != 0) {
+            continue;
         }
+        info->name = drive->blockdev.name;
+        info->model = drive->model;
+        info->serial = drive->serial;
+        info->firmware = drive->firmware;
+        info->sectors = drive->blockdev.sector_count;
+        info->channel = (uint8_t)(drive->channel - ata_channels);
+        info->slave = drive->slave;
+        info->lba48 = drive->lba48;
+        info->dma = ata_drive_dma(drive);
+        return 0;
+    }
+    return -1;
+}
 
-        lba += sectors_to_process;
-        remaining -= sectors_to_process;
+int ata_dma_available(void) {
+    for (size_t i = 0; i < ATA_MAX_DRIVES; ++i) {
+        const ata_drive_t *drive = &ata_drives[i];
+        if (drive->present && drive->dma_capable && drive->channel->bmide != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int ata_dma_enabled(void) {
+    return ata_dma_on;
+}
+
+int ata_set_dma(int enabled) {
+    if (enabled && !ata_dma_available()) {
+        return -1;
     }
+    ata_dma_on = enabled ? 1 : 0;
+    for (size_t i = 0; i < ATA_MAX_DRIVES; ++i) {
+        ata_drives[i].blockdev.driver = ata_drive_dma(&ata_drives[i]) ? "ata-dma" : "ata-pio";
+    }
+    return 0;
+}
+
+uint16_t ata_multiple_sectors(void) {
+    return (ata_default && ata_default->multiple_on) ? ata_default->multiple : 1;
+}
 
+int ata_set_multiple(int enabled) {
+    if (enabled && (!ata_default || ata_default->multiple < 2)) {
+        return -1;
+    }
+    for (size_t i = 0; i < ATA_MAX_DRIVES; ++i) {
+        ata_drives[i].multiple_on = enabled && ata_drives[i].multiple >= 2;
+    }
     return 0;
 }
 
-int ata_read_sectors(uint32_t lba, uint16_t sector_count, void *buffer) {
-    return ata_transfer(lba, sector_count, buffer, 0);
+int ata_irq_enabled(void) {
+    return ata_irq_mode;
 }
 
-int ata_write_sectors(uint32_t lba, uint16_t sector_count, const void *buffer) {
-    return ata_transfer(lba, sector_count, (void *)buffer, 1);
+void ata_set_irq(int enabled) {
+    ata_irq_mode = enabled ? 1 : 0;
+}
+
+void ata_get_stats(ata_stats_t *stats) {
+    if (stats) {
+        *stats = ata_stats;
+    }
+}
+
+int ata_lba48_supported(void) {
+    return ata_default && ata_default->lba48;
 }
 
 uint64_t ata_get_total_sectors(void) {
-    return ata_total_sectors;
+    return ata_default ? ata_default->total_sectors : 0;
 }
 
 const char *ata_get_model(void) {
-    return ata_present ? ata_model : NULL;
+    return ata_default ? ata_default->model : NULL;
 }
 
 const char *ata_get_serial(void) {
-    return ata_present ? ata_serial : NULL;
+    return ata_default ? ata_default->serial : NULL;
 }
 
 const char *ata_get_firmware(void) {
-    return ata_present ? ata_firmware : NULL;
+    return ata_default ? ata_default->firmware : NULL;
 }
 
 int ata_get_last_error(void) {
-    if (!ata_present) {
+    if (!ata_default) {
         return -1;
     }
-    return (int)inb(ATA_REG_ERROR);
+    return (int)inb(ata_default->channel->io + ATA_REG_ERROR);
 }
-
-
@@ -0,0 +1,651 @@
+#include <bcache.h>
+#include <memory.h>
+#include <pit.h>
+#include <string.h>
+
+#define BCACHE_BLOCK_SIZE       512u
+#define BCACHE_BLOCKS           128u
+#define BCACHE_BUCKETS          64u
+#define BCACHE_BYPASS_SECTORS   32u
+#define BCACHE_WRITEBACK_AGE_MS 5000u
+#define BCACHE_STREAMS          4u
+#define BCACHE_RA_MIN           4u
+#define BCACHE_RA_INITIAL       8u
+#define BCACHE_RA_MAX           32u
+#define BCACHE_NO_STREAM        0xFFu
+
+/* One cached sector. Blocks are found through a hash of (device, LBA) and
+ * recycled by a CLOCK hand. Dirty blocks are written back through the
+ * device queue, which merges neighbours into larger transfers. */
+typedef struct bcache_block {
+    struct bcache_block *hash_next;
+    blockdev_t *dev;
+    uint64_t lba;
+    uint64_t dirty_since;
+    uint8_t valid;
+    uint8_t dirty;
+    uint8_t referenced;
+    uint8_t queued;
+    uint8_t prefetched; /* filled by read-ahead and not read since */
+    uint8_t stream;
+    blockdev_io_t io;
+    uint8_t data[BCACHE_BLOCK_SIZE];
+} bcache_block_t;
+
+/* A sequential reader: a read that starts at (or one sector before,
+ * since neighbouring records share a sector) where the last one ended,
+ * or inside what was read ahead for it, continues the stream. Read-ahead
+ * lands in the stream's own buffer and enters the cache only once it has
+ * completed. */
+typedef struct bcache_stream {
+    blockdev_t *dev;
+    uint64_t next_lba;
+    uint64_t ahead_end;
+    uint64_t last_used;
+    uint32_t window;
+    uint32_t wasted;
+    int renewed;
+    int inflight;
+    volatile int done;
+    int stale;
+    blockdev_io_t io;
+    uint8_t *buffer;
+} bcache_stream_t;
+
+static bcache_block_t *bcache_blocks = NULL;
+static bcache_stream_t bcache_streams[BCACHE_STREAMS];
+static uint8_t *bcache_ra_buffers = NULL;
+static uint64_t bcache_stream_clock = 0;
+static bcache_block_t *bcache_table[BCACHE_BUCKETS];
+static int bcache_unavailable = 0;
+static size_t bcache_hand = 0;
+static size_t bcache_cached = 0;
+static size_t bcache_dirty = 0;
+static uint64_t bcache_hits = 0;
+static uint64_t bcache_misses = 0;
+static uint64_t bcache_bypassed = 0;
+static uint64_t bcache_writebacks = 0;
+static uint64_t bcache_evictions = 0;
+static uint64_t bcache_ra_requests = 0;
+static uint64_t bcache_ra_sectors = 0;
+static uint64_t bcache_ra_hits = 0;
+static uint64_t bcache_ra_wasted = 0;
+static uint64_t bcache_ra_waits = 0;
+
+/* The cache is allocated on first use; if the heap cannot spare it, all
+ * I/O goes straight to the devices. */
+static int bcache_ready(const blockdev_t *dev) {
+    if (dev && dev->sector_size != BCACHE_BLOCK_SIZE) {
+        return 0;
+    }
+    if (bcache_blocks) {
+        return 1;
+    }
+    if (bcache_unavailable) {
+        return 0;
+    }
+    bcache_blocks = (bcache_block_t *)kmalloc(BCACHE_BLOCKS * sizeof(bcache_block_t));
+    if (!bcache_blocks) {
+        bcache_unavailable = 1;
+        return 0;
+    }
+    memset(bcache_blocks, 0, BCACHE_BLOCKS * sizeof(bcache_block_t));
+    /* Without room for the read-ahead buffers the cache works without
+     * read-ahead. */
+    bcache_ra_buffers = (uint8_t *)kmalloc(BCACHE_STREAMS * BCACHE_RA_MAX * BCACHE_BLOCK_SIZE);
+    memset(bcache_streams, 0, sizeof(bcache_streams));
+    for (size_t i = 0; i < BCACHE_STREAMS && bcache_ra_buffers; ++i) {
+        bcache_streams[i].buffer = bcache_ra_buffers + i * BCACHE_RA_MAX * BCACHE_BLOCK_SIZE;
+    }
+    return 1;
+}
+
+static uint64_t bcache_now_ms(void) {
+    uint32_t freq = pit_current_frequency();
+    return freq ? pit_ticks() * 1000 / freq : 0;
+}
+
+static bcache_block_t **bcache_bucket(const blockdev_t *dev, uint64_t lba) {
+    uint32_t hash = (uint32_t)(lba * 2654435761u) ^ (uint32_t)((uintptr_t)dev >> 4);
+    return &bcache_table[hash % BCACHE_BUCKETS];
+}
+
+static bcache_block_t *bcache_lookup(const blockdev_t *dev, uint64_t lba) {
+    for (bcache_block_t *block = *bcache_bucket(dev, lba); block; block = block->hash_next) {
+        if (block->dev == dev && block->lba == lba) {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+static void bcache_unhash(bcache_block_t *block) {
+    bcache_block_t **link = bcache_bucket(block->dev, block->lba);
+    while (*link && *link != block) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = block->hash_next;
+    }
+    if (block->prefetched) {
+        bcache_ra_wasted++;
+        if (bcache_streams[block->stream].dev == block->dev) {
+            bcache_streams[block->stream].wasted++;
+        }
+        block->prefetched = 0;
+    }
+    block->hash_next = NULL;
+    block->valid = 0;
+    bcache_cached--;
+}
+
+static void bcache_mark_clean(bcache_block_t *block) {
+    if (block->dirty) {
+        block->dirty = 0;
+        bcache_dirty--;
+    }
+}
+
+static void bcache_cancel_ahead(const blockdev_t *dev, uint64_t lba, uint32_t count);
+
+/* Read-ahead in flight over this sector may have read it before the
+ * write landed, and the block can be evicted before that is reaped. */
+static void bcache_writeback_done(blockdev_io_t *io, void *user_data) {
+    bcache_block_t *block = (bcache_block_t *)user_data;
+    block->queued = 0;
+    bcache_cancel_ahead(block->dev, block->lba, 1);
+    if (io->status == 0) {
+        bcache_mark_clean(block);
+        bcache_writebacks++;
+    }
+}
+
+static void bcache_queue_writeback(bcache_block_t *block) {
+    if (block->queued) {
+        return;
+    }
+    block->io.op = BLOCKDEV_WRITE;
+    block->io.lba = block->lba;
+    block->io.count = 1;
+    block->io.buffer = block->data;
+    block->io.callback = bcache_writeback_done;
+    block->io.user_data = block;
+    block->queued = 1;
+    if (blockdev_queue(block->dev, &block->io) != 0) {
+        block->queued = 0;
+    }
+}
+
+/* Queues the dirty blocks of `dev` (all devices if NULL) that have been
+ * dirty since `before` or earlier, then dispatches the queues. */
+static int bcache_writeback(blockdev_t *dev, uint64_t before) {
+    for (size_t i = 0; i < BCACHE_BLOCKS; ++i) {
+        bcache_block_t *block = &bcache_blocks[i];
+        if (block->valid && block->dirty && (!dev || block->dev == dev) && block->dirty_since <= before) {
+            bcache_queue_writeback(block);
+        }
+    }
+    if (dev) {
+        return blockdev_unplug(dev);
+    }
+    int result = 0;
+    for (size_t i = 0; i < blockdev_count(); ++i) {
+        if (blockdev_unplug(blockdev_get(i)) != 0) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+/* Picks a block to reuse: a free one, or the first the CLOCK hand finds
+ * unreferenced. A dirty victim triggers write-back of every dirty block
+ * of its device, so the following evictions find clean blocks. */
+static bcache_block_t *bcache_victim(void) {
+    for (size_t scanned = 0; scanned < 2 * BCACHE_BLOCKS; ++scanned) {
+        bcache_block_t *block = &bcache_blocks[bcache_hand];
+        bcache_hand = (bcache_hand + 1) % BCACHE_BLOCKS;
+        if (!block->valid) {
+            return block;
+        }
+        if (block->referenced) {
+            block->referenced = 0;
+            continue;
+        }
+        if (block->dirty) {
+            bcache_writeback(block->dev, UINT64_MAX);
+            if (block->dirty) {
+                continue;
+            }
+        }
+        bcache_unhash(block);
+        bcache_evictions++;
+        return block;
+    }
+    return NULL;
+}
+
+static bcache_block_t *bcache_insert(blockdev_t *dev, uint64_t lba, const void *data) {
+    bcache_block_t *block = bcache_victim();
+    if (!block) {
+        return NULL;
+    }
+    block->dev = dev;
+    block->lba = lba;
+    block->valid = 1;
+    block->dirty = 0;
+    block->referenced = 1;
+    block->prefetched = 0;
+    block->stream = BCACHE_NO_STREAM;
+    memcpy(block->data, data, BCACHE_BLOCK_SIZE);
+    bcache_block_t **bucket = bcache_bucket(dev, lba);
+    block->hash_next = *bucket;
+    *bucket = block;
+    bcache_cached++;
+    return block;
+}
+
+static void bcache_prefetch_done(blockdev_io_t *io, void *user_data) {
+    (void)io;
+    ((bcache_stream_t *)user_data)->done = 1;
+}
+
+/* Moves a completed read-ahead into the cache. This runs only from the
+ * cache's entry points and never from the completion callback, which can
+ * fire inside a write-back started while choosing a victim. Sectors that
+ * were cached meanwhile keep their (possibly newer) contents; a stale
+ * read-ahead, one that overlapped a write, is dropped. */
+static void bcache_reap(bcache_stream_t *stream) {
+    if (!stream->inflight || !stream->done) {
+        return;
+    }
+    stream->inflight = 0;
+    stream->done = 0;
+    if (stream->io.status != 0 || stream->stale) {
+        if (stream->stale) {
+            bcache_ra_wasted += stream->io.count;
+        }
+        stream->stale = 0;
+        stream->ahead_end = stream->next_lba;
+        return;
+    }
+    uint8_t index = (uint8_t)(stream - bcache_streams);
+    for (uint32_t i = 0; i < stream->io.count; ++i) {
+        if (bcache_lookup(stream->dev, stream->io.lba + i)) {
+            continue;
+        }
+        bcache_block_t *block = bcache_insert(stream->dev, stream->io.lba + i,
+                                              stream->buffer + (size_t)i * BCACHE_BLOCK_SIZE);
+        if (block) {
+            block->prefetched = 1;
+            block->stream = index;
+        }
+    }
+}
+
+static void bcache_reap_all(void) {
+    for (size_t i = 0; i < BCACHE_STREAMS; ++i) {
+        bcache_reap(&bcache_streams[i]);
+    }
+}
+
+static int bcache_overlaps(const bcache_stream_t *stream, const blockdev_t *dev, uint64_t lba, uint32_t count) {
+    return stream->inflight && stream->dev == dev && lba < stream->io.lba + stream->io.count &&
+           stream->io.lba < lba + count;
+}
+
+/* A read of sectors that are still being read ahead waits for them
+ * rather than fetching them a second time. */
+static void bcache_wait_ahead(blockdev_t *dev, uint64_t lba, uint32_t count) {
+    for (size_t i = 0; i < BCACHE_STREAMS; ++i) {
+        bcache_stream_t *stream = &bcache_streams[i];
+        if (!bcache_overlaps(stream, dev, lba, count)) {
+            continue;
+        }
+        bcache_ra_waits++;
+        while (!stream->done) {
+            blockdev_poll(dev);
+        }
+        bcache_reap(stream);
+    }
+}
+
+/* Writes and invalidation make an in-flight read-ahead of the same
+ * sectors out of date. */
+static void bcache_cancel_ahead(const blockdev_t *dev, uint64_t lba, uint32_t count) {
+    if (!bcache_ra_buffers) {
+        return;
+    }
+    for (size_t i = 0; i < BCACHE_STREAMS; ++i) {
+        if (bcache_overlaps(&bcache_streams[i], dev, lba, count)) {
+            bcache_streams[i].stale = 1;
+        }
+    }
+}
+
+static bcache_stream_t *bcache_stream_find(const blockdev_t *dev, uint64_t lba, uint32_t count) {
+    for (size_t i = 0; i < BCACHE_STREAMS; ++i) {
+        bcache_stream_t *stream = &bcache_streams[i];
+        if (stream->dev == dev && lba + 1 >= stream->next_lba && lba <= stream->ahead_end &&
+            lba + count > stream->next_lba) {
+            return stream;
+        }
+    }
+    return NULL;
+}
+
+/* The least recently used stream with nothing in flight. */
+static bcache_stream_t *bcache_stream_alloc(blockdev_t *dev, uint64_t next_lba) {
+    bcache_stream_t *oldest = NULL;
+    for (size_t i = 0; i < BCACHE_STREAMS; ++i) {
+        bcache_stream_t *stream = &bcache_streams[i];
+        if (!stream->inflight && (!oldest || stream->last_used < oldest->last_used)) {
+            oldest = stream;
+        }
+    }
+    if (oldest) {
+        oldest->dev = dev;
+        oldest->next_lba = next_lba;
+        oldest->ahead_end = next_lba;
+        oldest->window = BCACHE_RA_INITIAL;
+        oldest->wasted = 0;
+        oldest->renewed = 0;
+        oldest->last_used = ++bcache_stream_clock;
+    }
+    return oldest;
+}
+
+/* Follows sequential readers and keeps a window of sectors read ahead of
+ * each. A stream gets read-ahead from its second read on; the next window
+ * is issued, without waiting, once the reader has used up half of what
+ * was read ahead. Each renewal doubles the window, up to BCACHE_RA_MAX,
+ * unless read-ahead sectors were evicted unread since the last one, which
+ * halves it, down to BCACHE_RA_MIN. On devices without a start hook the
+ * read-ahead completes before blockdev_start returns. */
+static void bcache_readahead(blockdev_t *dev, uint64_t lba, uint32_t count) {
+    if (!bcache_ra_buffers) {
+        return;
+    }
+    bcache_stream_t *stream = bcache_stream_find(dev, lba, count);
+    if (!stream) {
+        bcache_stream_alloc(dev, lba + count);
+        return;
+    }
+    stream->next_lba = lba + count;
+    stream->last_used = ++bcache_stream_clock;
+    if (stream->ahead_end < stream->next_lba) {
+        stream->ahead_end = stream->next_lba;
+    }
+    if (stream->inflight || stream->ahead_end - stream->next_lba > stream->window / 2) {
+        return;
+    }
+
+    if (stream->renewed) {
+        if (stream->wasted > 0) {
+            stream->window = (stream->window / 2 > BCACHE_RA_MIN) ? stream->window / 2 : BCACHE_RA_MIN;
+        } else {
+            stream->window = (stream->window * 2 < BCACHE_RA_MAX) ? stream->window * 2 : BCACHE_RA_MAX;
+        }
+    }
+    stream->wasted = 0;
+    stream->renewed = 1;
+
+    /* Cached sectors at the front are skipped and the window ends at the
+     * next one, so the read never covers a block that may be dirty. */
+    uint64_t start = stream->ahead_end;
+    uint64_t end = (dev->sector_count - start > stream->window) ? start + stream->window : dev->sector_count;
+    while (start < end && bcache_lookup(dev, start)) {
+        ++start;
+    }
+    stream->ahead_end = end;
+    if (start >= end) {
+        return;
+    }
+    for (uint64_t lba = start + 1; lba < end; ++lba) {
+        if (bcache_lookup(dev, lba)) {
+            end = lba;
+            break;
+        }
+    }
+    stream->ahead_end = end;
+
+    stream->io.op = BLOCKDEV_READ;
+    stream->io.lba = start;
+    stream->io.count = (uint32_t)(end - start);
+    stream->io.buffer = stream->buffer;
+    stream->io.callback = bcache_prefetch_done;
+    stream->io.user_data = stream;
+    stream->inflight = 1;
+    stream->done = 0;
+    stream->stale = 0;
+    if (blockdev_start(dev, &stream->io) != 0) {
+        stream->inflight = 0;
+        stream->ahead_end = start;
+        return;
+    }
+    bcache_ra_requests++;
+    bcache_ra_sectors += stream->io.count;
+    bcache_reap(stream);
+}
+
+/* Large reads go straight to the device so they do not flush the cache,
+ * but cached sectors still take precedence since they may be dirty. */
+static int bcache_read_bypass(blockdev_t *dev, uint64_t lba, uint32_t count, uint8_t *bytes) {
+    if (blockdev_read(dev, lba, count, bytes) != 0) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        bcache_block_t *block = bcache_lookup(dev, lba + i);
+        if (block && block->dirty) {
+            memcpy(bytes + (size_t)i * BCACHE_BLOCK_SIZE, block->data, BCACHE_BLOCK_SIZE);
+        }
+    }
+    bcache_bypassed += count;
+    return 0;
+}
+
+int bcache_read(blockdev_t *dev, uint64_t lba, uint32_t count, void *buffer) {
+    if (!dev || !bcache_ready(dev)) {
+        return blockdev_read(dev, lba, count, buffer);
+    }
+    uint8_t *bytes = (uint8_t *)buffer;
+    bcache_reap_all();
+    if (count > BCACHE_BYPASS_SECTORS) {
+        return bcache_read_bypass(dev, lba, count, bytes);
+    }
+
+    bcache_wait_ahead(dev, lba, count);
+    uint32_t i = 0;
+    while (i < count) {
+        bcache_block_t *block = bcache_lookup(dev, lba + i);
+        if (block) {
+            block->referenced = 1;
+            if (block->prefetched) {
+                block->prefetched = 0;
+                bcache_ra_hits++;
+            }
+            memcpy(bytes + (size_t)i * BCACHE_BLOCK_SIZE, block->data, BCACHE_BLOCK_SIZE);
+            bcache_hits++;
+            ++i;
+            continue;
+        }
+
+        /* Fetch the whole run of missing sectors with one request. */
+        uint32_t run = 1;
+        while (i + run < count && !bcache_lookup(dev, lba + i + run)) {
+            ++run;
+        }
+        uint8_t *dest = bytes + (size_t)i * BCACHE_BLOCK_SIZE;
+        if (blockdev_read(dev, lba + i, run, dest) != 0) {
+            return -1;
+        }
+        for (uint32_t j = 0; j < run; ++j) {
+            bcache_insert(dev, lba + i + j, dest + (size_t)j * BCACHE_BLOCK_SIZE);
+        }
+        bcache_misses += run;
+        i += run;
+    }
+    bcache_readahead(dev, lba, count);
+    return 0;
+}
+
+/* Writes straight to the device; cached copies are refreshed and become
+ * clean only once the device has accepted the data. After a failure the
+ * sectors' contents are unknown, so clean copies are dropped. */
+static int bcache_write_direct(blockdev_t *dev, uint64_t lba, uint32_t count, const uint8_t *bytes, int fua) {
+    bcache_cancel_ahead(dev, lba, count);
+    int status = fua ? blockdev_write_fua(dev, lba, count, bytes) : blockdev_write(dev, lba, count, bytes);
+    if (status != 0) {
+        for (uint32_t i = 0; i < count; ++i) {
+            bcache_block_t *block = bcache_lookup(dev, lba + i);
+            if (block && !block->dirty) {
+                bcache_unhash(block);
+            }
+        }
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        bcache_block_t *block = bcache_lookup(dev, lba + i);
+        if (block) {
+            memcpy(block->data, bytes + (size_t)i * BCACHE_BLOCK_SIZE, BCACHE_BLOCK_SIZE);
+            bcache_mark_clean(block);
+        }
+    }
+    bcache_bypassed += count;
+    return 0;
+}
+
+int bcache_write(blockdev_t *dev, uint64_t lba, uint32_t count, const void *buffer) {
+    if (!dev || !bcache_ready(dev)) {
+        return blockdev_write(dev, lba, count, buffer);
+    }
+    if (lba >= dev->sector_count || count > dev->sector_count - lba) {
+        return -1;
+    }
+    const uint8_t *bytes = (const uint8_t *)buffer;
+    bcache_cancel_ahead(dev, lba, count);
+
+    if (count > BCACHE_BYPASS_SECTORS) {
+        return bcache_write_direct(dev, lba, count, bytes, 0);
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const uint8_t *data = bytes + (size_t)i * BCACHE_BLOCK_SIZE;
+        bcache_block_t *block = bcache_lookup(dev, lba + i);
+        if (block) {
+            memcpy(block->data, data, BCACHE_BLOCK_SIZE);
+            block->referenced = 1;
+        } else {
+            block = bcache_insert(dev, lba + i, data);
+            if (!block) {
+                if (blockdev_write(dev, lba + i, 1, data) != 0) {
+                    return -1;
+                }
+                continue;
+            }
+        }
+        if (!block->dirty) {
+            block->dirty = 1;
+            block->dirty_since = bcache_now_ms();
+            bcache_dirty++;
+        }
+    }
+    return 0;
+}
+
+/* Writes past the cache and makes just this data durable (FUA), e.g.
+ * for a commit record; earlier writes need bcache_sync first. */
+int bcache_write_fua(blockdev_t *dev, uint64_t lba, uint32_t count, const void *buffer) {
+    if (!dev || !bcache_ready(dev)) {
+        return blockdev_write_fua(dev, lba, count, buffer);
+    }
+    return bcache_write_direct(dev, lba, count, (const uint8_t *)buffer, 1);
+}
+
+/* Writes back every dirty block of `dev` (all devices if NULL), then
+ * flushes the devices' write caches. */
+int bcache_sync(blockdev_t *dev) {
+    int result = 0;
+    if (bcache_blocks && bcache_dirty > 0) {
+        result = bcache_writeback(dev, UINT64_MAX);
+    }
+    if (dev) {
+        return (blockdev_flush(dev) == 0) ? result : -1;
+    }
+    for (size_t i = 0; i < blockdev_count(); ++i) {
+        if (blockdev_flush(blockdev_get(i)) != 0) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+/* Drops the clean blocks of `dev` (all devices if NULL), so the next
+ * reads come from the device. Dirty blocks are kept, and read-ahead in
+ * flight is dropped when it completes. */
+void bcache_invalidate(blockdev_t *dev) {
+    if (!bcache_blocks) {
+        return;
+    }
+    for (size_t i = 0; i < BCACHE_STREAMS; ++i) {
+        bcache_stream_t *stream = &bcache_streams[i];
+        if (!dev || stream->dev == dev) {
+            stream->stale = stream->inflight;
+            stream->ahead_end = stream->next_lba;
+        }
+    }
+    for (size_t i = 0; i < BCACHE_BLOCKS; ++i) {
+        bcache_block_t *block = &bcache_blocks[i];
+        if (block->valid && !block->dirty && (!dev || block->dev == dev)) {
+            bcache_unhash(block);
+        }
+    }
+}
+
+/* Periodic write-back of the blocks that have been dirty for longer than
+ * BCACHE_WRITEBACK_AGE_MS, and collection of finished read-ahead. Returns
+ * 1 if it did either. */
+int bcache_poll(void) {
+    if (!bcache_blocks) {
+        return 0;
+    }
+    int reaped = 0;
+    for (size_t i = 0; i < BCACHE_STREAMS; ++i) {
+        bcache_stream_t *stream = &bcache_streams[i];
+        if (stream->inflight) {
+            if (!stream->done) {
+                blockdev_poll(stream->dev);
+            }
+            reaped |= stream->done;
+            bcache_reap(stream);
+        }
+    }
+    if (bcache_dirty == 0) {
+        return reaped;
+    }
+    uint64_t now = bcache_now_ms();
+    if (now < BCACHE_WRITEBACK_AGE_MS) {
+        return reaped;
+    }
+    uint64_t written = bcache_writebacks;
+    bcache_writeback(NULL, now - BCACHE_WRITEBACK_AGE_MS);
+    return reaped || bcache_writebacks != written;
+}
+
+void bcache_get_stats(bcache_stats_t *stats) {
+    if (!stats) {
+        return;
+    }
+    stats->blocks = bcache_blocks ? BCACHE_BLOCKS : 0;
+    stats->cached = bcache_cached;
+    stats->dirty = bcache_dirty;
+    stats->hits = bcache_hits;
+    stats->misses = bcache_misses;
+    stats->bypassed = bcache_bypassed;
+    stats->writebacks = bcache_writebacks;
+    stats->evictions = bcache_evictions;
+    stats->ra_requests = bcache_ra_requests;
+    stats->ra_sectors = bcache_ra_sectors;
+    stats->ra_hits = bcache_ra_hits;
+    stats->ra_wasted = bcache_ra_wasted;
+    stats->ra_waits = bcache_ra_waits;
+}
@@ -0,0 +1,387 @@
+#include <blockdev.h>
+#include <cpu.h>
+#include <memory.h>
+#include <string.h>
+
+#define BLOCKDEV_BOUNCE_SIZE (32u * 1024u)
+
+static blockdev_t *blockdev_table[BLOCKDEV_MAX_DEVICES];
+static size_t blockdev_registered = 0;
+static uint8_t *blockdev_bounce = NULL;
+
+int blockdev_register(blockdev_t *dev) {
+    if (!dev || !dev->submit || dev->name[0] == '\0' || dev->sector_size == 0 || dev->max_transfer == 0 ||
+        (dev->start && !dev->poll)) {
+        return -1;
+    }
+    if (blockdev_registered == BLOCKDEV_MAX_DEVICES || blockdev_find(dev->name)) {
+        return -1;
+    }
+    memset(&dev->stats, 0, sizeof(dev->stats));
+    memset(&dev->queue_stats, 0, sizeof(dev->queue_stats));
+    dev->unflushed_writes = 0;
+    dev->queue = NULL;
+    dev->queue_depth = 0;
+    dev->queue_position = 0;
+    dev->inflight = 0;
+    blockdev_table[blockdev_registered++] = dev;
+    return 0;
+}
+
+blockdev_t *blockdev_find(const char *name) {
+    if (!name) {
+        return NULL;
+    }
+    for (size_t i = 0; i < blockdev_registered; ++i) {
+        if (strcmp(blockdev_table[i]->name, name) == 0) {
+            return blockdev_table[i];
+        }
+    }
+    return NULL;
+}
+
+blockdev_t *blockdev_get(size_t index) {
+    return (index < blockdev_registered) ? blockdev_table[index] : NULL;
+}
+
+size_t blockdev_count(void) {
+    return blockdev_registered;
+}
+
+static void blockdev_account(blockdev_t *dev, blockdev_op_t op, uint32_t count, uint32_t flags) {
+    if (op == BLOCKDEV_READ) {
+        dev->stats.reads++;
+        dev->stats.sectors_read += count;
+    } else {
+        dev->stats.writes++;
+        dev->stats.sectors_written += count;
+        if (flags & BLOCKDEV_REQ_FUA) {
+            dev->stats.fua_writes++;
+        } else {
+            dev->unflushed_writes++;
+        }
+    }
+}
+
+/* Checks the range, then hands it to the driver in max_transfer pieces. */
+static int blockdev_transfer(blockdev_t *dev, blockdev_op_t op, uint64_t lba, uint32_t count, void *buffer,
+                             uint32_t flags) {
+    if (!dev || !buffer || count == 0 || lba >= dev->sector_count || count > dev->sector_count - lba) {
+        return -1;
+    }
+
+    uint8_t *bytes = (uint8_t *)buffer;
+    while (count > 0) {
+        blockdev_request_t request;
+        request.op = op;
+        request.lba = lba;
+        request.count = (count > dev->max_transfer) ? dev->max_transfer : count;
+        request.buffer = bytes;
+        request.flags = flags;
+        if (dev->submit(dev, &request) != 0) {
+            dev->stats.errors++;
+            return -1;
+        }
+        blockdev_account(dev, op, request.count, flags);
+        lba += request.count;
+        count -= request.count;
+        bytes += (size_t)request.count * dev->sector_size;
+    }
+    return 0;
+}
+
+int blockdev_read(blockdev_t *dev, uint64_t lba, uint32_t count, void *buffer) {
+    return blockdev_transfer(dev, BLOCKDEV_READ, lba, count, buffer, 0);
+}
+
+int blockdev_write(blockdev_t *dev, uint64_t lba, uint32_t count, const void *buffer) {
+    return blockdev_transfer(dev, BLOCKDEV_WRITE, lba, count, (void *)buffer, 0);
+}
+
+/* A write that is durable on completion. Devices without FUA get the
+ * write followed by a flush, which also commits earlier writes. */
+int blockdev_write_fua(blockdev_t *dev, uint64_t lba, uint32_t count, const void *buffer) {
+    if (dev && (dev->features & BLOCKDEV_FEATURE_FUA)) {
+        return blockdev_transfer(dev, BLOCKDEV_WRITE, lba, count, (void *)buffer, BLOCKDEV_REQ_FUA);
+    }
+    if (blockdev_write(dev, lba, count, buffer) != 0) {
+        return -1;
+    }
+    return blockdev_flush(dev);
+}
+
+/* Write barrier: everything written before returns to the caller only
+ * once it is on stable media. Skipped if nothing was written since the
+ * last flush, so a commit costs one flush however it was split up. */
+int blockdev_flush(blockdev_t *dev) {
+    if (!dev) {
+        return -1;
+    }
+    if (dev->unflushed_writes == 0) {
+        dev->stats.flushes_skipped++;
+        return 0;
+    }
+    blockdev_request_t request = { BLOCKDEV_FLUSH, 0, 0, NULL, 0 };
+    uint64_t begin = rdtsc();
+    if (dev->submit(dev, &request) != 0) {
+        dev->stats.errors++;
+        return -1;
+    }
+    uint64_t cycles = rdtsc() - begin;
+    dev->stats.flushes++;
+    dev->stats.flush_cycles += cycles;
+    if (cycles > dev->stats.flush_max_cycles) {
+        dev->stats.flush_max_cycles = cycles;
+    }
+    dev->unflushed_writes = 0;
+    return 0;
+}
+
+/* The queue is kept sorted by LBA. A full queue is dispatched before the
+ * new request is added, so callers never have to wait for room. Each
+ * request must fit one transfer: a start hook gets it as it is. */
+int blockdev_queue(blockdev_t *dev, blockdev_io_t *io) {
+    if (!dev || !io || !io->buffer || io->count == 0 || io->op == BLOCKDEV_FLUSH ||
+        io->count > dev->max_transfer || io->lba >= dev->sector_count || io->count > dev->sector_count - io->lba) {
+        return -1;
+    }
+    if (dev->queue_depth == BLOCKDEV_QUEUE_DEPTH) {
+        blockdev_unplug(dev);
+    }
+
+    blockdev_io_t **link = &dev->queue;
+    while (*link && (*link)->lba <= io->lba) {
+        link = &(*link)->next;
+    }
+    io->status = 0;
+    io->next = *link;
+    *link = io;
+    dev->queue_depth++;
+    dev->queue_stats.queued++;
+    if (dev->queue_depth > dev->queue_stats.max_depth) {
+        dev->queue_stats.max_depth = dev->queue_depth;
+    }
+    return 0;
+}
+
+/* Length of the merge that starts at `first`: following requests of the
+ * same kind for the next sectors, up to the transfer limit. Their buffers
+ * must either be adjacent in memory or fit the bounce buffer together.
+ * Devices with several commands in flight never bounce: the single bounce
+ * buffer would serialise them, and separate commands are cheap there. */
+static size_t blockdev_merge_length(const blockdev_t *dev, const blockdev_io_t *first,
+                                    uint32_t *sectors, int *contiguous) {
+    size_t length = 1;
+    *sectors = first->count;
+    *contiguous = 1;
+    const blockdev_io_t *last = first;
+    for (const blockdev_io_t *io = first->next; io; io = io->next) {
+        uint32_t total = *sectors + io->count;
+        if (io->op != first->op || io->lba != last->lba + last->count || total > dev->max_transfer) {
+            break;
+        }
+        int adjacent = *contiguous &&
+                       (uint8_t *)last->buffer + (size_t)last->count * dev->sector_size == (uint8_t *)io->buffer;
+        if (!adjacent && ((dev->features & BLOCKDEV_FEATURE_QUEUED) || !blockdev_bounce || (size_t)total * dev->sector_size > BLOCKDEV_BOUNCE_SIZE)) {
+            break;
+        }
+        *contiguous = adjacent;
+        *sectors = total;
+        last = io;
+        ++length;
+    }
+    return length;
+}
+
+static int blockdev_dispatch(blockdev_t *dev, blockdev_io_t *first, size_t length,
+                             uint32_t sectors, int contiguous) {
+    uint8_t *buffer = contiguous ? (uint8_t *)first->buffer : blockdev_bounce;
+    blockdev_io_t *io = first;
+    if (!contiguous && first->op == BLOCKDEV_WRITE) {
+        uint8_t *dest = buffer;
+        for (size_t i = 0; i < length; ++i, io = io->next) {
+            memcpy(dest, io->buffer, (size_t)io->count * dev->sector_size);
+            dest += (size_t)io->count * dev->sector_size;
+        }
+    }
+
+    blockdev_op_t op = first->op;
+    uint64_t lba = first->lba;
+    int status = blockdev_transfer(dev, op, lba, sectors, buffer, 0);
+
+    const uint8_t *src = buffer;
+    io = first;
+    for (size_t i = 0; i < length; ++i) {
+        blockdev_io_t *next = io->next;
+        if (status == 0 && !contiguous && op == BLOCKDEV_READ) {
+            memcpy(io->buffer, src, (size_t)io->count * dev->sector_size);
+            src += (size_t)io->count * dev->sector_size;
+        }
+        io->status = status;
+        io->next = NULL;
+        if (io->callback) {
+            io->callback(io, io->user_data);
+        }
+        io = next;
+    }
+
+    dev->queue_stats.dispatched++;
+    dev->queue_stats.dispatched_sectors += sectors;
+    dev->queue_stats.merged += length - 1;
+    dev->queue_position = lba + sectors;
+    return status;
+}
+
+/* Finishes a merge started with blockdev_start_batch(): `tag` is its first
+ * request, the rest follow through `next`. Called by drivers from their
+ * poll hook. */
+void blockdev_complete(blockdev_t *dev, void *tag, int status) {
+    blockdev_io_t *io = (blockdev_io_t *)tag;
+    if (status == 0) {
+        uint32_t sectors = 0;
+        for (const blockdev_io_t *part = io; part; part = part->next) {
+            sectors += part->count;
+        }
+        blockdev_account(dev, io->op, sectors, 0);
+    } else {
+        dev->stats.errors++;
+    }
+    dev->inflight--;
+
+    while (io) {
+        blockdev_io_t *next = io->next;
+        io->status = status;
+        io->next = NULL;
+        if (io->callback) {
+            io->callback(io, io->user_data);
+        }
+        io = next;
+    }
+}
+
+/* Hands one request to the start hook. Returns 1 if every command slot
+ * is busy, else 0; a request the driver refused is completed as failed. */
+static int blockdev_try_start(blockdev_t *dev, const blockdev_request_t *request, blockdev_io_t *first) {
+    dev->inflight++;
+    int started = dev->start(dev, request, first);
+    if (started == 1) {
+        dev->inflight--;
+        return 1;
+    }
+    if (started != 0) {
+        blockdev_complete(dev, first, -1);
+    } else if (dev->inflight > dev->queue_stats.max_inflight) {
+        dev->queue_stats.max_inflight = dev->inflight;
+    }
+    return 0;
+}
+
+/* Issues one merge without waiting for it, polling the device while all
+ * of its command slots are busy. The merge is cut off the batch list so
+ * that completion can walk it. */
+static void blockdev_start_batch(blockdev_t *dev, blockdev_io_t *first, size_t length, uint32_t sectors) {
+    blockdev_io_t *last = first;
+    for (size_t i = 1; i < length; ++i) {
+        last = last->next;
+    }
+    last->next = NULL;
+
+    blockdev_request_t request = { first->op, first->lba, sectors, first->buffer, 0 };
+    while (blockdev_try_start(dev, &request, first) == 1) {
+        dev->poll(dev);
+    }
+
+    dev->queue_stats.dispatched++;
+    dev->queue_stats.dispatched_sectors += sectors;
+    dev->queue_stats.merged += length - 1;
+    dev->queue_position = request.lba + sectors;
+}
+
+/* Dispatches everything queued on `dev` in one elevator sweep: upwards
+ * from where the previous batch ended, then from the lowest LBA. Adjacent
+ * requests are merged into one transfer. Returns -1 if any failed. */
+int blockdev_unplug(blockdev_t *dev) {
+    if (!dev || !dev->queue) {
+        return 0;
+    }
+    if (!blockdev_bounce) {
+        blockdev_bounce = (uint8_t *)kmalloc(BLOCKDEV_BOUNCE_SIZE);
+    }
+
+    /* Detach the batch first: callbacks may queue new requests. */
+    blockdev_io_t *batch = dev->queue;
+    dev->queue = NULL;
+    dev->queue_depth = 0;
+
+    blockdev_io_t **split = &batch;
+    while (*split && (*split)->lba < dev->queue_position) {
+        split = &(*split)->next;
+    }
+    blockdev_io_t *sweep[2] = { *split, (*split == batch) ? NULL : batch };
+    *split = NULL;
+
+    int result = 0;
+    uint64_t errors = dev->stats.errors;
+    for (size_t pass = 0; pass < 2; ++pass) {
+        blockdev_io_t *io = sweep[pass];
+        while (io) {
+            uint32_t sectors = 0;
+            int contiguous = 1;
+            size_t length = blockdev_merge_length(dev, io, &sectors, &contiguous);
+            blockdev_io_t *after = io;
+            for (size_t i = 0; i < length; ++i) {
+                after = after->next;
+            }
+            if (dev->start && contiguous) {
+                blockdev_start_batch(dev, io, length, sectors);
+            } else {
+                /* A bounced merge goes through submit, behind whatever
+                 * is still in flight. */
+                while (dev->inflight > 0) {
+                    dev->poll(dev);
+                }
+                if (blockdev_dispatch(dev, io, length, sectors, contiguous) != 0) {
+                    result = -1;
+                }
+            }
+            io = after;
+        }
+    }
+
+    while (dev->inflight > 0) {
+        dev->poll(dev);
+    }
+    if (dev->stats.errors != errors) {
+        result = -1;
+    }
+    return result;
+}
+
+/* Starts one transfer without waiting, for callers that keep several
+ * devices busy at once. Returns 1 if the device has no free command slot
+ * (poll it and retry) and -1 for a bad range; otherwise 0, and the
+ * callback runs when the transfer is done - at once on devices without a
+ * start hook. */
+int blockdev_start(blockdev_t *dev, blockdev_io_t *io) {
+    if (!dev || !io || !io->buffer || io->count == 0 || io->op == BLOCKDEV_FLUSH ||
+        io->count > dev->max_transfer || io->lba >= dev->sector_count || io->count > dev->sector_count - io->lba) {
+        return -1;
+    }
+    io->status = 0;
+    io->next = NULL;
+    if (dev->start) {
+        blockdev_request_t request = { io->op, io->lba, io->count, io->buffer, 0 };
+        return blockdev_try_start(dev, &request, io);
+    }
+    io->status = blockdev_transfer(dev, io->op, io->lba, io->count, io->buffer, 0);
+    if (io->callback) {
+        io->callback(io, io->user_data);
+    }
+    return 0;
+}
+
+void blockdev_poll(blockdev_t *dev) {
+    if (dev && dev->poll) {
+        dev->poll(dev);
+    }
+}
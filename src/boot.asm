@@ -84,7 +84,10 @@ pml4_table:
 align 4096
 pdpt_table:
     dq pd_table + 0x03
-    times 511 dq 0
+    dq pd_table + 0x1000 + 0x03
+    dq pd_table + 0x2000 + 0x03
+    dq pd_table + 0x3000 + 0x03
+    times 508 dq 0
 
 align 4096
 pd_table:
@@ -93,6 +96,10 @@ pd_table:
     dq (i << 21) | 0x183        ; 1GiB identity (2MiB pages)
 %assign i i+1
 %endrep
+%rep 1536
+    dq (i << 21) | 0x19B        ; 1-4GiB identity, uncached: PCI device memory
+%assign i i+1
+%endrep
 
 SECTION .bss
 align 16
@@ -0,0 +1,251 @@
+#include <diskbench.h>
+#include <bcache.h>
+#include <cpu.h>
+#include <filesystem.h>
+#include <fsbench.h>
+#include <memory.h>
+#include <raid0.h>
+#include <string.h>
+
+typedef struct {
+    const char *name;
+    int write;
+    int random;
+    uint32_t default_ops;
+    uint32_t default_block;
+} diskbench_pattern_info_t;
+
+static const diskbench_pattern_info_t diskbench_patterns[DISKBENCH_PATTERN_COUNT] = {
+    [DISKBENCH_SEQ_READ] = { "seqread", 0, 0, 256, 256 },
+    [DISKBENCH_SEQ_WRITE] = { "seqwrite", 1, 0, 256, 256 },
+    [DISKBENCH_RAND_READ] = { "randread", 0, 1, 1024, 8 },
+    [DISKBENCH_RAND_WRITE] = { "randwrite", 1, 1, 1024, 8 }
+};
+
+/* One request slot. The io comes first so the completion callback can
+ * get from the io back to its slot. */
+typedef struct diskbench_slot {
+    blockdev_io_t io;
+    uint64_t start;
+    int busy;
+} diskbench_slot_t;
+
+typedef struct diskbench_state {
+    uint64_t *samples;
+    uint32_t issued;
+    uint32_t completed;
+    int failed;
+} diskbench_state_t;
+
+const char *diskbench_pattern_name(diskbench_pattern_t pattern) {
+    return (pattern < DISKBENCH_PATTERN_COUNT) ? diskbench_patterns[pattern].name : "?";
+}
+
+int diskbench_find_pattern(const char *name) {
+    for (int i = 0; i < DISKBENCH_PATTERN_COUNT; ++i) {
+        if (strcmp(name, diskbench_patterns[i].name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+uint32_t diskbench_default_ops(diskbench_pattern_t pattern) {
+    return (pattern < DISKBENCH_PATTERN_COUNT) ? diskbench_patterns[pattern].default_ops : 0;
+}
+
+uint32_t diskbench_default_block(diskbench_pattern_t pattern) {
+    return (pattern < DISKBENCH_PATTERN_COUNT) ? diskbench_patterns[pattern].default_block : 0;
+}
+
+/* md0 maps chunk c to member c % n at chunk c / n, so every array LBA
+ * from `chunks` whole chunks per member on lies past the first `chunks`
+ * chunks of each member. Returns 0 for any other device. */
+static uint64_t diskbench_raid0_image_end(const blockdev_t *dev) {
+    raid0_info_t info;
+    if (raid0_get_info(&info) != 0 || blockdev_find(info.name) != dev) {
+        return 0;
+    }
+    uint64_t end = 0;
+    for (size_t i = 0; i < info.members; ++i) {
+        const blockdev_t *member = blockdev_find(info.member_names[i]);
+        uint64_t member_end = member ? fs_image_end(member->sector_count) : 0;
+        if (member_end > end) {
+            end = member_end;
+        }
+    }
+    uint64_t chunks = (end + info.chunk_sectors - 1) / info.chunk_sectors;
+    return chunks * info.chunk_sectors * info.members;
+}
+
+/* The range a run may overwrite: everything past the filesystem's image
+ * slots, wherever the filesystem would put them on this device, so the
+ * image is safe whether or not the device is mounted. For md0 that also
+ * covers the images its members may hold. */
+int diskbench_scratch_range(const blockdev_t *dev, uint64_t *first, uint64_t *count) {
+    if (!dev || !first || !count) {
+        return -1;
+    }
+    uint64_t start = fs_image_end(dev->sector_count);
+    uint64_t members_end = diskbench_raid0_image_end(dev);
+    if (members_end > start) {
+        start = members_end;
+    }
+    if (start >= dev->sector_count) {
+        return -1;
+    }
+    *first = start;
+    *count = dev->sector_count - start;
+    return 0;
+}
+
+static void diskbench_done(blockdev_io_t *io, void *user_data) {
+    diskbench_state_t *state = (diskbench_state_t *)user_data;
+    diskbench_slot_t *slot = (diskbench_slot_t *)io;
+    uint64_t cycles = rdtsc() - slot->start;
+    if (io->status != 0) {
+        state->failed = 1;
+    } else {
+        state->samples[state->completed] = cycles;
+    }
+    state->completed++;
+    slot->busy = 0;
+}
+
+static uint32_t diskbench_bucket(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    uint32_t bucket = 0;
+    while (bucket + 1 < DISKBENCH_BUCKETS && us >= (1ull << bucket)) {
+        ++bucket;
+    }
+    return bucket;
+}
+
+static void diskbench_summarize(uint64_t *samples, uint32_t count, uint64_t total_cycles,
+                                diskbench_result_t *result) {
+    uint64_t hz = fsbench_tsc_hz();
+    if (count == 0 || hz == 0) {
+        return;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        result->histogram[diskbench_bucket(fsbench_cycles_to_ns(samples[i], hz))]++;
+    }
+    fsbench_sort(samples, count);
+    result->total_ns = fsbench_cycles_to_ns(total_cycles, hz);
+    result->iops = total_cycles ? (uint64_t)count * hz / total_cycles : 0;
+    result->kb_per_sec = total_cycles ? result->bytes / 1024 * hz / total_cycles : 0;
+    result->p50_ns = fsbench_cycles_to_ns(samples[(count - 1) * 50 / 100], hz);
+    result->p99_ns = fsbench_cycles_to_ns(samples[(count - 1) * 99 / 100], hz);
+    result->max_ns = fsbench_cycles_to_ns(samples[count - 1], hz);
+}
+
+/* Keeps up to `depth` requests in flight through blockdev_start and
+ * starts the next one as each completes, so the device sees a steady
+ * queue of that depth. Sequential patterns walk the scratch range and
+ * wrap around; random ones pick block-aligned offsets in it. Devices
+ * without a start hook complete each request at once, which makes every
+ * depth behave as depth one. */
+void diskbench_run(const diskbench_config_t *config, diskbench_result_t *result) {
+    memset(result, 0, sizeof(*result));
+    result->status = -1;
+    if (!config || !config->dev || config->pattern >= DISKBENCH_PATTERN_COUNT || config->ops == 0 ||
+        config->depth == 0 || config->depth > DISKBENCH_MAX_DEPTH) {
+        return;
+    }
+    const diskbench_pattern_info_t *info = &diskbench_patterns[config->pattern];
+    blockdev_t *dev = config->dev;
+    uint32_t block = config->block_sectors ? config->block_sectors : info->default_block;
+    uint32_t ops = (config->ops > DISKBENCH_MAX_OPS) ? DISKBENCH_MAX_OPS : config->ops;
+    size_t block_bytes = (size_t)block * dev->sector_size;
+    uint64_t first = 0;
+    uint64_t span = 0;
+    if (block > dev->max_transfer || block_bytes * config->depth > DISKBENCH_MAX_BYTES ||
+        diskbench_scratch_range(dev, &first, &span) != 0 || span < block) {
+        return;
+    }
+    uint64_t blocks = span / block;
+
+    /* Writes bypass the buffer cache: flush it and drop what it holds
+     * of the device, or cached sectors would be stale afterwards. */
+    if (info->write) {
+        if (bcache_sync(dev) != 0) {
+            return;
+        }
+        bcache_invalidate(dev);
+    }
+
+    diskbench_slot_t *slots = (diskbench_slot_t *)kmalloc(config->depth * sizeof(diskbench_slot_t));
+    uint8_t *buffers = (uint8_t *)kmalloc(block_bytes * config->depth);
+    uint64_t *samples = (uint64_t *)kmalloc(ops * sizeof(uint64_t));
+    if (!slots || !buffers || !samples) {
+        if (slots) {
+            kfree(slots);
+        }
+        if (buffers) {
+            kfree(buffers);
+        }
+        if (samples) {
+            kfree(samples);
+        }
+        return;
+    }
+    for (size_t i = 0; i < block_bytes * config->depth; ++i) {
+        buffers[i] = (uint8_t)(i * 131 + 7);
+    }
+    diskbench_state_t state = { samples, 0, 0, 0 };
+    for (uint32_t i = 0; i < config->depth; ++i) {
+        slots[i].busy = 0;
+        slots[i].io.buffer = buffers + i * block_bytes;
+    }
+
+    uint32_t seed = 2463534242u;
+    uint64_t begin = rdtsc();
+    while (state.completed < state.issued || (state.issued < ops && !state.failed)) {
+        int busy = 0;
+        for (uint32_t i = 0; i < config->depth && state.issued < ops && !state.failed; ++i) {
+            diskbench_slot_t *slot = &slots[i];
+            if (slot->busy) {
+                continue;
+            }
+            uint64_t index = state.issued % blocks;
+            if (info->random) {
+                seed ^= seed << 13;
+                seed ^= seed >> 17;
+                seed ^= seed << 5;
+                index = seed % blocks;
+            }
+            slot->io.op = info->write ? BLOCKDEV_WRITE : BLOCKDEV_READ;
+            slot->io.lba = first + index * block;
+            slot->io.count = block;
+            slot->io.callback = diskbench_done;
+            slot->io.user_data = &state;
+            slot->busy = 1;
+            slot->start = rdtsc();
+            int started = blockdev_start(dev, &slot->io);
+            if (started != 0) {
+                /* Busy with a command that is not ours (say, read-ahead
+                 * on the same ATA channel): polling lets it finish. */
+                slot->busy = 0;
+                state.failed = started < 0;
+                busy = started > 0;
+                break;
+            }
+            state.issued++;
+        }
+        if (state.completed < state.issued || busy) {
+            blockdev_poll(dev);
+        }
+    }
+    uint64_t total = rdtsc() - begin;
+
+    if (!state.failed) {
+        result->status = 0;
+        result->ops = ops;
+        result->block_sectors = block;
+        result->bytes = (uint64_t)ops * block_bytes;
+        diskbench_summarize(samples, ops, total, result);
+    }
+    kfree(samples);
+    kfree(buffers);
+    kfree(slots);
+}
@@ -1,7 +1,47 @@
 #include <filesystem.h>
 #include <memory.h>
 #include <string.h>
-#include <ata.h>
+#include <bcache.h>
+#include <blockdev.h>
+#include <checksum.h>
+#include <pit.h>
+#include <trigram.h>
+
+#define FS_CHUNK_SIZE     512u
+#define FS_CHUNK_BUCKETS  1024u
+
+/* File contents are split into FS_CHUNK_SIZE chunks that are interned in a
+ * global table keyed by their CRC32C, so identical chunks are stored once
+ * no matter how many files contain them. Chunks are immutable.
+ *
+ * A chunk that is also stored in an intact on-disk image is clean: its
+ * bytes may be evicted under memory pressure and are read back from the
+ * image, and checked against the hash, on the next access. */
+typedef struct fs_chunk {
+    struct fs_chunk *hash_next;
+    uint8_t *bytes;
+    uint32_t hash;
+    uint32_t refcount;
+    uint32_t save_epoch;
+    uint32_t save_index;
+    uint32_t save_offset;
+    uint32_t disk_generation;
+    uint32_t disk_offset;
+    uint16_t length;
+    uint8_t disk_slot;
+    uint8_t referenced;
+} fs_chunk_t;
+
+/* A file's chunk list. It is refcounted so a snapshot or a cp can share it;
+ * a shared list is copied before it is modified. */
+typedef struct fs_data {
+    uint32_t refcount;
+    size_t chunk_count;
+    size_t capacity;
+    fs_chunk_t *chunks[];
+} fs_data_t;
+
+struct fs_shadow;
 
 typedef struct fs_node {
     char name[FS_MAX_NAME_LEN];
@@ -9,35 +49,148 @@ typedef struct fs_node {
     struct fs_node *parent;
     struct fs_node *children;
     struct fs_node *next_sibling;
-    uint8_t *data;
+    struct fs_node *prev_sibling;
+    struct fs_node *index_root;
+    struct fs_node *index_left;
+    struct fs_node *index_right;
+    size_t index_count;
+    int index_height;
+    fs_data_t *data;
     size_t size;
-    size_t capacity;
+    fs_usage_t usage;
+    uint32_t search_doc;
+    int8_t search_mode;
+    uint32_t epoch;
+    struct fs_shadow *shadow;
 } fs_node_t;
 
+/* Pre-image of a node, captured the first time the node is mutated (or
+ * entered by the serializer) while a snapshot is being saved. Directories
+ * keep a frozen array of their children; files keep a reference to the
+ * data buffer they had when the snapshot was taken. */
+typedef struct fs_shadow {
+    fs_node_t *owner;
+    char name[FS_MAX_NAME_LEN];
+    fs_data_t *data;
+    size_t size;
+    fs_node_t **children;
+    size_t child_count;
+    fs_node_t *walk_parent;
+    size_t walk_index;
+    struct fs_shadow *prev;
+    struct fs_shadow *next;
+} fs_shadow_t;
+
 static fs_node_t *fs_root = NULL;
 static fs_node_t *fs_cwd = NULL;
 
+static fs_chunk_t *fs_chunk_table[FS_CHUNK_BUCKETS];
+static size_t fs_chunk_count = 0;
+static size_t fs_chunk_bytes = 0;
+static uint8_t fs_chunk_scratch[FS_CHUNK_SIZE];
+static uint8_t *fs_view_buffer = NULL;
+static size_t fs_view_capacity = 0;
+static fs_chunk_t *fs_view_chunk = NULL;
+
+/* Eviction keeps heap usage between the two watermarks (in 1/8ths of the
+ * heap); the clock hand walks the chunk table bucket by bucket. */
+#define FS_CACHE_HIGH_WATERMARK 6u
+#define FS_CACHE_LOW_WATERMARK  5u
+
+static size_t fs_cache_hand = 0;
+static size_t fs_cache_evicted_bytes = 0;
+static uint64_t fs_cache_hits = 0;
+static uint64_t fs_cache_misses = 0;
+static uint64_t fs_cache_evictions = 0;
+static int fs_cache_writeback = 0;
+static uint8_t fs_cache_sectors[2 * 512];
+static uint8_t fs_cache_compare[FS_CHUNK_SIZE];
+
+/* A snapshot with epoch E covers every node whose epoch differs from E.
+ * Nodes created during the snapshot, and nodes the serializer has already
+ * emitted, carry epoch E and can be changed without preserving anything. */
+static uint32_t fs_snapshot_epoch = 0;
+static int fs_snapshot_active = 0;
+static fs_shadow_t *fs_shadows = NULL;
+static fs_node_t *fs_zombies = NULL;
+
+static void fs_save_abort(fs_status_t status);
+
 #define FS_IMAGE_MAGIC        0x4D594653u
-#define FS_IMAGE_VERSION      1u
+#define FS_IMAGE_VERSION_V1   1u
+#define FS_IMAGE_VERSION_V2   2u
+#define FS_IMAGE_VERSION_V3   3u
+#define FS_IMAGE_VERSION      4u
 #define FS_IMAGE_LBA_START    2048u
 #define FS_IMAGE_LBA_COUNT    256u
+#define FS_IMAGE_SLOTS        2u
 #define FS_IMAGE_SECTOR_SIZE  512u
 #define FS_IMAGE_BUFFER_SIZE  (FS_IMAGE_LBA_COUNT * FS_IMAGE_SECTOR_SIZE)
-
+#define FS_IMAGE_CHUNK_SIZE   4096u
+#define FS_IMAGE_MAX_CHUNKS   (FS_IMAGE_BUFFER_SIZE / FS_IMAGE_CHUNK_SIZE)
+
+/* Version 1 images carried only the first four fields and no checksums;
+ * they are still accepted on load. Version 2 protects the payload that
+ * follows the header with one CRC32C per FS_IMAGE_CHUNK_SIZE chunk, and
+ * the header itself with header_crc. Version 3 keeps that header and
+ * stores file data as deduplicated blocks (see fs_write_entry).
+ *
+ * Version 4 adds a generation number. Images alternate between two slots
+ * of FS_IMAGE_LBA_COUNT sectors and the newest valid one is loaded, so a
+ * save never overwrites the image that evicted chunks are read from.
+ * Older versions had no generation field and live in slot 0 only. */
 typedef struct __attribute__((packed)) {
     uint32_t magic;
     uint32_t version;
     uint32_t total_size;
     uint32_t entry_count;
+    uint32_t chunk_size;
+    uint32_t chunk_count;
+    uint32_t chunk_crc[FS_IMAGE_MAX_CHUNKS];
+    uint32_t generation;
+    uint32_t header_crc;
 } fs_image_header_t;
 
+#define FS_IMAGE_HEADER_V1_SIZE 16u
+#define FS_IMAGE_HEADER_V2_SIZE (offsetof(fs_image_header_t, generation) + sizeof(uint32_t))
+
+/* Generation of the image each slot holds, or 0 if it holds none that is
+ * intact. fs_image_slot is the slot of the newest image. */
+static uint32_t fs_slot_generation[FS_IMAGE_SLOTS];
+static uint32_t fs_image_generation = 0;
+static uint32_t fs_image_slot = 0;
+static int fs_image_probed = 0;
+
+/* The mounted device and where its image slots start: FS_IMAGE_LBA_START
+ * when the device is large enough, otherwise its first sector. */
+static blockdev_t *fs_device = NULL;
+static uint64_t fs_image_base = FS_IMAGE_LBA_START;
+
+static uint64_t fs_image_slot_lba(uint32_t slot) {
+    return fs_image_base + (uint64_t)slot * FS_IMAGE_LBA_COUNT;
+}
+
+static uint64_t fs_image_base_for(uint64_t sector_count) {
+    return (sector_count >= FS_IMAGE_LBA_START + FS_IMAGE_SLOTS * FS_IMAGE_LBA_COUNT) ? FS_IMAGE_LBA_START : 0;
+}
+
+#define FS_IMAGE_BLOCK_INLINE   0xFFFFFFFFu
+
+/* Background save budget per fs_save_poll() call. */
+#define FS_SAVE_STEP_BYTES    4096u
+#define FS_SAVE_STEP_SECTORS  16u
+
+/* flags was reserved (zero) before version 3. */
 typedef struct __attribute__((packed)) {
     uint8_t type;
-    uint8_t reserved;
+    uint8_t flags;
     uint16_t path_len;
     uint32_t data_len;
 } fs_image_entry_t;
 
+#define FS_IMAGE_ENTRY_INDEX_ON   0x01u
+#define FS_IMAGE_ENTRY_INDEX_OFF  0x02u
+
 static uint8_t *fs_image_buffer = NULL;
 
 static const char *fs_skip_separators(const char *path) {
@@ -74,24 +227,164 @@ static const char *fs_read_component(const char *path, char buffer[FS_MAX_NAME_L
     return path;
 }
 
+/* Besides the sibling list, which keeps insertion order for the cursor and
+ * snapshots, every directory indexes its children by name in an AVL tree
+ * whose nodes also count their subtree. Lookups, ordered iteration from any
+ * name and positioning by rank are all O(log n). */
+static int fs_index_height(const fs_node_t *node) {
+    return node ? node->index_height : 0;
+}
+
+static size_t fs_index_count(const fs_node_t *node) {
+    return node ? node->index_count : 0;
+}
+
+static void fs_index_update(fs_node_t *node) {
+    int left = fs_index_height(node->index_left);
+    int right = fs_index_height(node->index_right);
+    node->index_height = 1 + (left > right ? left : right);
+    node->index_count = 1 + fs_index_count(node->index_left) + fs_index_count(node->index_right);
+}
+
+static fs_node_t *fs_index_rotate_right(fs_node_t *node) {
+    fs_node_t *pivot = node->index_left;
+    node->index_left = pivot->index_right;
+    pivot->index_right = node;
+    fs_index_update(node);
+    fs_index_update(pivot);
+    return pivot;
+}
+
+static fs_node_t *fs_index_rotate_left(fs_node_t *node) {
+    fs_node_t *pivot = node->index_right;
+    node->index_right = pivot->index_left;
+    pivot->index_left = node;
+    fs_index_update(node);
+    fs_index_update(pivot);
+    return pivot;
+}
+
+static fs_node_t *fs_index_balance(fs_node_t *node) {
+    fs_index_update(node);
+    int balance = fs_index_height(node->index_left) - fs_index_height(node->index_right);
+    if (balance > 1) {
+        if (fs_index_height(node->index_left->index_left) < fs_index_height(node->index_left->index_right)) {
+            node->index_left = fs_index_rotate_left(node->index_left);
+        }
+        return fs_index_rotate_right(node);
+    }
+    if (balance < -1) {
+        if (fs_index_height(node->index_right->index_right) < fs_index_height(node->index_right->index_left)) {
+            node->index_right = fs_index_rotate_right(node->index_right);
+        }
+        return fs_index_rotate_left(node);
+    }
+    return node;
+}
+
+/* Recursion depth is the tree height, about 1.44 * log2(n). */
+static fs_node_t *fs_index_insert(fs_node_t *root, fs_node_t *node) {
+    if (!root) {
+        node->index_left = NULL;
+        node->index_right = NULL;
+        fs_index_update(node);
+        return node;
+    }
+    if (strcmp(node->name, root->name) < 0) {
+        root->index_left = fs_index_insert(root->index_left, node);
+    } else {
+        root->index_right = fs_index_insert(root->index_right, node);
+    }
+    return fs_index_balance(root);
+}
+
+static fs_node_t *fs_index_remove_min(fs_node_t *root, fs_node_t **min_out) {
+    if (!root->index_left) {
+        *min_out = root;
+        return root->index_right;
+    }
+    root->index_left = fs_index_remove_min(root->index_left, min_out);
+    return fs_index_balance(root);
+}
+
+static fs_node_t *fs_index_remove(fs_node_t *root, const fs_node_t *node) {
+    if (!root) {
+        return NULL;
+    }
+    int cmp = strcmp(node->name, root->name);
+    if (cmp < 0) {
+        root->index_left = fs_index_remove(root->index_left, node);
+    } else if (cmp > 0) {
+        root->index_right = fs_index_remove(root->index_right, node);
+    } else {
+        if (!root->index_left || !root->index_right) {
+            return root->index_left ? root->index_left : root->index_right;
+        }
+        fs_node_t *successor = NULL;
+        fs_node_t *right = fs_index_remove_min(root->index_right, &successor);
+        successor->index_left = root->index_left;
+        successor->index_right = right;
+        root = successor;
+    }
+    return fs_index_balance(root);
+}
+
+/* First entry after `name` in ascending order, or before it when reverse
+ * is set. A NULL name yields the first entry in that direction. */
+static fs_node_t *fs_index_next(fs_node_t *root, const char *name, int reverse) {
+    fs_node_t *best = NULL;
+    while (root) {
+        int cmp = name ? strcmp(root->name, name) : 0;
+        int after = !name || (reverse ? cmp < 0 : cmp > 0);
+        if (after) {
+            best = root;
+            root = reverse ? root->index_right : root->index_left;
+        } else {
+            root = reverse ? root->index_left : root->index_right;
+        }
+    }
+    return best;
+}
+
+static fs_node_t *fs_index_select(fs_node_t *root, size_t rank) {
+    while (root) {
+        size_t left = fs_index_count(root->index_left);
+        if (rank < left) {
+            root = root->index_left;
+        } else if (rank == left) {
+            return root;
+        } else {
+            rank -= left + 1;
+            root = root->index_right;
+        }
+    }
+    return NULL;
+}
+
 static fs_node_t *fs_find_child(fs_node_t *parent, const char *name) {
     if (!parent || parent->type != FS_NODE_DIRECTORY) {
         return NULL;
     }
 
-    fs_node_t *child = parent->children;
-    while (child) {
-        if (strcmp(child->name, name) == 0) {
-            return child;
+    fs_node_t *node = parent->index_root;
+    while (node) {
+        int cmp = strcmp(name, node->name);
+        if (cmp == 0) {
+            return node;
         }
-        child = child->next_sibling;
+        node = (cmp < 0) ? node->index_left : node->index_right;
     }
     return NULL;
 }
 
 static void fs_attach_child(fs_node_t *parent, fs_node_t *child) {
+    parent->index_root = fs_index_insert(parent->index_root, child);
     child->parent = parent;
+    child->prev_sibling = NULL;
     child->next_sibling = parent->children;
+    if (parent->children) {
+        parent->children->prev_sibling = child;
+    }
     parent->children = child;
 }
 
@@ -100,728 +393,2664 @@ static void fs_detach_child(fs_node_t *node) {
         return;
     }
 
-    fs_node_t **cursor = &node->parent->children;
-    while (*cursor && *cursor != node) {
-        cursor = &(*cursor)->next_sibling;
+    if (node->prev_sibling) {
+        node->prev_sibling->next_sibling = node->next_sibling;
+    } else {
+        node->parent->children = node->next_sibling;
     }
-    if (*cursor == node) {
-        *cursor = node->next_sibling;
+    if (node->next_sibling) {
+        node->next_sibling->prev_sibling = node->prev_sibling;
     }
+    node->parent->index_root = fs_index_remove(node->parent->index_root, node);
     node->parent = NULL;
     node->next_sibling = NULL;
+    node->prev_sibling = NULL;
 }
 
-static void fs_free_subtree(fs_node_t *node) {
-    if (!node) {
-        return;
+/* Directories cache the totals of everything below them, so du and the
+ * save size check never need to walk a subtree. */
+static void fs_node_usage(const fs_node_t *node, fs_usage_t *usage) {
+    if (node->type == FS_NODE_FILE) {
+        usage->bytes = node->size;
+        usage->files = 1;
+        usage->directories = 0;
+    } else {
+        *usage = node->usage;
+        usage->directories++;
     }
-    fs_node_t *child = node->children;
-    while (child) {
-        fs_node_t *next = child->next_sibling;
-        fs_free_subtree(child);
-        child = next;
-    }
-    if (node->data) {
-        kfree(node->data);
-    }
-    kfree(node);
 }
 
-static void fs_clear_children(fs_node_t *node) {
-    if (!node) {
-        return;
-    }
-    fs_node_t *child = node->children;
-    while (child) {
-        fs_node_t *next = child->next_sibling;
-        fs_free_subtree(child);
-        child = next;
+static void fs_usage_propagate(fs_node_t *dir, const fs_usage_t *delta, int add) {
+    for (fs_node_t *cursor = dir; cursor; cursor = (cursor == fs_root) ? NULL : cursor->parent) {
+        if (add) {
+            cursor->usage.bytes += delta->bytes;
+            cursor->usage.files += delta->files;
+            cursor->usage.directories += delta->directories;
+        } else {
+            cursor->usage.bytes -= delta->bytes;
+            cursor->usage.files -= delta->files;
+            cursor->usage.directories -= delta->directories;
+        }
     }
-    node->children = NULL;
 }
 
-static fs_node_t *fs_alloc_node(const char *name, fs_node_type_t type) {
-    fs_node_t *node = (fs_node_t *)kmalloc(sizeof(fs_node_t));
-    if (!node) {
-        return NULL;
-    }
-    memset(node, 0, sizeof(fs_node_t));
-    fs_copy_name(node->name, name);
-    node->type = type;
-    return node;
+static void fs_usage_link(fs_node_t *node, int add) {
+    fs_usage_t usage;
+    fs_node_usage(node, &usage);
+    fs_usage_propagate(node->parent, &usage, add);
 }
 
-static fs_node_t *fs_start_for_path(const char *path) {
-    if (!fs_root) {
-        return NULL;
-    }
-
-    if (!path || *path == '\0') {
-        return fs_cwd ? fs_cwd : fs_root;
-    }
-
-    if (*path == '/') {
-        return fs_root;
+static void fs_usage_resize(fs_node_t *file, size_t old_size, size_t new_size) {
+    fs_usage_t delta = { 0, 0, 0 };
+    if (new_size >= old_size) {
+        delta.bytes = new_size - old_size;
+        fs_usage_propagate(file->parent, &delta, 1);
+    } else {
+        delta.bytes = old_size - new_size;
+        fs_usage_propagate(file->parent, &delta, 0);
     }
-
-    return fs_cwd ? fs_cwd : fs_root;
 }
 
-static fs_node_t *fs_walk(const char *path) {
-    fs_node_t *current = fs_start_for_path(path);
-    if (!current) {
-        return NULL;
-    }
-
-    if (!path || *path == '\0') {
-        return current;
-    }
+static int fs_chunk_on_disk(const fs_chunk_t *chunk) {
+    return chunk->disk_generation != 0 && fs_slot_generation[chunk->disk_slot] == chunk->disk_generation;
+}
 
-    const char *cursor = path;
-    if (*cursor == '/') {
-        cursor = fs_skip_separators(cursor);
-        if (*cursor == '\0') {
-            return current;
-        }
+/* Frees the bytes of clean chunks. Without force, a chunk touched since
+ * the hand last passed is spared once (second chance). Nothing is evicted
+ * while a save runs, since its image slot is being rewritten. */
+static size_t fs_cache_evict(size_t target, int force) {
+    if (fs_save_in_progress()) {
+        return 0;
     }
-
-    char component[FS_MAX_NAME_LEN];
-    int overflow = 0;
-    cursor = fs_skip_separators(cursor);
-    while (*cursor != '\0') {
-        cursor = fs_read_component(cursor, component, &overflow);
-        if (overflow) {
-            return NULL;
-        }
-        cursor = fs_skip_separators(cursor);
-
-        if (component[0] == '\0' || component[0] == '.') {
-            if (component[1] == '\0') {
+    size_t freed = 0;
+    for (size_t scanned = 0; scanned < 2 * FS_CHUNK_BUCKETS && freed < target; ++scanned) {
+        fs_chunk_t *chunk = fs_chunk_table[fs_cache_hand];
+        fs_cache_hand = (fs_cache_hand + 1) % FS_CHUNK_BUCKETS;
+        for (; chunk; chunk = chunk->hash_next) {
+            if (!chunk->bytes || chunk == fs_view_chunk || !fs_chunk_on_disk(chunk)) {
                 continue;
             }
-            if (component[1] == '.' && component[2] == '\0') {
-                if (current->parent) {
-                    current = current->parent;
-                }
+            if (chunk->referenced && !force) {
+                chunk->referenced = 0;
                 continue;
             }
+            kfree(chunk->bytes);
+            chunk->bytes = NULL;
+            freed += chunk->length;
+            fs_cache_evicted_bytes += chunk->length;
+            fs_cache_evictions++;
         }
-
-        if (current->type != FS_NODE_DIRECTORY) {
-            return NULL;
-        }
-
-        fs_node_t *next = fs_find_child(current, component);
-        if (!next) {
-            return NULL;
-        }
-        current = next;
     }
+    return freed;
+}
 
-    return current;
+/* Evicts down to the low watermark once usage passes the high one. If
+ * there is nothing clean left to evict, asks for an early save so there
+ * will be next time. */
+static void fs_cache_balance(void) {
+    size_t heap = memory_heap_size();
+    size_t used = memory_bytes_used();
+    if (used <= heap / 8 * FS_CACHE_HIGH_WATERMARK) {
+        return;
+    }
+    fs_cache_evict(used - heap / 8 * FS_CACHE_LOW_WATERMARK, 0);
+    if (memory_bytes_used() > heap / 8 * FS_CACHE_HIGH_WATERMARK) {
+        fs_cache_writeback = 1;
+    }
 }
 
-static fs_status_t fs_prepare_parent(const char *path, fs_node_t **parent_out, char leaf[FS_MAX_NAME_LEN]) {
-    if (!path || *path == '\0') {
-        return FS_ERR_INVALID;
+static void *fs_cache_alloc(size_t size) {
+    void *ptr = kmalloc(size);
+    if (!ptr && fs_cache_evict(size + FS_CHUNK_SIZE, 0) > 0) {
+        ptr = kmalloc(size);
     }
+    if (!ptr && fs_cache_evict(size + FS_CHUNK_SIZE, 1) > 0) {
+        ptr = kmalloc(size);
+    }
+    return ptr;
+}
 
-    fs_node_t *current = fs_start_for_path(path);
-    if (!current) {
+static fs_status_t fs_chunk_read_disk(const fs_chunk_t *chunk, uint8_t *dest) {
+    uint64_t lba = fs_image_slot_lba(chunk->disk_slot) + chunk->disk_offset / FS_IMAGE_SECTOR_SIZE;
+    size_t within = chunk->disk_offset % FS_IMAGE_SECTOR_SIZE;
+    uint32_t sectors = (uint32_t)((within + chunk->length + FS_IMAGE_SECTOR_SIZE - 1) / FS_IMAGE_SECTOR_SIZE);
+    if (!fs_chunk_on_disk(chunk) || bcache_read(fs_device, lba, sectors, fs_cache_sectors) != 0) {
         return FS_ERR_INVALID;
     }
+    memcpy(dest, fs_cache_sectors + within, chunk->length);
+    if (checksum_crc32c(dest, chunk->length) != chunk->hash) {
+        return FS_ERR_CORRUPT;
+    }
+    return FS_OK;
+}
 
-    const char *cursor = path;
-    if (*cursor == '/') {
-        cursor = fs_skip_separators(cursor);
-        if (*cursor == '\0') {
-            return FS_ERR_INVALID;
-        }
-        current = fs_root;
+/* Copies a chunk's bytes out without bringing an evicted chunk back. */
+static fs_status_t fs_chunk_read(const fs_chunk_t *chunk, uint8_t *dest) {
+    if (chunk->bytes) {
+        memcpy(dest, chunk->bytes, chunk->length);
+        return FS_OK;
     }
+    return fs_chunk_read_disk(chunk, dest);
+}
 
-    char component[FS_MAX_NAME_LEN];
-    int overflow = 0;
-    cursor = fs_skip_separators(cursor);
-    while (*cursor != '\0') {
-        cursor = fs_read_component(cursor, component, &overflow);
-        if (overflow) {
-            return FS_ERR_INVALID;
-        }
-        cursor = fs_skip_separators(cursor);
-        int more = (*cursor != '\0');
+/* Returns the chunk's bytes, reloading them if they were evicted. The
+ * pointer is only valid until the next allocation. */
+static const uint8_t *fs_chunk_access(fs_chunk_t *chunk) {
+    chunk->referenced = 1;
+    if (chunk->bytes) {
+        fs_cache_hits++;
+        return chunk->bytes;
+    }
 
-        if (!more) {
-            if (component[0] == '\0' ||
-                (component[0] == '.' && component[1] == '\0') ||
-                (component[0] == '.' && component[1] == '.' && component[2] == '\0')) {
-                return FS_ERR_INVALID;
-            }
-            if (parent_out) {
-                *parent_out = current;
-            }
-            if (leaf) {
-                fs_copy_name(leaf, component);
-            }
-            return FS_OK;
-        }
+    fs_cache_misses++;
+    uint8_t *bytes = (uint8_t *)fs_cache_alloc(chunk->length);
+    if (!bytes) {
+        return NULL;
+    }
+    if (fs_chunk_read_disk(chunk, bytes) != FS_OK) {
+        kfree(bytes);
+        return NULL;
+    }
+    chunk->bytes = bytes;
+    fs_cache_evicted_bytes -= chunk->length;
+    return bytes;
+}
 
-        if (component[0] == '\0' || (component[0] == '.' && component[1] == '\0')) {
+static fs_chunk_t *fs_chunk_intern(const uint8_t *bytes, size_t length) {
+    uint32_t hash = checksum_crc32c(bytes, length);
+    fs_chunk_t **bucket = &fs_chunk_table[hash & (FS_CHUNK_BUCKETS - 1)];
+    for (fs_chunk_t *chunk = *bucket; chunk; chunk = chunk->hash_next) {
+        if (chunk->hash != hash || chunk->length != length) {
             continue;
         }
-
-        if (component[0] == '.' && component[1] == '.' && component[2] == '\0') {
-            if (current->parent) {
-                current = current->parent;
-            }
-            continue;
+        if (fs_chunk_read(chunk, fs_cache_compare) == FS_OK && memcmp(fs_cache_compare, bytes, length) == 0) {
+            chunk->refcount++;
+            return chunk;
         }
+    }
 
-        fs_node_t *next = fs_find_child(current, component);
-        if (!next || next->type != FS_NODE_DIRECTORY) {
-            return FS_ERR_NOENT;
-        }
-        current = next;
+    fs_chunk_t *chunk = (fs_chunk_t *)fs_cache_alloc(sizeof(fs_chunk_t));
+    if (!chunk) {
+        return NULL;
     }
+    memset(chunk, 0, sizeof(fs_chunk_t));
+    chunk->bytes = (uint8_t *)fs_cache_alloc(length);
+    if (!chunk->bytes) {
+        kfree(chunk);
+        return NULL;
+    }
+    chunk->hash = hash;
+    chunk->refcount = 1;
+    chunk->length = (uint16_t)length;
+    chunk->referenced = 1;
+    memcpy(chunk->bytes, bytes, length);
+    chunk->hash_next = *bucket;
+    *bucket = chunk;
+    fs_chunk_count++;
+    fs_chunk_bytes += length;
+    fs_cache_balance();
+    return chunk;
+}
 
-    return FS_ERR_INVALID;
+static fs_chunk_t *fs_chunk_retain(fs_chunk_t *chunk) {
+    chunk->refcount++;
+    return chunk;
 }
 
-static fs_status_t fs_reserve(fs_node_t *node, size_t new_size) {
-    if (!node) {
-        return FS_ERR_INVALID;
+static void fs_chunk_release(fs_chunk_t *chunk) {
+    if (!chunk || --chunk->refcount > 0) {
+        return;
     }
-
-    if (new_size <= node->capacity) {
-        return FS_OK;
+    fs_chunk_t **cursor = &fs_chunk_table[chunk->hash & (FS_CHUNK_BUCKETS - 1)];
+    while (*cursor && *cursor != chunk) {
+        cursor = &(*cursor)->hash_next;
     }
-
-    size_t capacity = node->capacity ? node->capacity : 64;
-    while (capacity < new_size) {
-        capacity *= 2;
+    if (*cursor) {
+        *cursor = chunk->hash_next;
     }
-
-    uint8_t *buffer = (uint8_t *)kmalloc(capacity);
-    if (!buffer) {
-        return FS_ERR_NOMEM;
+    fs_chunk_count--;
+    fs_chunk_bytes -= chunk->length;
+    if (chunk == fs_view_chunk) {
+        fs_view_chunk = NULL;
     }
-    if (node->data && node->size > 0) {
-        memcpy(buffer, node->data, node->size);
-        kfree(node->data);
+    if (chunk->bytes) {
+        kfree(chunk->bytes);
+    } else {
+        fs_cache_evicted_bytes -= chunk->length;
     }
-    node->data = buffer;
-    node->capacity = capacity;
-    return FS_OK;
+    kfree(chunk);
 }
 
-static void fs_seed(void) {
-    fs_mkdir("/etc");
-    fs_create_file("/etc/motd");
-    const char *motd = "Welcome to MyOs!\nUse 'help' to discover shell commands.\n";
-    fs_write_file("/etc/motd", motd, strlen(motd));
+static size_t fs_chunks_for_size(size_t size) {
+    return (size + FS_CHUNK_SIZE - 1) / FS_CHUNK_SIZE;
+}
 
-    fs_mkdir("/docs");
-    fs_create_file("/docs/readme.txt");
-    const char *readme =
-        "MyOs RAM filesystem demo.\n"
-        "Try: ls, cd, pwd, cat, touch, write, append, mkdir, rm, savefs, loadfs.\n";
-    fs_write_file("/docs/readme.txt", readme, strlen(readme));
+static fs_data_t *fs_data_alloc(size_t capacity) {
+    fs_data_t *data = (fs_data_t *)fs_cache_alloc(sizeof(fs_data_t) + capacity * sizeof(fs_chunk_t *));
+    if (!data) {
+        return NULL;
+    }
+    data->refcount = 1;
+    data->chunk_count = 0;
+    data->capacity = capacity;
+    return data;
 }
 
-void fs_init(void) {
-    fs_root = fs_alloc_node("/", FS_NODE_DIRECTORY);
-    if (!fs_root) {
+static fs_data_t *fs_data_retain(fs_data_t *data) {
+    if (data) {
+        data->refcount++;
+    }
+    return data;
+}
+
+static void fs_data_release(fs_data_t *data) {
+    if (!data || --data->refcount > 0) {
         return;
     }
-    fs_root->parent = fs_root;
-    fs_cwd = fs_root;
-    
-    if (fs_persistence_available() && !fs_image_buffer) {
-        fs_image_buffer = (uint8_t *)kmalloc(FS_IMAGE_BUFFER_SIZE);
-        if (fs_image_buffer && fs_load() == FS_OK) {
-            return;
-        }
+    for (size_t i = 0; i < data->chunk_count; ++i) {
+        fs_chunk_release(data->chunks[i]);
     }
-    
-    fs_seed();
-    if (fs_persistence_available() && fs_image_buffer) {
-        fs_save();
+    kfree(data);
+}
+
+static fs_status_t fs_data_from_bytes(const uint8_t *bytes, size_t size, fs_data_t **out) {
+    *out = NULL;
+    if (size == 0) {
+        return FS_OK;
+    }
+    fs_data_t *data = fs_data_alloc(fs_chunks_for_size(size));
+    if (!data) {
+        return FS_ERR_NOMEM;
     }
+    for (size_t offset = 0; offset < size; offset += FS_CHUNK_SIZE) {
+        size_t length = (size - offset > FS_CHUNK_SIZE) ? FS_CHUNK_SIZE : size - offset;
+        fs_chunk_t *chunk = fs_chunk_intern(bytes + offset, length);
+        if (!chunk) {
+            fs_data_release(data);
+            return FS_ERR_NOMEM;
+        }
+        data->chunks[data->chunk_count++] = chunk;
+    }
+    *out = data;
+    return FS_OK;
 }
 
-fs_status_t fs_mkdir(const char *path) {
-    if (!fs_root) {
-        return FS_ERR_INVALID;
+static fs_status_t fs_data_copy_out(const fs_data_t *data, void *buffer, size_t length) {
+    uint8_t *dest = (uint8_t *)buffer;
+    for (size_t i = 0; data && i < data->chunk_count && length > 0; ++i) {
+        const uint8_t *bytes = fs_chunk_access(data->chunks[i]);
+        if (!bytes) {
+            return FS_ERR_CORRUPT;
+        }
+        size_t take = (data->chunks[i]->length < length) ? data->chunks[i]->length : length;
+        memcpy(dest, bytes, take);
+        dest += take;
+        length -= take;
     }
+    return FS_OK;
+}
 
-    if (fs_walk(path)) {
-        return FS_ERR_EXIST;
+static int fs_in_snapshot(const fs_node_t *node) {
+    return fs_snapshot_active && node->epoch != fs_snapshot_epoch;
+}
+
+static void fs_shadow_release(fs_shadow_t *shadow) {
+    if (shadow->prev) {
+        shadow->prev->next = shadow->next;
+    } else {
+        fs_shadows = shadow->next;
+    }
+    if (shadow->next) {
+        shadow->next->prev = shadow->prev;
+    }
+    shadow->owner->shadow = NULL;
+    fs_data_release(shadow->data);
+    if (shadow->children) {
+        kfree(shadow->children);
     }
+    kfree(shadow);
+}
 
-    fs_node_t *parent = NULL;
-    char leaf[FS_MAX_NAME_LEN];
-    fs_status_t status = fs_prepare_parent(path, &parent, leaf);
-    if (status != FS_OK) {
-        return status;
+/* Called before any change to a node's data, size or child list. */
+static void fs_cow_preserve(fs_node_t *node) {
+    if (!node || !fs_in_snapshot(node) || node->shadow) {
+        return;
     }
 
-    if (!parent || parent->type != FS_NODE_DIRECTORY) {
-        return FS_ERR_NOTDIR;
+    fs_shadow_t *shadow = (fs_shadow_t *)kmalloc(sizeof(fs_shadow_t));
+    if (!shadow) {
+        fs_save_abort(FS_ERR_NOMEM);
+        return;
+    }
+    memset(shadow, 0, sizeof(fs_shadow_t));
+    shadow->owner = node;
+    memcpy(shadow->name, node->name, FS_MAX_NAME_LEN);
+
+    if (node->type == FS_NODE_FILE) {
+        shadow->data = fs_data_retain(node->data);
+        shadow->size = node->size;
+    } else {
+        size_t count = 0;
+        for (fs_node_t *child = node->children; child; child = child->next_sibling) {
+            ++count;
+        }
+        if (count > 0) {
+            shadow->children = (fs_node_t **)kmalloc(count * sizeof(fs_node_t *));
+            if (!shadow->children) {
+                kfree(shadow);
+                fs_save_abort(FS_ERR_NOMEM);
+                return;
+            }
+            size_t i = 0;
+            for (fs_node_t *child = node->children; child; child = child->next_sibling) {
+                shadow->children[i++] = child;
+            }
+        }
+        shadow->child_count = count;
     }
 
-    fs_node_t *node = fs_alloc_node(leaf, FS_NODE_DIRECTORY);
-    if (!node) {
-        return FS_ERR_NOMEM;
+    shadow->next = fs_shadows;
+    if (fs_shadows) {
+        fs_shadows->prev = shadow;
     }
-    fs_attach_child(parent, node);
-    return FS_OK;
+    fs_shadows = shadow;
+    node->shadow = shadow;
 }
 
-fs_status_t fs_create_file(const char *path) {
-    if (!fs_root) {
-        return FS_ERR_INVALID;
+static void fs_snapshot_mark_done(fs_node_t *node) {
+    if (node->shadow) {
+        fs_shadow_release(node->shadow);
     }
+    node->epoch = fs_snapshot_epoch;
+}
 
-    if (fs_walk(path)) {
-        return FS_ERR_EXIST;
+/* Depth-first cursor over a subtree. It keeps no stack: it climbs back up
+ * through parent links, or, over a snapshot, through the parent recorded
+ * in each directory's shadow, so any depth is walked in O(1) memory. The
+ * path relative to the starting node is maintained incrementally.
+ *
+ * Each directory is reported twice, on entry and with post set after its
+ * children. Files are reported once. A node may be unlinked or freed when
+ * it is reported, provided fs_cursor_skip is called for a directory that
+ * was entered. */
+typedef struct {
+    fs_node_t *root;
+    fs_node_t *node;
+    fs_node_t *dir;
+    fs_node_t *next;
+    int is_dir;
+    int post;
+    int skip;
+    int snapshot;
+    int track_path;
+    fs_status_t status;
+    size_t path_len;
+    char path[FS_MAX_PATH_LEN];
+} fs_cursor_t;
+
+static void fs_cursor_init(fs_cursor_t *cursor, fs_node_t *root, int snapshot, int track_path) {
+    memset(cursor, 0, sizeof(*cursor));
+    cursor->root = root;
+    cursor->snapshot = snapshot;
+    cursor->track_path = track_path;
+    cursor->status = FS_OK;
+}
+
+static void fs_cursor_skip(fs_cursor_t *cursor) {
+    cursor->skip = 1;
+}
+
+/* In a snapshot walk the children come from the frozen list in the
+ * directory's shadow, so live changes cannot shift the iteration. */
+static fs_node_t *fs_cursor_next_child(fs_cursor_t *cursor) {
+    if (!cursor->snapshot) {
+        return cursor->next;
     }
+    fs_shadow_t *shadow = cursor->dir->shadow;
+    if (shadow->walk_index >= shadow->child_count) {
+        return NULL;
+    }
+    return shadow->children[shadow->walk_index++];
+}
 
-    fs_node_t *parent = NULL;
-    char leaf[FS_MAX_NAME_LEN];
-    fs_status_t status = fs_prepare_parent(path, &parent, leaf);
-    if (status != FS_OK) {
-        return status;
+static fs_node_t *fs_cursor_walk_parent(const fs_cursor_t *cursor, fs_node_t *dir) {
+    if (dir == cursor->root) {
+        return NULL;
     }
+    return cursor->snapshot ? dir->shadow->walk_parent : dir->parent;
+}
 
-    if (!parent || parent->type != FS_NODE_DIRECTORY) {
-        return FS_ERR_NOTDIR;
+static int fs_cursor_land(fs_cursor_t *cursor, fs_node_t *node) {
+    cursor->node = node;
+    cursor->is_dir = node->type == FS_NODE_DIRECTORY;
+    cursor->post = 0;
+    cursor->next = node->next_sibling;
+    if (!cursor->track_path) {
+        return 1;
     }
 
-    fs_node_t *node = fs_alloc_node(leaf, FS_NODE_FILE);
-    if (!node) {
-        return FS_ERR_NOMEM;
+    const char *name = (cursor->snapshot && node->shadow) ? node->shadow->name : node->name;
+    size_t name_len = strlen(name);
+    if (cursor->path_len + 1 + name_len >= FS_MAX_PATH_LEN) {
+        cursor->status = FS_ERR_INVALID;
+        return 0;
     }
-    fs_attach_child(parent, node);
-    return FS_OK;
+    cursor->path[cursor->path_len] = '/';
+    memcpy(&cursor->path[cursor->path_len + 1], name, name_len);
+    cursor->path_len += 1 + name_len;
+    cursor->path[cursor->path_len] = '\0';
+    return 1;
 }
 
-fs_status_t fs_write_file(const char *path, const void *data, size_t size) {
-    fs_node_t *node = fs_walk(path);
-    if (!node) {
-        return FS_ERR_NOENT;
+static void fs_cursor_pop_path(fs_cursor_t *cursor) {
+    if (!cursor->track_path) {
+        return;
     }
-    if (node->type != FS_NODE_FILE) {
-        return FS_ERR_ISDIR;
+    while (cursor->path_len > 0 && cursor->path[cursor->path_len - 1] != '/') {
+        cursor->path_len--;
     }
+    if (cursor->path_len > 0) {
+        cursor->path_len--;
+    }
+    cursor->path[cursor->path_len] = '\0';
+}
 
-    fs_status_t status = fs_reserve(node, size);
-    if (status != FS_OK) {
-        return status;
+/* Advances to the next node. Returns 0 when the walk is over, or when it
+ * failed, in which case status is set. */
+static int fs_cursor_next(fs_cursor_t *cursor) {
+    if (cursor->status != FS_OK) {
+        return 0;
+    }
+    if (!cursor->node) {
+        if (!cursor->root) {
+            return 0;
+        }
+        cursor->node = cursor->root;
+        cursor->is_dir = cursor->root->type == FS_NODE_DIRECTORY;
+        cursor->post = 0;
+        cursor->path_len = 0;
+        cursor->path[0] = '\0';
+        return 1;
+    }
+
+    fs_node_t *node = cursor->node;
+    int skip = cursor->skip;
+    cursor->skip = 0;
+
+    /* node may already have been freed by the caller; only its address
+     * and the fields captured when it was reached are used below. */
+    if (!cursor->post && cursor->is_dir && !skip) {
+        if (cursor->snapshot) {
+            fs_cow_preserve(node);
+            if (!node->shadow) {
+                cursor->status = FS_ERR_NOMEM;
+                return 0;
+            }
+            node->shadow->walk_parent = (node == cursor->root) ? NULL : cursor->dir;
+            node->shadow->walk_index = 0;
+        }
+        cursor->dir = node;
+        cursor->next = node->children;
+        fs_node_t *child = fs_cursor_next_child(cursor);
+        if (child) {
+            return fs_cursor_land(cursor, child);
+        }
+        cursor->dir = fs_cursor_walk_parent(cursor, node);
+        cursor->post = 1;
+        return 1;
     }
 
-    if (size > 0 && data) {
-        memcpy(node->data, data, size);
+    if (node == cursor->root) {
+        cursor->node = NULL;
+        cursor->root = NULL;
+        return 0;
     }
-    node->size = size;
-    return FS_OK;
+
+    fs_cursor_pop_path(cursor);
+    fs_node_t *sibling = fs_cursor_next_child(cursor);
+    if (sibling) {
+        return fs_cursor_land(cursor, sibling);
+    }
+
+    fs_node_t *parent = cursor->dir;
+    cursor->node = parent;
+    cursor->post = 1;
+    cursor->dir = fs_cursor_walk_parent(cursor, parent);
+    if (!cursor->snapshot) {
+        cursor->next = parent->next_sibling;
+    }
+    return 1;
 }
 
-fs_status_t fs_append_file(const char *path, const void *data, size_t size) {
-    fs_node_t *node = fs_walk(path);
+/* Frees a detached subtree. Parts the running snapshot still has to emit
+ * are parked on the zombie list and freed once the snapshot ends. */
+static void fs_free_subtree(fs_node_t *node) {
     if (!node) {
-        return FS_ERR_NOENT;
+        return;
     }
-    if (node->type != FS_NODE_FILE) {
-        return FS_ERR_ISDIR;
+    fs_cursor_t cursor;
+    fs_cursor_init(&cursor, node, 0, 0);
+    while (fs_cursor_next(&cursor)) {
+        fs_node_t *current = cursor.node;
+        if (!cursor.post && fs_in_snapshot(current)) {
+            current->next_sibling = fs_zombies;
+            fs_zombies = current;
+            fs_cursor_skip(&cursor);
+            continue;
+        }
+        if (current->type == FS_NODE_DIRECTORY && !cursor.post) {
+            continue;
+        }
+        fs_data_release(current->data);
+        kfree(current);
     }
+}
 
-    fs_status_t status = fs_reserve(node, node->size + size);
-    if (status != FS_OK) {
-        return status;
+static void fs_snapshot_end(void) {
+    fs_snapshot_active = 0;
+    while (fs_shadows) {
+        fs_shadow_release(fs_shadows);
+    }
+    while (fs_zombies) {
+        fs_node_t *next = fs_zombies->next_sibling;
+        fs_free_subtree(fs_zombies);
+        fs_zombies = next;
     }
+}
 
-    if (size > 0 && data) {
-        memcpy(node->data + node->size, data, size);
+/* Files below a directory with indexing switched on have a trigram index
+ * document. A directory's search_mode is 1 (on), -1 (off) or 0 (inherit
+ * from its parent); the root inherits "off". */
+static int fs_search_enabled(const fs_node_t *node) {
+    for (const fs_node_t *dir = node->parent; dir; dir = (dir == fs_root) ? NULL : dir->parent) {
+        if (dir->search_mode != 0) {
+            return dir->search_mode > 0;
+        }
     }
-    node->size += size;
-    return FS_OK;
+    return 0;
 }
 
-fs_status_t fs_read_file(const char *path, void *buffer, size_t buffer_size, size_t *out_size) {
-    fs_node_t *node = fs_walk(path);
-    if (!node) {
-        return FS_ERR_NOENT;
+static uint8_t fs_search_window[FS_MAX_PATH_LEN + FS_CHUNK_SIZE];
+
+/* Feeds the file's trigrams from byte `start` on, chunk by chunk, carrying
+ * the last two bytes so trigrams spanning chunks are not lost. */
+static void fs_search_feed(fs_node_t *node, size_t start) {
+    fs_data_t *data = node->data;
+    if (!data || start >= node->size) {
+        return;
     }
-    if (node->type != FS_NODE_FILE) {
-        return FS_ERR_ISDIR;
+    size_t carry = 0;
+    for (size_t i = start / FS_CHUNK_SIZE; i < data->chunk_count; ++i) {
+        fs_chunk_t *chunk = data->chunks[i];
+        size_t begin = (i == start / FS_CHUNK_SIZE) ? start % FS_CHUNK_SIZE : 0;
+        if (fs_chunk_read(chunk, fs_cache_compare) != FS_OK) {
+            trigram_doc_destroy(node->search_doc);
+            node->search_doc = TRIGRAM_NO_DOC;
+            return;
+        }
+        memcpy(fs_search_window + carry, fs_cache_compare + begin, chunk->length - begin);
+        size_t length = carry + chunk->length - begin;
+        trigram_doc_add(node->search_doc, fs_search_window, length);
+        carry = (length < 2) ? length : 2;
+        memmove(fs_search_window, fs_search_window + length - carry, carry);
+    }
+}
+
+static void fs_search_drop(fs_node_t *node) {
+    if (node->search_doc != TRIGRAM_NO_DOC) {
+        trigram_doc_destroy(node->search_doc);
+        node->search_doc = TRIGRAM_NO_DOC;
     }
+}
 
-    size_t to_copy = (buffer_size < node->size) ? buffer_size : node->size;
-    if (buffer && to_copy > 0) {
-        memcpy(buffer, node->data, to_copy);
+/* Brings a file's index document in line with its directory's setting,
+ * indexing the whole file if it had none. */
+static void fs_search_sync(fs_node_t *node) {
+    if (node->type != FS_NODE_FILE) {
+        return;
     }
-    if (out_size) {
-        *out_size = node->size;
+    if (!fs_search_enabled(node)) {
+        fs_search_drop(node);
+        return;
+    }
+    if (node->search_doc == TRIGRAM_NO_DOC) {
+        node->search_doc = trigram_doc_create(node);
+        fs_search_feed(node, 0);
     }
-    return FS_OK;
 }
 
-const uint8_t *fs_get_file_data(const char *path, size_t *out_size) {
-    fs_node_t *node = fs_walk(path);
-    if (!node || node->type != FS_NODE_FILE) {
-        return NULL;
+static void fs_search_append(fs_node_t *node, size_t old_size) {
+    if (node->search_doc == TRIGRAM_NO_DOC) {
+        fs_search_sync(node);
+        return;
     }
-    if (out_size) {
-        *out_size = node->size;
+    fs_search_feed(node, (old_size >= 2) ? old_size - 2 : 0);
+}
+
+static void fs_search_sync_subtree(fs_node_t *node, int drop) {
+    fs_cursor_t cursor;
+    fs_cursor_init(&cursor, node, 0, 0);
+    while (fs_cursor_next(&cursor)) {
+        if (cursor.node->type != FS_NODE_FILE) {
+            continue;
+        }
+        if (drop) {
+            fs_search_drop(cursor.node);
+        } else {
+            fs_search_sync(cursor.node);
+        }
     }
-    return node->data;
 }
 
-fs_status_t fs_list_dir(const char *path, fs_list_callback_t callback, void *user_data) {
-    fs_node_t *node = fs_walk(path);
+static void fs_clear_children(fs_node_t *node) {
     if (!node) {
-        return FS_ERR_NOENT;
-    }
-    if (node->type != FS_NODE_DIRECTORY) {
-        return FS_ERR_NOTDIR;
+        return;
     }
-
-    fs_dir_entry_t entry;
     fs_node_t *child = node->children;
     while (child) {
-        entry.name = child->name;
-        entry.size = child->size;
-        entry.is_directory = (child->type == FS_NODE_DIRECTORY);
-        if (callback) {
-            callback(&entry, user_data);
-        }
-        child = child->next_sibling;
+        fs_node_t *next = child->next_sibling;
+        fs_search_sync_subtree(child, 1);
+        fs_free_subtree(child);
+        child = next;
     }
-    return FS_OK;
+    node->children = NULL;
+    node->index_root = NULL;
+    memset(&node->usage, 0, sizeof(node->usage));
 }
 
-fs_status_t fs_change_dir(const char *path) {
-    fs_node_t *node = fs_walk(path);
+static fs_node_t *fs_alloc_node(const char *name, fs_node_type_t type) {
+    fs_node_t *node = (fs_node_t *)fs_cache_alloc(sizeof(fs_node_t));
     if (!node) {
-        return FS_ERR_NOENT;
+        return NULL;
     }
-    if (node->type != FS_NODE_DIRECTORY) {
-        return FS_ERR_NOTDIR;
+    memset(node, 0, sizeof(fs_node_t));
+    fs_copy_name(node->name, name);
+    node->type = type;
+    node->search_doc = TRIGRAM_NO_DOC;
+    node->epoch = fs_snapshot_epoch;
+    return node;
+}
+
+static fs_node_t *fs_start_for_path(const char *path) {
+    if (!fs_root) {
+        return NULL;
     }
-    fs_cwd = node;
-    return FS_OK;
+
+    if (!path || *path == '\0') {
+        return fs_cwd ? fs_cwd : fs_root;
+    }
+
+    if (*path == '/') {
+        return fs_root;
+    }
+
+    return fs_cwd ? fs_cwd : fs_root;
 }
 
-static void fs_build_path_from_node(fs_node_t *node, char *buffer, size_t buffer_size) {
-    if (!buffer || buffer_size < 2 || !node) {
-        if (buffer && buffer_size > 0) {
-            buffer[0] = '\0';
-        }
-        return;
+static fs_node_t *fs_walk(const char *path) {
+    fs_node_t *current = fs_start_for_path(path);
+    if (!current) {
+        return NULL;
     }
 
-    const size_t max_components = FS_MAX_PATH_LEN / 2;
-    fs_node_t *components[max_components];
-    size_t depth = 0;
-    fs_node_t *current = node;
-    while (current && current != fs_root && depth < max_components) {
-        components[depth++] = current;
-        current = current->parent;
+    if (!path || *path == '\0') {
+        return current;
     }
 
-    size_t pos = 0;
-    buffer[pos++] = '/';
+    const char *cursor = path;
+    if (*cursor == '/') {
+        cursor = fs_skip_separators(cursor);
+        if (*cursor == '\0') {
+            return current;
+        }
+    }
 
-    for (size_t i = 0; i < depth && pos < buffer_size - 1; ++i) {
-        fs_node_t *component_node = components[depth - i - 1];
-        size_t len = strlen(component_node->name);
-        if (pos + len >= buffer_size) {
+    char component[FS_MAX_NAME_LEN];
+    int overflow = 0;
+    cursor = fs_skip_separators(cursor);
+    while (*cursor != '\0') {
+        cursor = fs_read_component(cursor, component, &overflow);
+        if (overflow) {
+            return NULL;
+        }
+        cursor = fs_skip_separators(cursor);
+
+        if (component[0] == '\0' || component[0] == '.') {
+            if (component[1] == '\0') {
+                continue;
+            }
+            if (component[1] == '.' && component[2] == '\0') {
+                if (current->parent) {
+                    current = current->parent;
+                }
+                continue;
+            }
+        }
+
+        if (current->type != FS_NODE_DIRECTORY) {
+            return NULL;
+        }
+
+        fs_node_t *next = fs_find_child(current, component);
+        if (!next) {
+            return NULL;
+        }
+        current = next;
+    }
+
+    return current;
+}
+
+static fs_status_t fs_prepare_parent(const char *path, fs_node_t **parent_out, char leaf[FS_MAX_NAME_LEN]) {
+    if (!path || *path == '\0') {
+        return FS_ERR_INVALID;
+    }
+
+    fs_node_t *current = fs_start_for_path(path);
+    if (!current) {
+        return FS_ERR_INVALID;
+    }
+
+    const char *cursor = path;
+    if (*cursor == '/') {
+        cursor = fs_skip_separators(cursor);
+        if (*cursor == '\0') {
+            return FS_ERR_INVALID;
+        }
+        current = fs_root;
+    }
+
+    char component[FS_MAX_NAME_LEN];
+    int overflow = 0;
+    cursor = fs_skip_separators(cursor);
+    while (*cursor != '\0') {
+        cursor = fs_read_component(cursor, component, &overflow);
+        if (overflow) {
+            return FS_ERR_INVALID;
+        }
+        cursor = fs_skip_separators(cursor);
+        int more = (*cursor != '\0');
+
+        if (!more) {
+            if (component[0] == '\0' ||
+                (component[0] == '.' && component[1] == '\0') ||
+                (component[0] == '.' && component[1] == '.' && component[2] == '\0')) {
+                return FS_ERR_INVALID;
+            }
+            if (parent_out) {
+                *parent_out = current;
+            }
+            if (leaf) {
+                fs_copy_name(leaf, component);
+            }
+            return FS_OK;
+        }
+
+        if (component[0] == '\0' || (component[0] == '.' && component[1] == '\0')) {
+            continue;
+        }
+
+        if (component[0] == '.' && component[1] == '.' && component[2] == '\0') {
+            if (current->parent) {
+                current = current->parent;
+            }
+            continue;
+        }
+
+        fs_node_t *next = fs_find_child(current, component);
+        if (!next || next->type != FS_NODE_DIRECTORY) {
+            return FS_ERR_NOENT;
+        }
+        current = next;
+    }
+
+    return FS_ERR_INVALID;
+}
+
+/* Appends to a file's chunk list. Only the partial tail chunk and the new
+ * chunks are touched; the list itself is copied first if it is shared. On
+ * failure the file keeps its previous contents. */
+static fs_status_t fs_data_append(fs_node_t *node, const uint8_t *bytes, size_t size) {
+    if (size == 0) {
+        return FS_OK;
+    }
+
+    fs_data_t *data = node->data;
+    size_t old_size = node->size;
+    size_t needed = fs_chunks_for_size(old_size + size);
+
+    if (!data || data->refcount > 1 || data->capacity < needed) {
+        size_t capacity = (data && data->capacity) ? data->capacity : 1;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+        fs_data_t *copy = fs_data_alloc(capacity);
+        if (!copy) {
+            return FS_ERR_NOMEM;
+        }
+        for (size_t i = 0; data && i < data->chunk_count; ++i) {
+            copy->chunks[i] = fs_chunk_retain(data->chunks[i]);
+        }
+        copy->chunk_count = data ? data->chunk_count : 0;
+        fs_data_release(data);
+        node->data = data = copy;
+    }
+
+    size_t original_count = data->chunk_count;
+    size_t tail_length = old_size % FS_CHUNK_SIZE;
+    fs_chunk_t *old_tail = NULL;
+    size_t consumed = 0;
+
+    if (tail_length > 0) {
+        old_tail = data->chunks[original_count - 1];
+        consumed = FS_CHUNK_SIZE - tail_length;
+        if (consumed > size) {
+            consumed = size;
+        }
+        if (fs_chunk_read(old_tail, fs_chunk_scratch) != FS_OK) {
+            return FS_ERR_CORRUPT;
+        }
+        memcpy(fs_chunk_scratch + tail_length, bytes, consumed);
+        fs_chunk_t *tail = fs_chunk_intern(fs_chunk_scratch, tail_length + consumed);
+        if (!tail) {
+            return FS_ERR_NOMEM;
+        }
+        data->chunks[original_count - 1] = tail;
+    }
+
+    while (consumed < size) {
+        size_t length = (size - consumed > FS_CHUNK_SIZE) ? FS_CHUNK_SIZE : size - consumed;
+        fs_chunk_t *chunk = fs_chunk_intern(bytes + consumed, length);
+        if (!chunk) {
+            while (data->chunk_count > original_count) {
+                fs_chunk_release(data->chunks[--data->chunk_count]);
+            }
+            if (old_tail) {
+                fs_chunk_release(data->chunks[original_count - 1]);
+                data->chunks[original_count - 1] = old_tail;
+            }
+            return FS_ERR_NOMEM;
+        }
+        data->chunks[data->chunk_count++] = chunk;
+        consumed += length;
+    }
+
+    fs_chunk_release(old_tail);
+    node->size = old_size + size;
+    return FS_OK;
+}
+
+static void fs_seed(void) {
+    fs_mkdir("/etc");
+    fs_create_file("/etc/motd");
+    const char *motd = "Welcome to MyOs!\nUse 'help' to discover shell commands.\n";
+    fs_write_file("/etc/motd", motd, strlen(motd));
+
+    fs_mkdir("/docs");
+    fs_create_file("/docs/readme.txt");
+    const char *readme =
+        "MyOs RAM filesystem demo.\n"
+        "Try: ls, cd, pwd, cat, touch, write, append, mkdir, rm, savefs, loadfs.\n";
+    fs_write_file("/docs/readme.txt", readme, strlen(readme));
+}
+
+/* Devices tried at boot, in order; the first one present is mounted.
+ * `mount` picks any other. */
+static const char *const fs_default_devices[] = { "ata0", "virtio0", "sata0" };
+
+void fs_init(void) {
+    fs_root = fs_alloc_node("/", FS_NODE_DIRECTORY);
+    if (!fs_root) {
+        return;
+    }
+    fs_root->parent = fs_root;
+    fs_cwd = fs_root;
+    
+    for (size_t i = 0; i < sizeof(fs_default_devices) / sizeof(fs_default_devices[0]); ++i) {
+        if (blockdev_find(fs_default_devices[i]) && fs_mount(fs_default_devices[i]) == FS_OK) {
+            break;
+        }
+    }
+    if (fs_device && fs_load() == FS_OK) {
+        return;
+    }
+    
+    fs_seed();
+    if (fs_persistence_available() && fs_image_buffer) {
+        fs_save();
+    }
+}
+
+fs_status_t fs_mkdir(const char *path) {
+    if (!fs_root) {
+        return FS_ERR_INVALID;
+    }
+
+    if (fs_walk(path)) {
+        return FS_ERR_EXIST;
+    }
+
+    fs_node_t *parent = NULL;
+    char leaf[FS_MAX_NAME_LEN];
+    fs_status_t status = fs_prepare_parent(path, &parent, leaf);
+    if (status != FS_OK) {
+        return status;
+    }
+
+    if (!parent || parent->type != FS_NODE_DIRECTORY) {
+        return FS_ERR_NOTDIR;
+    }
+
+    fs_node_t *node = fs_alloc_node(leaf, FS_NODE_DIRECTORY);
+    if (!node) {
+        return FS_ERR_NOMEM;
+    }
+    fs_cow_preserve(parent);
+    fs_attach_child(parent, node);
+    fs_usage_link(node, 1);
+    return FS_OK;
+}
+
+fs_status_t fs_create_file(const char *path) {
+    if (!fs_root) {
+        return FS_ERR_INVALID;
+    }
+
+    if (fs_walk(path)) {
+        return FS_ERR_EXIST;
+    }
+
+    fs_node_t *parent = NULL;
+    char leaf[FS_MAX_NAME_LEN];
+    fs_status_t status = fs_prepare_parent(path, &parent, leaf);
+    if (status != FS_OK) {
+        return status;
+    }
+
+    if (!parent || parent->type != FS_NODE_DIRECTORY) {
+        return FS_ERR_NOTDIR;
+    }
+
+    fs_node_t *node = fs_alloc_node(leaf, FS_NODE_FILE);
+    if (!node) {
+        return FS_ERR_NOMEM;
+    }
+    fs_cow_preserve(parent);
+    fs_attach_child(parent, node);
+    fs_usage_link(node, 1);
+    fs_search_sync(node);
+    return FS_OK;
+}
+
+fs_status_t fs_write_file(const char *path, const void *data, size_t size) {
+    fs_node_t *node = fs_walk(path);
+    if (!node) {
+        return FS_ERR_NOENT;
+    }
+    if (node->type != FS_NODE_FILE) {
+        return FS_ERR_ISDIR;
+    }
+
+    fs_data_t *contents = NULL;
+    fs_status_t status = fs_data_from_bytes((const uint8_t *)data, data ? size : 0, &contents);
+    if (status != FS_OK) {
+        return status;
+    }
+
+    fs_cow_preserve(node);
+    fs_data_release(node->data);
+    fs_usage_resize(node, node->size, contents ? size : 0);
+    node->data = contents;
+    node->size = contents ? size : 0;
+    fs_search_drop(node);
+    fs_search_sync(node);
+    return FS_OK;
+}
+
+fs_status_t fs_append_file(const char *path, const void *data, size_t size) {
+    fs_node_t *node = fs_walk(path);
+    if (!node) {
+        return FS_ERR_NOENT;
+    }
+    if (node->type != FS_NODE_FILE) {
+        return FS_ERR_ISDIR;
+    }
+
+    if (!data || size == 0) {
+        return FS_OK;
+    }
+
+    fs_cow_preserve(node);
+    size_t old_size = node->size;
+    fs_status_t status = fs_data_append(node, (const uint8_t *)data, size);
+    if (status == FS_OK) {
+        fs_usage_resize(node, old_size, node->size);
+        fs_search_append(node, old_size);
+    }
+    return status;
+}
+
+fs_status_t fs_read_file(const char *path, void *buffer, size_t buffer_size, size_t *out_size) {
+    fs_node_t *node = fs_walk(path);
+    if (!node) {
+        return FS_ERR_NOENT;
+    }
+    if (node->type != FS_NODE_FILE) {
+        return FS_ERR_ISDIR;
+    }
+
+    size_t to_copy = (buffer_size < node->size) ? buffer_size : node->size;
+    if (out_size) {
+        *out_size = node->size;
+    }
+    if (buffer && to_copy > 0) {
+        return fs_data_copy_out(node->data, buffer, to_copy);
+    }
+    return FS_OK;
+}
+
+const uint8_t *fs_get_file_data(const char *path, size_t *out_size) {
+    fs_node_t *node = fs_walk(path);
+    if (!node || node->type != FS_NODE_FILE) {
+        return NULL;
+    }
+    if (out_size) {
+        *out_size = node->size;
+    }
+    if (!node->data) {
+        return NULL;
+    }
+    if (node->data->chunk_count == 1) {
+        /* The chunk stays pinned in memory until the next call. */
+        const uint8_t *bytes = fs_chunk_access(node->data->chunks[0]);
+        fs_view_chunk = bytes ? node->data->chunks[0] : NULL;
+        return bytes;
+    }
+
+    /* Multi-chunk files are gathered into a shared view buffer that stays
+     * valid until the next call. */
+    fs_view_chunk = NULL;
+    if (fs_view_capacity < node->size) {
+        uint8_t *view = (uint8_t *)fs_cache_alloc(node->size);
+        if (!view) {
+            return NULL;
+        }
+        if (fs_view_buffer) {
+            kfree(fs_view_buffer);
+        }
+        fs_view_buffer = view;
+        fs_view_capacity = node->size;
+    }
+    if (fs_data_copy_out(node->data, fs_view_buffer, node->size) != FS_OK) {
+        return NULL;
+    }
+    return fs_view_buffer;
+}
+
+fs_status_t fs_list_dir(const char *path, fs_list_callback_t callback, void *user_data) {
+    fs_node_t *node = fs_walk(path);
+    if (!node) {
+        return FS_ERR_NOENT;
+    }
+    if (node->type != FS_NODE_DIRECTORY) {
+        return FS_ERR_NOTDIR;
+    }
+
+    /* Entries come in name order. Each step looks up the successor of the
+     * previous name, so the callback may modify the directory. */
+    fs_dir_entry_t entry;
+    char name[FS_MAX_NAME_LEN];
+    fs_node_t *child = fs_index_next(node->index_root, NULL, 0);
+    while (child) {
+        memcpy(name, child->name, FS_MAX_NAME_LEN);
+        entry.name = name;
+        entry.size = child->size;
+        entry.is_directory = (child->type == FS_NODE_DIRECTORY);
+        if (callback) {
+            callback(&entry, user_data);
+        }
+        child = fs_index_next(node->index_root, name, 0);
+    }
+    return FS_OK;
+}
+
+fs_status_t fs_change_dir(const char *path) {
+    fs_node_t *node = fs_walk(path);
+    if (!node) {
+        return FS_ERR_NOENT;
+    }
+    if (node->type != FS_NODE_DIRECTORY) {
+        return FS_ERR_NOTDIR;
+    }
+    fs_cwd = node;
+    return FS_OK;
+}
+
+static void fs_build_path_from_node(fs_node_t *node, char *buffer, size_t buffer_size) {
+    if (!buffer || buffer_size < 2 || !node) {
+        if (buffer && buffer_size > 0) {
+            buffer[0] = '\0';
+        }
+        return;
+    }
+
+    const size_t max_components = FS_MAX_PATH_LEN / 2;
+    fs_node_t *components[max_components];
+    size_t depth = 0;
+    fs_node_t *current = node;
+    while (current && current != fs_root && depth < max_components) {
+        components[depth++] = current;
+        current = current->parent;
+    }
+
+    size_t pos = 0;
+    buffer[pos++] = '/';
+
+    for (size_t i = 0; i < depth && pos < buffer_size - 1; ++i) {
+        fs_node_t *component_node = components[depth - i - 1];
+        size_t len = strlen(component_node->name);
+        if (pos + len >= buffer_size) {
+            break;
+        }
+        memcpy(&buffer[pos], component_node->name, len);
+        pos += len;
+        if (i != depth - 1 && pos < buffer_size - 1) {
+            buffer[pos++] = '/';
+        }
+    }
+
+    buffer[pos] = '\0';
+}
+
+void fs_get_cwd(char *buffer, size_t buffer_size) {
+    fs_build_path_from_node(fs_cwd, buffer, buffer_size);
+}
+
+/* A directory stream remembers the absolute path and the last name it
+ * returned, not node pointers, so it stays valid while entries (or the
+ * directory itself) are added, removed or renamed between calls. */
+struct fs_dir {
+    char path[FS_MAX_PATH_LEN];
+    int reverse;
+    int positioned;
+    char last[FS_MAX_NAME_LEN];
+};
+
+fs_status_t fs_opendir(const char *path, fs_dir_order_t order, fs_dir_t **out) {
+    if (!out) {
+        return FS_ERR_INVALID;
+    }
+    *out = NULL;
+
+    fs_node_t *node = fs_walk(path);
+    if (!node) {
+        return FS_ERR_NOENT;
+    }
+    if (node->type != FS_NODE_DIRECTORY) {
+        return FS_ERR_NOTDIR;
+    }
+
+    fs_dir_t *dir = (fs_dir_t *)kmalloc(sizeof(fs_dir_t));
+    if (!dir) {
+        return FS_ERR_NOMEM;
+    }
+    memset(dir, 0, sizeof(fs_dir_t));
+    fs_build_path_from_node(node, dir->path, sizeof(dir->path));
+    dir->reverse = (order == FS_DIR_ORDER_NAME_DESC);
+    *out = dir;
+    return FS_OK;
+}
+
+static fs_node_t *fs_dir_node(const fs_dir_t *dir) {
+    fs_node_t *node = fs_walk(dir->path);
+    return (node && node->type == FS_NODE_DIRECTORY) ? node : NULL;
+}
+
+int fs_readdir(fs_dir_t *dir, fs_dir_entry_t *entry) {
+    fs_node_t *node = dir ? fs_dir_node(dir) : NULL;
+    if (!node) {
+        return 0;
+    }
+
+    fs_node_t *child = fs_index_next(node->index_root, dir->positioned ? dir->last : NULL, dir->reverse);
+    if (!child) {
+        return 0;
+    }
+    memcpy(dir->last, child->name, FS_MAX_NAME_LEN);
+    dir->positioned = 1;
+    if (entry) {
+        entry->name = dir->last;
+        entry->size = child->size;
+        entry->is_directory = (child->type == FS_NODE_DIRECTORY);
+    }
+    return 1;
+}
+
+/* Positions the stream so the next fs_readdir returns the entry at
+ * `offset` in the stream's order; found by rank, not by skipping. */
+fs_status_t fs_seekdir(fs_dir_t *dir, size_t offset) {
+    fs_node_t *node = dir ? fs_dir_node(dir) : NULL;
+    if (!node) {
+        return FS_ERR_NOENT;
+    }
+
+    size_t count = fs_index_count(node->index_root);
+    if (offset > count) {
+        offset = count;
+    }
+    if (offset == 0) {
+        dir->positioned = 0;
+        return FS_OK;
+    }
+
+    size_t rank = dir->reverse ? count - offset : offset - 1;
+    fs_node_t *child = fs_index_select(node->index_root, rank);
+    memcpy(dir->last, child->name, FS_MAX_NAME_LEN);
+    dir->positioned = 1;
+    return FS_OK;
+}
+
+size_t fs_dir_entry_count(fs_dir_t *dir) {
+    fs_node_t *node = dir ? fs_dir_node(dir) : NULL;
+    return node ? fs_index_count(node->index_root) : 0;
+}
+
+void fs_closedir(fs_dir_t *dir) {
+    if (dir) {
+        kfree(dir);
+    }
+}
+
+int fs_exists(const char *path) {
+    return fs_walk(path) != NULL;
+}
+
+int fs_is_dir(const char *path) {
+    fs_node_t *node = fs_walk(path);
+    if (!node) {
+        return 0;
+    }
+    return node->type == FS_NODE_DIRECTORY;
+}
+
+static int fs_is_within(const fs_node_t *node, const fs_node_t *ancestor) {
+    for (const fs_node_t *cursor = node; cursor; cursor = cursor->parent) {
+        if (cursor == ancestor) {
+            return 1;
+        }
+        if (cursor == fs_root) {
+            break;
+        }
+    }
+    return 0;
+}
+
+fs_status_t fs_remove(const char *path, int recursive) {
+    fs_node_t *node = fs_walk(path);
+    if (!node) {
+        return FS_ERR_NOENT;
+    }
+    if (node == fs_root) {
+        return FS_ERR_INVALID;
+    }
+
+    if (node->type == FS_NODE_DIRECTORY && node->children && !recursive) {
+        return FS_ERR_NOTEMPTY;
+    }
+
+    if (fs_is_within(fs_cwd, node)) {
+        fs_cwd = node->parent ? node->parent : fs_root;
+    }
+
+    fs_cow_preserve(node->parent);
+    fs_usage_link(node, 0);
+    fs_search_sync_subtree(node, 1);
+    fs_detach_child(node);
+    fs_free_subtree(node);
+    return FS_OK;
+}
+
+fs_status_t fs_rename(const char *old_path, const char *new_path) {
+    if (!fs_root) {
+        return FS_ERR_INVALID;
+    }
+
+    fs_node_t *node = fs_walk(old_path);
+    if (!node) {
+        return FS_ERR_NOENT;
+    }
+    if (node == fs_root) {
+        return FS_ERR_INVALID;
+    }
+    if (fs_walk(new_path)) {
+        return FS_ERR_EXIST;
+    }
+
+    fs_node_t *parent = NULL;
+    char leaf[FS_MAX_NAME_LEN];
+    fs_status_t status = fs_prepare_parent(new_path, &parent, leaf);
+    if (status != FS_OK) {
+        return status;
+    }
+    if (!parent || parent->type != FS_NODE_DIRECTORY) {
+        return FS_ERR_NOTDIR;
+    }
+    if (fs_is_within(parent, node)) {
+        return FS_ERR_INVALID;
+    }
+
+    /* Relinking is O(1): unhook from the old sibling list and prepend to
+     * the new one. Paths are never cached, so nothing else needs fixing. */
+    fs_cow_preserve(node->parent);
+    fs_cow_preserve(parent);
+    fs_cow_preserve(node);
+    fs_usage_link(node, 0);
+    fs_detach_child(node);
+    fs_copy_name(node->name, leaf);
+    fs_attach_child(parent, node);
+    fs_usage_link(node, 1);
+    fs_search_sync_subtree(node, 0);
+    return FS_OK;
+}
+
+/* Duplicates a subtree without attaching it. File nodes share the source
+ * chunk lists, which are copied on the first write to either side, so a
+ * copy costs metadata only. */
+static fs_node_t *fs_clone_subtree(fs_node_t *source, const char *name) {
+    fs_node_t *copy = NULL;
+    fs_node_t *target = NULL;
+    fs_cursor_t cursor;
+    fs_cursor_init(&cursor, source, 0, 0);
+    while (fs_cursor_next(&cursor)) {
+        fs_node_t *node = cursor.node;
+        if (cursor.post) {
+            target = target->parent;
+            continue;
+        }
+
+        fs_node_t *clone = fs_alloc_node(node == source ? name : node->name, node->type);
+        if (!clone) {
+            fs_free_subtree(copy);
+            return NULL;
+        }
+        clone->data = fs_data_retain(node->data);
+        clone->size = node->size;
+        clone->usage = node->usage;
+        clone->search_mode = node->search_mode;
+        if (!copy) {
+            copy = clone;
+        } else {
+            fs_attach_child(target, clone);
+        }
+        if (node->type == FS_NODE_DIRECTORY) {
+            target = clone;
+        }
+    }
+    return copy;
+}
+
+fs_status_t fs_copy(const char *src_path, const char *dst_path, int recursive) {
+    if (!fs_root) {
+        return FS_ERR_INVALID;
+    }
+
+    fs_node_t *source = fs_walk(src_path);
+    if (!source) {
+        return FS_ERR_NOENT;
+    }
+    if (source->type == FS_NODE_DIRECTORY && !recursive) {
+        return FS_ERR_ISDIR;
+    }
+    if (fs_walk(dst_path)) {
+        return FS_ERR_EXIST;
+    }
+
+    fs_node_t *parent = NULL;
+    char leaf[FS_MAX_NAME_LEN];
+    fs_status_t status = fs_prepare_parent(dst_path, &parent, leaf);
+    if (status != FS_OK) {
+        return status;
+    }
+    if (!parent || parent->type != FS_NODE_DIRECTORY) {
+        return FS_ERR_NOTDIR;
+    }
+    if (fs_is_within(parent, source)) {
+        return FS_ERR_INVALID;
+    }
+
+    fs_node_t *copy = fs_clone_subtree(source, leaf);
+    if (!copy) {
+        return FS_ERR_NOMEM;
+    }
+    fs_cow_preserve(parent);
+    fs_attach_child(parent, copy);
+    fs_usage_link(copy, 1);
+    fs_search_sync_subtree(copy, 0);
+    return FS_OK;
+}
+
+fs_status_t fs_get_usage(const char *path, fs_usage_t *usage) {
+    fs_node_t *node = fs_walk(path);
+    if (!node) {
+        return FS_ERR_NOENT;
+    }
+    if (usage && node->type == FS_NODE_DIRECTORY) {
+        *usage = node->usage;
+    } else if (usage) {
+        fs_node_usage(node, usage);
+    }
+    return FS_OK;
+}
+
+void fs_get_dedup_stats(fs_dedup_stats_t *stats) {
+    if (!stats) {
+        return;
+    }
+    memset(stats, 0, sizeof(*stats));
+    fs_cursor_t cursor;
+    fs_cursor_init(&cursor, fs_root, 0, 0);
+    while (fs_cursor_next(&cursor)) {
+        const fs_node_t *node = cursor.node;
+        if (node->type == FS_NODE_FILE) {
+            stats->logical_bytes += node->size;
+            stats->chunk_refs += node->data ? node->data->chunk_count : 0;
+        }
+    }
+    stats->physical_bytes = fs_chunk_bytes;
+    stats->chunk_count = fs_chunk_count;
+}
+
+fs_status_t fs_set_search_indexing(const char *path, int enabled) {
+    fs_node_t *node = fs_walk(path);
+    if (!node) {
+        return FS_ERR_NOENT;
+    }
+    if (node->type != FS_NODE_DIRECTORY) {
+        return FS_ERR_NOTDIR;
+    }
+    node->search_mode = enabled ? 1 : -1;
+    fs_search_sync_subtree(node, 0);
+    return FS_OK;
+}
+
+int fs_search_indexing_enabled(const char *path) {
+    fs_node_t *node = fs_walk(path);
+    if (!node) {
+        return 0;
+    }
+    if (node->type == FS_NODE_DIRECTORY && node->search_mode != 0) {
+        return node->search_mode > 0;
+    }
+    return fs_search_enabled(node);
+}
+
+/* Streams the file through a window that keeps the last length - 1 bytes
+ * of the previous chunk, so matches spanning chunks are found. */
+static int fs_data_contains(const fs_node_t *node, const uint8_t *text, size_t length) {
+    /* Evicted chunks are read for the scan but not brought back into the
+     * cache, so one search does not flush the working set. */
+    const fs_data_t *data = node->data;
+    if (!data || length == 0 || length > node->size) {
+        return length == 0;
+    }
+    size_t carry = 0;
+    for (size_t i = 0; i < data->chunk_count; ++i) {
+        const fs_chunk_t *chunk = data->chunks[i];
+        if (fs_chunk_read(chunk, fs_search_window + carry) != FS_OK) {
+            return 0;
+        }
+        size_t window = carry + chunk->length;
+        for (size_t pos = 0; pos + length <= window; ++pos) {
+            if (fs_search_window[pos] == text[0] && memcmp(fs_search_window + pos, text, length) == 0) {
+                return 1;
+            }
+        }
+        carry = (window < length - 1) ? window : length - 1;
+        memmove(fs_search_window, fs_search_window + window - carry, carry);
+    }
+    return 0;
+}
+
+typedef struct {
+    const uint8_t *text;
+    size_t length;
+    fs_search_callback_t callback;
+    void *user_data;
+    fs_search_result_t *result;
+} fs_search_query_t;
+
+static void fs_search_candidate(uint32_t doc, void *owner, void *user_data) {
+    (void)doc;
+    fs_search_query_t *query = (fs_search_query_t *)user_data;
+    fs_node_t *node = (fs_node_t *)owner;
+    query->result->candidates++;
+    if (!fs_data_contains(node, query->text, query->length)) {
+        return;
+    }
+    query->result->matches++;
+    if (query->callback) {
+        char path[FS_MAX_PATH_LEN];
+        fs_build_path_from_node(node, path, sizeof(path));
+        query->callback(path, query->user_data);
+    }
+}
+
+/* Only files in indexed directories are searched. The callback must not
+ * modify the filesystem. */
+fs_status_t fs_search(const char *text, fs_search_callback_t callback, void *user_data,
+                      fs_search_result_t *result) {
+    fs_search_result_t local;
+    if (!result) {
+        result = &local;
+    }
+    memset(result, 0, sizeof(*result));
+    if (!text || *text == '\0') {
+        return FS_ERR_INVALID;
+    }
+    size_t length = strlen(text);
+    if (length >= FS_MAX_PATH_LEN) {
+        return FS_ERR_INVALID;
+    }
+
+    fs_search_query_t query = { (const uint8_t *)text, length, callback, user_data, result };
+    trigram_query(query.text, length, fs_search_candidate, &query);
+    return FS_OK;
+}
+
+void fs_get_search_stats(fs_search_stats_t *stats) {
+    if (!stats) {
+        return;
+    }
+    trigram_stats_t index;
+    trigram_get_stats(&index);
+    stats->indexed_files = index.documents;
+    stats->incomplete_files = index.incomplete;
+    stats->trigrams = index.trigrams;
+    stats->postings = index.postings;
+    stats->memory_bytes = index.memory_bytes;
+}
+
+typedef struct {
+    uint8_t *buffer;
+    size_t capacity;
+    size_t position;
+} fs_stream_t;
+
+static int fs_stream_write(fs_stream_t *stream, const void *data, size_t length) {
+    if (stream->position + length > stream->capacity) {
+        return 0;
+    }
+    memcpy(stream->buffer + stream->position, data, length);
+    stream->position += length;
+    return 1;
+}
+
+/* Copies a chunk into the stream straight from the cache or the disk. */
+static fs_status_t fs_stream_write_chunk(fs_stream_t *stream, fs_chunk_t *chunk) {
+    if (stream->position + chunk->length > stream->capacity) {
+        return FS_ERR_NOMEM;
+    }
+    fs_status_t status = fs_chunk_read(chunk, stream->buffer + stream->position);
+    if (status != FS_OK) {
+        return status;
+    }
+    chunk->save_offset = (uint32_t)stream->position;
+    stream->position += chunk->length;
+    return FS_OK;
+}
+
+/* A version 3 file entry is followed by one uint32_t reference per data
+ * chunk. The first time a chunk appears in an image the reference is
+ * FS_IMAGE_BLOCK_INLINE followed by a uint16_t length and the bytes, and the
+ * chunk takes the next block index; later occurrences store that index. */
+static fs_status_t fs_write_entry(fs_stream_t *stream, const fs_node_t *node,
+                                  const char *path, size_t path_len,
+                                  uint32_t save_epoch, uint32_t *block_count) {
+    if (path_len == 0 || path_len >= FS_MAX_PATH_LEN) {
+        return FS_ERR_INVALID;
+    }
+
+    const fs_data_t *data = node->shadow ? node->shadow->data : node->data;
+    size_t size = node->shadow ? node->shadow->size : node->size;
+
+    fs_image_entry_t entry;
+    entry.type = (uint8_t)node->type;
+    entry.flags = 0;
+    if (node->search_mode > 0) {
+        entry.flags = FS_IMAGE_ENTRY_INDEX_ON;
+    } else if (node->search_mode < 0) {
+        entry.flags = FS_IMAGE_ENTRY_INDEX_OFF;
+    }
+    entry.path_len = (uint16_t)path_len;
+    entry.data_len = (node->type == FS_NODE_FILE) ? (uint32_t)size : 0;
+
+    if (!fs_stream_write(stream, &entry, sizeof(entry))) {
+        return FS_ERR_NOMEM;
+    }
+    if (!fs_stream_write(stream, path, path_len)) {
+        return FS_ERR_NOMEM;
+    }
+    for (size_t i = 0; entry.data_len > 0 && i < data->chunk_count; ++i) {
+        fs_chunk_t *chunk = data->chunks[i];
+        if (chunk->save_epoch == save_epoch) {
+            if (!fs_stream_write(stream, &chunk->save_index, sizeof(chunk->save_index))) {
+                return FS_ERR_NOMEM;
+            }
+            continue;
+        }
+
+        uint32_t marker = FS_IMAGE_BLOCK_INLINE;
+        if (!fs_stream_write(stream, &marker, sizeof(marker)) ||
+            !fs_stream_write(stream, &chunk->length, sizeof(chunk->length))) {
+            return FS_ERR_NOMEM;
+        }
+        fs_status_t status = fs_stream_write_chunk(stream, chunk);
+        if (status != FS_OK) {
+            return status;
+        }
+        chunk->save_epoch = save_epoch;
+        chunk->save_index = (*block_count)++;
+    }
+    return FS_OK;
+}
+
+static void fs_image_seal_header(fs_image_header_t *header, const uint8_t *image) {
+    size_t payload_size = header->total_size - sizeof(fs_image_header_t);
+    const uint8_t *payload = image + sizeof(fs_image_header_t);
+
+    header->chunk_size = FS_IMAGE_CHUNK_SIZE;
+    header->chunk_count = (uint32_t)((payload_size + FS_IMAGE_CHUNK_SIZE - 1) / FS_IMAGE_CHUNK_SIZE);
+    for (uint32_t i = 0; i < header->chunk_count; ++i) {
+        size_t offset = (size_t)i * FS_IMAGE_CHUNK_SIZE;
+        size_t length = payload_size - offset;
+        if (length > FS_IMAGE_CHUNK_SIZE) {
+            length = FS_IMAGE_CHUNK_SIZE;
+        }
+        header->chunk_crc[i] = checksum_crc32c(payload + offset, length);
+    }
+    header->header_crc = checksum_crc32c(header, offsetof(fs_image_header_t, header_crc));
+}
+
+/* The header checksum is always the last field, so for images without a
+ * generation it occupies the generation's place. */
+static fs_status_t fs_image_verify_header(const fs_image_header_t *header, size_t header_size) {
+    uint32_t stored_crc;
+    memcpy(&stored_crc, (const uint8_t *)header + header_size - sizeof(uint32_t), sizeof(stored_crc));
+    if (checksum_crc32c(header, header_size - sizeof(uint32_t)) != stored_crc) {
+        return FS_ERR_CORRUPT;
+    }
+    if (header->total_size < header_size || header->total_size > FS_IMAGE_BUFFER_SIZE) {
+        return FS_ERR_INVALID;
+    }
+    size_t payload_size = header->total_size - header_size;
+    if (header->chunk_size != FS_IMAGE_CHUNK_SIZE ||
+        header->chunk_count != (payload_size + FS_IMAGE_CHUNK_SIZE - 1) / FS_IMAGE_CHUNK_SIZE) {
+        return FS_ERR_CORRUPT;
+    }
+    return FS_OK;
+}
+
+static fs_status_t fs_image_verify_chunks(const fs_image_header_t *header, const uint8_t *image,
+                                          size_t header_size) {
+    size_t payload_size = header->total_size - header_size;
+    const uint8_t *payload = image + header_size;
+
+    for (uint32_t i = 0; i < header->chunk_count; ++i) {
+        size_t offset = (size_t)i * FS_IMAGE_CHUNK_SIZE;
+        size_t length = payload_size - offset;
+        if (length > FS_IMAGE_CHUNK_SIZE) {
+            length = FS_IMAGE_CHUNK_SIZE;
+        }
+        if (checksum_crc32c(payload + offset, length) != header->chunk_crc[i]) {
+            return FS_ERR_CORRUPT;
+        }
+    }
+    return FS_OK;
+}
+
+static fs_status_t fs_finalize_image(size_t image_size, uint32_t entry_count, uint32_t generation,
+                                     size_t *out_size) {
+    fs_image_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = FS_IMAGE_MAGIC;
+    header.version = FS_IMAGE_VERSION;
+    header.entry_count = entry_count;
+    header.generation = generation;
+    header.total_size = (uint32_t)image_size;
+
+    if (header.total_size > FS_IMAGE_BUFFER_SIZE) {
+        return FS_ERR_NOMEM;
+    }
+
+    fs_image_seal_header(&header, fs_image_buffer);
+    memcpy(fs_image_buffer, &header, sizeof(header));
+
+    size_t padding = 0;
+    if (image_size % FS_IMAGE_SECTOR_SIZE != 0) {
+        padding = FS_IMAGE_SECTOR_SIZE - (image_size % FS_IMAGE_SECTOR_SIZE);
+        if (image_size + padding > FS_IMAGE_BUFFER_SIZE) {
+            return FS_ERR_NOMEM;
+        }
+        memset(fs_image_buffer + image_size, 0, padding);
+        image_size += padding;
+    }
+
+    if (out_size) {
+        *out_size = image_size;
+    }
+
+    return FS_OK;
+}
+
+typedef struct {
+    fs_chunk_t **blocks;
+    uint32_t count;
+    uint32_t capacity;
+} fs_block_table_t;
+
+/* Decodes the chunk references of a version 3 file entry into a new chunk
+ * list. Inline blocks are interned and appended to the block table, which
+ * holds its own reference until the whole image has been read. */
+static fs_status_t fs_read_entry_blocks(const uint8_t **cursor, size_t *remaining, uint32_t data_len,
+                                        fs_block_table_t *table, fs_data_t **out) {
+    *out = NULL;
+    if (data_len == 0) {
+        return FS_OK;
+    }
+
+    size_t chunk_count = fs_chunks_for_size(data_len);
+    fs_data_t *data = fs_data_alloc(chunk_count);
+    if (!data) {
+        return FS_ERR_NOMEM;
+    }
+
+    fs_status_t status = FS_OK;
+    for (size_t i = 0; i < chunk_count; ++i) {
+        size_t expected = (i + 1 < chunk_count) ? FS_CHUNK_SIZE : data_len - i * FS_CHUNK_SIZE;
+        uint32_t reference;
+        if (*remaining < sizeof(reference)) {
+            status = FS_ERR_INVALID;
+            break;
+        }
+        memcpy(&reference, *cursor, sizeof(reference));
+        *cursor += sizeof(reference);
+        *remaining -= sizeof(reference);
+
+        fs_chunk_t *chunk;
+        if (reference == FS_IMAGE_BLOCK_INLINE) {
+            uint16_t length;
+            if (*remaining < sizeof(length)) {
+                status = FS_ERR_INVALID;
+                break;
+            }
+            memcpy(&length, *cursor, sizeof(length));
+            *cursor += sizeof(length);
+            *remaining -= sizeof(length);
+            if (length != expected || *remaining < length) {
+                status = FS_ERR_INVALID;
+                break;
+            }
+
+            if (table->count == table->capacity) {
+                uint32_t capacity = table->capacity ? table->capacity * 2 : 64;
+                fs_chunk_t **blocks = (fs_chunk_t **)kmalloc(capacity * sizeof(fs_chunk_t *));
+                if (!blocks) {
+                    status = FS_ERR_NOMEM;
+                    break;
+                }
+                if (table->blocks) {
+                    memcpy(blocks, table->blocks, table->count * sizeof(fs_chunk_t *));
+                    kfree(table->blocks);
+                }
+                table->blocks = blocks;
+                table->capacity = capacity;
+            }
+
+            chunk = fs_chunk_intern(*cursor, length);
+            if (!chunk) {
+                status = FS_ERR_NOMEM;
+                break;
+            }
+            if (!fs_chunk_on_disk(chunk)) {
+                /* The image being loaded is a valid home for the chunk. */
+                chunk->disk_slot = (uint8_t)fs_image_slot;
+                chunk->disk_generation = fs_image_generation;
+                chunk->disk_offset = (uint32_t)(*cursor - fs_image_buffer);
+            }
+            *cursor += length;
+            *remaining -= length;
+            table->blocks[table->count++] = chunk;
+        } else if (reference >= table->count || table->blocks[reference]->length != expected) {
+            status = FS_ERR_INVALID;
+            break;
+        } else {
+            chunk = table->blocks[reference];
+        }
+        data->chunks[data->chunk_count++] = fs_chunk_retain(chunk);
+    }
+
+    if (status != FS_OK) {
+        fs_data_release(data);
+        return status;
+    }
+    *out = data;
+    return FS_OK;
+}
+
+static fs_status_t fs_deserialize_entries(uint32_t version, const uint8_t *cursor, size_t remaining,
+                                          uint32_t entry_count, fs_block_table_t *table) {
+    char path[FS_MAX_PATH_LEN];
+
+    for (uint32_t i = 0; i < entry_count; ++i) {
+        if (remaining < sizeof(fs_image_entry_t)) {
+            return FS_ERR_INVALID;
+        }
+        fs_image_entry_t entry;
+        memcpy(&entry, cursor, sizeof(entry));
+        cursor += sizeof(fs_image_entry_t);
+        remaining -= sizeof(fs_image_entry_t);
+
+        if (entry.path_len == 0 || entry.path_len >= FS_MAX_PATH_LEN) {
+            return FS_ERR_INVALID;
+        }
+        if (remaining < entry.path_len) {
+            return FS_ERR_INVALID;
+        }
+
+        memcpy(path, cursor, entry.path_len);
+        path[entry.path_len] = '\0';
+        cursor += entry.path_len;
+        remaining -= entry.path_len;
+
+        if (entry.type == FS_NODE_DIRECTORY) {
+            fs_status_t status = fs_mkdir(path);
+            if (status != FS_OK && status != FS_ERR_EXIST) {
+                return status;
+            }
+            fs_node_t *dir = fs_walk(path);
+            if (dir && (entry.flags & FS_IMAGE_ENTRY_INDEX_ON)) {
+                dir->search_mode = 1;
+            } else if (dir && (entry.flags & FS_IMAGE_ENTRY_INDEX_OFF)) {
+                dir->search_mode = -1;
+            }
+            continue;
+        }
+
+        fs_data_t *contents = NULL;
+        fs_status_t status;
+        if (version >= FS_IMAGE_VERSION_V3) {
+            status = fs_read_entry_blocks(&cursor, &remaining, entry.data_len, table, &contents);
+        } else {
+            if (remaining < entry.data_len) {
+                return FS_ERR_INVALID;
+            }
+            status = fs_data_from_bytes(cursor, entry.data_len, &contents);
+            cursor += entry.data_len;
+            remaining -= entry.data_len;
+        }
+        if (status != FS_OK) {
+            return status;
+        }
+
+        status = fs_create_file(path);
+        fs_node_t *node = fs_walk(path);
+        if ((status != FS_OK && status != FS_ERR_EXIST) || !node || node->type != FS_NODE_FILE) {
+            fs_data_release(contents);
+            return (status != FS_OK) ? status : FS_ERR_INVALID;
+        }
+        fs_data_release(node->data);
+        fs_usage_resize(node, node->size, entry.data_len);
+        node->data = contents;
+        node->size = entry.data_len;
+        fs_search_drop(node);
+        fs_search_sync(node);
+    }
+
+    return FS_OK;
+}
+
+static fs_status_t fs_deserialize_from_buffer(uint32_t version, size_t header_size, size_t total_size,
+                                              uint32_t entry_count) {
+    if (total_size < header_size || total_size > FS_IMAGE_BUFFER_SIZE) {
+        return FS_ERR_INVALID;
+    }
+
+    fs_clear_children(fs_root);
+    fs_cwd = fs_root;
+
+    fs_block_table_t table = { NULL, 0, 0 };
+    fs_status_t status = fs_deserialize_entries(version, fs_image_buffer + header_size,
+                                                total_size - header_size, entry_count, &table);
+    for (uint32_t i = 0; i < table.count; ++i) {
+        fs_chunk_release(table.blocks[i]);
+    }
+    if (table.blocks) {
+        kfree(table.blocks);
+    }
+    return status;
+}
+
+/* Reads both slot headers and records the generation of each intact one;
+ * images older than version 4 can only be in slot 0. The newest becomes
+ * the current image. Returns its slot, or -1 if there is none. */
+static int fs_image_probe(void) {
+    int newest = -1;
+    for (uint32_t slot = 0; slot < FS_IMAGE_SLOTS; ++slot) {
+        fs_slot_generation[slot] = 0;
+        fs_image_header_t header;
+        if (bcache_read(fs_device, fs_image_slot_lba(slot), 1, fs_image_buffer) != 0) {
+            continue;
+        }
+        memcpy(&header, fs_image_buffer, sizeof(header));
+        if (header.magic != FS_IMAGE_MAGIC) {
+            continue;
+        }
+        if (header.version == FS_IMAGE_VERSION) {
+            if (fs_image_verify_header(&header, sizeof(fs_image_header_t)) == FS_OK && header.generation != 0) {
+                fs_slot_generation[slot] = header.generation;
+            }
+        } else if (slot == 0 && header.version >= FS_IMAGE_VERSION_V1 && header.version < FS_IMAGE_VERSION) {
+            fs_slot_generation[slot] = 1;
+        }
+        if (fs_slot_generation[slot] != 0 &&
+            (newest < 0 || fs_slot_generation[slot] > fs_slot_generation[newest])) {
+            newest = (int)slot;
+        }
+    }
+    fs_image_probed = 1;
+    if (newest >= 0) {
+        fs_image_slot = (uint32_t)newest;
+        fs_image_generation = fs_slot_generation[newest];
+    }
+    return newest;
+}
+
+typedef enum fs_load_phase {
+    FS_LOAD_IDLE = 0,
+    FS_LOAD_READING
+} fs_load_phase_t;
+
+/* State of the load in flight: the image is read a few sectors per step,
+ * then verified and deserialized in one go. */
+typedef struct {
+    fs_load_phase_t phase;
+    uint32_t slot;
+    int retried;
+    fs_image_header_t header;
+    size_t header_size;
+    uint32_t sectors_total;
+    uint32_t sectors_read;
+    fs_status_t last_status;
+} fs_load_context_t;
+
+static fs_load_context_t fs_load_ctx = { .phase = FS_LOAD_IDLE, .last_status = FS_OK };
+
+typedef enum fs_save_phase {
+    FS_SAVE_IDLE = 0,
+    FS_SAVE_SERIALIZING,
+    FS_SAVE_WRITING
+} fs_save_phase_t;
+
+/* State of the save in flight. The snapshot is serialized depth-first by a
+ * snapshot cursor, a few KiB per step, then written out a few sectors per
+ * step with the header sector last. */
+typedef struct {
+    fs_save_phase_t phase;
+    fs_stream_t stream;
+    uint32_t entry_count;
+    uint32_t block_count;
+    uint32_t slot;
+    uint32_t generation;
+    fs_cursor_t cursor;
+    uint32_t sectors_total;
+    uint32_t sectors_written;
+    uint64_t start_ticks;
+    fs_status_t last_status;
+    uint64_t last_duration_ms;
+} fs_save_context_t;
+
+static fs_save_context_t fs_save_ctx = { .phase = FS_SAVE_IDLE, .last_status = FS_OK };
+
+static uint64_t fs_ticks_to_ms(uint64_t ticks) {
+    uint32_t freq = pit_current_frequency();
+    return freq ? ticks * 1000 / freq : 0;
+}
+
+static void fs_save_finish(fs_status_t status) {
+    if (fs_snapshot_active) {
+        fs_snapshot_end();
+    }
+    fs_save_ctx.phase = FS_SAVE_IDLE;
+    fs_save_ctx.last_status = status;
+    fs_save_ctx.last_duration_ms = fs_ticks_to_ms(pit_ticks() - fs_save_ctx.start_ticks);
+}
+
+static void fs_save_abort(fs_status_t status) {
+    if (fs_save_ctx.phase != FS_SAVE_IDLE) {
+        fs_save_finish(status);
+    }
+}
+
+static fs_status_t fs_save_serialize_step(void) {
+    fs_cursor_t *cursor = &fs_save_ctx.cursor;
+    size_t start = fs_save_ctx.stream.position;
+
+    while (fs_save_ctx.stream.position - start < FS_SAVE_STEP_BYTES) {
+        if (!fs_cursor_next(cursor)) {
+            if (cursor->status != FS_OK) {
+                return cursor->status;
+            }
             break;
         }
-        memcpy(&buffer[pos], component_node->name, len);
-        pos += len;
-        if (i != depth - 1 && pos < buffer_size - 1) {
-            buffer[pos++] = '/';
+
+        fs_node_t *node = cursor->node;
+        if (cursor->post) {
+            fs_snapshot_mark_done(node);
+            continue;
+        }
+        if (node == fs_root) {
+            continue;
+        }
+
+        fs_status_t status = fs_write_entry(&fs_save_ctx.stream, node, cursor->path, cursor->path_len,
+                                            fs_snapshot_epoch, &fs_save_ctx.block_count);
+        if (status != FS_OK) {
+            return status;
+        }
+        fs_save_ctx.entry_count++;
+        if (node->type == FS_NODE_FILE) {
+            fs_snapshot_mark_done(node);
         }
     }
 
-    buffer[pos] = '\0';
-}
+    if (cursor->root) {
+        return FS_OK;
+    }
+    /* Every node has been emitted: the snapshot is no longer needed. */
+    fs_snapshot_end();
 
-void fs_get_cwd(char *buffer, size_t buffer_size) {
-    fs_build_path_from_node(fs_cwd, buffer, buffer_size);
+    size_t image_size = 0;
+    fs_status_t status = fs_finalize_image(fs_save_ctx.stream.position, fs_save_ctx.entry_count,
+                                           fs_save_ctx.generation, &image_size);
+    if (status != FS_OK) {
+        return status;
+    }
+    fs_save_ctx.sectors_total = (uint32_t)(image_size / FS_IMAGE_SECTOR_SIZE);
+    if (fs_save_ctx.sectors_total == 0 || fs_save_ctx.sectors_total > FS_IMAGE_LBA_COUNT) {
+        return FS_ERR_INVALID;
+    }
+    fs_save_ctx.sectors_written = 0;
+    fs_save_ctx.phase = FS_SAVE_WRITING;
+    /* Whatever the target slot held stops being an image from here on. */
+    fs_slot_generation[fs_save_ctx.slot] = 0;
+    return FS_OK;
 }
 
-int fs_exists(const char *path) {
-    return fs_walk(path) != NULL;
+/* Makes a freshly written image the current one. Every chunk it contains
+ * becomes clean and may be evicted from now on. */
+static void fs_image_commit_slot(uint32_t slot, uint32_t generation) {
+    fs_slot_generation[slot] = generation;
+    fs_image_slot = slot;
+    fs_image_generation = generation;
+    fs_cache_writeback = 0;
+
+    for (size_t bucket = 0; bucket < FS_CHUNK_BUCKETS; ++bucket) {
+        for (fs_chunk_t *chunk = fs_chunk_table[bucket]; chunk; chunk = chunk->hash_next) {
+            if (chunk->save_epoch == fs_snapshot_epoch) {
+                chunk->disk_slot = (uint8_t)slot;
+                chunk->disk_generation = generation;
+                chunk->disk_offset = chunk->save_offset;
+            }
+        }
+    }
 }
 
-int fs_is_dir(const char *path) {
-    fs_node_t *node = fs_walk(path);
-    if (!node) {
-        return 0;
+static fs_status_t fs_save_write_step(void) {
+    /* Payload sectors go first; the header sector, whose checksums cover
+     * them, is written last so a torn save never looks valid. */
+    uint32_t payload_sectors = fs_save_ctx.sectors_total - 1;
+    if (fs_save_ctx.sectors_written < payload_sectors) {
+        uint32_t first = 1 + fs_save_ctx.sectors_written;
+        uint32_t count = payload_sectors - fs_save_ctx.sectors_written;
+        if (count > FS_SAVE_STEP_SECTORS) {
+            count = FS_SAVE_STEP_SECTORS;
+        }
+        if (bcache_write(fs_device, fs_image_slot_lba(fs_save_ctx.slot) + first, count,
+                         fs_image_buffer + (size_t)first * FS_IMAGE_SECTOR_SIZE) != 0) {
+            return FS_ERR_INVALID;
+        }
+        fs_save_ctx.sectors_written += count;
+        return FS_OK;
     }
-    return node->type == FS_NODE_DIRECTORY;
+
+    /* Commit: one barrier makes the payload durable, then the header goes
+     * out as a FUA write. It bypasses the buffer cache so a failed write
+     * never leaves a valid-looking header behind. */
+    if (bcache_sync(fs_device) != 0 ||
+        bcache_write_fua(fs_device, fs_image_slot_lba(fs_save_ctx.slot), 1, fs_image_buffer) != 0) {
+        return FS_ERR_INVALID;
+    }
+    fs_save_ctx.sectors_written++;
+    fs_image_commit_slot(fs_save_ctx.slot, fs_save_ctx.generation);
+    fs_save_finish(FS_OK);
+    return FS_OK;
 }
 
-fs_status_t fs_remove(const char *path, int recursive) {
-    fs_node_t *node = fs_walk(path);
-    if (!node) {
-        return FS_ERR_NOENT;
+/* Runs one bounded slice of the save in flight. Returns 1 once the save
+ * has finished (successfully or not). */
+static int fs_save_step(void) {
+    fs_status_t status = FS_OK;
+    if (fs_save_ctx.phase == FS_SAVE_SERIALIZING) {
+        status = fs_save_serialize_step();
+    } else if (fs_save_ctx.phase == FS_SAVE_WRITING) {
+        status = fs_save_write_step();
     }
-    if (node == fs_root) {
+    if (status != FS_OK) {
+        fs_save_abort(status);
+    }
+    return fs_save_ctx.phase == FS_SAVE_IDLE;
+}
+
+fs_status_t fs_save_begin(void) {
+    if (!fs_device || !fs_root) {
         return FS_ERR_INVALID;
     }
+    if (!fs_image_buffer) {
+        return FS_ERR_NOMEM;
+    }
+    if (fs_save_ctx.phase != FS_SAVE_IDLE || fs_load_ctx.phase != FS_LOAD_IDLE) {
+        return FS_ERR_BUSY;
+    }
 
-    if (node->type == FS_NODE_DIRECTORY && node->children && !recursive) {
-        return FS_ERR_NOTEMPTY;
+    /* Each entry takes at least its header and a two-byte path, so a tree
+     * with too many nodes is rejected before any snapshot is taken. */
+    size_t entries = fs_root->usage.files + fs_root->usage.directories;
+    if (sizeof(fs_image_header_t) + entries * (sizeof(fs_image_entry_t) + 2) > FS_IMAGE_BUFFER_SIZE) {
+        return FS_ERR_NOMEM;
     }
 
-    if (node == fs_cwd) {
-        fs_cwd = node->parent ? node->parent : fs_root;
+    fs_save_ctx.phase = FS_SAVE_SERIALIZING;
+    fs_save_ctx.start_ticks = pit_ticks();
+    fs_save_ctx.stream.buffer = fs_image_buffer;
+    fs_save_ctx.stream.capacity = FS_IMAGE_BUFFER_SIZE;
+    fs_save_ctx.stream.position = sizeof(fs_image_header_t);
+    fs_save_ctx.entry_count = 0;
+    fs_save_ctx.block_count = 0;
+
+    /* Never overwrite the newest image: evicted chunks are read from it,
+     * and it survives if this save is torn. */
+    if (!fs_image_probed) {
+        fs_image_probe();
     }
+    fs_save_ctx.slot = fs_image_generation ? fs_image_slot ^ 1 : 0;
+    fs_save_ctx.generation = fs_image_generation + 1;
 
-    fs_detach_child(node);
-    fs_free_subtree(node);
+    fs_snapshot_epoch++;
+    fs_snapshot_active = 1;
+    fs_cursor_init(&fs_save_ctx.cursor, fs_root, 1, 1);
     return FS_OK;
 }
 
-typedef struct {
-    uint8_t *buffer;
-    size_t capacity;
-    size_t position;
-} fs_stream_t;
-
-static int fs_stream_write(fs_stream_t *stream, const void *data, size_t length) {
-    if (stream->position + length > stream->capacity) {
+int fs_save_poll(void) {
+    if (fs_save_ctx.phase == FS_SAVE_IDLE) {
         return 0;
     }
-    memcpy(stream->buffer + stream->position, data, length);
-    stream->position += length;
-    return 1;
+    return fs_save_step();
 }
 
-static fs_status_t fs_write_entry(fs_stream_t *stream, fs_node_t *node, uint32_t *entry_count) {
-    char path[FS_MAX_PATH_LEN];
-    fs_build_path_from_node(node, path, sizeof(path));
-    size_t path_len = strlen(path);
-    if (path_len == 0 || path_len >= FS_MAX_PATH_LEN) {
-        return FS_ERR_INVALID;
+int fs_save_in_progress(void) {
+    return fs_save_ctx.phase != FS_SAVE_IDLE;
+}
+
+fs_status_t fs_save_last_status(void) {
+    return fs_save_ctx.last_status;
+}
+
+uint64_t fs_save_last_duration_ms(void) {
+    return fs_save_ctx.last_duration_ms;
+}
+
+fs_status_t fs_save(void) {
+    /* An explicit save wants the current tree, not an older snapshot. */
+    fs_save_abort(FS_ERR_BUSY);
+
+    fs_status_t status = fs_save_begin();
+    if (status != FS_OK) {
+        return status;
+    }
+    while (!fs_save_step()) {
     }
-    if (path_len > 0xFFFF) {
+    return fs_save_ctx.last_status;
+}
+
+static fs_status_t fs_load_open_slot(uint32_t slot) {
+    fs_load_context_t *ctx = &fs_load_ctx;
+    ctx->slot = slot;
+    if (bcache_read(fs_device, fs_image_slot_lba(slot), 1, fs_image_buffer) != 0) {
         return FS_ERR_INVALID;
     }
 
-    fs_image_entry_t entry;
-    entry.type = (uint8_t)node->type;
-    entry.reserved = 0;
-    entry.path_len = (uint16_t)path_len;
-    entry.data_len = (node->type == FS_NODE_FILE) ? (uint32_t)node->size : 0;
+    fs_image_header_t *header = &ctx->header;
+    memcpy(header, fs_image_buffer, sizeof(*header));
 
-    if (!fs_stream_write(stream, &entry, sizeof(entry))) {
-        return FS_ERR_NOMEM;
-    }
-    if (!fs_stream_write(stream, path, path_len)) {
-        return FS_ERR_NOMEM;
+    if (header->version == FS_IMAGE_VERSION) {
+        ctx->header_size = sizeof(fs_image_header_t);
+    } else if (header->version == FS_IMAGE_VERSION_V3 || header->version == FS_IMAGE_VERSION_V2) {
+        ctx->header_size = FS_IMAGE_HEADER_V2_SIZE;
+    } else {
+        ctx->header_size = FS_IMAGE_HEADER_V1_SIZE;
     }
-    if (entry.data_len > 0) {
-        if (!fs_stream_write(stream, node->data, node->size)) {
-            return FS_ERR_NOMEM;
+    if (header->version != FS_IMAGE_VERSION_V1) {
+        fs_status_t status = fs_image_verify_header(header, ctx->header_size);
+        if (status != FS_OK) {
+            return status;
         }
     }
 
-    (*entry_count)++;
+    if (header->total_size < ctx->header_size || header->total_size > FS_IMAGE_BUFFER_SIZE) {
+        return FS_ERR_INVALID;
+    }
+
+    /* Only the sectors the image actually occupies are transferred. */
+    ctx->sectors_total = (header->total_size + FS_IMAGE_SECTOR_SIZE - 1) / FS_IMAGE_SECTOR_SIZE;
+    ctx->sectors_read = 1;
     return FS_OK;
 }
 
-static fs_status_t fs_serialize_node(fs_stream_t *stream, fs_node_t *node, uint32_t *entry_count) {
-    if (node != fs_root) {
-        fs_status_t status = fs_write_entry(stream, node, entry_count);
+static fs_status_t fs_load_finish_slot(void) {
+    fs_load_context_t *ctx = &fs_load_ctx;
+    if (ctx->header.version != FS_IMAGE_VERSION_V1) {
+        fs_status_t status = fs_image_verify_chunks(&ctx->header, fs_image_buffer, ctx->header_size);
         if (status != FS_OK) {
             return status;
         }
     }
 
-    fs_node_t *child = node->children;
-    while (child) {
-        fs_status_t status = fs_serialize_node(stream, child, entry_count);
-        if (status != FS_OK) {
-            return status;
+    /* Chunks interned from here on may be evicted back to this image. */
+    fs_image_slot = ctx->slot;
+    fs_image_generation = fs_slot_generation[ctx->slot];
+
+    if (ctx->header.entry_count == 0) {
+        fs_clear_children(fs_root);
+        fs_cwd = fs_root;
+        return FS_OK;
+    }
+
+    return fs_deserialize_from_buffer(ctx->header.version, ctx->header_size,
+                                      ctx->header.total_size, ctx->header.entry_count);
+}
+
+/* Ends the load with `status`, unless the image was corrupt and the other
+ * slot still holds one to fall back to, e.g. when the newest image was
+ * torn after its header was written. Returns 1 if the load is over. */
+static int fs_load_settle(fs_status_t status) {
+    fs_load_context_t *ctx = &fs_load_ctx;
+    uint32_t other = ctx->slot ^ 1;
+    if (status == FS_ERR_CORRUPT && !ctx->retried && fs_slot_generation[other] != 0) {
+        ctx->retried = 1;
+        fs_slot_generation[ctx->slot] = 0;
+        status = fs_load_open_slot(other);
+        if (status == FS_OK) {
+            return 0;
         }
-        child = child->next_sibling;
     }
-    return FS_OK;
+    ctx->phase = FS_LOAD_IDLE;
+    ctx->last_status = status;
+    return 1;
 }
 
-static fs_status_t fs_serialize_to_buffer(size_t *out_size) {
+/* Runs one bounded slice of the load in flight. Returns 1 once the load
+ * has finished (successfully or not). */
+static int fs_load_step(void) {
+    fs_load_context_t *ctx = &fs_load_ctx;
+    if (ctx->phase == FS_LOAD_IDLE) {
+        return 1;
+    }
+    if (ctx->sectors_read < ctx->sectors_total) {
+        uint32_t count = ctx->sectors_total - ctx->sectors_read;
+        if (count > FS_SAVE_STEP_SECTORS) {
+            count = FS_SAVE_STEP_SECTORS;
+        }
+        if (bcache_read(fs_device, fs_image_slot_lba(ctx->slot) + ctx->sectors_read, count,
+                             fs_image_buffer + (size_t)ctx->sectors_read * FS_IMAGE_SECTOR_SIZE) != 0) {
+            return fs_load_settle(FS_ERR_INVALID);
+        }
+        ctx->sectors_read += count;
+        return 0;
+    }
+    return fs_load_settle(fs_load_finish_slot());
+}
+
+static fs_status_t fs_load_begin(void) {
+    if (!fs_device) {
+        return FS_ERR_INVALID;
+    }
     if (!fs_image_buffer) {
         return FS_ERR_NOMEM;
     }
+    if (fs_load_ctx.phase != FS_LOAD_IDLE) {
+        return FS_ERR_BUSY;
+    }
 
-    fs_stream_t stream = {
-        .buffer = fs_image_buffer,
-        .capacity = FS_IMAGE_BUFFER_SIZE,
-        .position = sizeof(fs_image_header_t)
-    };
+    /* The image buffer and the tree are about to be replaced. */
+    fs_save_abort(FS_ERR_BUSY);
 
-    uint32_t entry_count = 0;
-    fs_status_t status = fs_serialize_node(&stream, fs_root, &entry_count);
-    if (status != FS_OK) {
+    int newest = fs_image_probe();
+    if (newest < 0) {
+        return FS_ERR_INVALID;
+    }
+    fs_load_ctx.phase = FS_LOAD_READING;
+    fs_load_ctx.retried = 0;
+    fs_status_t status = fs_load_open_slot((uint32_t)newest);
+    if (status != FS_OK && fs_load_settle(status)) {
         return status;
     }
+    return FS_OK;
+}
 
-    fs_image_header_t header;
-    header.magic = FS_IMAGE_MAGIC;
-    header.version = FS_IMAGE_VERSION;
-    header.entry_count = entry_count;
-    header.total_size = (uint32_t)stream.position;
-
-    if (header.total_size > FS_IMAGE_BUFFER_SIZE) {
-        return FS_ERR_NOMEM;
+fs_status_t fs_load(void) {
+    fs_status_t status = fs_load_begin();
+    if (status != FS_OK) {
+        return status;
     }
+    while (!fs_load_step()) {
+    }
+    return fs_load_ctx.last_status;
+}
 
-    memcpy(fs_image_buffer, &header, sizeof(header));
+/* Asynchronous requests wait in a FIFO queue and are carried out by
+ * fs_async_poll, one bounded slice per call, from whatever deferred-work
+ * context polls it; completion callbacks run there too. */
+#define FS_ASYNC_READ_CHUNKS 8u
 
-    size_t padding = 0;
-    if (stream.position % FS_IMAGE_SECTOR_SIZE != 0) {
-        padding = FS_IMAGE_SECTOR_SIZE - (stream.position % FS_IMAGE_SECTOR_SIZE);
-        if (stream.position + padding > FS_IMAGE_BUFFER_SIZE) {
-            return FS_ERR_NOMEM;
-        }
-        memset(fs_image_buffer + stream.position, 0, padding);
-        stream.position += padding;
+static fs_request_t *fs_request_head = NULL;
+static fs_request_t *fs_request_tail = NULL;
+
+static fs_status_t fs_request_submit(fs_request_t *request, fs_request_op_t op,
+                                     fs_request_callback_t callback, void *user_data) {
+    if (!request) {
+        return FS_ERR_INVALID;
     }
+    if (request->queued) {
+        return FS_ERR_BUSY;
+    }
+    request->op = op;
+    request->callback = callback;
+    request->user_data = user_data;
+    request->size = 0;
+    request->transferred = 0;
+    request->status = FS_OK;
+    request->next = NULL;
+    request->data = NULL;
+    request->started = 0;
+    request->queued = 1;
+    if (fs_request_tail) {
+        fs_request_tail->next = request;
+    } else {
+        fs_request_head = request;
+    }
+    fs_request_tail = request;
+    return FS_OK;
+}
 
-    if (out_size) {
-        *out_size = stream.position;
+static void fs_request_complete(fs_request_t *request, fs_status_t status) {
+    fs_request_head = request->next;
+    if (!fs_request_head) {
+        fs_request_tail = NULL;
+    }
+    if (request->data) {
+        fs_data_release((fs_data_t *)request->data);
+        request->data = NULL;
     }
+    request->next = NULL;
+    request->queued = 0;
+    request->status = status;
+    if (request->callback) {
+        request->callback(request, request->user_data);
+    }
+}
 
-    return FS_OK;
+fs_status_t fs_save_async(fs_request_t *request, fs_request_callback_t callback, void *user_data) {
+    if (!fs_device) {
+        return FS_ERR_INVALID;
+    }
+    return fs_request_submit(request, FS_REQUEST_SAVE, callback, user_data);
 }
 
-static fs_status_t fs_deserialize_from_buffer(size_t total_size, uint32_t entry_count) {
-    if (total_size < sizeof(fs_image_header_t) || total_size > FS_IMAGE_BUFFER_SIZE) {
+fs_status_t fs_load_async(fs_request_t *request, fs_request_callback_t callback, void *user_data) {
+    if (!fs_device) {
         return FS_ERR_INVALID;
     }
+    return fs_request_submit(request, FS_REQUEST_LOAD, callback, user_data);
+}
 
-    const uint8_t *cursor = fs_image_buffer + sizeof(fs_image_header_t);
-    size_t remaining = total_size - sizeof(fs_image_header_t);
+fs_status_t fs_read_async(fs_request_t *request, const char *path, void *buffer, size_t buffer_size,
+                          fs_request_callback_t callback, void *user_data) {
+    if (!request || !path || (!buffer && buffer_size > 0)) {
+        return FS_ERR_INVALID;
+    }
+    if (request->queued) {
+        return FS_ERR_BUSY;
+    }
+    request->path = path;
+    request->buffer = buffer;
+    request->length = buffer_size;
+    return fs_request_submit(request, FS_REQUEST_READ, callback, user_data);
+}
 
-    fs_clear_children(fs_root);
-    fs_cwd = fs_root;
+fs_status_t fs_write_async(fs_request_t *request, const char *path, const void *data, size_t size,
+                           fs_request_callback_t callback, void *user_data) {
+    if (!request || !path || (!data && size > 0)) {
+        return FS_ERR_INVALID;
+    }
+    if (request->queued) {
+        return FS_ERR_BUSY;
+    }
+    request->path = path;
+    request->buffer = (void *)data;
+    request->length = size;
+    return fs_request_submit(request, FS_REQUEST_WRITE, callback, user_data);
+}
 
-    char path[FS_MAX_PATH_LEN];
+fs_status_t fs_append_async(fs_request_t *request, const char *path, const void *data, size_t size,
+                            fs_request_callback_t callback, void *user_data) {
+    fs_status_t status = fs_write_async(request, path, data, size, callback, user_data);
+    if (status == FS_OK) {
+        request->op = FS_REQUEST_APPEND;
+    }
+    return status;
+}
 
-    for (uint32_t i = 0; i < entry_count; ++i) {
-        if (remaining < sizeof(fs_image_entry_t)) {
-            return FS_ERR_INVALID;
+/* A read pins the file's chunk list when it starts, so it returns the
+ * contents as of that moment even if the file is rewritten midway. */
+static void fs_request_read_step(fs_request_t *request) {
+    if (!request->started) {
+        fs_node_t *node = fs_walk(request->path);
+        if (!node) {
+            fs_request_complete(request, FS_ERR_NOENT);
+            return;
         }
-        const fs_image_entry_t *entry = (const fs_image_entry_t *)cursor;
-        cursor += sizeof(fs_image_entry_t);
-        remaining -= sizeof(fs_image_entry_t);
-
-        if (entry->path_len == 0 || entry->path_len >= FS_MAX_PATH_LEN) {
-            return FS_ERR_INVALID;
+        if (node->type != FS_NODE_FILE) {
+            fs_request_complete(request, FS_ERR_ISDIR);
+            return;
         }
-        if (remaining < entry->path_len) {
-            return FS_ERR_INVALID;
+        request->size = node->size;
+        request->data = fs_data_retain(node->data);
+        request->started = 1;
+        if (request->length > node->size) {
+            request->length = node->size;
         }
+    }
 
-        memcpy(path, cursor, entry->path_len);
-        path[entry->path_len] = '\0';
-        cursor += entry->path_len;
-        remaining -= entry->path_len;
-
-        if (remaining < entry->data_len) {
-            return FS_ERR_INVALID;
+    const fs_data_t *data = (const fs_data_t *)request->data;
+    uint8_t *dest = (uint8_t *)request->buffer;
+    for (uint32_t n = 0; n < FS_ASYNC_READ_CHUNKS && request->transferred < request->length; ++n) {
+        fs_chunk_t *chunk = data->chunks[request->transferred / FS_CHUNK_SIZE];
+        const uint8_t *bytes = fs_chunk_access(chunk);
+        if (!bytes) {
+            fs_request_complete(request, FS_ERR_CORRUPT);
+            return;
+        }
+        size_t take = request->length - request->transferred;
+        if (take > chunk->length) {
+            take = chunk->length;
         }
+        memcpy(dest + request->transferred, bytes, take);
+        request->transferred += take;
+    }
+    if (request->transferred == request->length) {
+        fs_request_complete(request, FS_OK);
+    }
+}
 
-        const uint8_t *data = cursor;
-        cursor += entry->data_len;
-        remaining -= entry->data_len;
+int fs_async_pending(void) {
+    return fs_request_head != NULL || fs_save_ctx.phase != FS_SAVE_IDLE;
+}
 
-        if (entry->type == FS_NODE_DIRECTORY) {
-            fs_status_t status = fs_mkdir(path);
-            if (status != FS_OK && status != FS_ERR_EXIST) {
-                return status;
+/* Runs one bounded slice of deferred work: the save in flight, whoever
+ * started it, or the request at the head of the queue. Returns 1 if there
+ * was work to do. */
+int fs_async_poll(void) {
+    fs_request_t *request = fs_request_head;
+    if (!request) {
+        if (fs_save_ctx.phase == FS_SAVE_IDLE) {
+            return 0;
+        }
+        fs_save_step();
+        return 1;
+    }
+
+    switch (request->op) {
+    case FS_REQUEST_SAVE:
+        if (!request->started) {
+            fs_status_t status = fs_save_begin();
+            if (status == FS_ERR_BUSY) {
+                /* Let a save started elsewhere finish first. */
+                fs_save_step();
+                break;
             }
-        } else {
-            fs_status_t status = fs_create_file(path);
-            if (status != FS_OK && status != FS_ERR_EXIST) {
-                return status;
+            if (status != FS_OK) {
+                fs_request_complete(request, status);
+                break;
             }
-            status = fs_write_file(path, data, entry->data_len);
+            request->started = 1;
+        }
+        if (fs_save_step()) {
+            fs_request_complete(request, fs_save_ctx.last_status);
+        }
+        break;
+    case FS_REQUEST_LOAD:
+        if (!request->started) {
+            fs_status_t status = fs_load_begin();
             if (status != FS_OK) {
-                return status;
+                fs_request_complete(request, status);
+                break;
             }
+            request->started = 1;
+        }
+        if (fs_load_step()) {
+            fs_request_complete(request, fs_load_ctx.last_status);
         }
+        break;
+    case FS_REQUEST_READ:
+        fs_request_read_step(request);
+        break;
+    case FS_REQUEST_WRITE:
+        fs_request_complete(request, fs_write_file(request->path, request->buffer, request->length));
+        break;
+    case FS_REQUEST_APPEND:
+        fs_request_complete(request, fs_append_file(request->path, request->buffer, request->length));
+        break;
+    default:
+        fs_request_complete(request, FS_ERR_INVALID);
+        break;
     }
-
-    return FS_OK;
+    return 1;
 }
 
-fs_status_t fs_save(void) {
-    if (!ata_is_available()) {
-        return FS_ERR_INVALID;
-    }
-
-    size_t serialized_size = 0;
-    fs_status_t status = fs_serialize_to_buffer(&serialized_size);
-    if (status != FS_OK) {
-        return status;
-    }
-
-    if (serialized_size == 0 || serialized_size > FS_IMAGE_BUFFER_SIZE) {
-        return FS_ERR_INVALID;
+/* Switches the device images are saved to and loaded from. The tree
+ * itself is kept; evicted chunks are brought back first, since their
+ * copies stay behind on the old device. */
+fs_status_t fs_mount(const char *device) {
+    blockdev_t *dev = blockdev_find(device);
+    if (!dev) {
+        return FS_ERR_NOENT;
     }
-
-    uint16_t sectors = (uint16_t)(serialized_size / FS_IMAGE_SECTOR_SIZE);
-    if (sectors == 0 || sectors > FS_IMAGE_LBA_COUNT) {
+    if (dev->sector_size != FS_IMAGE_SECTOR_SIZE || dev->sector_count < FS_IMAGE_SLOTS * FS_IMAGE_LBA_COUNT) {
         return FS_ERR_INVALID;
     }
-
-    if (ata_write_sectors(FS_IMAGE_LBA_START, sectors, fs_image_buffer) != 0) {
-        return FS_ERR_INVALID;
+    if (fs_save_ctx.phase != FS_SAVE_IDLE || fs_load_ctx.phase != FS_LOAD_IDLE) {
+        return FS_ERR_BUSY;
     }
-
-    return FS_OK;
-}
-
-fs_status_t fs_load(void) {
-    if (!ata_is_available()) {
-        return FS_ERR_INVALID;
+    if (dev == fs_device) {
+        return FS_OK;
     }
-
     if (!fs_image_buffer) {
-        return FS_ERR_NOMEM;
+        fs_image_buffer = (uint8_t *)kmalloc(FS_IMAGE_BUFFER_SIZE);
+        if (!fs_image_buffer) {
+            return FS_ERR_NOMEM;
+        }
     }
 
-    if (ata_read_sectors(FS_IMAGE_LBA_START, FS_IMAGE_LBA_COUNT, fs_image_buffer) != 0) {
-        return FS_ERR_INVALID;
+    for (size_t bucket = 0; bucket < FS_CHUNK_BUCKETS; ++bucket) {
+        for (fs_chunk_t *chunk = fs_chunk_table[bucket]; chunk; chunk = chunk->hash_next) {
+            if (!chunk->bytes && !fs_chunk_access(chunk)) {
+                return FS_ERR_NOMEM;
+            }
+        }
     }
-
-    fs_image_header_t header;
-    memcpy(&header, fs_image_buffer, sizeof(header));
-
-    if (header.magic != FS_IMAGE_MAGIC || header.version != FS_IMAGE_VERSION) {
-        return FS_ERR_INVALID;
+    for (size_t bucket = 0; bucket < FS_CHUNK_BUCKETS; ++bucket) {
+        for (fs_chunk_t *chunk = fs_chunk_table[bucket]; chunk; chunk = chunk->hash_next) {
+            chunk->disk_generation = 0;
+        }
     }
+    memset(fs_slot_generation, 0, sizeof(fs_slot_generation));
+    fs_image_slot = 0;
+    fs_image_generation = 0;
+    fs_image_probed = 0;
+    fs_cache_writeback = 0;
 
-    if (header.total_size < sizeof(fs_image_header_t) || header.total_size > FS_IMAGE_BUFFER_SIZE) {
-        return FS_ERR_INVALID;
+    if (fs_device) {
+        bcache_sync(fs_device);
     }
+    fs_device = dev;
+    fs_image_base = fs_image_base_for(dev->sector_count);
+    return FS_OK;
+}
 
-    if (header.entry_count == 0) {
-        fs_clear_children(fs_root);
-        fs_cwd = fs_root;
-        return FS_OK;
-    }
+const char *fs_mounted_device(void) {
+    return fs_device ? fs_device->name : NULL;
+}
 
-    return fs_deserialize_from_buffer(header.total_size, header.entry_count);
+/* First sector past the image slots on a device of `sector_count`
+ * sectors: everything from there on is never touched by the filesystem. */
+uint64_t fs_image_end(uint64_t sector_count) {
+    return fs_image_base_for(sector_count) + FS_IMAGE_SLOTS * FS_IMAGE_LBA_COUNT;
 }
 
 int fs_persistence_available(void) {
-    return ata_is_available();
+    return fs_device != NULL;
+}
+
+void fs_get_cache_stats(fs_cache_stats_t *stats) {
+    if (!stats) {
+        return;
+    }
+    stats->resident_bytes = fs_chunk_bytes - fs_cache_evicted_bytes;
+    stats->evicted_bytes = fs_cache_evicted_bytes;
+    stats->hits = fs_cache_hits;
+    stats->misses = fs_cache_misses;
+    stats->evictions = fs_cache_evictions;
 }
 
+/* Evicts every chunk that can be read back from the disk. Returns the
+ * number of bytes freed. */
+size_t fs_cache_drop(void) {
+    return fs_cache_evict((size_t)-1, 1);
+}
 
+/* Set when memory is over the watermark but nothing is clean enough to
+ * evict; a save makes the data evictable. */
+int fs_cache_writeback_wanted(void) {
+    return fs_cache_writeback;
+}
@@ -0,0 +1,273 @@
+#include <fsbench.h>
+#include <cpu.h>
+#include <memory.h>
+#include <pit.h>
+#include <string.h>
+
+#define FSBENCH_ROOT          "/.fsbench"
+#define FSBENCH_DEEP_DEPTH    48u
+#define FSBENCH_APPEND_FILES  4u
+#define FSBENCH_APPEND_LINE   64u
+#define FSBENCH_SEQ_BYTES     (32u * 1024u)
+#define FSBENCH_CALIBRATE_TICKS 10u
+
+typedef struct {
+    const char *name;
+    uint32_t default_ops;
+} fsbench_workload_info_t;
+
+static const fsbench_workload_info_t fsbench_workloads[FSBENCH_WORKLOAD_COUNT] = {
+    [FSBENCH_CREATE] = { "create", 1000 },
+    [FSBENCH_LOOKUP] = { "lookup", 1000 },
+    [FSBENCH_REMOVE] = { "remove", 1000 },
+    [FSBENCH_DEEP_LOOKUP] = { "deep", 1000 },
+    [FSBENCH_APPEND] = { "append", 2000 },
+    [FSBENCH_SEQ_WRITE] = { "seqwrite", 64 },
+    [FSBENCH_ROUNDTRIP] = { "roundtrip", 4 }
+};
+
+static uint64_t fsbench_hz = 0;
+
+const char *fsbench_workload_name(fsbench_workload_t workload) {
+    return (workload < FSBENCH_WORKLOAD_COUNT) ? fsbench_workloads[workload].name : "?";
+}
+
+int fsbench_find_workload(const char *name) {
+    for (int i = 0; i < FSBENCH_WORKLOAD_COUNT; ++i) {
+        if (strcmp(name, fsbench_workloads[i].name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+uint32_t fsbench_default_ops(fsbench_workload_t workload) {
+    return (workload < FSBENCH_WORKLOAD_COUNT) ? fsbench_workloads[workload].default_ops : 0;
+}
+
+/* Counts TSC cycles across a few PIT ticks, starting on a tick edge. */
+uint64_t fsbench_tsc_hz(void) {
+    if (fsbench_hz != 0) {
+        return fsbench_hz;
+    }
+    uint32_t freq = pit_current_frequency();
+    if (freq == 0) {
+        return 0;
+    }
+    uint64_t start_tick = pit_ticks();
+    while (pit_ticks() == start_tick) {
+        __asm__ volatile("hlt");
+    }
+    uint64_t start = rdtsc();
+    start_tick = pit_ticks();
+    while (pit_ticks() - start_tick < FSBENCH_CALIBRATE_TICKS) {
+        __asm__ volatile("hlt");
+    }
+    fsbench_hz = (rdtsc() - start) * freq / FSBENCH_CALIBRATE_TICKS;
+    return fsbench_hz;
+}
+
+/* Writes "<prefix><number>" into `out`. */
+static void fsbench_format_path(char *out, const char *prefix, uint32_t number) {
+    size_t len = strlen(prefix);
+    memcpy(out, prefix, len);
+    char digits[10];
+    size_t count = 0;
+    do {
+        digits[count++] = (char)('0' + number % 10);
+        number /= 10;
+    } while (number > 0);
+    while (count > 0) {
+        out[len++] = digits[--count];
+    }
+    out[len] = '\0';
+}
+
+static void fsbench_file_path(char *out, uint32_t index) {
+    fsbench_format_path(out, FSBENCH_ROOT "/f", index);
+}
+
+static fs_status_t fsbench_create_files(uint32_t count) {
+    char path[FS_MAX_PATH_LEN];
+    for (uint32_t i = 0; i < count; ++i) {
+        fsbench_file_path(path, i);
+        fs_status_t status = fs_create_file(path);
+        if (status != FS_OK) {
+            return status;
+        }
+    }
+    return FS_OK;
+}
+
+void fsbench_sort(uint64_t *values, uint32_t count) {
+    /* Shell sort with Ciura's gaps: no recursion, no extra memory. */
+    static const uint32_t gaps[] = { 701, 301, 132, 57, 23, 10, 4, 1 };
+    for (size_t g = 0; g < sizeof(gaps) / sizeof(gaps[0]); ++g) {
+        uint32_t gap = gaps[g];
+        for (uint32_t i = gap; i < count; ++i) {
+            uint64_t value = values[i];
+            uint32_t j = i;
+            while (j >= gap && values[j - gap] > value) {
+                values[j] = values[j - gap];
+                j -= gap;
+            }
+            values[j] = value;
+        }
+    }
+}
+
+uint64_t fsbench_cycles_to_ns(uint64_t cycles, uint64_t hz) {
+    /* Split to keep cycles * 10^9 from overflowing on long runs. */
+    return (cycles / hz) * 1000000000ull + (cycles % hz) * 1000000000ull / hz;
+}
+
+static void fsbench_summarize(uint64_t *samples, uint32_t count, uint64_t total_cycles,
+                              fsbench_result_t *result) {
+    uint64_t hz = fsbench_tsc_hz();
+    if (count == 0 || hz == 0) {
+        return;
+    }
+    fsbench_sort(samples, count);
+    result->total_ns = fsbench_cycles_to_ns(total_cycles, hz);
+    result->ops_per_sec = total_cycles ? (uint64_t)count * hz / total_cycles : 0;
+    result->p50_ns = fsbench_cycles_to_ns(samples[(count - 1) * 50 / 100], hz);
+    result->p90_ns = fsbench_cycles_to_ns(samples[(count - 1) * 90 / 100], hz);
+    result->p99_ns = fsbench_cycles_to_ns(samples[(count - 1) * 99 / 100], hz);
+    result->max_ns = fsbench_cycles_to_ns(samples[count - 1], hz);
+}
+
+/* Runs `ops` operations of one workload in a scratch directory, timing
+ * each with the TSC. Setup and cleanup are not timed. The round trip
+ * workload saves and reloads the whole tree, so it overwrites the image
+ * on disk just like savefs. */
+void fsbench_run(fsbench_workload_t workload, uint32_t ops, fsbench_result_t *result) {
+    memset(result, 0, sizeof(*result));
+    if (workload >= FSBENCH_WORKLOAD_COUNT || ops == 0) {
+        result->status = FS_ERR_INVALID;
+        return;
+    }
+    if (ops > FSBENCH_MAX_OPS) {
+        ops = FSBENCH_MAX_OPS;
+    }
+    if (workload == FSBENCH_ROUNDTRIP && !fs_persistence_available()) {
+        result->status = FS_ERR_INVALID;
+        return;
+    }
+
+    uint64_t *samples = (uint64_t *)kmalloc(ops * sizeof(uint64_t));
+    uint8_t *payload = (uint8_t *)kmalloc(FSBENCH_SEQ_BYTES);
+    if (!samples || !payload) {
+        if (samples) {
+            kfree(samples);
+        }
+        if (payload) {
+            kfree(payload);
+        }
+        result->status = FS_ERR_NOMEM;
+        return;
+    }
+    for (uint32_t i = 0; i < FSBENCH_SEQ_BYTES; ++i) {
+        payload[i] = (uint8_t)('a' + i % 26);
+    }
+
+    /* The round trip works on the tree as it is, so that the scratch
+     * directory never reaches the disk. */
+    fs_remove(FSBENCH_ROOT, 1);
+    fs_status_t status = (workload == FSBENCH_ROUNDTRIP) ? FS_OK : fs_mkdir(FSBENCH_ROOT);
+
+    char path[FS_MAX_PATH_LEN];
+    if (status == FS_OK && (workload == FSBENCH_LOOKUP || workload == FSBENCH_REMOVE)) {
+        status = fsbench_create_files(ops);
+    }
+    if (status == FS_OK && workload == FSBENCH_DEEP_LOOKUP) {
+        memcpy(path, FSBENCH_ROOT, sizeof(FSBENCH_ROOT));
+        size_t len = sizeof(FSBENCH_ROOT) - 1;
+        for (uint32_t depth = 0; depth < FSBENCH_DEEP_DEPTH && status == FS_OK; ++depth) {
+            memcpy(path + len, "/d", 3);
+            len += 2;
+            status = fs_mkdir(path);
+        }
+        memcpy(path + len, "/leaf", 6);
+        if (status == FS_OK) {
+            status = fs_create_file(path);
+        }
+    }
+    if (status == FS_OK && workload == FSBENCH_APPEND) {
+        for (uint32_t i = 0; i < FSBENCH_APPEND_FILES && status == FS_OK; ++i) {
+            fsbench_file_path(path, i);
+            status = fs_create_file(path);
+        }
+    }
+    if (status == FS_OK && workload == FSBENCH_SEQ_WRITE) {
+        fsbench_file_path(path, 0);
+        status = fs_create_file(path);
+    }
+
+    uint64_t total = 0;
+    uint32_t done = 0;
+    for (; status == FS_OK && done < ops; ++done) {
+        size_t size = 0;
+        uint64_t start = 0;
+        switch (workload) {
+        case FSBENCH_CREATE:
+            fsbench_file_path(path, done);
+            start = rdtsc();
+            status = fs_create_file(path);
+            break;
+        case FSBENCH_LOOKUP:
+            fsbench_file_path(path, (done * 7919u) % ops);
+            start = rdtsc();
+            status = fs_read_file(path, NULL, 0, &size);
+            break;
+        case FSBENCH_REMOVE:
+            fsbench_file_path(path, done);
+            start = rdtsc();
+            status = fs_remove(path, 0);
+            break;
+        case FSBENCH_DEEP_LOOKUP:
+            start = rdtsc();
+            status = fs_read_file(path, NULL, 0, &size);
+            break;
+        case FSBENCH_APPEND:
+            fsbench_file_path(path, done % FSBENCH_APPEND_FILES);
+            payload[0] = (uint8_t)('0' + done % 10);
+            start = rdtsc();
+            status = fs_append_file(path, payload, FSBENCH_APPEND_LINE);
+            result->bytes += FSBENCH_APPEND_LINE;
+            break;
+        case FSBENCH_SEQ_WRITE:
+            /* Stamp the iteration and the offset into every block so no
+             * two blocks match and deduplication cannot skip the work. */
+            for (uint32_t offset = 0; offset < FSBENCH_SEQ_BYTES; offset += 512) {
+                uint32_t tag[2] = { done, offset };
+                memcpy(payload + offset, tag, sizeof(tag));
+            }
+            start = rdtsc();
+            status = fs_write_file(path, payload, FSBENCH_SEQ_BYTES);
+            result->bytes += FSBENCH_SEQ_BYTES;
+            break;
+        case FSBENCH_ROUNDTRIP:
+            start = rdtsc();
+            status = fs_save();
+            if (status == FS_OK) {
+                status = fs_load();
+            }
+            break;
+        default:
+            status = FS_ERR_INVALID;
+            break;
+        }
+        uint64_t cycles = rdtsc() - start;
+        samples[done] = cycles;
+        total += cycles;
+    }
+
+    fs_remove(FSBENCH_ROOT, 1);
+    result->status = status;
+    result->ops = (status == FS_OK) ? done : 0;
+    if (status == FS_OK) {
+        fsbench_summarize(samples, done, total, result);
+    }
+    kfree(payload);
+    kfree(samples);
+}
@@ -4,6 +4,8 @@
 #include <string.h>
 #include <pit.h>
 #include <keyboard.h>
+#include <ata.h>
+#include <cpu.h>
 
 #define IDT_ENTRY_COUNT 256
 #define IDT_TYPE_INTERRUPT_GATE 0x8E
@@ -16,7 +18,20 @@
 #define ICW1_ICW4 0x01
 #define ICW4_8086 0x01
 #define PIC_EOI 0x20
+#define PIC_READ_ISR 0x0B
 #define IRQ_BASE 0x20
+#define IRQ_LINES 16
+#define IRQ_SHARED_MAX 4
+#define MSI_VECTOR_BASE 0x40
+#define MSI_VECTORS 16
+#define SPURIOUS_VECTOR 0xFF
+#define APIC_BASE_ENABLE (1u << 11)
+#define APIC_BASE_MASK 0xFFFFF000u
+#define LAPIC_REG_ID 0x20
+#define LAPIC_REG_EOI 0xB0
+#define LAPIC_REG_SVR 0xF0
+#define LAPIC_SVR_ENABLE 0x100
+#define MSI_ADDRESS_BASE 0xFEE00000u
 
 struct idt_entry {
     uint16_t offset_low;
@@ -36,6 +51,22 @@ struct idt_descriptor {
 static struct idt_entry idt[IDT_ENTRY_COUNT];
 static struct idt_descriptor idtr;
 
+/* Handlers of PCI devices, several per line: PCI interrupts are level
+ * triggered and may share a line. */
+typedef struct irq_action {
+    irq_handler_t handler;
+    void *context;
+} irq_action_t;
+
+static irq_action_t irq_actions[IRQ_LINES][IRQ_SHARED_MAX];
+
+/* Message-signalled interrupts get a vector each and go through the local
+ * APIC, which is switched on when the first vector is handed out; the
+ * PIC keeps delivering the legacy lines through LINT0 as before. */
+static irq_action_t msi_actions[MSI_VECTORS];
+static size_t msi_allocated = 0;
+static volatile uint32_t *lapic = NULL;
+
 static const char *exception_messages[] = {
     "Divide-by-zero",
     "Debug",
@@ -104,8 +135,8 @@ static void pic_remap(void) {
     outb(PIC2_DATA, ICW4_8086);
     io_wait();
 
-    outb(PIC1_DATA, 0xFC); /* unmask IRQ0 and IRQ1 */
-    outb(PIC2_DATA, 0xFF);
+    outb(PIC1_DATA, 0xF8); /* unmask IRQ0, IRQ1 and the IRQ2 cascade */
+    outb(PIC2_DATA, 0x3F); /* unmask IRQ14 and IRQ15 (ATA channels) */
 }
 
 static void pic_send_eoi(uint8_t irq) {
@@ -115,6 +146,24 @@ static void pic_send_eoi(uint8_t irq) {
     outb(PIC1_COMMAND, PIC_EOI);
 }
 
+/* IRQ15 is also what the slave PIC reports for a spurious interrupt; a
+ * real one has its bit set in the in-service register. */
+static int pic_irq15_spurious(void) {
+    outb(PIC2_COMMAND, PIC_READ_ISR);
+    return (inb(PIC2_COMMAND) & 0x80) == 0;
+}
+
+/* The same holds for IRQ7 on the master. */
+static int pic_irq7_spurious(void) {
+    outb(PIC1_COMMAND, PIC_READ_ISR);
+    return (inb(PIC1_COMMAND) & 0x80) == 0;
+}
+
+static void pic_unmask(uint8_t irq) {
+    uint16_t port = (irq < 8) ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) & (uint8_t)~(1u << (irq & 7)));
+}
+
 static void print_hex64(uint64_t value) {
     static const char hex_digits[] = "0123456789ABCDEF";
     char buffer[17];
@@ -209,6 +258,154 @@ static void irq_keyboard(struct interrupt_frame *frame) {
     pic_send_eoi(1);
 }
 
+__attribute__((interrupt))
+static void irq_ata_primary(struct interrupt_frame *frame) {
+    (void)frame;
+    ata_handle_irq(0);
+    pic_send_eoi(14);
+}
+
+__attribute__((interrupt))
+static void irq_ata_secondary(struct interrupt_frame *frame) {
+    (void)frame;
+    if (pic_irq15_spurious()) {
+        outb(PIC1_COMMAND, PIC_EOI); /* the master still saw the cascade */
+        return;
+    }
+    ata_handle_irq(1);
+    pic_send_eoi(15);
+}
+
+/* Runs every handler registered on the line; each checks and acknowledges
+ * its own device. */
+static void irq_dispatch(uint8_t irq) {
+    if (irq == 7 && pic_irq7_spurious()) {
+        return;
+    }
+    for (size_t i = 0; i < IRQ_SHARED_MAX && irq_actions[irq][i].handler; ++i) {
+        irq_actions[irq][i].handler(irq_actions[irq][i].context);
+    }
+    pic_send_eoi(irq);
+}
+
+#define DEFINE_IRQ(n) \
+    __attribute__((interrupt)) \
+    static void irq_line##n(struct interrupt_frame *frame) { \
+        (void)frame; \
+        irq_dispatch(n); \
+    }
+
+DEFINE_IRQ(3)
+DEFINE_IRQ(4)
+DEFINE_IRQ(5)
+DEFINE_IRQ(6)
+DEFINE_IRQ(7)
+DEFINE_IRQ(9)
+DEFINE_IRQ(10)
+DEFINE_IRQ(11)
+DEFINE_IRQ(12)
+DEFINE_IRQ(13)
+
+static void msi_dispatch(uint8_t index) {
+    if (msi_actions[index].handler) {
+        msi_actions[index].handler(msi_actions[index].context);
+    }
+    lapic[LAPIC_REG_EOI / 4] = 0;
+}
+
+#define DEFINE_MSI(n) \
+    __attribute__((interrupt)) \
+    static void irq_msi##n(struct interrupt_frame *frame) { \
+        (void)frame; \
+        msi_dispatch(n); \
+    }
+
+DEFINE_MSI(0)
+DEFINE_MSI(1)
+DEFINE_MSI(2)
+DEFINE_MSI(3)
+DEFINE_MSI(4)
+DEFINE_MSI(5)
+DEFINE_MSI(6)
+DEFINE_MSI(7)
+DEFINE_MSI(8)
+DEFINE_MSI(9)
+DEFINE_MSI(10)
+DEFINE_MSI(11)
+DEFINE_MSI(12)
+DEFINE_MSI(13)
+DEFINE_MSI(14)
+DEFINE_MSI(15)
+
+static void (*const msi_stubs[MSI_VECTORS])(struct interrupt_frame *) = {
+    irq_msi0, irq_msi1, irq_msi2, irq_msi3, irq_msi4, irq_msi5, irq_msi6, irq_msi7,
+    irq_msi8, irq_msi9, irq_msi10, irq_msi11, irq_msi12, irq_msi13, irq_msi14, irq_msi15
+};
+
+/* The local APIC does not acknowledge a spurious interrupt. */
+__attribute__((interrupt))
+static void irq_spurious(struct interrupt_frame *frame) {
+    (void)frame;
+}
+
+/* Software-enables the local APIC. Its base must lie in the identity
+ * mapped, uncached first 4 GiB, which is where firmware leaves it. */
+static int lapic_enable(void) {
+    if (lapic) {
+        return 0;
+    }
+    if (!cpu_has_apic()) {
+        return -1;
+    }
+    uint64_t base = rdmsr(MSR_APIC_BASE);
+    if (!(base & APIC_BASE_ENABLE) || (base >> 32) != 0) {
+        return -1;
+    }
+    lapic = (volatile uint32_t *)(uintptr_t)(base & APIC_BASE_MASK);
+    idt_set_gate(SPURIOUS_VECTOR, (void *)irq_spurious);
+    lapic[LAPIC_REG_SVR / 4] = LAPIC_SVR_ENABLE | SPURIOUS_VECTOR;
+    return 0;
+}
+
+/* Hands out the next free vector for a message-signalled interrupt and
+ * installs `handler` on it. Returns the vector, or -1 if there is no
+ * local APIC or no vector left. Vectors are never freed. */
+int interrupts_alloc_vector(irq_handler_t handler, void *context) {
+    if (!handler || msi_allocated >= MSI_VECTORS || lapic_enable() != 0) {
+        return -1;
+    }
+    size_t index = msi_allocated++;
+    msi_actions[index].context = context;
+    msi_actions[index].handler = handler;
+    idt_set_gate((uint8_t)(MSI_VECTOR_BASE + index), (void *)msi_stubs[index]);
+    return MSI_VECTOR_BASE + (int)index;
+}
+
+/* The message address that delivers to this CPU's local APIC: physical
+ * destination, no redirection. The message data is just the vector. */
+uint32_t interrupts_msi_address(void) {
+    uint32_t apic_id = lapic ? lapic[LAPIC_REG_ID / 4] >> 24 : 0;
+    return MSI_ADDRESS_BASE | (apic_id << 12);
+}
+
+/* Adds a handler for a device on PIC line `irq` and unmasks the line.
+ * Lines the kernel drives itself (timer, keyboard, cascade, RTC, ATA)
+ * are refused. */
+int interrupts_register_irq(uint8_t irq, irq_handler_t handler, void *context) {
+    if (irq >= IRQ_LINES || irq <= 2 || irq == 8 || irq >= 14 || !handler) {
+        return -1;
+    }
+    for (size_t i = 0; i < IRQ_SHARED_MAX; ++i) {
+        if (!irq_actions[irq][i].handler) {
+            irq_actions[irq][i].context = context;
+            irq_actions[irq][i].handler = handler;
+            pic_unmask(irq);
+            return 0;
+        }
+    }
+    return -1;
+}
+
 void interrupts_init(void) {
     memset(idt, 0, sizeof(idt));
 
@@ -247,6 +444,18 @@ void interrupts_init(void) {
 
     idt_set_gate(IRQ_BASE + 0, (void *)irq_timer);
     idt_set_gate(IRQ_BASE + 1, (void *)irq_keyboard);
+    idt_set_gate(IRQ_BASE + 14, (void *)irq_ata_primary);
+    idt_set_gate(IRQ_BASE + 15, (void *)irq_ata_secondary);
+    idt_set_gate(IRQ_BASE + 3, (void *)irq_line3);
+    idt_set_gate(IRQ_BASE + 4, (void *)irq_line4);
+    idt_set_gate(IRQ_BASE + 5, (void *)irq_line5);
+    idt_set_gate(IRQ_BASE + 6, (void *)irq_line6);
+    idt_set_gate(IRQ_BASE + 7, (void *)irq_line7);
+    idt_set_gate(IRQ_BASE + 9, (void *)irq_line9);
+    idt_set_gate(IRQ_BASE + 10, (void *)irq_line10);
+    idt_set_gate(IRQ_BASE + 11, (void *)irq_line11);
+    idt_set_gate(IRQ_BASE + 12, (void *)irq_line12);
+    idt_set_gate(IRQ_BASE + 13, (void *)irq_line13);
 
     idtr.limit = sizeof(idt) - 1;
     idtr.base = (uint64_t)&idt[0];
@@ -263,3 +472,8 @@ void interrupts_disable(void) {
     __asm__ volatile("cli");
 }
 
+int interrupts_enabled(void) {
+    uint64_t flags;
+    __asm__ volatile("pushfq; popq %0" : "=r"(flags));
+    return (flags & (1u << 9)) != 0;
+}
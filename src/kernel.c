@@ -5,7 +5,11 @@
 #include <memory.h>
 #include <shell.h>
 #include <filesystem.h>
+#include <pci.h>
 #include <ata.h>
+#include <ahci.h>
+#include <virtio_blk.h>
+#include <checksum.h>
 
 extern uint8_t _kernel_end;
 
@@ -26,6 +30,15 @@ void kernel_main(void) {
     keyboard_init();
     interrupts_enable();
 
+    checksum_init();
+
+    pci_init();
+    if (pci_get_ecam(NULL, NULL, NULL) == 0) {
+        terminal_write_line("[kernel] PCI configuration space via ECAM.");
+    } else {
+        terminal_write_line("[kernel] PCI configuration space via ports 0xCF8/0xCFC.");
+    }
+
     ata_init();
     if (ata_is_available()) {
         terminal_write_line("[kernel] ATA initialized.");
@@ -33,6 +46,16 @@ void kernel_main(void) {
         terminal_write_line("[kernel] ATA device not found.");
     }
 
+    ahci_init();
+    if (ahci_is_available()) {
+        terminal_write_line("[kernel] AHCI SATA disks initialized.");
+    }
+
+    virtio_blk_init();
+    if (virtio_blk_is_available()) {
+        terminal_write_line("[kernel] virtio-blk initialized.");
+    }
+
     fs_init();
     terminal_write_line("[kernel] Filesystem ready.");
 
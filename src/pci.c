@@ -0,0 +1,485 @@
+#include <pci.h>
+#include <acpi.h>
+#include <io.h>
+#include <memory.h>
+#include <string.h>
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+
+#define PCI_STATUS_CAP_LIST  0x0010
+#define PCI_MSI_64BIT        0x0080
+#define PCI_MSI_MME_MASK     0x0070
+#define PCI_MSI_ENABLE       0x0001
+#define PCI_MSIX_ENABLE      0x8000
+#define PCI_MSIX_MASK_ALL    0x4000
+#define PCI_MSIX_TABLE_SIZE  0x07FF
+#define PCI_MSIX_ENTRY_SIZE  16u
+
+/* boot.asm identity maps the first 4 GiB with 2 MiB pages, uncached from
+ * 1 GiB up; device memory above 4 GiB gets uncached pages on demand. */
+#define PCI_UNCACHED_START   0x40000000ull
+#define PCI_MAPPED_LIMIT     0x100000000ull
+#define PCI_PML4_SPAN        0x8000000000ull
+#define PAGE_PRESENT_WRITE   0x03ull
+#define PAGE_LARGE_UNCACHED  0x19Bull
+#define PAGE_ADDRESS_MASK    0x000FFFFFFFFFF000ull
+
+typedef struct pci_mcfg_entry {
+    uint64_t base;
+    uint16_t segment;
+    uint8_t start_bus;
+    uint8_t end_bus;
+    uint32_t reserved;
+} __attribute__((packed)) pci_mcfg_entry_t;
+
+static pci_device_info_t pci_devices[PCI_MAX_DEVICES];
+static size_t pci_total = 0;
+static int pci_scanned = 0;
+static const pci_driver_t *pci_drivers[PCI_MAX_DRIVERS];
+static size_t pci_driver_total = 0;
+
+static volatile uint8_t *pci_ecam = NULL;
+static uint8_t pci_ecam_start = 0;
+static uint8_t pci_ecam_end = 0;
+
+/* Backs [base, base + size) with uncached 2 MiB pages. Below 4 GiB only
+ * the uncached part of the boot identity map qualifies; above it, page
+ * directories are added for each missing GiB below 512 GiB. */
+static int pci_map_uncached(uint64_t base, uint64_t size) {
+    if (size == 0) {
+        return -1;
+    }
+    uint64_t end = base + size;
+    if (end <= PCI_MAPPED_LIMIT) {
+        return base >= PCI_UNCACHED_START ? 0 : -1;
+    }
+    if (base < PCI_MAPPED_LIMIT || end > PCI_PML4_SPAN || end < base) {
+        return -1;
+    }
+    uint64_t cr3;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    uint64_t *pml4 = (uint64_t *)(uintptr_t)(cr3 & PAGE_ADDRESS_MASK);
+    uint64_t *pdpt = (uint64_t *)(uintptr_t)(pml4[0] & PAGE_ADDRESS_MASK);
+    for (uint64_t gib = base >> 30; gib <= (end - 1) >> 30; ++gib) {
+        if (pdpt[gib] & 1) {
+            continue;
+        }
+        uint64_t *pd = (uint64_t *)kmalloc_aligned(4096, 4096);
+        if (!pd) {
+            return -1;
+        }
+        for (uint64_t i = 0; i < 512; ++i) {
+            pd[i] = (gib << 30) | (i << 21) | PAGE_LARGE_UNCACHED;
+        }
+        pdpt[gib] = (uint64_t)(uintptr_t)pd | PAGE_PRESENT_WRITE;
+    }
+    __asm__ volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+    return 0;
+}
+
+/* Memory-mapped configuration: 4 KiB per function, so offsets past 255
+ * would be reachable too, though the interface keeps to the first 256. */
+static volatile uint8_t *pci_ecam_address(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset) {
+    if (!pci_ecam || bus < pci_ecam_start || bus > pci_ecam_end) {
+        return NULL;
+    }
+    return pci_ecam + (((uint32_t)(bus - pci_ecam_start) << 20) | ((uint32_t)(slot & 0x1F) << 15) |
+                       ((uint32_t)(function & 0x07) << 12) | offset);
+}
+
+/* Configuration mechanism #1: the address port selects a dword of one
+ * function's configuration space, the data port reads or writes it. */
+static void pci_select(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset) {
+    outl(PCI_CONFIG_ADDRESS, 0x80000000u | ((uint32_t)bus << 16) | ((uint32_t)(slot & 0x1F) << 11) |
+                                 ((uint32_t)(function & 0x07) << 8) | (offset & 0xFC));
+}
+
+uint32_t pci_config_read32(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset) {
+    volatile uint8_t *ecam = pci_ecam_address(bus, slot, function, offset & 0xFC);
+    if (ecam) {
+        return *(volatile uint32_t *)ecam;
+    }
+    pci_select(bus, slot, function, offset);
+    return inl(PCI_CONFIG_DATA);
+}
+
+uint16_t pci_config_read16(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset) {
+    uint32_t value = pci_config_read32(bus, slot, function, offset);
+    return (uint16_t)(value >> ((offset & 2) * 8));
+}
+
+void pci_config_write32(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset, uint32_t value) {
+    volatile uint8_t *ecam = pci_ecam_address(bus, slot, function, offset & 0xFC);
+    if (ecam) {
+        *(volatile uint32_t *)ecam = value;
+        return;
+    }
+    pci_select(bus, slot, function, offset);
+    outl(PCI_CONFIG_DATA, value);
+}
+
+/* Through ECAM a word is written on its own; the port mechanism only
+ * moves dwords here, so the other half is read and written back. */
+void pci_config_write16(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset, uint16_t value) {
+    volatile uint8_t *ecam = pci_ecam_address(bus, slot, function, offset & 0xFE);
+    if (ecam) {
+        *(volatile uint16_t *)ecam = value;
+        return;
+    }
+    uint32_t dword = pci_config_read32(bus, slot, function, offset);
+    uint32_t shift = (offset & 2) * 8;
+    dword = (dword & ~(0xFFFFu << shift)) | ((uint32_t)value << shift);
+    pci_config_write32(bus, slot, function, offset, dword);
+}
+
+/* Uses the MCFG entry for segment 0, if ACPI has one and its window can
+ * be mapped; otherwise configuration space stays behind the ports. */
+static void pci_setup_ecam(void) {
+    const acpi_header_t *mcfg = acpi_find_table("MCFG");
+    if (!mcfg || mcfg->length < sizeof(acpi_header_t) + 8) {
+        return;
+    }
+    const uint8_t *entries = (const uint8_t *)mcfg + sizeof(acpi_header_t) + 8;
+    size_t count = (mcfg->length - sizeof(acpi_header_t) - 8) / sizeof(pci_mcfg_entry_t);
+    for (size_t i = 0; i < count; ++i) {
+        pci_mcfg_entry_t entry;
+        memcpy(&entry, entries + i * sizeof(pci_mcfg_entry_t), sizeof(entry));
+        if (entry.segment != 0 || entry.end_bus < entry.start_bus) {
+            continue;
+        }
+        /* The window is laid out from bus 0 even when it starts later. */
+        uint64_t first = entry.base + ((uint64_t)entry.start_bus << 20);
+        uint64_t size = (uint64_t)(entry.end_bus - entry.start_bus + 1) << 20;
+        if (pci_map_uncached(first, size) != 0) {
+            continue;
+        }
+        pci_ecam = (volatile uint8_t *)(uintptr_t)first;
+        pci_ecam_start = entry.start_bus;
+        pci_ecam_end = entry.end_bus;
+        return;
+    }
+}
+
+/* Sizes each BAR by writing all ones and reading back which address bits
+ * stick. Decoding is off meanwhile, so the BAR never claims a bogus
+ * range, and interrupts are off so no handler sees the device that way.
+ * Host bridges keep decoding: turning it off can cut off memory. */
+static void pci_size_bars(pci_device_info_t *entry) {
+    const pci_device_t *dev = &entry->device;
+    int count = (entry->header_type & 0x7F) == 0 ? 6 : ((entry->header_type & 0x7F) == 1 ? 2 : 0);
+    if (count == 0) {
+        return;
+    }
+    int host_bridge = dev->class_code == 0x06 && dev->subclass == 0x00;
+    int enabled = interrupts_enabled();
+    interrupts_disable();
+    uint16_t command = pci_config_read16(dev->bus, dev->slot, dev->function, PCI_REG_COMMAND);
+    if (!host_bridge) {
+        pci_config_write16(dev->bus, dev->slot, dev->function, PCI_REG_COMMAND,
+                           command & (uint16_t)~(PCI_COMMAND_IO | PCI_COMMAND_MEMORY));
+    }
+
+    for (int i = 0; i < count; ++i) {
+        uint8_t offset = (uint8_t)(PCI_REG_BAR0 + i * 4);
+        uint32_t original = pci_config_read32(dev->bus, dev->slot, dev->function, offset);
+        pci_config_write32(dev->bus, dev->slot, dev->function, offset, 0xFFFFFFFFu);
+        uint32_t mask = pci_config_read32(dev->bus, dev->slot, dev->function, offset);
+        pci_config_write32(dev->bus, dev->slot, dev->function, offset, original);
+        pci_bar_info_t *bar = &entry->bars[i];
+        if (mask == 0) {
+            continue;
+        }
+        if (original & 1) {
+            bar->io = 1;
+            bar->base = original & 0xFFFFFFFCu;
+            bar->size = (~(mask & 0xFFFFFFFCu) + 1) & 0xFFFF;
+            continue;
+        }
+        uint64_t base = original & 0xFFFFFFF0u;
+        uint64_t size_mask = 0xFFFFFFFF00000000ull | (mask & 0xFFFFFFF0u);
+        bar->prefetchable = (original & 0x08) != 0;
+        if (((original >> 1) & 3) == 2 && i + 1 < count) {
+            uint8_t high = (uint8_t)(offset + 4);
+            uint32_t original_high = pci_config_read32(dev->bus, dev->slot, dev->function, high);
+            pci_config_write32(dev->bus, dev->slot, dev->function, high, 0xFFFFFFFFu);
+            uint32_t mask_high = pci_config_read32(dev->bus, dev->slot, dev->function, high);
+            pci_config_write32(dev->bus, dev->slot, dev->function, high, original_high);
+            base |= (uint64_t)original_high << 32;
+            size_mask = ((uint64_t)mask_high << 32) | (mask & 0xFFFFFFF0u);
+            bar->is64 = 1;
+            ++i;
+        }
+        bar->base = base;
+        bar->size = ~size_mask + 1;
+    }
+
+    pci_config_write16(dev->bus, dev->slot, dev->function, PCI_REG_COMMAND, command);
+    if (enabled) {
+        interrupts_enable();
+    }
+}
+
+static void pci_add_function(uint8_t bus, uint8_t slot, uint8_t function, uint32_t id) {
+    if (pci_total >= PCI_MAX_DEVICES) {
+        return;
+    }
+    pci_device_info_t *entry = &pci_devices[pci_total++];
+    memset(entry, 0, sizeof(*entry));
+    uint32_t class_reg = pci_config_read32(bus, slot, function, PCI_REG_CLASS);
+    entry->device.bus = bus;
+    entry->device.slot = slot;
+    entry->device.function = function;
+    entry->device.vendor_id = (uint16_t)id;
+    entry->device.device_id = (uint16_t)(id >> 16);
+    entry->device.class_code = (uint8_t)(class_reg >> 24);
+    entry->device.subclass = (uint8_t)(class_reg >> 16);
+    entry->device.prog_if = (uint8_t)(class_reg >> 8);
+    entry->header_type = (uint8_t)pci_config_read16(bus, slot, function, PCI_REG_HEADER);
+    uint16_t interrupt = pci_config_read16(bus, slot, function, PCI_REG_INTERRUPT);
+    entry->interrupt_line = (uint8_t)interrupt;
+    entry->interrupt_pin = (uint8_t)(interrupt >> 8);
+    entry->has_msi = pci_find_capability(&entry->device, PCI_CAP_MSI) != 0;
+    entry->has_msix = pci_find_capability(&entry->device, PCI_CAP_MSIX) != 0;
+    pci_size_bars(entry);
+}
+
+/* Sets up configuration access and records every function on every bus
+ * it reaches, in bus, slot, function order. Runs once. */
+void pci_init(void) {
+    if (pci_scanned) {
+        return;
+    }
+    pci_scanned = 1;
+    pci_setup_ecam();
+    uint32_t first = pci_ecam ? pci_ecam_start : 0;
+    uint32_t last = pci_ecam ? pci_ecam_end : 255;
+    for (uint32_t bus = first; bus <= last; ++bus) {
+        for (uint8_t slot = 0; slot < 32; ++slot) {
+            uint8_t functions = 1;
+            for (uint8_t function = 0; function < functions; ++function) {
+                uint32_t id = pci_config_read32((uint8_t)bus, slot, function, PCI_REG_VENDOR_ID);
+                if ((id & 0xFFFF) == 0xFFFF) {
+                    continue;
+                }
+                if (function == 0 && (pci_config_read16((uint8_t)bus, slot, 0, PCI_REG_HEADER) & 0x80)) {
+                    functions = 8;
+                }
+                pci_add_function((uint8_t)bus, slot, function, id);
+            }
+        }
+    }
+}
+
+int pci_get_ecam(uint64_t *base, uint8_t *start_bus, uint8_t *end_bus) {
+    if (!pci_ecam) {
+        return -1;
+    }
+    if (base) {
+        *base = (uint64_t)(uintptr_t)pci_ecam - ((uint64_t)pci_ecam_start << 20);
+    }
+    if (start_bus) {
+        *start_bus = pci_ecam_start;
+    }
+    if (end_bus) {
+        *end_bus = pci_ecam_end;
+    }
+    return 0;
+}
+
+size_t pci_device_count(void) {
+    return pci_total;
+}
+
+int pci_get_device_info(size_t index, pci_device_info_t *info) {
+    if (index >= pci_total || !info) {
+        return -1;
+    }
+    *info = pci_devices[index];
+    return 0;
+}
+
+static pci_device_info_t *pci_lookup(const pci_device_t *device) {
+    for (size_t i = 0; device && i < pci_total; ++i) {
+        const pci_device_t *dev = &pci_devices[i].device;
+        if (dev->bus == device->bus && dev->slot == device->slot && dev->function == device->function) {
+            return &pci_devices[i];
+        }
+    }
+    return NULL;
+}
+
+static int pci_driver_matches(const pci_driver_t *driver, const pci_device_t *dev) {
+    return (driver->vendor_id == PCI_ANY_ID || driver->vendor_id == dev->vendor_id) &&
+           (driver->device_id == PCI_ANY_ID || driver->device_id == dev->device_id) &&
+           (driver->class_code == PCI_ANY_ID || driver->class_code == dev->class_code) &&
+           (driver->subclass == PCI_ANY_ID || driver->subclass == dev->subclass);
+}
+
+/* Adds `driver` to the registry and offers it every matching device no
+ * driver has claimed yet. Returns how many it claimed, or -1 if the
+ * registry is full. */
+int pci_register_driver(const pci_driver_t *driver) {
+    if (!driver || !driver->probe || pci_driver_total >= PCI_MAX_DRIVERS) {
+        return -1;
+    }
+    pci_init();
+    pci_drivers[pci_driver_total++] = driver;
+    int claimed = 0;
+    for (size_t i = 0; i < pci_total; ++i) {
+        pci_device_info_t *entry = &pci_devices[i];
+        if (!entry->driver && pci_driver_matches(driver, &entry->device) && driver->probe(&entry->device) == 0) {
+            entry->driver = driver->name;
+            ++claimed;
+        }
+    }
+    return claimed;
+}
+
+/* The first recorded device whose ID register (device << 16 | vendor)
+ * and class register match the given values under the masks. Returns 0
+ * and fills `device` if found. */
+static int pci_find(uint32_t id_mask, uint32_t id_value, uint32_t class_mask, uint32_t class_value,
+                    pci_device_t *device) {
+    pci_init();
+    for (size_t i = 0; i < pci_total; ++i) {
+        const pci_device_t *dev = &pci_devices[i].device;
+        uint32_t id = ((uint32_t)dev->device_id << 16) | dev->vendor_id;
+        uint32_t class_reg = ((uint32_t)dev->class_code << 24) | ((uint32_t)dev->subclass << 16) |
+                             ((uint32_t)dev->prog_if << 8);
+        if ((id & id_mask) == id_value && (class_reg & class_mask) == class_value) {
+            if (device) {
+                *device = *dev;
+            }
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int pci_find_class(uint8_t class_code, uint8_t subclass, pci_device_t *device) {
+    return pci_find(0, 0, 0xFFFF0000u, ((uint32_t)class_code << 24) | ((uint32_t)subclass << 16), device);
+}
+
+int pci_find_device(uint16_t vendor_id, uint16_t device_id, pci_device_t *device) {
+    return pci_find(0xFFFFFFFFu, ((uint32_t)device_id << 16) | vendor_id, 0, 0, device);
+}
+
+uint8_t pci_interrupt_line(const pci_device_t *device) {
+    return (uint8_t)pci_config_read16(device->bus, device->slot, device->function, PCI_REG_INTERRUPT);
+}
+
+uint32_t pci_bar(const pci_device_t *device, int index) {
+    return pci_config_read32(device->bus, device->slot, device->function, (uint8_t)(PCI_REG_BAR0 + index * 4));
+}
+
+/* Returns a pointer to memory BAR `index`, mapped uncached, and turns on
+ * memory decoding. NULL for I/O or unimplemented BARs and for ones that
+ * cannot be mapped. */
+volatile void *pci_map_bar(const pci_device_t *device, int index, uint64_t *size) {
+    pci_device_info_t *entry = pci_lookup(device);
+    if (!entry || index < 0 || index >= PCI_MAX_BARS) {
+        return NULL;
+    }
+    const pci_bar_info_t *bar = &entry->bars[index];
+    if (bar->size == 0 || bar->io || pci_map_uncached(bar->base, bar->size) != 0) {
+        return NULL;
+    }
+    pci_enable(device, PCI_COMMAND_MEMORY);
+    if (size) {
+        *size = bar->size;
+    }
+    return (volatile void *)(uintptr_t)bar->base;
+}
+
+void pci_enable(const pci_device_t *device, uint16_t command_bits) {
+    uint16_t command = pci_config_read16(device->bus, device->slot, device->function, PCI_REG_COMMAND);
+    pci_config_write16(device->bus, device->slot, device->function, PCI_REG_COMMAND, command | command_bits);
+}
+
+/* Walks the capability list. Returns the capability's offset, or 0. */
+uint8_t pci_find_capability(const pci_device_t *device, uint8_t id) {
+    if (!(pci_config_read16(device->bus, device->slot, device->function, PCI_REG_STATUS) & PCI_STATUS_CAP_LIST)) {
+        return 0;
+    }
+    uint8_t offset = (uint8_t)pci_config_read16(device->bus, device->slot, device->function, PCI_REG_CAPABILITY) &
+                     0xFC;
+    for (int guard = 0; offset >= 0x40 && guard < 48; ++guard) {
+        uint16_t header = pci_config_read16(device->bus, device->slot, device->function, offset);
+        if ((header & 0xFF) == id) {
+            return offset;
+        }
+        offset = (uint8_t)(header >> 8) & 0xFC;
+    }
+    return 0;
+}
+
+static void pci_record_vector(pci_device_info_t *entry, pci_irq_mode_t mode, int vector) {
+    entry->irq_mode = mode;
+    entry->vectors[entry->vector_count++] = (uint8_t)vector;
+}
+
+/* Switches the device from its INTx# pin to a single MSI message and
+ * returns the vector allocated for it, or -1. */
+int pci_enable_msi(const pci_device_t *device, irq_handler_t handler, void *context) {
+    pci_device_info_t *entry = pci_lookup(device);
+    uint8_t cap = device ? pci_find_capability(device, PCI_CAP_MSI) : 0;
+    if (!entry || cap == 0 || entry->irq_mode != PCI_IRQ_INTX) {
+        return -1;
+    }
+    int vector = interrupts_alloc_vector(handler, context);
+    if (vector < 0) {
+        return -1;
+    }
+    uint16_t control = pci_config_read16(device->bus, device->slot, device->function, (uint8_t)(cap + 2));
+    pci_config_write32(device->bus, device->slot, device->function, (uint8_t)(cap + 4), interrupts_msi_address());
+    if (control & PCI_MSI_64BIT) {
+        pci_config_write32(device->bus, device->slot, device->function, (uint8_t)(cap + 8), 0);
+        pci_config_write16(device->bus, device->slot, device->function, (uint8_t)(cap + 12), (uint16_t)vector);
+    } else {
+        pci_config_write16(device->bus, device->slot, device->function, (uint8_t)(cap + 8), (uint16_t)vector);
+    }
+    control = (uint16_t)((control & ~PCI_MSI_MME_MASK) | PCI_MSI_ENABLE);
+    pci_config_write16(device->bus, device->slot, device->function, (uint8_t)(cap + 2), control);
+    pci_enable(device, PCI_COMMAND_MASTER | PCI_COMMAND_INTX_DISABLE);
+    pci_record_vector(entry, PCI_IRQ_MSI, vector);
+    return vector;
+}
+
+/* Points MSI-X table entry `entry` at a newly allocated vector, unmasks
+ * it and turns MSI-X on. Entries not set up this way keep their reset
+ * state, masked. Returns the vector, or -1. */
+int pci_enable_msix(const pci_device_t *device, uint16_t entry, irq_handler_t handler, void *context) {
+    pci_device_info_t *info = pci_lookup(device);
+    uint8_t cap = device ? pci_find_capability(device, PCI_CAP_MSIX) : 0;
+    if (!info || cap == 0 || info->irq_mode == PCI_IRQ_MSI || info->vector_count >= PCI_MAX_VECTORS) {
+        return -1;
+    }
+    uint16_t control = pci_config_read16(device->bus, device->slot, device->function, (uint8_t)(cap + 2));
+    uint32_t table = pci_config_read32(device->bus, device->slot, device->function, (uint8_t)(cap + 4));
+    uint32_t entries = (control & PCI_MSIX_TABLE_SIZE) + 1u;
+    uint64_t bar_size = 0;
+    volatile uint8_t *bar = (volatile uint8_t *)pci_map_bar(device, (int)(table & 7), &bar_size);
+    uint64_t table_offset = table & ~7u;
+    if (entry >= entries || !bar || table_offset + (uint64_t)entries * PCI_MSIX_ENTRY_SIZE > bar_size) {
+        return -1;
+    }
+    int vector = interrupts_alloc_vector(handler, context);
+    if (vector < 0) {
+        return -1;
+    }
+
+    /* The whole function stays masked while the entry is rewritten. */
+    pci_config_write16(device->bus, device->slot, device->function, (uint8_t)(cap + 2),
+                       control | PCI_MSIX_ENABLE | PCI_MSIX_MASK_ALL);
+    volatile uint32_t *slot = (volatile uint32_t *)(bar + table_offset + (size_t)entry * PCI_MSIX_ENTRY_SIZE);
+    slot[0] = interrupts_msi_address();
+    slot[1] = 0;
+    slot[2] = (uint32_t)vector;
+    slot[3] = 0;
+    pci_config_write16(device->bus, device->slot, device->function, (uint8_t)(cap + 2),
+                       (uint16_t)((control | PCI_MSIX_ENABLE) & ~PCI_MSIX_MASK_ALL));
+    pci_enable(device, PCI_COMMAND_MASTER | PCI_COMMAND_INTX_DISABLE);
+    pci_record_vector(info, PCI_IRQ_MSIX, vector);
+    return vector;
+}
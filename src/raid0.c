@@ -0,0 +1,211 @@
+#include <raid0.h>
+#include <bcache.h>
+#include <blockdev.h>
+#include <string.h>
+
+#define RAID0_SECTOR_SIZE 512u
+
+/* A request covers at most RAID0_MAX_CHUNKS chunks, and so splits into
+ * one more piece than that when it does not start on a chunk boundary. */
+#define RAID0_MAX_CHUNKS  32u
+#define RAID0_MAX_PIECES  (RAID0_MAX_CHUNKS + 1)
+
+typedef struct raid0_batch {
+    size_t remaining;
+    int status;
+} raid0_batch_t;
+
+static blockdev_t *raid0_members[RAID0_MAX_MEMBERS];
+static size_t raid0_member_count = 0;
+static uint32_t raid0_chunk = 0;
+static blockdev_io_t raid0_pieces[RAID0_MAX_PIECES];
+static uint8_t raid0_piece_member[RAID0_MAX_PIECES];
+static uint8_t raid0_piece_overlapped[RAID0_MAX_PIECES];
+static uint64_t raid0_piece_total = 0;
+static uint64_t raid0_overlapped = 0;
+
+static int raid0_submit(blockdev_t *dev, const blockdev_request_t *request);
+
+static blockdev_t raid0_blockdev = {
+    .name = "md0",
+    .driver = "raid0",
+    .sector_size = RAID0_SECTOR_SIZE,
+    .max_transfer = 1,
+    .submit = raid0_submit
+};
+
+/* Pieces are counted here rather than when started: a driver that
+ * refuses one completes it at once with an error. */
+static void raid0_piece_done(blockdev_io_t *io, void *user_data) {
+    raid0_batch_t *batch = (raid0_batch_t *)user_data;
+    if (io->status != 0) {
+        batch->status = -1;
+    } else {
+        raid0_piece_total++;
+        raid0_overlapped += raid0_piece_overlapped[io - raid0_pieces];
+    }
+    batch->remaining--;
+}
+
+static int raid0_member_busy(size_t except) {
+    for (size_t i = 0; i < raid0_member_count; ++i) {
+        if (i != except && raid0_members[i]->inflight > 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Splits the request at chunk boundaries: chunk c of the array is chunk
+ * c / n of member c % n. Each member is handed its next piece as soon as
+ * it has a free command slot and all members are polled until the last
+ * piece is done, so members with a start hook work at the same time. */
+static int raid0_transfer(const blockdev_request_t *request) {
+    size_t count = 0;
+    uint64_t lba = request->lba;
+    uint32_t remaining = request->count;
+    uint8_t *buffer = (uint8_t *)request->buffer;
+    raid0_batch_t batch = { 0, 0 };
+
+    while (remaining > 0 && count < RAID0_MAX_PIECES) {
+        uint64_t chunk = lba / raid0_chunk;
+        uint32_t offset = (uint32_t)(lba % raid0_chunk);
+        uint32_t sectors = raid0_chunk - offset;
+        if (sectors > remaining) {
+            sectors = remaining;
+        }
+        blockdev_io_t *io = &raid0_pieces[count];
+        io->op = request->op;
+        io->lba = (chunk / raid0_member_count) * raid0_chunk + offset;
+        io->count = sectors;
+        io->buffer = buffer;
+        io->callback = raid0_piece_done;
+        io->user_data = &batch;
+        raid0_piece_member[count] = (uint8_t)(chunk % raid0_member_count);
+        ++count;
+        lba += sectors;
+        remaining -= sectors;
+        buffer += (size_t)sectors * RAID0_SECTOR_SIZE;
+    }
+    if (remaining > 0) {
+        return -1;
+    }
+
+    size_t next[RAID0_MAX_MEMBERS] = { 0 };
+    batch.remaining = count;
+    while (batch.remaining > 0) {
+        for (size_t m = 0; m < raid0_member_count; ++m) {
+            for (; next[m] < count; ++next[m]) {
+                if (raid0_piece_member[next[m]] != m) {
+                    continue;
+                }
+                raid0_piece_overlapped[next[m]] = (uint8_t)raid0_member_busy(m);
+                int started = blockdev_start(raid0_members[m], &raid0_pieces[next[m]]);
+                if (started == 1) {
+                    break;
+                }
+                if (started < 0) {
+                    batch.status = -1;
+                    batch.remaining--;
+                }
+            }
+        }
+        for (size_t m = 0; m < raid0_member_count && batch.remaining > 0; ++m) {
+            blockdev_poll(raid0_members[m]);
+        }
+    }
+    return batch.status;
+}
+
+static int raid0_submit(blockdev_t *dev, const blockdev_request_t *request) {
+    (void)dev;
+    if (request->op != BLOCKDEV_FLUSH) {
+        return raid0_transfer(request);
+    }
+    int result = 0;
+    for (size_t i = 0; i < raid0_member_count; ++i) {
+        if (blockdev_flush(raid0_members[i]) != 0) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+/* Stripes `count` devices into md0. Every member contributes the same
+ * number of whole chunks, set by the smallest one. md0 goes to the
+ * members directly, so whatever the buffer cache holds for them is
+ * written back and dropped first. There is one array per boot: block
+ * devices cannot be unregistered. */
+int raid0_create(const char *const *members, size_t count, uint32_t chunk_sectors) {
+    if (raid0_member_count != 0 || !members || count < 2 || count > RAID0_MAX_MEMBERS || chunk_sectors == 0) {
+        return -1;
+    }
+    blockdev_t *devices[RAID0_MAX_MEMBERS];
+    uint64_t smallest = UINT64_MAX;
+    for (size_t i = 0; i < count; ++i) {
+        blockdev_t *dev = blockdev_find(members[i]);
+        if (!dev || dev == &raid0_blockdev || dev->sector_size != RAID0_SECTOR_SIZE ||
+            dev->max_transfer < chunk_sectors) {
+            return -1;
+        }
+        for (size_t j = 0; j < i; ++j) {
+            if (devices[j] == dev) {
+                return -1;
+            }
+        }
+        devices[i] = dev;
+        if (dev->sector_count < smallest) {
+            smallest = dev->sector_count;
+        }
+    }
+    uint64_t per_member = smallest / chunk_sectors * chunk_sectors;
+    if (per_member == 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (bcache_sync(devices[i]) != 0) {
+            return -1;
+        }
+        bcache_invalidate(devices[i]);
+    }
+
+    memcpy(raid0_members, devices, count * sizeof(devices[0]));
+    raid0_member_count = count;
+    raid0_chunk = chunk_sectors;
+    raid0_blockdev.sector_count = per_member * count;
+    raid0_blockdev.max_transfer = chunk_sectors * RAID0_MAX_CHUNKS;
+    if (blockdev_register(&raid0_blockdev) != 0) {
+        raid0_member_count = 0;
+        return -1;
+    }
+    return 0;
+}
+
+int raid0_is_active(void) {
+    return raid0_member_count != 0;
+}
+
+int raid0_is_member(const blockdev_t *dev) {
+    for (size_t i = 0; i < raid0_member_count; ++i) {
+        if (raid0_members[i] == dev) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int raid0_get_info(raid0_info_t *info) {
+    if (!info || raid0_member_count == 0) {
+        return -1;
+    }
+    info->name = raid0_blockdev.name;
+    info->members = raid0_member_count;
+    for (size_t i = 0; i < raid0_member_count; ++i) {
+        info->member_names[i] = raid0_members[i]->name;
+    }
+    info->chunk_sectors = raid0_chunk;
+    info->sectors = raid0_blockdev.sector_count;
+    info->pieces = raid0_piece_total;
+    info->overlapped = raid0_overlapped;
+    return 0;
+}
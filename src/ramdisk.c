@@ -0,0 +1,65 @@
+#include <ramdisk.h>
+#include <memory.h>
+#include <string.h>
+
+#define RAMDISK_MAX_TRANSFER 256u
+
+typedef struct {
+    blockdev_t dev;
+    uint8_t *storage;
+} ramdisk_t;
+
+static uint32_t ramdisk_next_index = 0;
+
+static int ramdisk_submit(blockdev_t *dev, const blockdev_request_t *request) {
+    ramdisk_t *disk = (ramdisk_t *)dev->driver_data;
+    uint8_t *sectors = disk->storage + (size_t)request->lba * RAMDISK_SECTOR_SIZE;
+    size_t length = (size_t)request->count * RAMDISK_SECTOR_SIZE;
+
+    switch (request->op) {
+    case BLOCKDEV_READ:
+        memcpy(request->buffer, sectors, length);
+        return 0;
+    case BLOCKDEV_WRITE:
+        memcpy(sectors, request->buffer, length);
+        return 0;
+    case BLOCKDEV_FLUSH:
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+/* Creates a zero-filled disk on the heap and registers it as "ramN". */
+blockdev_t *ramdisk_create(uint32_t sector_count) {
+    if (sector_count == 0 || ramdisk_next_index > 9) {
+        return NULL;
+    }
+    ramdisk_t *disk = (ramdisk_t *)kmalloc(sizeof(ramdisk_t));
+    if (!disk) {
+        return NULL;
+    }
+    memset(disk, 0, sizeof(ramdisk_t));
+    disk->storage = (uint8_t *)kmalloc((size_t)sector_count * RAMDISK_SECTOR_SIZE);
+    if (!disk->storage) {
+        kfree(disk);
+        return NULL;
+    }
+    memset(disk->storage, 0, (size_t)sector_count * RAMDISK_SECTOR_SIZE);
+
+    memcpy(disk->dev.name, "ram0", 5);
+    disk->dev.name[3] = (char)('0' + ramdisk_next_index);
+    disk->dev.driver = "ramdisk";
+    disk->dev.sector_size = RAMDISK_SECTOR_SIZE;
+    disk->dev.sector_count = sector_count;
+    disk->dev.max_transfer = RAMDISK_MAX_TRANSFER;
+    disk->dev.submit = ramdisk_submit;
+    disk->dev.driver_data = disk;
+    if (blockdev_register(&disk->dev) != 0) {
+        kfree(disk->storage);
+        kfree(disk);
+        return NULL;
+    }
+    ramdisk_next_index++;
+    return &disk->dev;
+}
@@ -7,11 +7,24 @@
 #include <filesystem.h>
 #include <system.h>
 #include <ata.h>
+#include <ahci.h>
+#include <virtio_blk.h>
+#include <raid0.h>
+#include <checksum.h>
+#include <bcache.h>
+#include <blockdev.h>
+#include <ramdisk.h>
+#include <cpu.h>
+#include <fsbench.h>
+#include <diskbench.h>
+#include <pci.h>
 
 #define SHELL_BUFFER_SIZE 256
 #define SHELL_HISTORY_SIZE 50
 #define SHELL_AUTOCOMPLETE_MAX_MATCHES 32
 #define SHELL_AUTOSAVE_INTERVAL_SECONDS 60
+#define SHELL_WRITEBACK_INTERVAL_SECONDS 5
+#define SHELL_CHECKSUM_BATCH_SECTORS 8
 
 static char *shell_history_data[SHELL_HISTORY_SIZE];
 static size_t shell_history_count = 0;
@@ -33,6 +46,58 @@ static void print_uint64(uint64_t value) {
     terminal_write(&buffer[i]);
 }
 
+static void print_uint64_padded(uint64_t value, size_t width) {
+    size_t digits = 1;
+    for (uint64_t rest = value; rest >= 10; rest /= 10) {
+        ++digits;
+    }
+    while (digits++ < width) {
+        terminal_write(" ");
+    }
+    print_uint64(value);
+}
+
+static void print_hex32(uint32_t value) {
+    static const char hex_digits[] = "0123456789ABCDEF";
+    char buffer[9];
+    buffer[8] = '\0';
+    for (int i = 7; i >= 0; --i) {
+        buffer[i] = hex_digits[value & 0xF];
+        value >>= 4;
+    }
+    terminal_write(buffer);
+}
+
+static void print_hex_digits(uint64_t value, size_t digits) {
+    static const char hex_digits[] = "0123456789ABCDEF";
+    char buffer[17];
+    if (digits > 16) {
+        digits = 16;
+    }
+    buffer[digits] = '\0';
+    for (size_t i = digits; i > 0; --i) {
+        buffer[i - 1] = hex_digits[value & 0xF];
+        value >>= 4;
+    }
+    terminal_write(buffer);
+}
+
+static int shell_parse_uint64(const char *str, uint64_t *out_value) {
+    if (!str || *str == '\0') {
+        return 0;
+    }
+    uint64_t value = 0;
+    while (*str) {
+        if (*str < '0' || *str > '9') {
+            return 0;
+        }
+        value = value * 10 + (uint64_t)(*str - '0');
+        ++str;
+    }
+    *out_value = value;
+    return 1;
+}
+
 static void shell_build_prompt_path(char *buffer, size_t buffer_size) {
     if (buffer_size == 0) {
         return;
@@ -115,6 +180,9 @@ static void shell_print_fs_error(fs_status_t status) {
         case FS_ERR_NOTEMPTY:
             terminal_write_line("Filesystem error: directory not empty.");
             break;
+        case FS_ERR_CORRUPT:
+            terminal_write_line("Filesystem error: image checksum mismatch.");
+            break;
         default:
             terminal_write_line("Filesystem error: unknown.");
             break;
@@ -128,6 +196,10 @@ static void shell_print_prompt(void) {
     terminal_write("myos ");
     terminal_set_color(TERMINAL_COLOR_LIGHT_CYAN, TERMINAL_COLOR_BLACK);
     terminal_write(prompt_path);
+    if (fs_save_in_progress()) {
+        terminal_set_color(TERMINAL_COLOR_DARK_GREY, TERMINAL_COLOR_BLACK);
+        terminal_write(" [saving]");
+    }
     terminal_set_color(TERMINAL_COLOR_LIGHT_GREEN, TERMINAL_COLOR_BLACK);
     terminal_write("> ");
     terminal_set_color(TERMINAL_COLOR_LIGHT_GREY, TERMINAL_COLOR_BLACK);
@@ -143,7 +215,7 @@ static void shell_cmd_help(void) {
     terminal_write_line("  history    - list recent commands");
     terminal_write_line("  echo TEXT  - print TEXT");
     terminal_write_line("  pwd        - show current directory");
-    terminal_write_line("  ls [PATH]  - list directory contents");
+    terminal_write_line("  ls [-r] [-n LIMIT] [-o OFFSET] [PATH] - list directory in name order");
     terminal_write_line("  cd PATH    - change directory");
     terminal_write_line("  touch PATH - create/truncate a file");
     terminal_write_line("  cat PATH   - print file contents");
@@ -151,9 +223,29 @@ static void shell_cmd_help(void) {
     terminal_write_line("  append PATH DATA - append DATA to file");
     terminal_write_line("  mkdir PATH - create directory");
     terminal_write_line("  rm [-r] PATH - remove file or directory");
-    terminal_write_line("  savefs     - persist filesystem to disk");
-    terminal_write_line("  loadfs     - reload filesystem from disk");
-    terminal_write_line("  diskinfo   - show ATA disk information");
+    terminal_write_line("  cp [-r] SRC DST - copy file or directory (data is shared)");
+    terminal_write_line("  mv SRC DST - move or rename file or directory");
+    terminal_write_line("  savefs [&] - persist filesystem to disk (& - in the background)");
+    terminal_write_line("  loadfs [&] - reload filesystem from disk (& - in the background)");
+    terminal_write_line("  diskinfo   - show ATA disk information (all four drive positions)");
+    terminal_write_line("  diskbench [-m] [-h] [-d DEV] [-b KB] [-q DEPTH] [-n OPS] [PATTERN...] - raw disk MB/s, IOPS, latency");
+    terminal_write_line("  atadma [on|off|irq|poll|bench [SECTORS]] - ATA transfer/completion mode, PIO vs DMA benchmark");
+    terminal_write_line("  ahci [ncq on|off|bench [READS]] - SATA disks on AHCI, NCQ queue depth benchmark");
+    terminal_write_line("  virtio [irq|poll|bench [SECTORS]] - virtio-blk completion mode, counters, virtio vs ATA benchmark");
+    terminal_write_line("  raid [create [-c SECTORS] DEV DEV...|bench [SECTORS]] - RAID-0 stripe md0, per-disk vs striped read benchmark");
+    terminal_write_line("  checksum PATH | -d LBA COUNT - CRC32C of a file or mounted disk sectors");
+    terminal_write_line("  lsblk      - list block devices");
+    terminal_write_line("  lspci [-v] - list PCI functions, their drivers and interrupt vectors; -v adds BARs");
+    terminal_write_line("  iostat     - show block queue counters and cache flush timings");
+    terminal_write_line("  mount [DEVICE] - save to and load from DEVICE, show the mounted one");
+    terminal_write_line("  ramdisk SECTORS - create a RAM-backed block device");
+    terminal_write_line("  du [-s] [PATH] - show disk usage of a directory tree");
+    terminal_write_line("  dedupstat  - show file data deduplication statistics");
+    terminal_write_line("  index [on|off [PATH]] - toggle content indexing, show index stats");
+    terminal_write_line("  search TEXT - list indexed files containing TEXT");
+    terminal_write_line("  cache [drop] - show file cache counters, evict all saved data");
+    terminal_write_line("  bcache [sync|drop] - show disk block cache counters, write back dirty blocks");
+    terminal_write_line("  fsbench [-m] [-n OPS] [WORKLOAD...] - benchmark filesystem workloads");
     terminal_write_line("  poweroff   - shut down the system");
     terminal_write_line("  reboot     - restart the system");
     terminal_write_line("");
@@ -162,7 +254,7 @@ static void shell_cmd_help(void) {
     terminal_write_line("  Left/Right - move cursor in line");
     terminal_write_line("  Tab        - autocomplete commands");
     terminal_write_line("  Ctrl+R     - search history");
-    terminal_write_line("  Autosave   - snapshot every minute when disk is attached");
+    terminal_write_line("  Autosave   - background snapshot every minute when disk is attached");
 }
 
 static void shell_cmd_clear(void) {
@@ -219,176 +311,1810 @@ static void shell_cmd_mem(void) {
     terminal_write_line(" bytes");
 }
 
-static void shell_cmd_echo(const char *args) {
-    if (args == NULL || *args == '\0') {
-        terminal_write_line("");
-        return;
+static void shell_cmd_echo(const char *args) {
+    if (args == NULL || *args == '\0') {
+        terminal_write_line("");
+        return;
+    }
+    terminal_write_line(args);
+}
+
+static void shell_cmd_pwd(void) {
+    char path[FS_MAX_PATH_LEN];
+    fs_get_cwd(path, sizeof(path));
+    terminal_write_line(path);
+}
+
+static void shell_ls_callback(const fs_dir_entry_t *entry, void *user_data) {
+    (void)user_data;
+    if (entry->is_directory) {
+        terminal_write("[DIR] ");
+    } else {
+        terminal_write("      ");
+    }
+    terminal_write(entry->name);
+    if (!entry->is_directory) {
+        terminal_write("  ");
+        print_uint64(entry->size);
+        terminal_write(" bytes");
+    }
+    terminal_write_line("");
+}
+
+static void shell_cmd_ls(const char *args) {
+    char token[FS_MAX_PATH_LEN];
+    char path[FS_MAX_PATH_LEN];
+    fs_dir_order_t order = FS_DIR_ORDER_NAME;
+    uint64_t limit = 0;
+    uint64_t offset = 0;
+    path[0] = '\0';
+
+    const char *rest = shell_extract_token(args, token, sizeof(token));
+    while (token[0] != '\0') {
+        if (strcmp(token, "-r") == 0) {
+            order = FS_DIR_ORDER_NAME_DESC;
+        } else if (strcmp(token, "-n") == 0 || strcmp(token, "-o") == 0) {
+            int is_limit = (token[1] == 'n');
+            rest = shell_extract_token(rest, token, sizeof(token));
+            if (!shell_parse_uint64(token, is_limit ? &limit : &offset)) {
+                terminal_write_line("Usage: ls [-r] [-n LIMIT] [-o OFFSET] [PATH]");
+                return;
+            }
+        } else {
+            memcpy(path, token, strlen(token) + 1);
+        }
+        rest = shell_extract_token(rest, token, sizeof(token));
+    }
+
+    fs_dir_t *dir = NULL;
+    fs_status_t status = fs_opendir(path[0] ? path : NULL, order, &dir);
+    if (status == FS_OK) {
+        status = fs_seekdir(dir, (size_t)offset);
+    }
+    if (status == FS_OK) {
+        size_t total = fs_dir_entry_count(dir);
+        uint64_t shown = 0;
+        fs_dir_entry_t entry;
+        while ((limit == 0 || shown < limit) && fs_readdir(dir, &entry)) {
+            shell_ls_callback(&entry, NULL);
+            ++shown;
+        }
+        if (offset + shown < total) {
+            terminal_write("-- ");
+            print_uint64(total - offset - shown);
+            terminal_write(" more, continue with -o ");
+            print_uint64(offset + shown);
+            terminal_write_line(" --");
+        }
+        fs_closedir(dir);
+        return;
+    }
+    if (status == FS_ERR_NOENT) {
+        terminal_write_line("ls: path not found.");
+    } else if (status == FS_ERR_NOTDIR) {
+        terminal_write_line("ls: not a directory.");
+    } else {
+        shell_print_fs_error(status);
+    }
+}
+
+static void shell_cmd_cd(const char *args) {
+    const char *path = shell_skip_spaces(args);
+    if (!path || *path == '\0') {
+        path = "/";
+    }
+    fs_status_t status = fs_change_dir(path);
+    if (status != FS_OK) {
+        shell_print_fs_error(status);
+    }
+}
+
+static void shell_cmd_touch(const char *args) {
+    const char *path = shell_skip_spaces(args);
+    if (!path || *path == '\0') {
+        terminal_write_line("Usage: touch PATH");
+        return;
+    }
+
+    if (fs_is_dir(path)) {
+        terminal_write_line("touch: cannot operate on a directory.");
+        return;
+    }
+
+    fs_status_t status = fs_create_file(path);
+    if (status == FS_ERR_EXIST) {
+        status = fs_write_file(path, NULL, 0);
+    }
+    if (status != FS_OK) {
+        shell_print_fs_error(status);
+    }
+}
+
+static void shell_cmd_mkdir(const char *args) {
+    const char *path = shell_skip_spaces(args);
+    if (!path || *path == '\0') {
+        terminal_write_line("Usage: mkdir PATH");
+        return;
+    }
+
+    fs_status_t status = fs_mkdir(path);
+    if (status != FS_OK) {
+        shell_print_fs_error(status);
+    }
+}
+
+static void shell_cmd_rm(const char *args) {
+    char token[FS_MAX_PATH_LEN];
+    const char *rest = shell_extract_token(args, token, sizeof(token));
+    int recursive = 0;
+
+    if (strcmp(token, "-r") == 0 || strcmp(token, "--recursive") == 0) {
+        recursive = 1;
+        rest = shell_extract_token(rest, token, sizeof(token));
+    }
+
+    if (token[0] == '\0') {
+        terminal_write_line("Usage: rm [-r] PATH");
+        return;
+    }
+
+    fs_status_t status = fs_remove(token, recursive);
+    if (status != FS_OK) {
+        shell_print_fs_error(status);
+    }
+}
+
+/* cp/mv into an existing directory keep the source's last path component. */
+static int shell_resolve_destination(const char *src, const char *dst, char *out, size_t out_size) {
+    size_t dst_len = strlen(dst);
+    if (dst_len >= out_size) {
+        return 0;
+    }
+    memcpy(out, dst, dst_len + 1);
+    if (!fs_is_dir(dst)) {
+        return 1;
+    }
+
+    size_t end = strlen(src);
+    while (end > 0 && src[end - 1] == '/') {
+        --end;
+    }
+    size_t start = end;
+    while (start > 0 && src[start - 1] != '/') {
+        --start;
+    }
+    if (start == end) {
+        return 0;
+    }
+
+    size_t pos = dst_len;
+    if (pos == 0 || out[pos - 1] != '/') {
+        if (pos + 1 >= out_size) {
+            return 0;
+        }
+        out[pos++] = '/';
+    }
+    if (pos + (end - start) >= out_size) {
+        return 0;
+    }
+    memcpy(&out[pos], &src[start], end - start);
+    out[pos + (end - start)] = '\0';
+    return 1;
+}
+
+static void shell_cmd_cp(const char *args) {
+    char src[FS_MAX_PATH_LEN];
+    char dst[FS_MAX_PATH_LEN];
+    char target[FS_MAX_PATH_LEN];
+    const char *rest = shell_extract_token(args, src, sizeof(src));
+    int recursive = 0;
+
+    if (strcmp(src, "-r") == 0 || strcmp(src, "--recursive") == 0) {
+        recursive = 1;
+        rest = shell_extract_token(rest, src, sizeof(src));
+    }
+    shell_extract_token(rest, dst, sizeof(dst));
+
+    if (src[0] == '\0' || dst[0] == '\0') {
+        terminal_write_line("Usage: cp [-r] SRC DST");
+        return;
+    }
+    if (fs_is_dir(src) && !recursive) {
+        terminal_write_line("cp: source is a directory (use -r).");
+        return;
+    }
+    if (!shell_resolve_destination(src, dst, target, sizeof(target))) {
+        shell_print_fs_error(FS_ERR_INVALID);
+        return;
+    }
+
+    fs_status_t status = fs_copy(src, target, recursive);
+    if (status != FS_OK) {
+        shell_print_fs_error(status);
+    }
+}
+
+static void shell_cmd_mv(const char *args) {
+    char src[FS_MAX_PATH_LEN];
+    char dst[FS_MAX_PATH_LEN];
+    char target[FS_MAX_PATH_LEN];
+    const char *rest = shell_extract_token(args, src, sizeof(src));
+    shell_extract_token(rest, dst, sizeof(dst));
+
+    if (src[0] == '\0' || dst[0] == '\0') {
+        terminal_write_line("Usage: mv SRC DST");
+        return;
+    }
+    if (!shell_resolve_destination(src, dst, target, sizeof(target))) {
+        shell_print_fs_error(FS_ERR_INVALID);
+        return;
+    }
+
+    fs_status_t status = fs_rename(src, target);
+    if (status != FS_OK) {
+        shell_print_fs_error(status);
+    }
+}
+
+/* Background filesystem jobs. The request callbacks only mark them
+ * finished; the idle loop reports them between key presses. */
+typedef struct {
+    fs_request_t request;
+    const char *label;
+    int finished;
+} shell_fs_job_t;
+
+static shell_fs_job_t shell_autosave_job = { .label = "autosave" };
+static shell_fs_job_t shell_savefs_job = { .label = "savefs" };
+static shell_fs_job_t shell_loadfs_job = { .label = "loadfs" };
+static shell_fs_job_t *const shell_fs_jobs[] = { &shell_autosave_job, &shell_savefs_job, &shell_loadfs_job };
+
+static void shell_fs_job_done(fs_request_t *request, void *user_data) {
+    (void)request;
+    ((shell_fs_job_t *)user_data)->finished = 1;
+}
+
+static void shell_fs_job_submit(shell_fs_job_t *job, fs_request_op_t op) {
+    fs_status_t status = (op == FS_REQUEST_LOAD)
+                             ? fs_load_async(&job->request, shell_fs_job_done, job)
+                             : fs_save_async(&job->request, shell_fs_job_done, job);
+    if (status == FS_ERR_BUSY) {
+        terminal_write_line("Already running in the background.");
+    } else if (status != FS_OK) {
+        shell_print_fs_error(status);
+    } else {
+        terminal_write_line("Running in the background.");
+    }
+}
+
+/* Prints the outcome of every finished job. Returns 1 if anything was
+ * printed. */
+static int shell_report_fs_jobs(void) {
+    int reported = 0;
+    for (size_t i = 0; i < sizeof(shell_fs_jobs) / sizeof(shell_fs_jobs[0]); ++i) {
+        shell_fs_job_t *job = shell_fs_jobs[i];
+        if (!job->finished) {
+            continue;
+        }
+        job->finished = 0;
+        reported = 1;
+
+        terminal_write_line("");
+        terminal_write("[");
+        terminal_write(job->label);
+        terminal_write("] ");
+        if (job->request.status != FS_OK) {
+            shell_print_fs_error(job->request.status);
+        } else if (job->request.op == FS_REQUEST_LOAD) {
+            terminal_write_line("Filesystem reloaded from disk.");
+        } else {
+            terminal_write("Filesystem snapshot saved in ");
+            print_uint64(fs_save_last_duration_ms());
+            terminal_write_line(" ms.");
+        }
+    }
+    return reported;
+}
+
+static int shell_background_requested(const char *args) {
+    char token[4];
+    shell_extract_token(args, token, sizeof(token));
+    return strcmp(token, "&") == 0;
+}
+
+static void shell_cmd_savefs(const char *args) {
+    if (!fs_persistence_available()) {
+        terminal_write_line("Persistence unavailable: attach an ATA disk.");
+        return;
+    }
+    if (shell_background_requested(args)) {
+        shell_fs_job_submit(&shell_savefs_job, FS_REQUEST_SAVE);
+        return;
+    }
+    fs_status_t status = fs_save();
+    if (status == FS_OK) {
+        terminal_write("Filesystem snapshot saved to disk in ");
+        print_uint64(fs_save_last_duration_ms());
+        terminal_write_line(" ms.");
+    } else {
+        shell_print_fs_error(status);
+    }
+}
+
+static void shell_cmd_loadfs(const char *args) {
+    if (!fs_persistence_available()) {
+        terminal_write_line("Persistence unavailable: attach an ATA disk.");
+        return;
+    }
+    if (shell_background_requested(args)) {
+        shell_fs_job_submit(&shell_loadfs_job, FS_REQUEST_LOAD);
+        return;
+    }
+    fs_status_t status = fs_load();
+    if (status == FS_OK) {
+        terminal_write_line("Filesystem reloaded from disk.");
+    } else {
+        shell_print_fs_error(status);
+    }
+}
+
+static void shell_cmd_diskinfo(void) {
+    if (!ata_is_available()) {
+        terminal_write_line("ATA disk not available.");
+        return;
+    }
+
+    ata_drive_info_t info;
+    for (size_t i = 0; ata_get_drive_info(i, &info) == 0; ++i) {
+        uint64_t total_bytes = info.sectors * 512;
+        uint64_t total_mb = total_bytes / (1024 * 1024);
+        uint64_t total_gb = total_bytes / (1024 * 1024 * 1024);
+
+        terminal_write(info.name);
+        terminal_write(info.channel ? " (secondary " : " (primary ");
+        terminal_write_line(info.slave ? "slave):" : "master):");
+        terminal_write("  Model:    ");
+        terminal_write_line(info.model[0] ? info.model : "(unknown)");
+        terminal_write("  Serial:   ");
+        terminal_write_line(info.serial[0] ? info.serial : "(unknown)");
+        terminal_write("  Firmware: ");
+        terminal_write_line(info.firmware[0] ? info.firmware : "(unknown)");
+        terminal_write("  Transfer: ");
+        terminal_write_line(info.dma ? "DMA (bus master)" : "PIO");
+        terminal_write("  Address:  ");
+        terminal_write_line(info.lba48 ? "LBA48 (up to 65536 sectors per command)" : "LBA28");
+        terminal_write("  Capacity: ");
+        print_uint64(info.sectors);
+        terminal_write(" sectors (");
+        if (total_gb > 0) {
+            print_uint64(total_gb);
+            terminal_write(" GB / ");
+        }
+        print_uint64(total_mb);
+        terminal_write_line(" MB)");
+    }
+}
+
+#define SHELL_ATABENCH_SECTORS 8192u
+#define SHELL_ATABENCH_BATCH   256u
+
+/* Reads `sectors` sectors from the start of the disk in one mode and
+ * prints the throughput and the share of transfer time the CPU was busy
+ * rather than waiting on the drive. */
+static void shell_atabench_mode(const char *label, int dma, int multiple, uint64_t sectors, uint8_t *buffer) {
+    terminal_write(label);
+    ata_set_dma(dma);
+    ata_set_multiple(multiple);
+    ata_stats_t before;
+    ata_stats_t after;
+    ata_get_stats(&before);
+    for (uint64_t lba = 0; lba < sectors; lba += SHELL_ATABENCH_BATCH) {
+        uint16_t batch = (sectors - lba > SHELL_ATABENCH_BATCH) ? SHELL_ATABENCH_BATCH : (uint16_t)(sectors - lba);
+        if (ata_read_sectors(lba, batch, buffer) != 0) {
+            terminal_write_line("read failed.");
+            return;
+        }
+    }
+    ata_get_stats(&after);
+    if (dma && after.dma_errors != before.dma_errors) {
+        terminal_write_line("DMA failed, fell back to PIO.");
+        return;
+    }
+
+    uint64_t cycles = after.cycles - before.cycles;
+    uint64_t busy = cycles - (after.wait_cycles - before.wait_cycles);
+    uint64_t hz = fsbench_tsc_hz();
+    uint64_t kb_per_sec = (cycles && hz) ? sectors * 512 * hz / cycles / 1024 : 0;
+    print_uint64(kb_per_sec / 1024);
+    terminal_write(".");
+    print_uint64((kb_per_sec % 1024) * 10 / 1024);
+    terminal_write(" MB/s, CPU busy ");
+    print_uint64(cycles ? busy * 100 / cycles : 0);
+    terminal_write("%");
+    if (!dma) {
+        terminal_write(", ");
+        print_uint64(after.pio_blocks - before.pio_blocks);
+        terminal_write(" DRQ blocks");
+    }
+    terminal_write_line("");
+}
+
+#define SHELL_AHCIBENCH_READS   1024u
+#define SHELL_AHCIBENCH_SECTORS 8u
+
+/* Issues `reads` random 4 KiB reads through the device's request queue,
+ * a full queue at a time, and returns the TSC cycles taken, or 0 if a
+ * read failed or the device is smaller than one read. All reads land in
+ * one buffer: only the timing matters. */
+static uint64_t shell_queued_random_reads(blockdev_t *dev, uint32_t reads, uint8_t *buffer) {
+    static blockdev_io_t ios[BLOCKDEV_QUEUE_DEPTH];
+    uint64_t slots = dev->sector_count / SHELL_AHCIBENCH_SECTORS;
+    uint32_t seed = 12345;
+    uint64_t errors = dev->stats.errors;
+    if (slots == 0) {
+        return 0;
+    }
+
+    uint64_t begin = rdtsc();
+    for (uint32_t done = 0; done < reads;) {
+        uint32_t batch = (reads - done > BLOCKDEV_QUEUE_DEPTH) ? BLOCKDEV_QUEUE_DEPTH : reads - done;
+        for (uint32_t i = 0; i < batch; ++i) {
+            seed = seed * 1103515245u + 12345u;
+            ios[i].op = BLOCKDEV_READ;
+            ios[i].lba = (seed % slots) * SHELL_AHCIBENCH_SECTORS;
+            ios[i].count = SHELL_AHCIBENCH_SECTORS;
+            ios[i].buffer = buffer;
+            ios[i].callback = NULL;
+            ios[i].user_data = NULL;
+            blockdev_queue(dev, &ios[i]);
+        }
+        blockdev_unplug(dev);
+        done += batch;
+    }
+    uint64_t cycles = rdtsc() - begin;
+    return (dev->stats.errors == errors && cycles > 0) ? cycles : 0;
+}
+
+/* Prints random-read throughput at `depth` commands in flight. */
+static void shell_ahcibench_depth(blockdev_t *dev, uint32_t depth, uint32_t reads, uint8_t *buffer) {
+    ahci_set_queue_limit(depth);
+    uint64_t cycles = shell_queued_random_reads(dev, reads, buffer);
+    terminal_write("  QD ");
+    print_uint64_padded(depth, 2);
+    terminal_write(": ");
+    if (cycles == 0) {
+        terminal_write_line("read failed.");
+        return;
+    }
+    uint64_t hz = fsbench_tsc_hz();
+    uint64_t iops = (cycles && hz) ? (uint64_t)reads * hz / cycles : 0;
+    print_uint64_padded(iops, 7);
+    terminal_write(" IOPS, ");
+    uint64_t kb_per_sec = iops * SHELL_AHCIBENCH_SECTORS * 512 / 1024;
+    print_uint64(kb_per_sec / 1024);
+    terminal_write(".");
+    print_uint64((kb_per_sec % 1024) * 10 / 1024);
+    terminal_write_line(" MB/s");
+}
+
+static void shell_cmd_ahci(const char *args) {
+    char token[16];
+    const char *rest = shell_extract_token(args, token, sizeof(token));
+    if (!ahci_is_available()) {
+        terminal_write_line("No AHCI controller with SATA disks found.");
+        return;
+    }
+
+    if (strcmp(token, "ncq") == 0) {
+        shell_extract_token(rest, token, sizeof(token));
+        if (strcmp(token, "on") != 0 && strcmp(token, "off") != 0) {
+            terminal_write_line("Usage: ahci ncq on|off");
+            return;
+        }
+        if (ahci_set_ncq(token[1] == 'n') != 0) {
+            terminal_write_line("ahci: no disk supports NCQ.");
+            return;
+        }
+    } else if (strcmp(token, "bench") == 0) {
+        uint64_t reads = SHELL_AHCIBENCH_READS;
+        shell_extract_token(rest, token, sizeof(token));
+        if (token[0] != '\0' && (!shell_parse_uint64(token, &reads) || reads == 0 || reads > 0xFFFFFFFFu)) {
+            terminal_write_line("Usage: ahci bench [READS]");
+            return;
+        }
+        ahci_port_info_t info;
+        ahci_get_port_info(0, &info);
+        blockdev_t *dev = blockdev_find(info.name);
+        uint8_t *buffer = (uint8_t *)kmalloc(SHELL_AHCIBENCH_SECTORS * 512);
+        if (!dev || !buffer) {
+            terminal_write_line("ahci: out of memory.");
+            return;
+        }
+        if (dev->sector_count < SHELL_AHCIBENCH_SECTORS) {
+            terminal_write_line("ahci: disk is smaller than one 4 KiB read.");
+            kfree(buffer);
+            return;
+        }
+        uint32_t max_depth = ahci_ncq_enabled() ? info.queue_depth : 1;
+        uint32_t old_limit = ahci_queue_limit();
+        terminal_write("Random 4 KiB reads from ");
+        terminal_write(info.name);
+        terminal_write(", ");
+        print_uint64(reads);
+        terminal_write_line(ahci_ncq_enabled() && info.queue_depth > 1 ? " per queue depth (NCQ):"
+                                                                        : " (no NCQ, one command at a time):");
+        for (uint32_t depth = 1; depth <= max_depth; depth *= 2) {
+            shell_ahcibench_depth(dev, depth, (uint32_t)reads, buffer);
+        }
+        ahci_set_queue_limit(old_limit);
+        kfree(buffer);
+        return;
+    } else if (token[0] != '\0') {
+        terminal_write_line("Usage: ahci [ncq on|off|bench [READS]]");
+        return;
+    }
+
+    terminal_write_line("NAME          SECTORS  QUEUE  FUA  MODEL");
+    for (size_t i = 0; i < ahci_port_count(); ++i) {
+        ahci_port_info_t info;
+        ahci_get_port_info(i, &info);
+        terminal_write(info.name);
+        for (size_t len = strlen(info.name); len < 8; ++len) {
+            terminal_write(" ");
+        }
+        print_uint64_padded(info.sectors, 12);
+        print_uint64_padded(info.queue_depth, 7);
+        terminal_write(info.fua ? "  yes  " : "   no  ");
+        terminal_write_line(info.model[0] ? info.model : "(unknown)");
+    }
+    ahci_stats_t stats;
+    ahci_get_stats(&stats);
+    terminal_write("NCQ:        ");
+    terminal_write_line(ahci_ncq_enabled() ? "on" : "off");
+    terminal_write("Commands:   ");
+    print_uint64(stats.commands);
+    terminal_write(" (");
+    print_uint64(stats.ncq_commands);
+    terminal_write_line(" queued)");
+    terminal_write("Max active: ");
+    print_uint64(stats.max_active);
+    terminal_write_line("");
+    terminal_write("Errors:     ");
+    print_uint64(stats.errors);
+    terminal_write(", port restarts ");
+    print_uint64(stats.restarts);
+    terminal_write_line("");
+}
+
+#define SHELL_VIRTIOBENCH_SECTORS 8192u
+#define SHELL_VIRTIOBENCH_BATCH   256u
+
+/* Reads the first `sectors` sectors of `dev` in `batch`-sector transfers
+ * and returns the throughput in KiB/s, or 0 if a read failed. */
+static uint64_t shell_sequential_read_kbps(blockdev_t *dev, uint64_t sectors, uint32_t batch, uint8_t *buffer) {
+    uint64_t hz = fsbench_tsc_hz();
+    uint64_t begin = rdtsc();
+    for (uint64_t lba = 0; lba < sectors; lba += batch) {
+        uint32_t count = (sectors - lba > batch) ? batch : (uint32_t)(sectors - lba);
+        if (blockdev_read(dev, lba, count, buffer) != 0) {
+            return 0;
+        }
+    }
+    uint64_t cycles = rdtsc() - begin;
+    return (cycles && hz) ? sectors * 512 * hz / cycles / 1024 : 0;
+}
+
+static void shell_print_device_column(const char *name) {
+    terminal_write("  ");
+    terminal_write(name);
+    for (size_t len = strlen(name); len < 8; ++len) {
+        terminal_write(" ");
+    }
+}
+
+static void shell_print_mb_per_sec(uint64_t kb_per_sec) {
+    print_uint64_padded(kb_per_sec / 1024, 6);
+    terminal_write(".");
+    print_uint64((kb_per_sec % 1024) * 10 / 1024);
+    terminal_write(" MB/s");
+}
+
+/* Sequential reads in 128 KiB transfers, then queued random 4 KiB reads,
+ * on one device. */
+static void shell_virtiobench_device(blockdev_t *dev, uint64_t sectors, uint8_t *buffer) {
+    uint64_t hz = fsbench_tsc_hz();
+    if (sectors > dev->sector_count) {
+        sectors = dev->sector_count;
+    }
+    shell_print_device_column(dev->name);
+
+    uint64_t kb_per_sec = shell_sequential_read_kbps(dev, sectors, SHELL_VIRTIOBENCH_BATCH, buffer);
+    if (kb_per_sec == 0) {
+        terminal_write_line("read failed.");
+        return;
+    }
+    shell_print_mb_per_sec(kb_per_sec);
+    terminal_write(" sequential, ");
+
+    if (dev->sector_count < SHELL_AHCIBENCH_SECTORS) {
+        terminal_write_line("too small for random 4 KiB reads.");
+        return;
+    }
+    uint64_t cycles = shell_queued_random_reads(dev, SHELL_AHCIBENCH_READS, buffer);
+    if (cycles == 0) {
+        terminal_write_line("random reads failed.");
+        return;
+    }
+    print_uint64_padded(hz ? (uint64_t)SHELL_AHCIBENCH_READS * hz / cycles : 0, 7);
+    terminal_write_line(" IOPS random 4 KiB");
+}
+
+static void shell_cmd_virtio(const char *args) {
+    char token[16];
+    const char *rest = shell_extract_token(args, token, sizeof(token));
+    if (!virtio_blk_is_available()) {
+        terminal_write_line("No virtio block device found.");
+        return;
+    }
+
+    if (strcmp(token, "irq") == 0 || strcmp(token, "poll") == 0) {
+        virtio_blk_set_irq(token[0] == 'i');
+    } else if (strcmp(token, "bench") == 0) {
+        uint64_t sectors = SHELL_VIRTIOBENCH_SECTORS;
+        shell_extract_token(rest, token, sizeof(token));
+        if (token[0] != '\0' && (!shell_parse_uint64(token, &sectors) || sectors == 0)) {
+            terminal_write_line("Usage: virtio bench [SECTORS]");
+            return;
+        }
+        uint8_t *buffer = (uint8_t *)kmalloc(SHELL_VIRTIOBENCH_BATCH * 512);
+        if (!buffer) {
+            terminal_write_line("virtio: out of memory.");
+            return;
+        }
+        terminal_write("Reading ");
+        print_uint64(sectors);
+        terminal_write(" sectors, then ");
+        print_uint64(SHELL_AHCIBENCH_READS);
+        terminal_write_line(" random reads queued 64 at a time:");
+        shell_virtiobench_device(blockdev_find("virtio0"), sectors, buffer);
+        blockdev_t *ata = blockdev_find("ata0");
+        if (ata) {
+            shell_virtiobench_device(ata, sectors, buffer);
+        } else {
+            terminal_write_line("  ata0     not present.");
+        }
+        kfree(buffer);
+        return;
+    } else if (token[0] != '\0') {
+        terminal_write_line("Usage: virtio [irq|poll|bench [SECTORS]]");
+        return;
+    }
+
+    virtio_blk_stats_t stats;
+    virtio_blk_get_stats(&stats);
+    terminal_write("Queue size:  ");
+    print_uint64(virtio_blk_queue_size());
+    terminal_write_line(virtio_blk_indirect_enabled() ? " (indirect descriptors)" : " (3 descriptors per request)");
+    terminal_write("Completion:  ");
+    terminal_write_line(virtio_blk_irq_usable() ? "interrupt" : "polling");
+    terminal_write("Requests:    ");
+    print_uint64(stats.requests);
+    terminal_write(", in flight at most ");
+    print_uint64(stats.max_inflight);
+    terminal_write_line("");
+    terminal_write("Notifies:    ");
+    print_uint64(stats.notifies);
+    terminal_write_line("");
+    terminal_write("Interrupts:  ");
+    print_uint64(stats.irqs);
+    terminal_write_line("");
+    terminal_write("Errors:      ");
+    print_uint64(stats.errors);
+    terminal_write(", timeouts ");
+    print_uint64(stats.timeouts);
+    terminal_write_line("");
+}
+
+#define SHELL_RAIDBENCH_SECTORS 16384u
+#define SHELL_RAIDBENCH_BATCH   512u
+
+/* Sequential reads from every member alone, then from md0 with the same
+ * amount of data per member, so a perfect stripe reads n times as much
+ * in the time of its slowest member. */
+static void shell_raidbench(const raid0_info_t *info, uint64_t sectors) {
+    uint8_t *buffer = (uint8_t *)kmalloc(SHELL_RAIDBENCH_BATCH * 512);
+    if (!buffer) {
+        terminal_write_line("raid: out of memory.");
+        return;
+    }
+    terminal_write("Reading ");
+    print_uint64(sectors);
+    terminal_write(" sectors per disk in ");
+    print_uint64(SHELL_RAIDBENCH_BATCH / 2);
+    terminal_write_line(" KiB transfers:");
+
+    uint64_t slowest = 0;
+    for (size_t i = 0; i < info->members; ++i) {
+        blockdev_t *member = blockdev_find(info->member_names[i]);
+        uint64_t count = (sectors < member->sector_count) ? sectors : member->sector_count;
+        shell_print_device_column(member->name);
+        uint64_t kb_per_sec = shell_sequential_read_kbps(member, count, SHELL_RAIDBENCH_BATCH, buffer);
+        if (kb_per_sec == 0) {
+            terminal_write_line("read failed.");
+            kfree(buffer);
+            return;
+        }
+        shell_print_mb_per_sec(kb_per_sec);
+        terminal_write_line("");
+        if (slowest == 0 || kb_per_sec < slowest) {
+            slowest = kb_per_sec;
+        }
+    }
+
+    blockdev_t *md = blockdev_find(info->name);
+    uint64_t total = sectors * info->members;
+    if (total > md->sector_count) {
+        total = md->sector_count;
+    }
+    shell_print_device_column(md->name);
+    uint64_t kb_per_sec = shell_sequential_read_kbps(md, total, SHELL_RAIDBENCH_BATCH, buffer);
+    kfree(buffer);
+    if (kb_per_sec == 0) {
+        terminal_write_line("read failed.");
+        return;
+    }
+    shell_print_mb_per_sec(kb_per_sec);
+    uint64_t scale = kb_per_sec * 10 / slowest;
+    terminal_write(", x");
+    print_uint64(scale / 10);
+    terminal_write(".");
+    print_uint64(scale % 10);
+    terminal_write_line(" the slowest disk");
+}
+
+static void shell_cmd_raid(const char *args) {
+    char token[BLOCKDEV_NAME_LEN];
+    const char *rest = shell_extract_token(args, token, sizeof(token));
+    raid0_info_t info;
+
+    if (strcmp(token, "create") == 0) {
+        static char names[RAID0_MAX_MEMBERS][BLOCKDEV_NAME_LEN];
+        const char *members[RAID0_MAX_MEMBERS];
+        uint64_t chunk = RAID0_DEFAULT_CHUNK;
+        size_t count = 0;
+        rest = shell_extract_token(rest, token, sizeof(token));
+        if (strcmp(token, "-c") == 0) {
+            rest = shell_extract_token(rest, token, sizeof(token));
+            if (!shell_parse_uint64(token, &chunk) || chunk == 0 || chunk > 65536) {
+                terminal_write_line("Usage: raid create [-c SECTORS] DEV DEV [DEV...]");
+                return;
+            }
+            rest = shell_extract_token(rest, token, sizeof(token));
+        }
+        while (token[0] != '\0' && count < RAID0_MAX_MEMBERS) {
+            const char *mounted = fs_mounted_device();
+            if (mounted && strcmp(token, mounted) == 0) {
+                terminal_write("raid: ");
+                terminal_write(token);
+                terminal_write_line(" holds the mounted filesystem.");
+                return;
+            }
+            memcpy(names[count], token, sizeof(token));
+            members[count] = names[count];
+            ++count;
+            rest = shell_extract_token(rest, token, sizeof(token));
+        }
+        if (count < 2 || token[0] != '\0') {
+            terminal_write_line("Usage: raid create [-c SECTORS] DEV DEV [DEV...]");
+            return;
+        }
+        if (raid0_create(members, count, (uint32_t)chunk) != 0) {
+            terminal_write_line("raid: cannot create md0 (already exists, unknown device, or chunk too large).");
+            return;
+        }
+    } else if (strcmp(token, "bench") == 0) {
+        uint64_t sectors = SHELL_RAIDBENCH_SECTORS;
+        shell_extract_token(rest, token, sizeof(token));
+        if (token[0] != '\0' && (!shell_parse_uint64(token, &sectors) || sectors == 0)) {
+            terminal_write_line("Usage: raid bench [SECTORS]");
+            return;
+        }
+        if (raid0_get_info(&info) != 0) {
+            terminal_write_line("No RAID-0 array. Create one with: raid create DEV DEV");
+            return;
+        }
+        shell_raidbench(&info, sectors);
+        return;
+    } else if (token[0] != '\0') {
+        terminal_write_line("Usage: raid [create [-c SECTORS] DEV DEV [DEV...]|bench [SECTORS]]");
+        return;
+    }
+
+    if (raid0_get_info(&info) != 0) {
+        terminal_write_line("No RAID-0 array. Create one with: raid create DEV DEV");
+        return;
+    }
+    terminal_write(info.name);
+    terminal_write(": RAID-0 over");
+    for (size_t i = 0; i < info.members; ++i) {
+        terminal_write(" ");
+        terminal_write(info.member_names[i]);
+    }
+    terminal_write_line("");
+    terminal_write("Chunk:       ");
+    print_uint64(info.chunk_sectors);
+    terminal_write_line(" sectors");
+    terminal_write("Capacity:    ");
+    print_uint64(info.sectors);
+    terminal_write_line(" sectors");
+    terminal_write("Transfers:   ");
+    print_uint64(info.pieces);
+    terminal_write(", started while another disk was busy: ");
+    print_uint64(info.overlapped);
+    terminal_write_line("");
+}
+
+static void shell_cmd_atadma(const char *args) {
+    char token[16];
+    const char *rest = shell_extract_token(args, token, sizeof(token));
+    if (!ata_is_available()) {
+        terminal_write_line("ATA disk not available.");
+        return;
+    }
+
+    if (strcmp(token, "on") == 0 || strcmp(token, "off") == 0) {
+        if (ata_set_dma(token[1] == 'n') != 0) {
+            terminal_write_line("atadma: no bus-master IDE controller found.");
+            return;
+        }
+    } else if (strcmp(token, "irq") == 0 || strcmp(token, "poll") == 0) {
+        ata_set_irq(token[0] == 'i');
+    } else if (strcmp(token, "bench") == 0) {
+        uint64_t sectors = SHELL_ATABENCH_SECTORS;
+        shell_extract_token(rest, token, sizeof(token));
+        if (token[0] != '\0' && (!shell_parse_uint64(token, &sectors) || sectors == 0)) {
+            terminal_write_line("Usage: atadma bench [SECTORS]");
+            return;
+        }
+        if (sectors > ata_get_total_sectors()) {
+            sectors = ata_get_total_sectors();
+        }
+        uint8_t *buffer = (uint8_t *)kmalloc(SHELL_ATABENCH_BATCH * 512);
+        if (!buffer) {
+            terminal_write_line("atadma: out of memory.");
+            return;
+        }
+        int was_dma = ata_dma_enabled();
+        int was_multiple = ata_multiple_sectors() > 1;
+        terminal_write("Reading ");
+        print_uint64(sectors);
+        terminal_write(" sectors in 128 KiB transfers, ");
+        terminal_write_line(ata_irq_enabled() ? "interrupt completion:" : "polled completion:");
+        shell_atabench_mode("  PIO:          ", 0, 0, sectors, buffer);
+        if (ata_set_multiple(1) == 0) {
+            terminal_write("  PIO multiple: ");
+            print_uint64(ata_multiple_sectors());
+            terminal_write(" sectors/DRQ, ");
+            shell_atabench_mode("", 0, 1, sectors, buffer);
+        } else {
+            terminal_write_line("  PIO multiple: not supported.");
+        }
+        if (ata_dma_available()) {
+            shell_atabench_mode("  DMA:          ", 1, was_multiple, sectors, buffer);
+        } else {
+            terminal_write_line("  DMA:          not available.");
+        }
+        ata_set_dma(was_dma && ata_dma_available());
+        ata_set_multiple(was_multiple);
+        kfree(buffer);
+        return;
+    } else if (token[0] != '\0') {
+        terminal_write_line("Usage: atadma [on|off|irq|poll|bench [SECTORS]]");
+        return;
+    }
+
+    terminal_write("Transfer mode: ");
+    terminal_write_line(ata_dma_enabled() ? "DMA" : "PIO");
+    terminal_write("Completion:    ");
+    terminal_write_line(ata_irq_enabled() ? "interrupt (IRQ14/IRQ15)" : "polling");
+    terminal_write("PIO block:     ");
+    print_uint64(ata_multiple_sectors());
+    terminal_write_line(ata_multiple_sectors() > 1 ? " sectors (READ/WRITE MULTIPLE)" : " sector");
+    ata_stats_t stats;
+    ata_get_stats(&stats);
+    terminal_write("PIO commands: ");
+    print_uint64(stats.pio_commands);
+    terminal_write_line("");
+    terminal_write("PIO blocks:   ");
+    print_uint64(stats.pio_blocks);
+    terminal_write_line("");
+    terminal_write("DMA commands: ");
+    print_uint64(stats.dma_commands);
+    terminal_write_line("");
+    terminal_write("DMA errors:   ");
+    print_uint64(stats.dma_errors);
+    terminal_write_line("");
+    terminal_write("EXT commands: ");
+    print_uint64(stats.ext_commands);
+    terminal_write_line("");
+    terminal_write("Interrupts:   ");
+    print_uint64(stats.irqs);
+    terminal_write_line("");
+    terminal_write("Timeouts:     ");
+    print_uint64(stats.timeouts);
+    terminal_write_line("");
+}
+
+static void shell_print_usage_line(const fs_usage_t *usage, const char *name, int is_directory) {
+    terminal_write("  ");
+    print_uint64(usage->bytes);
+    terminal_write(" bytes  ");
+    terminal_write(name);
+    terminal_write_line(is_directory ? "/" : "");
+}
+
+static void shell_du_callback(const fs_dir_entry_t *entry, void *user_data) {
+    const char *base = (const char *)user_data;
+    char path[FS_MAX_PATH_LEN];
+    size_t base_len = base ? strlen(base) : 0;
+    size_t name_len = strlen(entry->name);
+    if (base_len + 1 + name_len >= sizeof(path)) {
+        return;
+    }
+
+    size_t pos = 0;
+    if (base_len > 0) {
+        memcpy(path, base, base_len);
+        pos = base_len;
+        path[pos++] = '/';
+    }
+    memcpy(&path[pos], entry->name, name_len + 1);
+
+    fs_usage_t usage;
+    if (fs_get_usage(path, &usage) == FS_OK) {
+        shell_print_usage_line(&usage, entry->name, entry->is_directory);
+    }
+}
+
+static void shell_cmd_du(const char *args) {
+    char token[FS_MAX_PATH_LEN];
+    const char *rest = shell_extract_token(args, token, sizeof(token));
+    int summary = 0;
+
+    if (strcmp(token, "-s") == 0) {
+        summary = 1;
+        rest = shell_extract_token(rest, token, sizeof(token));
+    }
+    const char *path = token[0] ? token : NULL;
+
+    fs_usage_t usage;
+    fs_status_t status = fs_get_usage(path, &usage);
+    if (status != FS_OK) {
+        shell_print_fs_error(status);
+        return;
+    }
+
+    if (!summary && fs_is_dir(path)) {
+        fs_list_dir(path, shell_du_callback, (void *)path);
+    }
+    terminal_write("Total: ");
+    print_uint64(usage.bytes);
+    terminal_write(" bytes in ");
+    print_uint64(usage.files);
+    terminal_write(" files, ");
+    print_uint64(usage.directories);
+    terminal_write_line(" directories");
+}
+
+static void shell_search_callback(const char *path, void *user_data) {
+    (void)user_data;
+    terminal_write("  ");
+    terminal_write_line(path);
+}
+
+static void shell_cmd_search(const char *args) {
+    const char *text = shell_skip_spaces(args);
+    if (!text || *text == '\0') {
+        terminal_write_line("Usage: search TEXT");
+        return;
+    }
+
+    fs_search_result_t result;
+    uint64_t start = rdtsc();
+    fs_status_t status = fs_search(text, shell_search_callback, NULL, &result);
+    uint64_t cycles = rdtsc() - start;
+    if (status != FS_OK) {
+        shell_print_fs_error(status);
+        return;
+    }
+
+    print_uint64(result.matches);
+    terminal_write(" matching files (");
+    print_uint64(result.candidates);
+    terminal_write(" candidates) in ");
+    uint64_t hz = fsbench_tsc_hz();
+    if (hz == 0) {
+        print_uint64(cycles);
+        terminal_write_line(" cycles");
+        return;
+    }
+    print_uint64(fsbench_cycles_to_ns(cycles, hz));
+    terminal_write_line(" ns");
+}
+
+static void shell_print_fsbench_result(fsbench_workload_t workload, const fsbench_result_t *result,
+                                       int machine) {
+    const char *name = fsbench_workload_name(workload);
+    if (machine) {
+        terminal_write("fsbench workload=");
+        terminal_write(name);
+        terminal_write(" status=");
+        terminal_write(result->status == FS_OK ? "ok" : "error");
+        terminal_write(" ops=");
+        print_uint64(result->ops);
+        terminal_write(" bytes=");
+        print_uint64(result->bytes);
+        terminal_write(" total_ns=");
+        print_uint64(result->total_ns);
+        terminal_write(" ops_per_sec=");
+        print_uint64(result->ops_per_sec);
+        terminal_write(" p50_ns=");
+        print_uint64(result->p50_ns);
+        terminal_write(" p90_ns=");
+        print_uint64(result->p90_ns);
+        terminal_write(" p99_ns=");
+        print_uint64(result->p99_ns);
+        terminal_write(" max_ns=");
+        print_uint64(result->max_ns);
+        terminal_write_line("");
+        return;
+    }
+
+    terminal_write(name);
+    for (size_t len = strlen(name); len < 10; ++len) {
+        terminal_write(" ");
+    }
+    if (result->status != FS_OK) {
+        shell_print_fs_error(result->status);
+        return;
+    }
+    print_uint64_padded(result->ops, 6);
+    print_uint64_padded(result->ops_per_sec, 10);
+    print_uint64_padded(result->p50_ns, 10);
+    print_uint64_padded(result->p90_ns, 10);
+    print_uint64_padded(result->p99_ns, 10);
+    print_uint64_padded(result->max_ns, 11);
+    terminal_write_line("");
+}
+
+static void shell_cmd_fsbench(const char *args) {
+    char token[16];
+    int machine = 0;
+    uint64_t ops = 0;
+    uint32_t selected = 0;
+    const char *rest = args;
+
+    while (1) {
+        rest = shell_extract_token(rest, token, sizeof(token));
+        if (token[0] == '\0') {
+            break;
+        }
+        if (strcmp(token, "-m") == 0) {
+            machine = 1;
+        } else if (strcmp(token, "-n") == 0) {
+            rest = shell_extract_token(rest, token, sizeof(token));
+            if (!shell_parse_uint64(token, &ops) || ops == 0 || ops > FSBENCH_MAX_OPS) {
+                terminal_write_line("fsbench: -n expects 1..4096");
+                return;
+            }
+        } else if (strcmp(token, "all") == 0) {
+            selected = (1u << FSBENCH_WORKLOAD_COUNT) - 1;
+        } else {
+            int workload = fsbench_find_workload(token);
+            if (workload < 0) {
+                terminal_write_line("Usage: fsbench [-m] [-n OPS] [all|create|lookup|remove|deep|append|seqwrite|roundtrip ...]");
+                return;
+            }
+            selected |= 1u << workload;
+        }
+    }
+    if (selected == 0) {
+        /* The round trip rewrites the disk image, so it only runs on request. */
+        selected = ((1u << FSBENCH_WORKLOAD_COUNT) - 1) & ~(1u << FSBENCH_ROUNDTRIP);
+    }
+    if (!fs_persistence_available()) {
+        selected &= ~(1u << FSBENCH_ROUNDTRIP);
+    }
+
+    uint64_t hz = fsbench_tsc_hz();
+    if (machine) {
+        terminal_write("fsbench tsc_hz=");
+        print_uint64(hz);
+        terminal_write_line("");
+    } else {
+        terminal_write("TSC: ");
+        print_uint64(hz / 1000000);
+        terminal_write_line(" MHz");
+        terminal_write_line("workload     ops     ops/s    p50 ns    p90 ns    p99 ns     max ns");
+    }
+
+    for (int workload = 0; workload < FSBENCH_WORKLOAD_COUNT; ++workload) {
+        if (!(selected & (1u << workload))) {
+            continue;
+        }
+        fsbench_result_t result;
+        uint32_t count = ops ? (uint32_t)ops : fsbench_default_ops((fsbench_workload_t)workload);
+        fsbench_run((fsbench_workload_t)workload, count, &result);
+        shell_print_fsbench_result((fsbench_workload_t)workload, &result, machine);
+    }
+}
+
+static void shell_print_diskbench_histogram(const diskbench_result_t *result) {
+    uint32_t peak = 0;
+    for (uint32_t i = 0; i < DISKBENCH_BUCKETS; ++i) {
+        if (result->histogram[i] > peak) {
+            peak = result->histogram[i];
+        }
+    }
+    for (uint32_t i = 0; i < DISKBENCH_BUCKETS && peak > 0; ++i) {
+        if (result->histogram[i] == 0) {
+            continue;
+        }
+        if (i + 1 < DISKBENCH_BUCKETS) {
+            terminal_write("    < ");
+            print_uint64_padded(1ull << i, 6);
+        } else {
+            terminal_write("   >= ");
+            print_uint64_padded(1ull << (i - 1), 6);
+        }
+        terminal_write(" us");
+        print_uint64_padded(result->histogram[i], 6);
+        terminal_write(" ");
+        for (uint32_t bar = 0; bar < (result->histogram[i] * 40 + peak - 1) / peak; ++bar) {
+            terminal_write("#");
+        }
+        terminal_write_line("");
+    }
+}
+
+static void shell_print_diskbench_result(diskbench_pattern_t pattern, const diskbench_result_t *result,
+                                         int machine, int histogram) {
+    const char *name = diskbench_pattern_name(pattern);
+    if (machine) {
+        terminal_write("diskbench pattern=");
+        terminal_write(name);
+        terminal_write(" status=");
+        terminal_write(result->status == 0 ? "ok" : "error");
+        terminal_write(" ops=");
+        print_uint64(result->ops);
+        terminal_write(" block_sectors=");
+        print_uint64(result->block_sectors);
+        terminal_write(" bytes=");
+        print_uint64(result->bytes);
+        terminal_write(" total_ns=");
+        print_uint64(result->total_ns);
+        terminal_write(" iops=");
+        print_uint64(result->iops);
+        terminal_write(" kb_per_sec=");
+        print_uint64(result->kb_per_sec);
+        terminal_write(" p50_ns=");
+        print_uint64(result->p50_ns);
+        terminal_write(" p99_ns=");
+        print_uint64(result->p99_ns);
+        terminal_write(" max_ns=");
+        print_uint64(result->max_ns);
+        terminal_write_line("");
+        return;
+    }
+
+    terminal_write(name);
+    for (size_t len = strlen(name); len < 10; ++len) {
+        terminal_write(" ");
+    }
+    if (result->status != 0) {
+        terminal_write_line("I/O error");
+        return;
+    }
+    print_uint64_padded(result->ops, 6);
+    print_uint64_padded(result->block_sectors / 2, 6);
+    print_uint64_padded(result->kb_per_sec / 1024, 7);
+    terminal_write(".");
+    print_uint64((result->kb_per_sec % 1024) * 10 / 1024);
+    print_uint64_padded(result->iops, 8);
+    print_uint64_padded(result->p50_ns / 1000, 9);
+    print_uint64_padded(result->p99_ns / 1000, 9);
+    print_uint64_padded(result->max_ns / 1000, 10);
+    terminal_write_line("");
+    if (histogram) {
+        shell_print_diskbench_histogram(result);
+    }
+}
+
+static void shell_cmd_diskbench(const char *args) {
+    static const char *usage =
+        "Usage: diskbench [-m] [-h] [-d DEV] [-b KB] [-q DEPTH] [-n OPS] [all|seqread|seqwrite|randread|randwrite ...]";
+    char token[BLOCKDEV_NAME_LEN];
+    int machine = 0;
+    int histogram = 0;
+    uint64_t block_kb = 0;
+    uint64_t depth = 1;
+    uint64_t ops = 0;
+    uint32_t selected = 0;
+    const char *device = fs_mounted_device();
+    char device_name[BLOCKDEV_NAME_LEN];
+    const char *rest = args;
+
+    while (1) {
+        rest = shell_extract_token(rest, token, sizeof(token));
+        if (token[0] == '\0') {
+            break;
+        }
+        if (strcmp(token, "-m") == 0) {
+            machine = 1;
+        } else if (strcmp(token, "-h") == 0) {
+            histogram = 1;
+        } else if (strcmp(token, "-d") == 0) {
+            rest = shell_extract_token(rest, device_name, sizeof(device_name));
+            device = device_name;
+        } else if (strcmp(token, "-b") == 0) {
+            rest = shell_extract_token(rest, token, sizeof(token));
+            if (!shell_parse_uint64(token, &block_kb) || block_kb == 0 || block_kb > 256) {
+                terminal_write_line("diskbench: -b expects 1..256 KiB");
+                return;
+            }
+        } else if (strcmp(token, "-q") == 0) {
+            rest = shell_extract_token(rest, token, sizeof(token));
+            if (!shell_parse_uint64(token, &depth) || depth == 0 || depth > DISKBENCH_MAX_DEPTH) {
+                terminal_write_line("diskbench: -q expects 1..32");
+                return;
+            }
+        } else if (strcmp(token, "-n") == 0) {
+            rest = shell_extract_token(rest, token, sizeof(token));
+            if (!shell_parse_uint64(token, &ops) || ops == 0 || ops > DISKBENCH_MAX_OPS) {
+                terminal_write_line("diskbench: -n expects 1..4096");
+                return;
+            }
+        } else if (strcmp(token, "all") == 0) {
+            selected = (1u << DISKBENCH_PATTERN_COUNT) - 1;
+        } else {
+            int pattern = diskbench_find_pattern(token);
+            if (pattern < 0) {
+                terminal_write_line(usage);
+                return;
+            }
+            selected |= 1u << pattern;
+        }
+    }
+    if (selected == 0) {
+        selected = (1u << DISKBENCH_PATTERN_COUNT) - 1;
+    }
+
+    blockdev_t *dev = blockdev_find(device ? device : "ata0");
+    uint64_t first = 0;
+    uint64_t span = 0;
+    if (!dev) {
+        terminal_write_line("diskbench: no such device (see lsblk).");
+        return;
+    }
+    if (diskbench_scratch_range(dev, &first, &span) != 0) {
+        terminal_write_line("diskbench: the device has no room past the filesystem image.");
+        return;
+    }
+    if (block_kb * 2 > dev->max_transfer || block_kb * 1024 * depth > DISKBENCH_MAX_BYTES) {
+        terminal_write_line("diskbench: block too large for the device, or block x depth over 512 KiB.");
+        return;
+    }
+
+    uint64_t hz = fsbench_tsc_hz();
+    if (machine) {
+        terminal_write("diskbench device=");
+        terminal_write(dev->name);
+        terminal_write(" depth=");
+        print_uint64(depth);
+        terminal_write(" scratch_lba=");
+        print_uint64(first);
+        terminal_write(" scratch_sectors=");
+        print_uint64(span);
+        terminal_write(" tsc_hz=");
+        print_uint64(hz);
+        terminal_write_line("");
+    } else {
+        terminal_write(dev->name);
+        terminal_write(": scratch LBA ");
+        print_uint64(first);
+        terminal_write("..");
+        print_uint64(first + span - 1);
+        terminal_write(", queue depth ");
+        print_uint64(depth);
+        terminal_write(", TSC ");
+        print_uint64(hz / 1000000);
+        terminal_write_line(" MHz");
+        terminal_write_line("pattern      ops    KB     MB/s    IOPS   p50 us   p99 us    max us");
+    }
+
+    for (int pattern = 0; pattern < DISKBENCH_PATTERN_COUNT; ++pattern) {
+        if (!(selected & (1u << pattern))) {
+            continue;
+        }
+        diskbench_config_t config;
+        config.dev = dev;
+        config.pattern = (diskbench_pattern_t)pattern;
+        config.block_sectors = (uint32_t)block_kb * 2;
+        config.depth = (uint32_t)depth;
+        config.ops = ops ? (uint32_t)ops : diskbench_default_ops((diskbench_pattern_t)pattern);
+        diskbench_result_t result;
+        diskbench_run(&config, &result);
+        shell_print_diskbench_result((diskbench_pattern_t)pattern, &result, machine, histogram);
+    }
+}
+
+static void shell_cmd_index(const char *args) {
+    char token[FS_MAX_PATH_LEN];
+    const char *rest = shell_extract_token(args, token, sizeof(token));
+
+    if (token[0] != '\0') {
+        int enable = (strcmp(token, "on") == 0);
+        if (!enable && strcmp(token, "off") != 0) {
+            terminal_write_line("Usage: index [on|off [PATH]]");
+            return;
+        }
+        shell_extract_token(rest, token, sizeof(token));
+        fs_status_t status = fs_set_search_indexing(token[0] ? token : NULL, enable);
+        if (status != FS_OK) {
+            shell_print_fs_error(status);
+            return;
+        }
+    }
+
+    fs_search_stats_t stats;
+    fs_get_search_stats(&stats);
+    terminal_write("Indexing here: ");
+    terminal_write_line(fs_search_indexing_enabled(NULL) ? "on" : "off");
+    terminal_write("Indexed files: ");
+    print_uint64(stats.indexed_files);
+    if (stats.incomplete_files > 0) {
+        terminal_write(" (");
+        print_uint64(stats.incomplete_files);
+        terminal_write(" always scanned)");
+    }
+    terminal_write_line("");
+    terminal_write("Trigrams:      ");
+    print_uint64(stats.trigrams);
+    terminal_write(" (");
+    print_uint64(stats.postings);
+    terminal_write_line(" postings)");
+    terminal_write("Index memory:  ");
+    print_uint64(stats.memory_bytes);
+    terminal_write_line(" bytes");
+}
+
+static void shell_cmd_dedupstat(void) {
+    fs_dedup_stats_t stats;
+    fs_get_dedup_stats(&stats);
+
+    terminal_write("Logical:  ");
+    print_uint64(stats.logical_bytes);
+    terminal_write(" bytes in ");
+    print_uint64(stats.chunk_refs);
+    terminal_write_line(" chunk references");
+    terminal_write("Physical: ");
+    print_uint64(stats.physical_bytes);
+    terminal_write(" bytes in ");
+    print_uint64(stats.chunk_count);
+    terminal_write_line(" unique chunks");
+    if (stats.physical_bytes > 0) {
+        uint64_t ratio = (uint64_t)stats.logical_bytes * 100 / stats.physical_bytes;
+        terminal_write("Ratio:    ");
+        print_uint64(ratio / 100);
+        terminal_write(".");
+        if (ratio % 100 < 10) {
+            terminal_write("0");
+        }
+        print_uint64(ratio % 100);
+        terminal_write_line("x");
     }
-    terminal_write_line(args);
 }
 
-static void shell_cmd_pwd(void) {
-    char path[FS_MAX_PATH_LEN];
-    fs_get_cwd(path, sizeof(path));
-    terminal_write_line(path);
-}
+static void shell_cmd_cache(const char *args) {
+    char token[16];
+    shell_extract_token(args, token, sizeof(token));
+    if (token[0] != '\0') {
+        if (strcmp(token, "drop") != 0) {
+            terminal_write_line("Usage: cache [drop]");
+            return;
+        }
+        terminal_write("Evicted ");
+        print_uint64(fs_cache_drop());
+        terminal_write_line(" bytes.");
+    }
 
-static void shell_ls_callback(const fs_dir_entry_t *entry, void *user_data) {
-    (void)user_data;
-    if (entry->is_directory) {
-        terminal_write("[DIR] ");
-    } else {
-        terminal_write("      ");
+    fs_cache_stats_t stats;
+    fs_get_cache_stats(&stats);
+    terminal_write("Resident:  ");
+    print_uint64(stats.resident_bytes);
+    terminal_write_line(" bytes");
+    terminal_write("Evicted:   ");
+    print_uint64(stats.evicted_bytes);
+    terminal_write_line(" bytes");
+    terminal_write("Hits:      ");
+    print_uint64(stats.hits);
+    terminal_write_line("");
+    terminal_write("Misses:    ");
+    print_uint64(stats.misses);
+    terminal_write_line("");
+    terminal_write("Evictions: ");
+    print_uint64(stats.evictions);
+    terminal_write_line("");
+    if (fs_cache_writeback_wanted()) {
+        terminal_write_line("Memory is low and unsaved data cannot be evicted; run savefs.");
     }
-    terminal_write(entry->name);
-    if (!entry->is_directory) {
-        terminal_write("  ");
-        print_uint64(entry->size);
-        terminal_write(" bytes");
+}
+
+static void shell_cmd_bcache(const char *args) {
+    char token[16];
+    shell_extract_token(args, token, sizeof(token));
+    if (token[0] != '\0') {
+        int drop = (strcmp(token, "drop") == 0);
+        if (!drop && strcmp(token, "sync") != 0) {
+            terminal_write_line("Usage: bcache [sync|drop]");
+            return;
+        }
+        if (bcache_sync(NULL) != 0) {
+            terminal_write_line("bcache: write-back failed.");
+        } else if (drop) {
+            bcache_invalidate(NULL);
+        }
     }
+
+    bcache_stats_t stats;
+    bcache_get_stats(&stats);
+    uint64_t lookups = stats.hits + stats.misses;
+    terminal_write("Blocks:     ");
+    print_uint64(stats.cached);
+    terminal_write(" / ");
+    print_uint64(stats.blocks);
+    terminal_write_line("");
+    terminal_write("Dirty:      ");
+    print_uint64(stats.dirty);
+    terminal_write_line("");
+    terminal_write("Hits:       ");
+    print_uint64(stats.hits);
+    terminal_write_line("");
+    terminal_write("Misses:     ");
+    print_uint64(stats.misses);
+    terminal_write_line("");
+    terminal_write("Hit ratio:  ");
+    print_uint64(lookups ? stats.hits * 100 / lookups : 0);
+    terminal_write_line("%");
+    terminal_write("Bypassed:   ");
+    print_uint64(stats.bypassed);
+    terminal_write_line("");
+    terminal_write("Writebacks: ");
+    print_uint64(stats.writebacks);
+    terminal_write_line("");
+    terminal_write("Evictions:  ");
+    print_uint64(stats.evictions);
+    terminal_write_line("");
+    terminal_write("Read-ahead: ");
+    print_uint64(stats.ra_requests);
+    terminal_write(" requests, ");
+    print_uint64(stats.ra_sectors);
+    terminal_write_line(" sectors");
+    terminal_write("  used:     ");
+    print_uint64(stats.ra_hits);
+    terminal_write(" (");
+    print_uint64(stats.ra_sectors ? stats.ra_hits * 100 / stats.ra_sectors : 0);
+    terminal_write_line("%)");
+    terminal_write("  wasted:   ");
+    print_uint64(stats.ra_wasted);
+    terminal_write_line("");
+    terminal_write("  waits:    ");
+    print_uint64(stats.ra_waits);
     terminal_write_line("");
 }
 
-static void shell_cmd_ls(const char *args) {
-    const char *path = shell_skip_spaces(args);
-    if (path && *path == '\0') {
-        path = NULL;
+static void shell_print_pci_bars(const pci_device_info_t *info) {
+    for (size_t i = 0; i < PCI_MAX_BARS; ++i) {
+        const pci_bar_info_t *bar = &info->bars[i];
+        if (bar->size == 0) {
+            continue;
+        }
+        terminal_write("           BAR");
+        print_uint64(i);
+        terminal_write(bar->io ? "  io    0x" : (bar->is64 ? "  mem64 0x" : "  mem32 0x"));
+        print_hex_digits(bar->base, bar->is64 ? 16 : 8);
+        terminal_write("  ");
+        if (bar->size >= 1024 * 1024) {
+            print_uint64(bar->size / (1024 * 1024));
+            terminal_write(" MiB");
+        } else if (bar->size >= 1024) {
+            print_uint64(bar->size / 1024);
+            terminal_write(" KiB");
+        } else {
+            print_uint64(bar->size);
+            terminal_write(" B");
+        }
+        terminal_write_line(bar->prefetchable ? ", prefetchable" : "");
     }
-    fs_status_t status = fs_list_dir(path, shell_ls_callback, NULL);
-    if (status == FS_OK) {
+    if (info->has_msi || info->has_msix) {
+        terminal_write("           caps:");
+        terminal_write(info->has_msi ? " MSI" : "");
+        terminal_write_line(info->has_msix ? " MSI-X" : "");
+    }
+}
+
+/* One line per PCI function: address, IDs, class, the driver that
+ * claimed it and how it interrupts; -v adds BARs and MSI capabilities. */
+static void shell_cmd_lspci(const char *args) {
+    char token[16];
+    shell_extract_token(args, token, sizeof(token));
+    int verbose = strcmp(token, "-v") == 0;
+    if (token[0] != '\0' && !verbose) {
+        terminal_write_line("Usage: lspci [-v]");
         return;
     }
-    if (status == FS_ERR_NOENT) {
-        terminal_write_line("ls: path not found.");
-    } else if (status == FS_ERR_NOTDIR) {
-        terminal_write_line("ls: not a directory.");
+
+    uint64_t ecam = 0;
+    uint8_t start_bus = 0;
+    uint8_t end_bus = 0;
+    if (pci_get_ecam(&ecam, &start_bus, &end_bus) == 0) {
+        terminal_write("Config space: ECAM at 0x");
+        print_hex_digits(ecam, ecam >> 32 ? 16 : 8);
+        terminal_write(", buses ");
+        print_uint64(start_bus);
+        terminal_write("-");
+        print_uint64(end_bus);
+        terminal_write_line("");
     } else {
-        shell_print_fs_error(status);
+        terminal_write_line("Config space: ports 0xCF8/0xCFC");
+    }
+
+    terminal_write_line("BDF      ID         CLASS     DRIVER      IRQ");
+    for (size_t i = 0; i < pci_device_count(); ++i) {
+        pci_device_info_t info;
+        pci_get_device_info(i, &info);
+        const pci_device_t *dev = &info.device;
+        print_hex_digits(dev->bus, 2);
+        terminal_write(":");
+        print_hex_digits(dev->slot, 2);
+        terminal_write(".");
+        print_hex_digits(dev->function, 1);
+        terminal_write("  ");
+        print_hex_digits(dev->vendor_id, 4);
+        terminal_write(":");
+        print_hex_digits(dev->device_id, 4);
+        terminal_write("  ");
+        print_hex_digits(dev->class_code, 2);
+        terminal_write(".");
+        print_hex_digits(dev->subclass, 2);
+        terminal_write(".");
+        print_hex_digits(dev->prog_if, 2);
+        terminal_write("  ");
+        const char *driver = info.driver ? info.driver : "-";
+        terminal_write(driver);
+        for (size_t len = strlen(driver); len < 12; ++len) {
+            terminal_write(" ");
+        }
+        if (info.irq_mode != PCI_IRQ_INTX) {
+            terminal_write(info.irq_mode == PCI_IRQ_MSI ? "MSI" : "MSI-X");
+            for (size_t v = 0; v < info.vector_count; ++v) {
+                terminal_write(" 0x");
+                print_hex_digits(info.vectors[v], 2);
+            }
+            terminal_write_line("");
+        } else if (info.interrupt_pin >= 1 && info.interrupt_pin <= 4) {
+            char pin[] = "INTA# line ";
+            pin[3] = (char)('A' + info.interrupt_pin - 1);
+            terminal_write(pin);
+            print_uint64(info.interrupt_line);
+            terminal_write_line("");
+        } else {
+            terminal_write_line("-");
+        }
+        if (verbose) {
+            shell_print_pci_bars(&info);
+        }
     }
 }
 
-static void shell_cmd_cd(const char *args) {
-    const char *path = shell_skip_spaces(args);
-    if (!path || *path == '\0') {
-        path = "/";
+static void shell_cmd_lsblk(void) {
+    const char *mounted = fs_mounted_device();
+    terminal_write_line("NAME      DRIVER    SECTORS      SIZE KB     READS    WRITES");
+    for (size_t i = 0; i < blockdev_count(); ++i) {
+        const blockdev_t *dev = blockdev_get(i);
+        terminal_write(dev->name);
+        for (size_t len = strlen(dev->name); len < 10; ++len) {
+            terminal_write(" ");
+        }
+        terminal_write(dev->driver);
+        for (size_t len = strlen(dev->driver); len < 8; ++len) {
+            terminal_write(" ");
+        }
+        print_uint64_padded(dev->sector_count, 9);
+        print_uint64_padded(dev->sector_count * dev->sector_size / 1024, 12);
+        print_uint64_padded(dev->stats.reads, 10);
+        print_uint64_padded(dev->stats.writes, 10);
+        if (mounted && strcmp(mounted, dev->name) == 0) {
+            terminal_write("  [mounted]");
+        }
+        terminal_write_line("");
     }
-    fs_status_t status = fs_change_dir(path);
-    if (status != FS_OK) {
-        shell_print_fs_error(status);
+}
+
+static void shell_cmd_iostat(void) {
+    terminal_write_line("NAME        QUEUED    MERGED  DISPATCH  AVG SECT  MAX DEPTH  DEPTH  IN FLIGHT");
+    for (size_t i = 0; i < blockdev_count(); ++i) {
+        const blockdev_t *dev = blockdev_get(i);
+        const blockdev_queue_stats_t *stats = &dev->queue_stats;
+        terminal_write(dev->name);
+        for (size_t len = strlen(dev->name); len < 8; ++len) {
+            terminal_write(" ");
+        }
+        print_uint64_padded(stats->queued, 10);
+        print_uint64_padded(stats->merged, 10);
+        print_uint64_padded(stats->dispatched, 10);
+        print_uint64_padded(stats->dispatched ? stats->dispatched_sectors / stats->dispatched : 0, 10);
+        print_uint64_padded(stats->max_depth, 11);
+        print_uint64_padded(dev->queue_depth, 7);
+        print_uint64_padded(stats->max_inflight, 11);
+        terminal_write_line("");
+    }
+
+    uint64_t hz = fsbench_tsc_hz();
+    terminal_write_line("");
+    terminal_write_line("NAME       FLUSHES   SKIPPED    AVG us    MAX us  FUA WRITES");
+    for (size_t i = 0; i < blockdev_count(); ++i) {
+        const blockdev_t *dev = blockdev_get(i);
+        const blockdev_stats_t *stats = &dev->stats;
+        uint64_t average = stats->flushes ? stats->flush_cycles / stats->flushes : 0;
+        terminal_write(dev->name);
+        for (size_t len = strlen(dev->name); len < 8; ++len) {
+            terminal_write(" ");
+        }
+        print_uint64_padded(stats->flushes, 10);
+        print_uint64_padded(stats->flushes_skipped, 10);
+        print_uint64_padded(hz ? average * 1000000 / hz : 0, 10);
+        print_uint64_padded(hz ? stats->flush_max_cycles * 1000000 / hz : 0, 10);
+        print_uint64_padded(stats->fua_writes, 12);
+        terminal_write_line(dev->features & BLOCKDEV_FEATURE_FUA ? "" : "  (no FUA)");
     }
 }
 
-static void shell_cmd_touch(const char *args) {
-    const char *path = shell_skip_spaces(args);
-    if (!path || *path == '\0') {
-        terminal_write_line("Usage: touch PATH");
+static void shell_cmd_mount(const char *args) {
+    char name[BLOCKDEV_NAME_LEN];
+    shell_extract_token(args, name, sizeof(name));
+    if (name[0] == '\0') {
+        const char *mounted = fs_mounted_device();
+        terminal_write("Mounted: ");
+        terminal_write_line(mounted ? mounted : "(none)");
         return;
     }
-
-    if (fs_is_dir(path)) {
-        terminal_write_line("touch: cannot operate on a directory.");
+    if (raid0_is_member(blockdev_find(name))) {
+        terminal_write_line("mount: device is a member of md0.");
         return;
     }
 
-    fs_status_t status = fs_create_file(path);
-    if (status == FS_ERR_EXIST) {
-        status = fs_write_file(path, NULL, 0);
+    fs_status_t status = fs_mount(name);
+    if (status == FS_ERR_NOENT) {
+        terminal_write_line("mount: no such device.");
+        return;
+    }
+    if (status == FS_ERR_INVALID) {
+        terminal_write_line("mount: device too small or has an unsupported sector size.");
+        return;
     }
     if (status != FS_OK) {
         shell_print_fs_error(status);
+        return;
+    }
+
+    status = fs_load();
+    if (status == FS_OK) {
+        terminal_write_line("Filesystem loaded from the device.");
+    } else if (status == FS_ERR_INVALID) {
+        terminal_write_line("No filesystem image on the device; the next save will create one.");
+    } else {
+        shell_print_fs_error(status);
     }
 }
 
-static void shell_cmd_mkdir(const char *args) {
-    const char *path = shell_skip_spaces(args);
-    if (!path || *path == '\0') {
-        terminal_write_line("Usage: mkdir PATH");
+static void shell_cmd_ramdisk(const char *args) {
+    char token[16];
+    uint64_t sectors = 0;
+    shell_extract_token(args, token, sizeof(token));
+    if (!shell_parse_uint64(token, &sectors) || sectors == 0 || sectors > 0xFFFFFFFFu) {
+        terminal_write_line("Usage: ramdisk SECTORS");
         return;
     }
-
-    fs_status_t status = fs_mkdir(path);
-    if (status != FS_OK) {
-        shell_print_fs_error(status);
+    blockdev_t *dev = ramdisk_create((uint32_t)sectors);
+    if (!dev) {
+        terminal_write_line("ramdisk: out of memory.");
+        return;
     }
+    terminal_write("Created ");
+    terminal_write_line(dev->name);
 }
 
-static void shell_cmd_rm(const char *args) {
-    char token[FS_MAX_PATH_LEN];
-    const char *rest = shell_extract_token(args, token, sizeof(token));
-    int recursive = 0;
+static void shell_print_crc32c(uint32_t crc) {
+    terminal_write("CRC32C: 0x");
+    print_hex32(crc);
+    terminal_write(checksum_hw_accelerated() ? " (sse4.2)" : " (slicing-by-8)");
+    terminal_write_line("");
+}
 
-    if (strcmp(token, "-r") == 0 || strcmp(token, "--recursive") == 0) {
-        recursive = 1;
-        rest = shell_extract_token(rest, token, sizeof(token));
+static void shell_checksum_disk(const char *args) {
+    char token[32];
+    uint64_t lba = 0;
+    uint64_t count = 0;
+    const char *rest = shell_extract_token(args, token, sizeof(token));
+    int ok = shell_parse_uint64(token, &lba);
+    shell_extract_token(rest, token, sizeof(token));
+    ok = ok && shell_parse_uint64(token, &count);
+    if (!ok || count == 0) {
+        terminal_write_line("Usage: checksum -d LBA COUNT");
+        return;
+    }
+    blockdev_t *dev = blockdev_find(fs_mounted_device());
+    if (!dev) {
+        terminal_write_line("No disk mounted.");
+        return;
+    }
+    if (lba + count > dev->sector_count) {
+        terminal_write_line("checksum: range exceeds disk capacity.");
+        return;
     }
 
-    if (token[0] == '\0') {
-        terminal_write_line("Usage: rm [-r] PATH");
+    uint8_t *buffer = (uint8_t *)kmalloc(SHELL_CHECKSUM_BATCH_SECTORS * 512);
+    if (!buffer) {
+        terminal_write_line("checksum: out of memory.");
         return;
     }
 
-    fs_status_t status = fs_remove(token, recursive);
-    if (status != FS_OK) {
-        shell_print_fs_error(status);
+    uint32_t crc = 0;
+    while (count > 0) {
+        uint16_t batch = (count > SHELL_CHECKSUM_BATCH_SECTORS) ? SHELL_CHECKSUM_BATCH_SECTORS : (uint16_t)count;
+        if (bcache_read(dev, lba, batch, buffer) != 0) {
+            terminal_write_line("checksum: disk read failed.");
+            kfree(buffer);
+            return;
+        }
+        crc = checksum_crc32c_update(crc, buffer, (size_t)batch * 512);
+        lba += batch;
+        count -= batch;
     }
+    kfree(buffer);
+    shell_print_crc32c(crc);
 }
 
-static void shell_cmd_savefs(void) {
-    if (!fs_persistence_available()) {
-        terminal_write_line("Persistence unavailable: attach an ATA disk.");
+static void shell_cmd_checksum(const char *args) {
+    char token[FS_MAX_PATH_LEN];
+    const char *rest = shell_extract_token(args, token, sizeof(token));
+    if (token[0] == '\0') {
+        terminal_write_line("Usage: checksum PATH | checksum -d LBA COUNT");
         return;
     }
-    fs_status_t status = fs_save();
-    if (status == FS_OK) {
-        terminal_write_line("Filesystem snapshot saved to disk.");
-    } else {
-        shell_print_fs_error(status);
+
+    if (strcmp(token, "-d") == 0) {
+        shell_checksum_disk(rest);
+        return;
     }
-}
 
-static void shell_cmd_loadfs(void) {
-    if (!fs_persistence_available()) {
-        terminal_write_line("Persistence unavailable: attach an ATA disk.");
+    if (!fs_exists(token)) {
+        terminal_write_line("checksum: file not found.");
         return;
     }
-    fs_status_t status = fs_load();
-    if (status == FS_OK) {
-        terminal_write_line("Filesystem reloaded from disk.");
-    } else {
-        shell_print_fs_error(status);
+    if (fs_is_dir(token)) {
+        terminal_write_line("checksum: path is a directory.");
+        return;
     }
-}
 
-static void shell_cmd_diskinfo(void) {
-    if (!ata_is_available()) {
-        terminal_write_line("ATA disk not available.");
+    size_t size = 0;
+    const uint8_t *data = fs_get_file_data(token, &size);
+    if (!data && size > 0) {
+        terminal_write_line("checksum: unable to read file.");
         return;
     }
-    
-    const char *model = ata_get_model();
-    const char *serial = ata_get_serial();
-    const char *firmware = ata_get_firmware();
-    uint64_t total_sectors = ata_get_total_sectors();
-    uint64_t total_bytes = total_sectors * 512;
-    uint64_t total_mb = total_bytes / (1024 * 1024);
-    uint64_t total_gb = total_bytes / (1024 * 1024 * 1024);
-    
-    terminal_write_line("ATA Disk Information:");
-    terminal_write("  Model:    ");
-    terminal_write_line(model && model[0] ? model : "(unknown)");
-    terminal_write("  Serial:   ");
-    terminal_write_line(serial && serial[0] ? serial : "(unknown)");
-    terminal_write("  Firmware: ");
-    terminal_write_line(firmware && firmware[0] ? firmware : "(unknown)");
-    terminal_write("  Capacity: ");
-    print_uint64(total_sectors);
-    terminal_write(" sectors (");
-    if (total_gb > 0) {
-        print_uint64(total_gb);
-        terminal_write(" GB / ");
-    }
-    print_uint64(total_mb);
-    terminal_write_line(" MB)");
+    shell_print_crc32c(checksum_crc32c(data, size));
 }
 
 static void shell_cmd_poweroff(void) {
@@ -396,11 +2122,13 @@ static void shell_cmd_poweroff(void) {
         terminal_write_line("Tip: run 'savefs' to persist changes before shutdown.");
     }
     terminal_write_line("Powering off...");
+    bcache_sync(NULL);
     system_poweroff();
 }
 
 static void shell_cmd_reboot(void) {
     terminal_write_line("Rebooting...");
+    bcache_sync(NULL);
     system_reboot();
 }
 
@@ -667,15 +2395,23 @@ static void shell_execute(const char *line) {
         return;
     }
 
+    if ((args = shell_match_command(line, "cp")) != NULL) {
+        shell_cmd_cp(args);
+        return;
+    }
+
+    if ((args = shell_match_command(line, "mv")) != NULL) {
+        shell_cmd_mv(args);
+        return;
+    }
+
     if ((args = shell_match_command(line, "savefs")) != NULL) {
-        (void)args;
-        shell_cmd_savefs();
+        shell_cmd_savefs(args);
         return;
     }
 
     if ((args = shell_match_command(line, "loadfs")) != NULL) {
-        (void)args;
-        shell_cmd_loadfs();
+        shell_cmd_loadfs(args);
         return;
     }
 
@@ -685,6 +2421,99 @@ static void shell_execute(const char *line) {
         return;
     }
 
+    if ((args = shell_match_command(line, "checksum")) != NULL) {
+        shell_cmd_checksum(args);
+        return;
+    }
+
+    if ((args = shell_match_command(line, "du")) != NULL) {
+        shell_cmd_du(args);
+        return;
+    }
+
+    if ((args = shell_match_command(line, "index")) != NULL) {
+        shell_cmd_index(args);
+        return;
+    }
+
+    if ((args = shell_match_command(line, "search")) != NULL) {
+        shell_cmd_search(args);
+        return;
+    }
+
+    if ((args = shell_match_command(line, "dedupstat")) != NULL) {
+        (void)args;
+        shell_cmd_dedupstat();
+        return;
+    }
+
+    if ((args = shell_match_command(line, "atadma")) != NULL) {
+        shell_cmd_atadma(args);
+        return;
+    }
+
+    if ((args = shell_match_command(line, "lspci")) != NULL) {
+        shell_cmd_lspci(args);
+        return;
+    }
+
+    if ((args = shell_match_command(line, "lsblk")) != NULL) {
+        (void)args;
+        shell_cmd_lsblk();
+        return;
+    }
+
+    if ((args = shell_match_command(line, "virtio")) != NULL) {
+        shell_cmd_virtio(args);
+        return;
+    }
+
+    if ((args = shell_match_command(line, "diskbench")) != NULL) {
+        shell_cmd_diskbench(args);
+        return;
+    }
+
+    if ((args = shell_match_command(line, "raid")) != NULL) {
+        shell_cmd_raid(args);
+        return;
+    }
+
+    if ((args = shell_match_command(line, "ahci")) != NULL) {
+        shell_cmd_ahci(args);
+        return;
+    }
+
+    if ((args = shell_match_command(line, "iostat")) != NULL) {
+        (void)args;
+        shell_cmd_iostat();
+        return;
+    }
+
+    if ((args = shell_match_command(line, "mount")) != NULL) {
+        shell_cmd_mount(args);
+        return;
+    }
+
+    if ((args = shell_match_command(line, "ramdisk")) != NULL) {
+        shell_cmd_ramdisk(args);
+        return;
+    }
+
+    if ((args = shell_match_command(line, "fsbench")) != NULL) {
+        shell_cmd_fsbench(args);
+        return;
+    }
+
+    if ((args = shell_match_command(line, "cache")) != NULL) {
+        shell_cmd_cache(args);
+        return;
+    }
+
+    if ((args = shell_match_command(line, "bcache")) != NULL) {
+        shell_cmd_bcache(args);
+        return;
+    }
+
     if ((args = shell_match_command(line, "poweroff")) != NULL) {
         (void)args;
         shell_cmd_poweroff();
@@ -704,8 +2533,8 @@ static void shell_execute(const char *line) {
 
 static const char *shell_commands[] = {
     "help", "clear", "uptime", "mem", "testmem", "history", "echo", "pwd", "ls", "cd",
-    "touch", "cat", "write", "append", "mkdir", "rm", "savefs", "loadfs", "diskinfo",
-    "poweroff", "reboot", NULL
+    "touch", "cat", "write", "append", "mkdir", "rm", "cp", "mv", "savefs", "loadfs", "diskinfo", "diskbench", "atadma", "ahci", "virtio", "raid",
+    "checksum", "du", "dedupstat", "index", "search", "cache", "bcache", "fsbench", "lsblk", "lspci", "iostat", "mount", "ramdisk", "poweroff", "reboot", NULL
 };
 
 static size_t shell_collect_command_matches(const char *prefix, const char **matches, size_t max_matches) {
@@ -794,6 +2623,9 @@ static void shell_history_append(char **history, size_t *history_count, size_t *
     }
 }
 
+/* Queues a background snapshot when the interval has elapsed, or early when
+ * the file cache needs data written back before it can evict. Returns 1 if
+ * a save was queued. */
 static int shell_maybe_autosave(void) {
     uint64_t now = pit_seconds();
     if (shell_last_autosave_seconds == 0 || now < shell_last_autosave_seconds) {
@@ -806,19 +2638,17 @@ static int shell_maybe_autosave(void) {
         return 0;
     }
 
-    if ((now - shell_last_autosave_seconds) < SHELL_AUTOSAVE_INTERVAL_SECONDS) {
+    uint64_t interval = fs_cache_writeback_wanted() ? SHELL_WRITEBACK_INTERVAL_SECONDS
+                                                    : SHELL_AUTOSAVE_INTERVAL_SECONDS;
+    if ((now - shell_last_autosave_seconds) < interval) {
         return 0;
     }
 
     shell_last_autosave_seconds = now;
-    fs_status_t status = fs_save();
-    if (status == FS_OK) {
-        terminal_write_line("[autosave] Filesystem snapshot saved.");
-    } else {
-        terminal_write("[autosave] ");
-        shell_print_fs_error(status);
+    if (fs_save_in_progress()) {
+        return 0;
     }
-    return 1;
+    return fs_save_async(&shell_autosave_job.request, shell_fs_job_done, &shell_autosave_job) == FS_OK;
 }
 
 static size_t shell_read_line_with_history(char *buffer, size_t buffer_size,
@@ -844,11 +2674,36 @@ static size_t shell_read_line_with_history(char *buffer, size_t buffer_size,
     while (1) {
         uint16_t code;
         while (!keyboard_try_read_char_extended(&code)) {
-            if (shell_maybe_autosave()) {
-                shell_print_prompt();
-                terminal_get_cursor(&prompt_row, &prompt_col);
-                rendered_length = 0;
-                shell_refresh_input(buffer, length, cursor_pos, prompt_row, prompt_col, &rendered_length);
+            shell_maybe_autosave();
+            if (fs_async_pending()) {
+                /* Run background filesystem work in idle time, one bounded
+                 * slice between key checks. */
+                int was_saving = fs_save_in_progress();
+                fs_async_poll();
+                if (shell_report_fs_jobs()) {
+                    if (in_search) {
+                        terminal_write("(reverse-i-search)`");
+                        terminal_write(search_buffer);
+                        terminal_write("': ");
+                    } else {
+                        shell_print_prompt();
+                        terminal_get_cursor(&prompt_row, &prompt_col);
+                        rendered_length = 0;
+                        shell_refresh_input(buffer, length, cursor_pos, prompt_row, prompt_col, &rendered_length);
+                    }
+                } else if (was_saving != fs_save_in_progress() && !in_search) {
+                    /* Redraw the prompt in place so it shows the save marker. */
+                    size_t old_end = prompt_col + rendered_length;
+                    terminal_set_cursor(prompt_row, 0);
+                    shell_print_prompt();
+                    terminal_get_cursor(&prompt_row, &prompt_col);
+                    rendered_length = (old_end > prompt_col) ? old_end - prompt_col : 0;
+                    shell_refresh_input(buffer, length, cursor_pos, prompt_row, prompt_col, &rendered_length);
+                }
+                continue;
+            }
+            if (bcache_poll()) {
+                continue;
             }
             __asm__ volatile("hlt");
         }
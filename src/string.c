@@ -91,3 +91,15 @@ void *memmove(void *dest, const void *src, size_t count) {
     return dest;
 }
 
+int memcmp(const void *a, const void *b, size_t count) {
+    const unsigned char *pa = (const unsigned char *)a;
+    const unsigned char *pb = (const unsigned char *)b;
+    while (count--) {
+        if (*pa != *pb) {
+            return *pa - *pb;
+        }
+        ++pa;
+        ++pb;
+    }
+    return 0;
+}
@@ -0,0 +1,342 @@
+#include <trigram.h>
+#include <memory.h>
+#include <string.h>
+
+#define TRIGRAM_BUCKETS        4096u
+#define TRIGRAM_MAX_QUERY_KEYS 256u
+#define TRIGRAM_COMPACT_MIN    64u
+
+enum {
+    TRIGRAM_DOC_FREE = 0,
+    TRIGRAM_DOC_LIVE,
+    TRIGRAM_DOC_INCOMPLETE,
+    TRIGRAM_DOC_DEAD
+};
+
+/* Posting list of one trigram: the ids of the documents containing it,
+ * sorted and unique. Ids of destroyed documents linger until the next
+ * compaction and are skipped by queries. */
+typedef struct trigram_list {
+    struct trigram_list *next;
+    uint32_t key;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *docs;
+} trigram_list_t;
+
+typedef struct {
+    void *owner;
+    uint8_t state;
+} trigram_doc_t;
+
+static trigram_list_t *trigram_table[TRIGRAM_BUCKETS];
+static trigram_doc_t *trigram_docs = NULL;
+static uint32_t trigram_doc_capacity = 0;
+static uint32_t trigram_doc_hint = 0;
+static size_t trigram_list_count = 0;
+static size_t trigram_posting_count = 0;
+static size_t trigram_live_docs = 0;
+static size_t trigram_incomplete_docs = 0;
+static size_t trigram_dead_docs = 0;
+static size_t trigram_memory = 0;
+
+static uint32_t trigram_key(const uint8_t *bytes) {
+    return ((uint32_t)bytes[0] << 16) | ((uint32_t)bytes[1] << 8) | bytes[2];
+}
+
+static uint32_t trigram_bucket(uint32_t key) {
+    return (key * 2654435761u) >> 20;
+}
+
+static trigram_list_t *trigram_find(uint32_t key) {
+    trigram_list_t *list = trigram_table[trigram_bucket(key)];
+    while (list && list->key != key) {
+        list = list->next;
+    }
+    return list;
+}
+
+static int trigram_doc_is_live(uint32_t doc) {
+    uint8_t state = trigram_docs[doc].state;
+    return state == TRIGRAM_DOC_LIVE || state == TRIGRAM_DOC_INCOMPLETE;
+}
+
+static size_t trigram_lower_bound(const trigram_list_t *list, uint32_t doc) {
+    size_t low = 0;
+    size_t high = list->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (list->docs[mid] < doc) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static int trigram_list_contains(const trigram_list_t *list, uint32_t doc) {
+    size_t pos = trigram_lower_bound(list, doc);
+    return pos < list->count && list->docs[pos] == doc;
+}
+
+static int trigram_list_insert(trigram_list_t *list, uint32_t doc) {
+    /* New documents take increasing ids, so this is usually an append. */
+    size_t pos = list->count;
+    if (pos > 0 && list->docs[pos - 1] >= doc) {
+        pos = trigram_lower_bound(list, doc);
+        if (pos < list->count && list->docs[pos] == doc) {
+            return 1;
+        }
+    }
+
+    if (list->count == list->capacity) {
+        uint32_t capacity = list->capacity ? list->capacity * 2 : 4;
+        uint32_t *docs = (uint32_t *)kmalloc(capacity * sizeof(uint32_t));
+        if (!docs) {
+            return 0;
+        }
+        if (list->docs) {
+            memcpy(docs, list->docs, list->count * sizeof(uint32_t));
+            kfree(list->docs);
+        }
+        trigram_memory += (capacity - list->capacity) * sizeof(uint32_t);
+        list->docs = docs;
+        list->capacity = capacity;
+    }
+
+    for (size_t i = list->count; i > pos; --i) {
+        list->docs[i] = list->docs[i - 1];
+    }
+    list->docs[pos] = doc;
+    list->count++;
+    trigram_posting_count++;
+    return 1;
+}
+
+static trigram_list_t *trigram_find_or_create(uint32_t key) {
+    trigram_list_t *list = trigram_find(key);
+    if (list) {
+        return list;
+    }
+    list = (trigram_list_t *)kmalloc(sizeof(trigram_list_t));
+    if (!list) {
+        return NULL;
+    }
+    memset(list, 0, sizeof(trigram_list_t));
+    list->key = key;
+    uint32_t bucket = trigram_bucket(key);
+    list->next = trigram_table[bucket];
+    trigram_table[bucket] = list;
+    trigram_list_count++;
+    trigram_memory += sizeof(trigram_list_t);
+    return list;
+}
+
+/* Drops the ids of destroyed documents from every posting list, frees
+ * lists that become empty and makes those ids reusable. */
+static void trigram_compact(void) {
+    for (uint32_t bucket = 0; bucket < TRIGRAM_BUCKETS; ++bucket) {
+        trigram_list_t **link = &trigram_table[bucket];
+        while (*link) {
+            trigram_list_t *list = *link;
+            uint32_t kept = 0;
+            for (uint32_t i = 0; i < list->count; ++i) {
+                if (trigram_doc_is_live(list->docs[i])) {
+                    list->docs[kept++] = list->docs[i];
+                }
+            }
+            trigram_posting_count -= list->count - kept;
+            list->count = kept;
+
+            if (kept == 0) {
+                *link = list->next;
+                trigram_memory -= sizeof(trigram_list_t) + list->capacity * sizeof(uint32_t);
+                trigram_list_count--;
+                if (list->docs) {
+                    kfree(list->docs);
+                }
+                kfree(list);
+            } else {
+                link = &list->next;
+            }
+        }
+    }
+
+    for (uint32_t doc = 0; doc < trigram_doc_capacity; ++doc) {
+        if (trigram_docs[doc].state == TRIGRAM_DOC_DEAD) {
+            trigram_docs[doc].state = TRIGRAM_DOC_FREE;
+        }
+    }
+    trigram_dead_docs = 0;
+    trigram_doc_hint = 0;
+}
+
+uint32_t trigram_doc_create(void *owner) {
+    uint32_t doc = trigram_doc_hint;
+    while (doc < trigram_doc_capacity && trigram_docs[doc].state != TRIGRAM_DOC_FREE) {
+        ++doc;
+    }
+
+    if (doc == trigram_doc_capacity) {
+        uint32_t capacity = trigram_doc_capacity ? trigram_doc_capacity * 2 : 64;
+        trigram_doc_t *docs = (trigram_doc_t *)kmalloc(capacity * sizeof(trigram_doc_t));
+        if (!docs) {
+            return TRIGRAM_NO_DOC;
+        }
+        memset(docs, 0, capacity * sizeof(trigram_doc_t));
+        if (trigram_docs) {
+            memcpy(docs, trigram_docs, trigram_doc_capacity * sizeof(trigram_doc_t));
+            kfree(trigram_docs);
+        }
+        trigram_memory += (capacity - trigram_doc_capacity) * sizeof(trigram_doc_t);
+        trigram_docs = docs;
+        trigram_doc_capacity = capacity;
+    }
+
+    trigram_docs[doc].owner = owner;
+    trigram_docs[doc].state = TRIGRAM_DOC_LIVE;
+    trigram_doc_hint = doc + 1;
+    trigram_live_docs++;
+    return doc;
+}
+
+/* Indexes every trigram of `bytes`. A document whose trigrams could not
+ * all be recorded is marked incomplete and returned by every query, so
+ * running out of memory costs speed, never results. */
+void trigram_doc_add(uint32_t doc, const uint8_t *bytes, size_t length) {
+    if (doc >= trigram_doc_capacity || trigram_docs[doc].state != TRIGRAM_DOC_LIVE || length < 3) {
+        return;
+    }
+
+    uint32_t previous = TRIGRAM_NO_DOC;
+    for (size_t i = 0; i + 3 <= length; ++i) {
+        uint32_t key = trigram_key(bytes + i);
+        if (key == previous) {
+            continue;
+        }
+        previous = key;
+
+        trigram_list_t *list = trigram_find_or_create(key);
+        if (!list || !trigram_list_insert(list, doc)) {
+            trigram_docs[doc].state = TRIGRAM_DOC_INCOMPLETE;
+            trigram_incomplete_docs++;
+            return;
+        }
+    }
+}
+
+void trigram_doc_destroy(uint32_t doc) {
+    if (doc >= trigram_doc_capacity || !trigram_doc_is_live(doc)) {
+        return;
+    }
+    if (trigram_docs[doc].state == TRIGRAM_DOC_INCOMPLETE) {
+        trigram_incomplete_docs--;
+    }
+    trigram_docs[doc].state = TRIGRAM_DOC_DEAD;
+    trigram_docs[doc].owner = NULL;
+    trigram_live_docs--;
+    trigram_dead_docs++;
+    if (doc < trigram_doc_hint) {
+        trigram_doc_hint = doc;
+    }
+
+    if (trigram_dead_docs >= TRIGRAM_COMPACT_MIN && trigram_dead_docs > trigram_live_docs) {
+        trigram_compact();
+    }
+}
+
+static void trigram_emit_incomplete(uint32_t *next, uint32_t limit,
+                                    trigram_candidate_callback_t callback, void *user_data) {
+    if (trigram_incomplete_docs == 0) {
+        *next = limit;
+        return;
+    }
+    for (; *next < limit; ++*next) {
+        if (trigram_docs[*next].state == TRIGRAM_DOC_INCOMPLETE) {
+            callback(*next, trigram_docs[*next].owner, user_data);
+        }
+    }
+}
+
+/* Reports every document that may contain `text`: those whose posting
+ * lists include all of its trigrams, plus incomplete ones. Text shorter
+ * than a trigram cannot be narrowed and matches every document. */
+void trigram_query(const uint8_t *text, size_t length, trigram_candidate_callback_t callback, void *user_data) {
+    if (!callback || trigram_live_docs == 0) {
+        return;
+    }
+
+    if (!text || length < 3) {
+        for (uint32_t doc = 0; doc < trigram_doc_capacity; ++doc) {
+            if (trigram_doc_is_live(doc)) {
+                callback(doc, trigram_docs[doc].owner, user_data);
+            }
+        }
+        return;
+    }
+
+    trigram_list_t *lists[TRIGRAM_MAX_QUERY_KEYS];
+    size_t list_count = 0;
+    int missing = 0;
+    for (size_t i = 0; i + 3 <= length && list_count < TRIGRAM_MAX_QUERY_KEYS; ++i) {
+        trigram_list_t *list = trigram_find(trigram_key(text + i));
+        if (!list) {
+            missing = 1;
+            break;
+        }
+
+        /* Keep the array sorted by list length, without duplicates. */
+        size_t pos = 0;
+        int duplicate = 0;
+        while (pos < list_count && lists[pos]->count <= list->count) {
+            if (lists[pos] == list) {
+                duplicate = 1;
+                break;
+            }
+            ++pos;
+        }
+        for (size_t j = pos; !duplicate && j < list_count; ++j) {
+            duplicate = (lists[j] == list);
+        }
+        if (duplicate) {
+            continue;
+        }
+        for (size_t j = list_count; j > pos; --j) {
+            lists[j] = lists[j - 1];
+        }
+        lists[pos] = list;
+        ++list_count;
+    }
+
+    uint32_t next_incomplete = 0;
+    if (!missing) {
+        const trigram_list_t *shortest = lists[0];
+        for (uint32_t i = 0; i < shortest->count; ++i) {
+            uint32_t doc = shortest->docs[i];
+            if (trigram_docs[doc].state != TRIGRAM_DOC_LIVE) {
+                continue;
+            }
+            int match = 1;
+            for (size_t j = 1; j < list_count && match; ++j) {
+                match = trigram_list_contains(lists[j], doc);
+            }
+            if (match) {
+                trigram_emit_incomplete(&next_incomplete, doc, callback, user_data);
+                callback(doc, trigram_docs[doc].owner, user_data);
+            }
+        }
+    }
+    trigram_emit_incomplete(&next_incomplete, trigram_doc_capacity, callback, user_data);
+}
+
+void trigram_get_stats(trigram_stats_t *stats) {
+    if (!stats) {
+        return;
+    }
+    stats->trigrams = trigram_list_count;
+    stats->postings = trigram_posting_count;
+    stats->documents = trigram_live_docs;
+    stats->incomplete = trigram_incomplete_docs;
+    stats->memory_bytes = trigram_memory;
+}
@@ -0,0 +1,523 @@
+#include <virtio_blk.h>
+#include <blockdev.h>
+#include <interrupts.h>
+#include <io.h>
+#include <pci.h>
+#include <pit.h>
+#include <string.h>
+
+#define VIRTIO_VENDOR_ID           0x1AF4
+#define VIRTIO_BLK_LEGACY_ID       0x1001
+
+/* Legacy virtio PCI registers, relative to the I/O BAR0. The device
+ * configuration follows at 0x14 as long as MSI-X is off; with MSI-X on,
+ * the vector registers take 0x14-0x17 and it moves to 0x18. */
+#define VIRTIO_REG_DEVICE_FEATURES 0x00
+#define VIRTIO_REG_GUEST_FEATURES  0x04
+#define VIRTIO_REG_QUEUE_PFN       0x08
+#define VIRTIO_REG_QUEUE_SIZE      0x0C
+#define VIRTIO_REG_QUEUE_SELECT    0x0E
+#define VIRTIO_REG_QUEUE_NOTIFY    0x10
+#define VIRTIO_REG_STATUS          0x12
+#define VIRTIO_REG_ISR             0x13
+#define VIRTIO_REG_QUEUE_VECTOR    0x16
+#define VIRTIO_REG_CONFIG          0x14
+#define VIRTIO_REG_CONFIG_MSIX     0x18
+#define VIRTIO_CONFIG_CAPACITY     0x00
+#define VIRTIO_CONFIG_SIZE_MAX     0x08
+
+#define VIRTIO_STATUS_ACKNOWLEDGE  0x01
+#define VIRTIO_STATUS_DRIVER       0x02
+#define VIRTIO_STATUS_DRIVER_OK    0x04
+#define VIRTIO_STATUS_FAILED       0x80
+#define VIRTIO_ISR_QUEUE           0x01
+
+#define VIRTIO_BLK_F_SIZE_MAX      (1u << 1)
+#define VIRTIO_BLK_F_RO            (1u << 5)
+#define VIRTIO_BLK_F_FLUSH         (1u << 9)
+#define VIRTIO_RING_F_INDIRECT     (1u << 28)
+
+#define VIRTIO_BLK_T_IN            0
+#define VIRTIO_BLK_T_OUT           1
+#define VIRTIO_BLK_T_FLUSH         4
+#define VIRTIO_BLK_S_OK            0
+
+#define VIRTQ_DESC_F_NEXT          0x0001
+#define VIRTQ_DESC_F_WRITE         0x0002
+#define VIRTQ_DESC_F_INDIRECT      0x0004
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 0x0001
+#define VIRTQ_USED_F_NO_NOTIFY     0x0001
+
+#define VIRTIO_SECTOR_SIZE         512u
+#define VIRTIO_QUEUE_MAX           1024u
+#define VIRTIO_QUEUE_ALIGN         4096u
+#define VIRTIO_BLK_REQUESTS        64u
+#define VIRTIO_BLK_MAX_TRANSFER    65536u
+#define VIRTIO_TIMEOUT_MS          5000
+
+/* Legacy split-ring layout: descriptor table and available ring, then
+ * the used ring on the next page boundary. */
+#define VIRTQ_ALIGN(x)       (((x) + VIRTIO_QUEUE_ALIGN - 1) & ~(size_t)(VIRTIO_QUEUE_ALIGN - 1))
+#define VIRTQ_USED_OFFSET(n) VIRTQ_ALIGN(16 * (size_t)(n) + 6 + 2 * (size_t)(n))
+#define VIRTQ_BYTES(n)       (VIRTQ_USED_OFFSET(n) + VIRTQ_ALIGN(6 + 8 * (size_t)(n)))
+
+typedef struct virtq_desc {
+    uint64_t address;
+    uint32_t length;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed)) virtq_desc_t;
+
+typedef struct virtq_avail {
+    uint16_t flags;
+    uint16_t index;
+    uint16_t ring[];
+} __attribute__((packed)) virtq_avail_t;
+
+typedef struct virtq_used_elem {
+    uint32_t id;
+    uint32_t length;
+} __attribute__((packed)) virtq_used_elem_t;
+
+typedef struct virtq_used {
+    uint16_t flags;
+    uint16_t index;
+    virtq_used_elem_t ring[];
+} __attribute__((packed)) virtq_used_t;
+
+/* One request: the indirect table (header, data, status) and the header
+ * and status byte it points at. Without indirect descriptors request i
+ * uses ring descriptors 3i..3i+2 instead. Synchronous requests are marked
+ * done rather than freed, so the waiter can read the result. */
+typedef struct virtio_blk_request {
+    virtq_desc_t table[3];
+    struct {
+        uint32_t type;
+        uint32_t reserved;
+        uint64_t sector;
+    } __attribute__((packed)) header;
+    volatile uint8_t status;
+    uint8_t done;
+    int result;
+    void *tag;
+} __attribute__((aligned(16))) virtio_blk_request_t;
+
+static uint8_t virtio_ring[VIRTQ_BYTES(VIRTIO_QUEUE_MAX)] __attribute__((aligned(4096)));
+static virtio_blk_request_t virtio_requests[VIRTIO_BLK_REQUESTS];
+static virtq_desc_t *virtio_desc = NULL;
+static volatile virtq_avail_t *virtio_avail = NULL;
+static volatile virtq_used_t *virtio_used = NULL;
+static uint16_t virtio_queue = 0;
+static uint16_t virtio_used_seen = 0;
+static uint16_t virtio_unkicked = 0;
+static uint32_t virtio_slots = 0;
+static uint64_t virtio_busy = 0;
+static uint64_t virtio_progress_ms = 0;
+
+static int virtio_present = 0;
+static int virtio_broken = 0;
+static uint16_t virtio_io = 0;
+static int virtio_indirect = 0;
+static int virtio_flush = 0;
+static int virtio_read_only = 0;
+static int virtio_irq_ok = 0;
+static int virtio_msix = 0;
+static uint16_t virtio_config = VIRTIO_REG_CONFIG;
+static int virtio_irq_mode = 1;
+static volatile int virtio_irq_pending = 0;
+static virtio_blk_stats_t virtio_stats;
+
+/* Marks requests issued by virtio_blk_submit, which waits for them. */
+static char virtio_sync_tag;
+
+static int virtio_blk_submit(blockdev_t *dev, const blockdev_request_t *request);
+static int virtio_blk_start(blockdev_t *dev, const blockdev_request_t *request, void *tag);
+static void virtio_blk_poll(blockdev_t *dev);
+
+static blockdev_t virtio_blockdev = {
+    .name = "virtio0",
+    .driver = "virtio-blk",
+    .sector_size = VIRTIO_SECTOR_SIZE,
+    .max_transfer = VIRTIO_BLK_MAX_TRANSFER,
+    .features = BLOCKDEV_FEATURE_QUEUED,
+    .submit = virtio_blk_submit,
+    .start = virtio_blk_start,
+    .poll = virtio_blk_poll
+};
+
+static uint64_t virtio_get_time_ms(void) {
+    uint32_t freq = pit_current_frequency();
+    if (freq == 0) {
+        return 0;
+    }
+    return pit_ticks() * 1000 / freq;
+}
+
+static void virtio_barrier(void) {
+    __asm__ volatile("mfence" ::: "memory");
+}
+
+/* Reading the ISR register acknowledges the interrupt and lowers the
+ * line; the used ring itself is processed outside the handler. */
+static void virtio_blk_handle_irq(void *context) {
+    (void)context;
+    if (inb(virtio_io + VIRTIO_REG_ISR) & VIRTIO_ISR_QUEUE) {
+        virtio_irq_pending = 1;
+        virtio_stats.irqs++;
+    }
+}
+
+/* With MSI-X the message itself is the notification: there is no ISR
+ * register to read and nothing to lower. */
+static void virtio_blk_handle_msix(void *context) {
+    (void)context;
+    virtio_irq_pending = 1;
+    virtio_stats.irqs++;
+}
+
+int virtio_blk_irq_usable(void) {
+    return virtio_irq_ok && virtio_irq_mode && interrupts_enabled();
+}
+
+static void virtio_set_desc(virtq_desc_t *desc, const volatile void *address, uint32_t length, uint16_t flags,
+                            uint16_t next) {
+    desc->address = (uint64_t)(uintptr_t)address;
+    desc->length = length;
+    desc->flags = flags;
+    desc->next = next;
+}
+
+/* Describes request `slot` and places it in the available ring. The
+ * device is not notified yet: virtio_blk_kick does that once for all
+ * requests added since the last notification. */
+static void virtio_blk_push(uint32_t slot, uint32_t type, uint64_t lba, void *buffer, uint32_t bytes, void *tag) {
+    virtio_blk_request_t *request = &virtio_requests[slot];
+    request->header.type = type;
+    request->header.reserved = 0;
+    request->header.sector = lba;
+    request->status = 0xFF;
+    request->done = 0;
+    request->result = -1;
+    request->tag = tag;
+
+    virtq_desc_t *table = virtio_indirect ? request->table : &virtio_desc[slot * 3];
+    uint16_t base = virtio_indirect ? 0 : (uint16_t)(slot * 3);
+    uint16_t count = 0;
+    virtio_set_desc(&table[count], &request->header, sizeof(request->header), VIRTQ_DESC_F_NEXT,
+                    (uint16_t)(base + count + 1));
+    ++count;
+    if (bytes > 0) {
+        virtio_set_desc(&table[count], buffer, bytes,
+                        VIRTQ_DESC_F_NEXT | (type == VIRTIO_BLK_T_IN ? VIRTQ_DESC_F_WRITE : 0),
+                        (uint16_t)(base + count + 1));
+        ++count;
+    }
+    virtio_set_desc(&table[count], &request->status, 1, VIRTQ_DESC_F_WRITE, 0);
+    ++count;
+
+    uint16_t head = base;
+    if (virtio_indirect) {
+        head = (uint16_t)slot;
+        virtio_set_desc(&virtio_desc[head], table, count * sizeof(virtq_desc_t), VIRTQ_DESC_F_INDIRECT, 0);
+        virtio_stats.indirect++;
+    }
+
+    if (virtio_busy == 0) {
+        virtio_progress_ms = virtio_get_time_ms();
+    }
+    virtio_busy |= 1ull << slot;
+    uint32_t inflight = 0;
+    for (uint64_t mask = virtio_busy; mask; mask &= mask - 1) {
+        ++inflight;
+    }
+    if (inflight > virtio_stats.max_inflight) {
+        virtio_stats.max_inflight = inflight;
+    }
+
+    uint16_t index = virtio_avail->index;
+    virtio_avail->ring[index % virtio_queue] = head;
+    virtio_barrier();
+    virtio_avail->index = (uint16_t)(index + 1);
+    virtio_unkicked++;
+}
+
+static void virtio_blk_kick(void) {
+    if (virtio_unkicked == 0) {
+        return;
+    }
+    virtio_unkicked = 0;
+    virtio_barrier();
+    if (!(virtio_used->flags & VIRTQ_USED_F_NO_NOTIFY)) {
+        outw(virtio_io + VIRTIO_REG_QUEUE_NOTIFY, 0);
+        virtio_stats.notifies++;
+    }
+}
+
+static void virtio_blk_finish(uint32_t slot, int status) {
+    virtio_blk_request_t *request = &virtio_requests[slot];
+    void *tag = request->tag;
+    virtio_stats.requests++;
+    if (status != 0) {
+        virtio_stats.errors++;
+    }
+    virtio_progress_ms = virtio_get_time_ms();
+    if (tag == &virtio_sync_tag) {
+        request->result = status;
+        request->done = 1;
+        return;
+    }
+    request->tag = NULL;
+    virtio_busy &= ~(1ull << slot);
+    blockdev_complete(&virtio_blockdev, tag, status);
+}
+
+/* Takes finished requests off the used ring. Returns how many. */
+static uint32_t virtio_blk_reap(void) {
+    uint32_t reaped = 0;
+    while (virtio_used_seen != virtio_used->index) {
+        virtio_barrier();
+        uint32_t id = virtio_used->ring[virtio_used_seen % virtio_queue].id;
+        virtio_used_seen++;
+        uint32_t slot = virtio_indirect ? id : id / 3;
+        if (slot < virtio_slots && (virtio_busy & (1ull << slot))) {
+            virtio_blk_finish(slot, virtio_requests[slot].status == VIRTIO_BLK_S_OK ? 0 : -1);
+            ++reaped;
+        }
+    }
+    return reaped;
+}
+
+/* A device that stops answering is reset and left out of service; what
+ * it still held fails. */
+static void virtio_blk_fail_all(void) {
+    outb(virtio_io + VIRTIO_REG_STATUS, 0);
+    virtio_broken = 1;
+    virtio_stats.timeouts++;
+    for (uint32_t slot = 0; slot < virtio_slots; ++slot) {
+        if ((virtio_busy & (1ull << slot)) && !virtio_requests[slot].done) {
+            virtio_blk_finish(slot, -1);
+        }
+    }
+}
+
+/* Sends pending requests, then collects completions, sleeping until the
+ * queue interrupt if there are none yet. The flag is tested with
+ * interrupts off and `sti; hlt` is atomic, as in the ATA driver. */
+static void virtio_blk_poll(blockdev_t *dev) {
+    (void)dev;
+    virtio_blk_kick();
+    if (virtio_blk_reap() > 0 || virtio_busy == 0) {
+        return;
+    }
+
+    if (virtio_blk_irq_usable()) {
+        __asm__ volatile("cli");
+        if (virtio_irq_pending || virtio_used_seen != virtio_used->index) {
+            virtio_irq_pending = 0;
+            __asm__ volatile("sti");
+        } else {
+            __asm__ volatile("sti; hlt");
+        }
+    } else {
+        __asm__ volatile("pause");
+    }
+
+    if (virtio_blk_reap() == 0 && virtio_get_time_ms() - virtio_progress_ms > VIRTIO_TIMEOUT_MS) {
+        virtio_blk_fail_all();
+    }
+}
+
+static int virtio_blk_free_slot(void) {
+    for (uint32_t slot = 0; slot < virtio_slots; ++slot) {
+        if (!(virtio_busy & (1ull << slot))) {
+            return (int)slot;
+        }
+    }
+    return -1;
+}
+
+static int virtio_blk_check(const blockdev_request_t *request) {
+    if (virtio_broken) {
+        return -1;
+    }
+    if (request->op == BLOCKDEV_WRITE && virtio_read_only) {
+        return -1;
+    }
+    return 0;
+}
+
+static uint32_t virtio_blk_type(blockdev_op_t op) {
+    if (op == BLOCKDEV_READ) {
+        return VIRTIO_BLK_T_IN;
+    }
+    return (op == BLOCKDEV_WRITE) ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_FLUSH;
+}
+
+static int virtio_blk_submit(blockdev_t *dev, const blockdev_request_t *request) {
+    if (virtio_blk_check(request) != 0) {
+        return -1;
+    }
+    if (request->op == BLOCKDEV_FLUSH && !virtio_flush) {
+        return 0; /* no volatile write cache advertised */
+    }
+    int slot;
+    while ((slot = virtio_blk_free_slot()) < 0) {
+        virtio_blk_poll(dev);
+    }
+    uint32_t bytes = (request->op == BLOCKDEV_FLUSH) ? 0 : request->count * VIRTIO_SECTOR_SIZE;
+    virtio_blk_push((uint32_t)slot, virtio_blk_type(request->op), request->lba, request->buffer, bytes,
+                    &virtio_sync_tag);
+    virtio_blk_request_t *pending = &virtio_requests[slot];
+    while (!pending->done && !virtio_broken) {
+        virtio_blk_poll(dev);
+    }
+    int result = pending->done ? pending->result : -1;
+    pending->tag = NULL;
+    virtio_busy &= ~(1ull << slot);
+    return result;
+}
+
+/* Asynchronous path used by blockdev_unplug: requests are only placed in
+ * the ring here, and the whole batch goes to the device with one
+ * notification from the next poll. */
+static int virtio_blk_start(blockdev_t *dev, const blockdev_request_t *request, void *tag) {
+    (void)dev;
+    if (request->op == BLOCKDEV_FLUSH || virtio_blk_check(request) != 0) {
+        return -1;
+    }
+    int slot = virtio_blk_free_slot();
+    if (slot < 0) {
+        return 1;
+    }
+    virtio_blk_push((uint32_t)slot, virtio_blk_type(request->op), request->lba, request->buffer,
+                    request->count * VIRTIO_SECTOR_SIZE, tag);
+    return 0;
+}
+
+/* Takes a legacy (transitional) virtio block device, negotiates flush,
+ * size limit and indirect descriptors, and sets up virtqueue 0. The queue
+ * interrupt is an MSI-X message when the device and the CPU allow it,
+ * and the INTx# line otherwise. */
+static int virtio_blk_probe(const pci_device_t *device) {
+    pci_device_t pci = *device;
+    if (virtio_present) {
+        return -1;
+    }
+    uint32_t bar0 = pci_bar(&pci, 0);
+    if (!(bar0 & 1)) {
+        return -1;
+    }
+    pci_enable(&pci, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+    virtio_io = (uint16_t)(bar0 & 0xFFFC);
+
+    outb(virtio_io + VIRTIO_REG_STATUS, 0);
+    outb(virtio_io + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outb(virtio_io + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    uint32_t features = inl(virtio_io + VIRTIO_REG_DEVICE_FEATURES);
+    features &= VIRTIO_BLK_F_SIZE_MAX | VIRTIO_BLK_F_RO | VIRTIO_BLK_F_FLUSH | VIRTIO_RING_F_INDIRECT;
+    outl(virtio_io + VIRTIO_REG_GUEST_FEATURES, features);
+    virtio_indirect = (features & VIRTIO_RING_F_INDIRECT) != 0;
+    virtio_flush = (features & VIRTIO_BLK_F_FLUSH) != 0;
+    virtio_read_only = (features & VIRTIO_BLK_F_RO) != 0;
+
+    outw(virtio_io + VIRTIO_REG_QUEUE_SELECT, 0);
+    uint16_t size = inw(virtio_io + VIRTIO_REG_QUEUE_SIZE);
+    if (size == 0 || size > VIRTIO_QUEUE_MAX || (size & (size - 1)) != 0) {
+        outb(virtio_io + VIRTIO_REG_STATUS, VIRTIO_STATUS_FAILED);
+        return -1;
+    }
+    memset(virtio_ring, 0, VIRTQ_BYTES(size));
+    virtio_queue = size;
+    virtio_desc = (virtq_desc_t *)virtio_ring;
+    virtio_avail = (volatile virtq_avail_t *)(virtio_ring + 16 * (size_t)size);
+    virtio_used = (volatile virtq_used_t *)(virtio_ring + VIRTQ_USED_OFFSET(size));
+    virtio_used_seen = 0;
+    virtio_unkicked = 0;
+    virtio_busy = 0;
+    virtio_slots = virtio_indirect ? size : size / 3u;
+    if (virtio_slots > VIRTIO_BLK_REQUESTS) {
+        virtio_slots = VIRTIO_BLK_REQUESTS;
+    }
+    outl(virtio_io + VIRTIO_REG_QUEUE_PFN, (uint32_t)((uintptr_t)virtio_ring / VIRTIO_QUEUE_ALIGN));
+
+    /* Queue 0 is still selected: route it to MSI-X entry 0. A device that
+     * cannot take the vector reads back as having none, and with MSI-X
+     * on it no longer uses the line either, so it is polled. */
+    virtio_msix = pci_enable_msix(&pci, 0, virtio_blk_handle_msix, NULL) >= 0;
+    if (virtio_msix) {
+        virtio_config = VIRTIO_REG_CONFIG_MSIX;
+        outw(virtio_io + VIRTIO_REG_QUEUE_VECTOR, 0);
+    }
+
+    uint64_t capacity = (uint64_t)inl(virtio_io + virtio_config + VIRTIO_CONFIG_CAPACITY) |
+                        ((uint64_t)inl(virtio_io + virtio_config + VIRTIO_CONFIG_CAPACITY + 4) << 32);
+    uint32_t max_transfer = VIRTIO_BLK_MAX_TRANSFER;
+    if (features & VIRTIO_BLK_F_SIZE_MAX) {
+        uint32_t size_max = inl(virtio_io + virtio_config + VIRTIO_CONFIG_SIZE_MAX) / VIRTIO_SECTOR_SIZE;
+        if (size_max > 0 && size_max < max_transfer) {
+            max_transfer = size_max;
+        }
+    }
+
+    if (virtio_msix) {
+        virtio_irq_ok = inw(virtio_io + VIRTIO_REG_QUEUE_VECTOR) == 0;
+    } else {
+        uint8_t line = pci_interrupt_line(&pci);
+        virtio_irq_ok = line < 16 && interrupts_register_irq(line, virtio_blk_handle_irq, NULL) == 0;
+    }
+    virtio_avail->flags = virtio_irq_ok ? 0 : VIRTQ_AVAIL_F_NO_INTERRUPT;
+
+    outb(virtio_io + VIRTIO_REG_STATUS,
+         VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+
+    virtio_blockdev.sector_count = capacity;
+    virtio_blockdev.max_transfer = max_transfer;
+    virtio_present = capacity > 0 && blockdev_register(&virtio_blockdev) >= 0;
+    return virtio_present ? 0 : -1;
+}
+
+static const pci_driver_t virtio_blk_driver = {
+    .name = "virtio-blk",
+    .vendor_id = VIRTIO_VENDOR_ID,
+    .device_id = VIRTIO_BLK_LEGACY_ID,
+    .class_code = PCI_ANY_ID,
+    .subclass = PCI_ANY_ID,
+    .probe = virtio_blk_probe
+};
+
+void virtio_blk_init(void) {
+    if (!virtio_present) {
+        pci_register_driver(&virtio_blk_driver);
+    }
+}
+
+int virtio_blk_is_available(void) {
+    return virtio_present && !virtio_broken;
+}
+
+uint16_t virtio_blk_queue_size(void) {
+    return virtio_queue;
+}
+
+int virtio_blk_indirect_enabled(void) {
+    return virtio_indirect;
+}
+
+int virtio_blk_irq_enabled(void) {
+    return virtio_irq_mode;
+}
+
+/* In polling mode the device is asked not to interrupt at all. */
+void virtio_blk_set_irq(int enabled) {
+    virtio_irq_mode = enabled ? 1 : 0;
+    if (virtio_avail) {
+        virtio_avail->flags = (virtio_irq_mode && virtio_irq_ok) ? 0 : VIRTQ_AVAIL_F_NO_INTERRUPT;
+    }
+}
+
+void virtio_blk_get_stats(virtio_blk_stats_t *stats) {
+    if (stats) {
+        *stats = virtio_stats;
+    }
+}